@@ -0,0 +1,163 @@
+#ifdef _WIN32
+#include "nssm.h"
+#else
+#include "platform.h"
+#include "backoff.h"
+#endif
+
+/*
+  Nothing here reads the clock, so a policy can be simulated by feeding it
+  uptimes and times from a virtual clock.
+*/
+
+void seed_backoff(backoff_t *backoff, unsigned long seed) {
+  /* Xorshift gets stuck at zero. */
+  backoff->seed = seed ? seed : 0x9e3779b9UL;
+}
+
+static unsigned long backoff_random(backoff_t *backoff) {
+  unsigned long x = backoff->seed;
+  x ^= (x << 13) & 0xffffffffUL;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xffffffffUL;
+  backoff->seed = x;
+  return x;
+}
+
+/* Delay before the restart with the given throttle count, without jitter. */
+unsigned long backoff_milliseconds(backoff_t *backoff, unsigned long throttle) {
+  platform_u64_t cap = backoff->cap ? backoff->cap : 0xffffffffUL;
+  platform_u64_t ms = backoff->base;
+  if (throttle < 1) throttle = 1;
+
+  if (backoff->policy == NSSM_BACKOFF_LINEAR) ms *= throttle;
+  else {
+    /* Stop doubling once we hit the cap so we can't overflow. */
+    for (unsigned long i = 1; i < throttle && ms < cap; i++) ms *= 2;
+  }
+
+  if (ms > cap) ms = cap;
+  return (unsigned long) ms;
+}
+
+/*
+  Delay before the restart with the given throttle count.  With full
+  jitter the delay is chosen uniformly between zero and the computed value,
+  so services which failed together don't all restart together.
+*/
+unsigned long backoff_delay(backoff_t *backoff, unsigned long throttle) {
+  unsigned long ms = backoff_milliseconds(backoff, throttle);
+  if (! backoff->jitter || ! ms) return ms;
+  if (ms == 0xffffffffUL) return backoff_random(backoff);
+  return backoff_random(backoff) % (ms + 1);
+}
+
+/*
+  Record that the application exited at time now, having failed if it didn't
+  survive the throttle period.  Returns the new state of the breaker.
+*/
+unsigned long breaker_exit(breaker_t *breaker, platform_u64_t now, bool failed) {
+  if (! breaker->failures) {
+    close_breaker(breaker);
+    return breaker->state;
+  }
+
+  if (! failed) {
+    close_breaker(breaker);
+    return breaker->state;
+  }
+
+  /* A failed trial trips the breaker straight away. */
+  if (breaker->state == NSSM_BREAKER_HALF_OPEN) {
+    breaker->state = NSSM_BREAKER_TRIPPED;
+    return breaker->state;
+  }
+
+  /* The window opens with the first failure after it last expired. */
+  if (! breaker->count || now - breaker->window_start > breaker->window) {
+    breaker->window_start = now;
+    breaker->count = 0;
+  }
+
+  if (++breaker->count >= breaker->failures) breaker->state = NSSM_BREAKER_TRIPPED;
+  return breaker->state;
+}
+
+void close_breaker(breaker_t *breaker) {
+  breaker->state = NSSM_BREAKER_CLOSED;
+  breaker->count = 0;
+}
+
+/* Forgive one throttled restart for every decay period of healthy uptime. */
+unsigned long decay_throttle(backoff_t *backoff, unsigned long throttle, platform_u64_t uptime) {
+  if (! backoff->decay) return throttle;
+  platform_u64_t forgiven = uptime / backoff->decay;
+  if (forgiven >= throttle) return 0;
+  return throttle - (unsigned long) forgiven;
+}
+
+/*
+  Decide how long to wait before starting the application, given the
+  throttle count and the uptime of the previous run, and count the start.
+  Returns NSSM_RESTART_NOW if this isn't a restart at all, otherwise why
+  we wait, with the delay in ms.
+*/
+unsigned long plan_restart(backoff_t *backoff, breaker_t *breaker, unsigned long *throttle, platform_u64_t uptime, unsigned long restart_delay, unsigned long *ms) {
+  /* Healthy uptime wears down a decaying throttle. */
+  if (backoff->policy == NSSM_BACKOFF_DECAYING && *throttle) *throttle = decay_throttle(backoff, *throttle, uptime);
+
+  /* This can't be a restart if the service is already running. */
+  bool tripped = (breaker->state == NSSM_BREAKER_TRIPPED);
+  *ms = 0;
+  if (! (*throttle)++ && ! tripped) return NSSM_RESTART_NOW;
+
+  if (tripped) {
+    *ms = breaker->retry;
+    return NSSM_RESTART_TRIPPED;
+  }
+
+  unsigned long throttle_ms = backoff_delay(backoff, *throttle);
+  if (restart_delay <= throttle_ms) {
+    *ms = throttle_ms;
+    return NSSM_RESTART_THROTTLED;
+  }
+
+  *ms = restart_delay;
+  return (*throttle == 1) ? NSSM_RESTART_DELAYED : NSSM_RESTART_THROTTLED;
+}
+
+/*
+  After waiting, the next run is a trial unless the breaker was closed in
+  the meantime.  Returns true if it is.
+*/
+bool begin_trial(breaker_t *breaker) {
+  if (breaker->state != NSSM_BREAKER_TRIPPED) return false;
+  breaker->state = NSSM_BREAKER_HALF_OPEN;
+  return true;
+}
+
+/*
+  Record that the application was started, and whether it survived the
+  throttle period.  Returns true if that closed the breaker.
+*/
+bool record_start(backoff_t *backoff, breaker_t *breaker, unsigned long *throttle, bool started, unsigned long restart_delay) {
+  /* A decaying throttle is worn down by uptime rather than reset here. */
+  if (started && backoff->policy != NSSM_BACKOFF_DECAYING) *throttle = 0;
+
+  /* Ensure the restart delay is always applied. */
+  if (restart_delay && ! *throttle) (*throttle)++;
+
+  /* A trial run which survived the throttle period closes the breaker. */
+  if (! started || breaker->state != NSSM_BREAKER_HALF_OPEN) return false;
+  close_breaker(breaker);
+  return true;
+}
+
+/*
+  Record that the application exited at time now after running for the
+  given uptime.  Quick exits count towards the breaker.  Returns the new
+  state of the breaker.
+*/
+unsigned long record_exit(breaker_t *breaker, platform_u64_t now, platform_u64_t uptime, unsigned long throttle_delay) {
+  return breaker_exit(breaker, now, uptime < throttle_delay);
+}
@@ -0,0 +1,58 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+/*
+  Restart throttling policies.  The throttle count is the number of
+  consecutive restarts which were subject to throttling.
+*/
+#define NSSM_BACKOFF_EXPONENTIAL 0
+#define NSSM_BACKOFF_LINEAR 1
+#define NSSM_BACKOFF_DECAYING 2
+#define NSSM_NUM_BACKOFF_POLICIES 3
+
+typedef struct {
+  unsigned long policy;
+  unsigned long base;
+  unsigned long cap;
+  unsigned long jitter;
+  unsigned long decay;
+  unsigned long seed;
+} backoff_t;
+
+/*
+  Crash-loop circuit breaker.  After the configured number of failed runs
+  within the window the breaker trips and restarts are held off for the retry
+  period.  The next run is a half-open trial which closes the breaker if it
+  survives the throttle period or trips it again if it doesn't.
+*/
+#define NSSM_BREAKER_CLOSED 0
+#define NSSM_BREAKER_TRIPPED 1
+#define NSSM_BREAKER_HALF_OPEN 2
+
+typedef struct {
+  unsigned long failures;
+  unsigned long window;
+  unsigned long retry;
+  unsigned long state;
+  unsigned long count;
+  platform_u64_t window_start;
+} breaker_t;
+
+/* What plan_restart() decided. */
+#define NSSM_RESTART_NOW 0
+#define NSSM_RESTART_DELAYED 1
+#define NSSM_RESTART_THROTTLED 2
+#define NSSM_RESTART_TRIPPED 3
+
+void seed_backoff(backoff_t *, unsigned long);
+unsigned long backoff_milliseconds(backoff_t *, unsigned long);
+unsigned long backoff_delay(backoff_t *, unsigned long);
+unsigned long decay_throttle(backoff_t *, unsigned long, platform_u64_t);
+unsigned long breaker_exit(breaker_t *, platform_u64_t, bool);
+void close_breaker(breaker_t *);
+unsigned long plan_restart(backoff_t *, breaker_t *, unsigned long *, platform_u64_t, unsigned long, unsigned long *);
+bool begin_trial(breaker_t *);
+bool record_start(backoff_t *, breaker_t *, unsigned long *, bool, unsigned long);
+unsigned long record_exit(breaker_t *, platform_u64_t, platform_u64_t, unsigned long);
+
+#endif
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "backoff.h"
+
+/*
+  Simulation of the restart throttling policies and the circuit breaker.
+  Time is a virtual clock advanced by the test, so the whole run takes no
+  real time and always gives the same result.  Build and run it with
+  "make check".
+*/
+
+static int failures = 0;
+
+#define CHECK(x) check((x), #x, __LINE__)
+
+static void check(bool ok, const char *what, int line) {
+  if (ok) return;
+  fprintf(stderr, "backoff_test.cpp:%d: FAILED: %s\n", line, what);
+  failures++;
+}
+
+static void init_backoff(backoff_t *backoff, unsigned long policy, unsigned long base, unsigned long cap, unsigned long jitter, unsigned long decay) {
+  memset(backoff, 0, sizeof(*backoff));
+  backoff->policy = policy;
+  backoff->base = base;
+  backoff->cap = cap;
+  backoff->jitter = jitter;
+  backoff->decay = decay;
+  seed_backoff(backoff, 12345);
+}
+
+static void init_breaker(breaker_t *breaker, unsigned long failures, unsigned long window, unsigned long retry) {
+  memset(breaker, 0, sizeof(*breaker));
+  breaker->failures = failures;
+  breaker->window = window;
+  breaker->retry = retry;
+}
+
+static void test_exponential() {
+  backoff_t backoff;
+  init_backoff(&backoff, NSSM_BACKOFF_EXPONENTIAL, 1500, 60000, 0, 0);
+
+  CHECK(backoff_milliseconds(&backoff, 0) == 1500);
+  CHECK(backoff_milliseconds(&backoff, 1) == 1500);
+  CHECK(backoff_milliseconds(&backoff, 2) == 3000);
+  CHECK(backoff_milliseconds(&backoff, 3) == 6000);
+  CHECK(backoff_milliseconds(&backoff, 6) == 48000);
+  CHECK(backoff_milliseconds(&backoff, 7) == 60000);
+  CHECK(backoff_milliseconds(&backoff, 1000) == 60000);
+  /* No jitter means the delay is exact. */
+  CHECK(backoff_delay(&backoff, 4) == 12000);
+
+  /* Without a cap doubling stops at the largest delay, rather than wrapping. */
+  backoff.cap = 0;
+  CHECK(backoff_milliseconds(&backoff, 22) == 1500UL << 21);
+  CHECK(backoff_milliseconds(&backoff, 23) == 0xffffffffUL);
+  CHECK(backoff_milliseconds(&backoff, 0xffffffffUL) == 0xffffffffUL);
+}
+
+static void test_linear() {
+  backoff_t backoff;
+  init_backoff(&backoff, NSSM_BACKOFF_LINEAR, 1000, 5000, 0, 0);
+
+  CHECK(backoff_milliseconds(&backoff, 1) == 1000);
+  CHECK(backoff_milliseconds(&backoff, 2) == 2000);
+  CHECK(backoff_milliseconds(&backoff, 5) == 5000);
+  CHECK(backoff_milliseconds(&backoff, 6) == 5000);
+  CHECK(backoff_milliseconds(&backoff, 100000) == 5000);
+
+  backoff.cap = 0;
+  CHECK(backoff_milliseconds(&backoff, 5000000UL) == 0xffffffffUL);
+}
+
+static void test_jitter() {
+  backoff_t backoff, again;
+  init_backoff(&backoff, NSSM_BACKOFF_EXPONENTIAL, 1000, 30000, 1, 0);
+  init_backoff(&again, NSSM_BACKOFF_EXPONENTIAL, 1000, 30000, 1, 0);
+
+  for (unsigned long throttle = 1; throttle <= 8; throttle++) {
+    unsigned long ms = backoff_milliseconds(&backoff, throttle);
+    unsigned long lowest = 0xffffffffUL, highest = 0;
+    bool repeatable = true;
+    for (int i = 0; i < 10000; i++) {
+      unsigned long delay = backoff_delay(&backoff, throttle);
+      if (delay != backoff_delay(&again, throttle)) repeatable = false;
+      if (delay < lowest) lowest = delay;
+      if (delay > highest) highest = delay;
+    }
+
+    /* Full jitter: anywhere from zero up to the delay without jitter. */
+    CHECK(highest <= ms);
+    CHECK(lowest < ms / 20);
+    CHECK(highest > ms - ms / 20);
+    CHECK(repeatable);
+  }
+
+  /* A zero seed would get stuck. */
+  seed_backoff(&backoff, 0);
+  CHECK(backoff.seed != 0);
+  unsigned long nonzero = 0;
+  for (int i = 0; i < 100; i++) if (backoff_delay(&backoff, 3)) nonzero++;
+  CHECK(nonzero > 90);
+
+  /* Jitter of an uncapped delay at the limit uses the whole range. */
+  backoff.cap = 0;
+  CHECK(backoff_milliseconds(&backoff, 64) == 0xffffffffUL);
+  (void) backoff_delay(&backoff, 64);
+}
+
+static void test_decay() {
+  backoff_t backoff;
+  init_backoff(&backoff, NSSM_BACKOFF_DECAYING, 1000, 0, 0, 0);
+
+  /* No decay period means the throttle is kept. */
+  CHECK(decay_throttle(&backoff, 5, 1000000ULL) == 5);
+
+  backoff.decay = 10000;
+  CHECK(decay_throttle(&backoff, 5, 0ULL) == 5);
+  CHECK(decay_throttle(&backoff, 5, 9999ULL) == 5);
+  CHECK(decay_throttle(&backoff, 5, 10000ULL) == 4);
+  CHECK(decay_throttle(&backoff, 5, 25000ULL) == 3);
+  CHECK(decay_throttle(&backoff, 5, 50000ULL) == 0);
+  CHECK(decay_throttle(&backoff, 5, 0xffffffffffffULL) == 0);
+  CHECK(decay_throttle(&backoff, 0, 10000ULL) == 0);
+}
+
+static void test_breaker() {
+  breaker_t breaker;
+
+  /* Disabled. */
+  init_breaker(&breaker, 0, 60000, 30000);
+  for (int i = 0; i < 10; i++) CHECK(breaker_exit(&breaker, (platform_u64_t) i, true) == NSSM_BREAKER_CLOSED);
+
+  /* Three failures within a minute trip it. */
+  init_breaker(&breaker, 3, 60000, 30000);
+  CHECK(breaker_exit(&breaker, 1000ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 2000ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 3000ULL, true) == NSSM_BREAKER_TRIPPED);
+  CHECK(breaker.count == 3);
+
+  /* A failed trial trips it again straight away. */
+  breaker.state = NSSM_BREAKER_HALF_OPEN;
+  CHECK(breaker_exit(&breaker, 40000ULL, true) == NSSM_BREAKER_TRIPPED);
+
+  /* A trial which survived closes it and forgets the failures. */
+  breaker.state = NSSM_BREAKER_HALF_OPEN;
+  CHECK(breaker_exit(&breaker, 80000ULL, false) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker.count == 0);
+
+  /* Failures spread over more than the window don't trip it. */
+  init_breaker(&breaker, 3, 60000, 30000);
+  CHECK(breaker_exit(&breaker, 0ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 30000ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 61000ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker.count == 1);
+  CHECK(breaker.window_start == 61000ULL);
+  CHECK(breaker_exit(&breaker, 62000ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 63000ULL, true) == NSSM_BREAKER_TRIPPED);
+
+  /* A healthy run in between starts the count again. */
+  init_breaker(&breaker, 3, 60000, 30000);
+  CHECK(breaker_exit(&breaker, 0ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 1000ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 2000ULL, false) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 3000ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 4000ULL, true) == NSSM_BREAKER_CLOSED);
+  CHECK(breaker_exit(&breaker, 5000ULL, true) == NSSM_BREAKER_TRIPPED);
+
+  /* CONTINUE closes a tripped breaker. */
+  close_breaker(&breaker);
+  CHECK(breaker.state == NSSM_BREAKER_CLOSED);
+  CHECK(breaker.count == 0);
+}
+
+#define SIMULATION_RUNS 32
+
+typedef struct {
+  unsigned long trips;
+  unsigned long trials;
+  unsigned long closes;
+  unsigned long starts;
+  /* Wait before each run. */
+  unsigned long delays[SIMULATION_RUNS];
+} simulation_t;
+
+/*
+  Run the supervisor's restart loop against an application which runs for
+  each of the given uptimes in turn, making the same calls as
+  throttle_restart(), start_service() and end_service().  Returns the
+  virtual time at which the last run started.
+*/
+static platform_u64_t simulate(backoff_t *backoff, breaker_t *breaker, unsigned long throttle_delay, unsigned long restart_delay, const unsigned long *uptimes, unsigned long runs, simulation_t *sim) {
+  platform_u64_t now = 0;
+  unsigned long throttle = 0;
+  unsigned long uptime = 0;
+  memset(sim, 0, sizeof(*sim));
+
+  for (unsigned long run = 0; run < runs; run++) {
+    /* throttle_restart() */
+    unsigned long ms;
+    if (plan_restart(backoff, breaker, &throttle, uptime, restart_delay, &ms) != NSSM_RESTART_NOW) {
+      sim->delays[run] = ms;
+      now += ms;
+    }
+    if (begin_trial(breaker)) sim->trials++;
+    sim->starts++;
+
+    /* start_service() */
+    uptime = uptimes[run];
+    if (record_start(backoff, breaker, &throttle, uptime >= throttle_delay, restart_delay)) sim->closes++;
+    if (run == runs - 1) break;
+
+    /* end_service() */
+    now += uptime;
+    if (record_exit(breaker, now, uptime, throttle_delay) == NSSM_BREAKER_TRIPPED) sim->trips++;
+  }
+
+  return now;
+}
+
+/*
+  An application which crashes after crash_ms for the first crashes runs
+  and then stays up.  Returns the virtual time at which it was finally
+  healthy.
+*/
+static platform_u64_t crash_loop(backoff_t *backoff, breaker_t *breaker, unsigned long throttle_delay, unsigned long crash_ms, unsigned long crashes, simulation_t *sim) {
+  unsigned long uptimes[SIMULATION_RUNS];
+  for (unsigned long run = 0; run < crashes; run++) uptimes[run] = crash_ms;
+  uptimes[crashes] = throttle_delay;
+  return simulate(backoff, breaker, throttle_delay, 0, uptimes, crashes + 1, sim);
+}
+
+static void test_simulation() {
+  backoff_t backoff;
+  breaker_t breaker;
+  simulation_t sim;
+
+  /*
+    Without a breaker: the throttle count is two by the first restart, so
+    3s, 6s, 12s ... capped at 60s between runs lasting 100ms.
+  */
+  init_backoff(&backoff, NSSM_BACKOFF_EXPONENTIAL, 1500, 60000, 0, 0);
+  init_breaker(&breaker, 0, 0, 0);
+  platform_u64_t healthy = crash_loop(&backoff, &breaker, 1500, 100, 10, &sim);
+  CHECK(sim.starts == 11);
+  CHECK(sim.trips == 0);
+  CHECK(sim.delays[0] == 0);
+  CHECK(sim.delays[1] == 3000);
+  CHECK(sim.delays[10] == 60000);
+  CHECK(healthy == 10 * 100ULL + 3000ULL + 6000ULL + 12000ULL + 24000ULL + 48000ULL + 5 * 60000ULL);
+
+  /*
+    Five quick failures within a minute trip the breaker, which holds
+    restarts off for five minutes.  The trial crashes too, so it trips
+    again, and the second trial survives and closes it.
+  */
+  init_backoff(&backoff, NSSM_BACKOFF_LINEAR, 1000, 10000, 0, 0);
+  init_breaker(&breaker, 5, 60000, 300000);
+  healthy = crash_loop(&backoff, &breaker, 1500, 100, 6, &sim);
+  CHECK(sim.trips == 2);
+  CHECK(sim.trials == 2);
+  CHECK(sim.closes == 1);
+  CHECK(breaker.state == NSSM_BREAKER_CLOSED);
+  CHECK(sim.delays[5] == 300000);
+  CHECK(sim.delays[6] == 300000);
+  CHECK(healthy == 6 * 100ULL + 2000ULL + 3000ULL + 4000ULL + 5000ULL + 2 * 300000ULL);
+
+  /* The same crash loop with jitter never waits longer than without. */
+  init_backoff(&backoff, NSSM_BACKOFF_LINEAR, 1000, 10000, 1, 0);
+  init_breaker(&breaker, 5, 60000, 300000);
+  platform_u64_t jittered = crash_loop(&backoff, &breaker, 1500, 100, 6, &sim);
+  CHECK(jittered <= healthy);
+  CHECK(jittered >= 6 * 100ULL + 2 * 300000ULL);
+  CHECK(sim.trips == 2);
+  CHECK(sim.closes == 1);
+
+  /* Crashes slower than the window never trip it. */
+  init_backoff(&backoff, NSSM_BACKOFF_EXPONENTIAL, 1500, 60000, 0, 0);
+  init_breaker(&breaker, 3, 2000, 300000);
+  crash_loop(&backoff, &breaker, 1500, 1000, 8, &sim);
+  CHECK(sim.trips == 0);
+  CHECK(breaker.state == NSSM_BREAKER_CLOSED);
+
+  /* A restart delay longer than the backoff is used instead. */
+  init_backoff(&backoff, NSSM_BACKOFF_EXPONENTIAL, 1500, 60000, 0, 0);
+  init_breaker(&breaker, 0, 0, 0);
+  unsigned long slow[] = { 100, 100, 100, 100 };
+  simulate(&backoff, &breaker, 1500, 5000, slow, 4, &sim);
+  CHECK(sim.delays[1] == 5000);
+  CHECK(sim.delays[2] == 6000);
+  CHECK(sim.delays[3] == 12000);
+}
+
+static void test_decaying_simulation() {
+  backoff_t backoff;
+  breaker_t breaker;
+  simulation_t sim;
+
+  /*
+    Runs which survive the throttle period don't reset a decaying throttle,
+    so an application which keeps crashing after a few seconds is still
+    backed off: 2s, 4s, 8s ...
+  */
+  init_backoff(&backoff, NSSM_BACKOFF_DECAYING, 1000, 30000, 0, 10000);
+  init_breaker(&breaker, 0, 0, 0);
+  unsigned long flaky[] = { 3000, 3000, 3000, 3000, 3000, 3000 };
+  simulate(&backoff, &breaker, 1500, 0, flaky, 6, &sim);
+  CHECK(sim.delays[0] == 0);
+  CHECK(sim.delays[1] == 2000);
+  CHECK(sim.delays[2] == 4000);
+  CHECK(sim.delays[3] == 8000);
+  CHECK(sim.delays[4] == 16000);
+  CHECK(sim.delays[5] == 30000);
+
+  /* The same application under the exponential policy is never throttled. */
+  init_backoff(&backoff, NSSM_BACKOFF_EXPONENTIAL, 1000, 30000, 0, 0);
+  simulate(&backoff, &breaker, 1500, 0, flaky, 6, &sim);
+  for (unsigned long run = 0; run < 6; run++) CHECK(sim.delays[run] == 0);
+
+  /*
+    Every ten seconds of uptime forgives one throttled restart.  After
+    four quick crashes the throttle is five; a 25s run forgives two of
+    them, so the next delay is for a throttle of four rather than six.
+    A long run forgives the rest and the next crash restarts at once.
+  */
+  init_backoff(&backoff, NSSM_BACKOFF_DECAYING, 1000, 0, 0, 10000);
+  unsigned long recovering[] = { 100, 100, 100, 100, 25000, 100, 100000, 100 };
+  simulate(&backoff, &breaker, 1500, 0, recovering, 8, &sim);
+  CHECK(sim.delays[4] == 16000);
+  CHECK(sim.delays[5] == 8000);
+  CHECK(sim.delays[6] == 16000);
+  CHECK(sim.delays[7] == 0);
+}
+
+int main() {
+  test_exponential();
+  test_linear();
+  test_jitter();
+  test_decay();
+  test_breaker();
+  test_simulation();
+  test_decaying_simulation();
+
+  if (failures) {
+    fprintf(stderr, "backoff_test: %d checks failed\n", failures);
+    return 1;
+  }
+  printf("backoff_test: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,460 @@
+#ifdef _WIN32
+#include "nssm.h"
+#else
+#include <string.h>
+#include "platform.h"
+#include "cpuset.h"
+#endif
+
+#define CPUSET_BIT(i) (((platform_u64_t) 1) << (i))
+
+/* Parse a decimal number, advancing the pointer past it. */
+static int cpuset_number(const platform_char_t **s, unsigned long *number) {
+  const platform_char_t *p = *s;
+  if (*p < '0' || *p > '9') return CPUSET_SYNTAX;
+
+  unsigned long n = 0;
+  while (*p >= '0' && *p <= '9') {
+    n = n * 10 + (unsigned long) (*p - '0');
+    if (n > 0xffffUL) return CPUSET_RANGE;
+    p++;
+  }
+
+  *number = n;
+  *s = p;
+  return CPUSET_OK;
+}
+
+static bool cpuset_prefix(const platform_char_t *s, const char *prefix) {
+  for ( ; *prefix; s++, prefix++) {
+    if (*s != (platform_char_t) *prefix) return false;
+  }
+  return true;
+}
+
+/*
+  Parse an AppAffinity string.
+  Returns CPUSET_OK or CPUSET_SYNTAX or CPUSET_RANGE.
+*/
+int parse_cpuset(const platform_char_t *string, cpuset_t *set) {
+  memset(set, 0, sizeof(*set));
+  if (! string) return CPUSET_OK;
+
+  const platform_char_t *s = string;
+  unsigned long group = 0;
+  unsigned long first, last, i;
+  int ret;
+
+  while (*s) {
+    if (cpuset_prefix(s, CPUSET_NODE_PREFIX)) {
+      s += sizeof(CPUSET_NODE_PREFIX) - 1;
+      ret = cpuset_number(&s, &first);
+      if (ret) return ret;
+      if (first >= CPUSET_MAX_NODES) return CPUSET_RANGE;
+      set->nodes |= CPUSET_BIT(first);
+    }
+    else {
+      ret = cpuset_number(&s, &first);
+      if (ret) return ret;
+      if (*s == ':') {
+        if (first >= CPUSET_MAX_GROUPS) return CPUSET_RANGE;
+        group = first;
+        s++;
+        ret = cpuset_number(&s, &first);
+        if (ret) return ret;
+      }
+
+      last = first;
+      if (*s == '-') {
+        s++;
+        ret = cpuset_number(&s, &last);
+        if (ret) return ret;
+        if (last < first) return CPUSET_SYNTAX;
+      }
+
+      /* A group has at most 64 processors. */
+      if (last >= 64) return CPUSET_RANGE;
+      for (i = first; i <= last; i++) set->groups[group] |= CPUSET_BIT(i);
+    }
+
+    if (! *s) break;
+    if (*s != ',') return CPUSET_SYNTAX;
+    if (! *(++s)) return CPUSET_SYNTAX;
+  }
+
+  return CPUSET_OK;
+}
+
+static int cpuset_append(platform_char_t *buffer, unsigned long len, unsigned long *used, const char *text) {
+  for ( ; *text; text++) {
+    if (*used + 1 >= len) return 1;
+    buffer[(*used)++] = (platform_char_t) *text;
+  }
+  buffer[*used] = 0;
+  return 0;
+}
+
+static int cpuset_append_number(platform_char_t *buffer, unsigned long len, unsigned long *used, unsigned long number) {
+  char digits[16];
+  char *p = digits + sizeof(digits) - 1;
+  *p = '\0';
+  do {
+    *(--p) = (char) ('0' + number % 10);
+    number /= 10;
+  } while (number);
+  return cpuset_append(buffer, len, used, p);
+}
+
+/*
+  Canonical string for a set, in the same style as affinity_mask_to_string().
+  Returns non-zero if the buffer is too small.
+*/
+int format_cpuset(const cpuset_t *set, platform_char_t *buffer, unsigned long len) {
+  if (! len) return 1;
+  buffer[0] = 0;
+
+  unsigned long used = 0;
+  unsigned long current = 0;
+  unsigned long g, i, first;
+  int ret = 0;
+
+  for (g = 0; g < CPUSET_MAX_GROUPS; g++) {
+    platform_u64_t mask = set->groups[g];
+    for (i = 0; i < 64 && ! ret; i++) {
+      if (! (mask & CPUSET_BIT(i))) continue;
+
+      first = i;
+      while (i < 63 && (mask & CPUSET_BIT(i + 1))) i++;
+
+      if (used) ret |= cpuset_append(buffer, len, &used, ",");
+      if (g != current) {
+        ret |= cpuset_append_number(buffer, len, &used, g);
+        ret |= cpuset_append(buffer, len, &used, ":");
+        current = g;
+      }
+      ret |= cpuset_append_number(buffer, len, &used, first);
+      if (i != first) {
+        ret |= cpuset_append(buffer, len, &used, (i == first + 1) ? "," : "-");
+        ret |= cpuset_append_number(buffer, len, &used, i);
+      }
+    }
+  }
+
+  for (i = 0; i < CPUSET_MAX_NODES && ! ret; i++) {
+    if (! (set->nodes & CPUSET_BIT(i))) continue;
+    if (used) ret |= cpuset_append(buffer, len, &used, ",");
+    ret |= cpuset_append(buffer, len, &used, CPUSET_NODE_PREFIX);
+    ret |= cpuset_append_number(buffer, len, &used, i);
+  }
+
+  return ret;
+}
+
+bool cpuset_is_empty(const cpuset_t *set) {
+  if (set->nodes) return false;
+  for (unsigned long g = 0; g < CPUSET_MAX_GROUPS; g++) {
+    if (set->groups[g]) return false;
+  }
+  return true;
+}
+
+/* True if the set can't be expressed as a classic affinity mask. */
+bool cpuset_is_extended(const cpuset_t *set) {
+  if (set->nodes) return true;
+  for (unsigned long g = 1; g < CPUSET_MAX_GROUPS; g++) {
+    if (set->groups[g]) return true;
+  }
+  return false;
+}
+
+unsigned long cpuset_count(const cpuset_t *set) {
+  unsigned long count = 0;
+  for (unsigned long g = 0; g < CPUSET_MAX_GROUPS; g++) {
+    for (unsigned long i = 0; i < 64; i++) {
+      if (set->groups[g] & CPUSET_BIT(i)) count++;
+    }
+  }
+  return count;
+}
+
+/*
+  Share the processors of a set out between instances in contiguous slices,
+  in group order, as instance_affinity() does for a classic mask.  Nodes
+  should already have been resolved to processors.  Every slice keeps the
+  node preference.
+*/
+void slice_cpuset(const cpuset_t *set, unsigned long index, unsigned long instances, cpuset_t *slice) {
+  unsigned long count = cpuset_count(set);
+  if (instances < 2 || ! count) {
+    memcpy(slice, set, sizeof(*slice));
+    return;
+  }
+
+  unsigned long first, last;
+  if (count >= instances) {
+    first = index * count / instances;
+    last = (index + 1) * count / instances;
+  }
+  else {
+    first = index % count;
+    last = first + 1;
+  }
+
+  memset(slice, 0, sizeof(*slice));
+  slice->nodes = set->nodes;
+
+  unsigned long rank = 0;
+  for (unsigned long g = 0; g < CPUSET_MAX_GROUPS; g++) {
+    for (unsigned long i = 0; i < 64; i++) {
+      if (! (set->groups[g] & CPUSET_BIT(i))) continue;
+      if (rank >= first && rank < last) slice->groups[g] |= CPUSET_BIT(i);
+      rank++;
+    }
+  }
+}
+
+#ifdef _WIN32
+
+extern imports_t imports;
+
+/* ProcThreadAttributeValue() for attributes which older SDKs don't have. */
+#define CPUSET_ATTRIBUTE_GROUP_AFFINITY 0x00030003
+#define CPUSET_ATTRIBUTE_PREFERRED_NODE 0x00020004
+#ifndef EXTENDED_STARTUPINFO_PRESENT
+#define EXTENDED_STARTUPINFO_PRESENT 0x00080000
+#endif
+
+/* The part of SYSTEM_CPU_SET_INFORMATION we use. */
+#define CPUSET_INFORMATION_CPU_SET 0
+typedef struct {
+  unsigned long size;
+  unsigned long type;
+  unsigned long id;
+  WORD group;
+  BYTE logical_processor;
+  BYTE core;
+  BYTE last_level_cache;
+  BYTE numa_node;
+} cpuset_information_t;
+
+/* Add the processors of each node in the set to its groups. */
+void resolve_cpuset(const cpuset_t *set, cpuset_t *resolved) {
+  memcpy(resolved, set, sizeof(*resolved));
+
+  for (unsigned long node = 0; node < CPUSET_MAX_NODES; node++) {
+    if (! (set->nodes & CPUSET_BIT(node))) continue;
+
+    if (imports.GetNumaNodeProcessorMaskEx) {
+      cpuset_group_affinity_t affinity;
+      ZeroMemory(&affinity, sizeof(affinity));
+      if (imports.GetNumaNodeProcessorMaskEx((USHORT) node, &affinity) && affinity.group < CPUSET_MAX_GROUPS) resolved->groups[affinity.group] |= (platform_u64_t) affinity.mask;
+    }
+    else if (imports.GetNumaNodeProcessorMask) {
+      ULONGLONG mask;
+      if (imports.GetNumaNodeProcessorMask((UCHAR) node, &mask)) resolved->groups[0] |= (platform_u64_t) mask;
+    }
+  }
+}
+
+static unsigned long first_group(const cpuset_t *set) {
+  for (unsigned long g = 0; g < CPUSET_MAX_GROUPS; g++) {
+    if (set->groups[g]) return g;
+  }
+  return CPUSET_MAX_GROUPS;
+}
+
+/*
+  Build the attributes which put the application's initial thread in the
+  first group of a resolved set and make it prefer memory from the first
+  node.  The list is left empty on systems which don't support attributes,
+  which is not an error.
+  Returns non-zero on error, with the failed function in *function and the
+  error in GetLastError().
+*/
+int open_cpuset_attributes(const cpuset_t *set, cpuset_attributes_t *attributes, const TCHAR **function) {
+  ZeroMemory(attributes, sizeof(*attributes));
+  if (! imports.InitializeProcThreadAttributeList || ! imports.UpdateProcThreadAttribute || ! imports.DeleteProcThreadAttributeList) return 0;
+
+  unsigned long count = 0;
+  unsigned long group = first_group(set);
+  if (group < CPUSET_MAX_GROUPS) {
+    attributes->affinity.group = (WORD) group;
+    attributes->affinity.mask = (ULONG_PTR) set->groups[group];
+    count++;
+  }
+
+  unsigned long node;
+  for (node = 0; node < CPUSET_MAX_NODES; node++) {
+    if (set->nodes & CPUSET_BIT(node)) break;
+  }
+  if (node < CPUSET_MAX_NODES) {
+    attributes->node = (USHORT) node;
+    count++;
+  }
+
+  if (! count) return 0;
+
+  SIZE_T size = 0;
+  imports.InitializeProcThreadAttributeList(0, count, 0, &size);
+  attributes->startup.list = HeapAlloc(GetProcessHeap(), 0, size);
+  if (! attributes->startup.list) {
+    *function = _T("HeapAlloc()");
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return 1;
+  }
+
+  if (! imports.InitializeProcThreadAttributeList(attributes->startup.list, count, 0, &size)) {
+    unsigned long error = GetLastError();
+    HeapFree(GetProcessHeap(), 0, attributes->startup.list);
+    attributes->startup.list = 0;
+    *function = _T("InitializeProcThreadAttributeList()");
+    SetLastError(error);
+    return 2;
+  }
+
+  if (group < CPUSET_MAX_GROUPS && ! imports.UpdateProcThreadAttribute(attributes->startup.list, 0, CPUSET_ATTRIBUTE_GROUP_AFFINITY, &attributes->affinity, sizeof(attributes->affinity), 0, 0)) {
+    unsigned long error = GetLastError();
+    close_cpuset_attributes(attributes);
+    *function = _T("UpdateProcThreadAttribute()");
+    SetLastError(error);
+    return 3;
+  }
+
+  if (node < CPUSET_MAX_NODES && ! imports.UpdateProcThreadAttribute(attributes->startup.list, 0, CPUSET_ATTRIBUTE_PREFERRED_NODE, &attributes->node, sizeof(attributes->node), 0, 0)) {
+    unsigned long error = GetLastError();
+    close_cpuset_attributes(attributes);
+    *function = _T("UpdateProcThreadAttribute()");
+    SetLastError(error);
+    return 4;
+  }
+
+  return 0;
+}
+
+/*
+  The STARTUPINFO to pass to CreateProcess(), which is si itself if there
+  are no attributes.  The attributes must stay open until the process has
+  been created.
+*/
+STARTUPINFO *cpuset_startupinfo(cpuset_attributes_t *attributes, STARTUPINFO *si, unsigned long *flags) {
+  if (! attributes->startup.list) return si;
+
+  memcpy(&attributes->startup.si, si, sizeof(attributes->startup.si));
+  attributes->startup.si.cb = sizeof(attributes->startup);
+  *flags |= EXTENDED_STARTUPINFO_PRESENT;
+  return &attributes->startup.si;
+}
+
+void close_cpuset_attributes(cpuset_attributes_t *attributes) {
+  if (! attributes->startup.list) return;
+  imports.DeleteProcThreadAttributeList(attributes->startup.list);
+  HeapFree(GetProcessHeap(), 0, attributes->startup.list);
+  attributes->startup.list = 0;
+}
+
+/* Default CPU sets let threads in any group use the processors of the set. */
+static int set_default_cpu_sets(HANDLE process_handle, const cpuset_t *set, const TCHAR **function) {
+  unsigned long len = 0;
+  imports.GetSystemCpuSetInformation(0, 0, &len, process_handle, 0);
+  if (! len) {
+    *function = _T("GetSystemCpuSetInformation()");
+    return 1;
+  }
+
+  unsigned char *buffer = (unsigned char *) HeapAlloc(GetProcessHeap(), 0, len);
+  /* There can't be more IDs than there are entries. */
+  unsigned long *ids = (unsigned long *) HeapAlloc(GetProcessHeap(), 0, (len / sizeof(cpuset_information_t) + 1) * sizeof(unsigned long));
+  if (! buffer || ! ids) {
+    if (buffer) HeapFree(GetProcessHeap(), 0, buffer);
+    if (ids) HeapFree(GetProcessHeap(), 0, ids);
+    *function = _T("HeapAlloc()");
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return 2;
+  }
+
+  if (! imports.GetSystemCpuSetInformation(buffer, len, &len, process_handle, 0)) {
+    unsigned long error = GetLastError();
+    HeapFree(GetProcessHeap(), 0, buffer);
+    HeapFree(GetProcessHeap(), 0, ids);
+    *function = _T("GetSystemCpuSetInformation()");
+    SetLastError(error);
+    return 3;
+  }
+
+  unsigned long count = 0;
+  unsigned long offset = 0;
+  while (offset + sizeof(cpuset_information_t) <= len) {
+    cpuset_information_t *info = (cpuset_information_t *) (buffer + offset);
+    if (! info->size) break;
+    if (info->type == CPUSET_INFORMATION_CPU_SET && info->group < CPUSET_MAX_GROUPS && info->logical_processor < 64) {
+      if (set->groups[info->group] & CPUSET_BIT(info->logical_processor)) ids[count++] = info->id;
+    }
+    offset += info->size;
+  }
+  HeapFree(GetProcessHeap(), 0, buffer);
+
+  int ret = 0;
+  if (count && ! imports.SetProcessDefaultCpuSets(process_handle, ids, count)) {
+    *function = _T("SetProcessDefaultCpuSets()");
+    ret = 4;
+  }
+  else if (! count) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    *function = _T("GetSystemCpuSetInformation()");
+    ret = 5;
+  }
+
+  unsigned long error = GetLastError();
+  HeapFree(GetProcessHeap(), 0, ids);
+  SetLastError(error);
+  return ret;
+}
+
+/*
+  Apply a resolved set to a process, which should still be suspended, and
+  its initial thread, which may be NULL for a running process.
+
+  A set within a single group gets a hard affinity: the whole process for
+  group 0, which is what we always did, or the initial thread for other
+  groups.  On Windows 10 and later the set also becomes the process' default
+  CPU sets, which covers every thread and every group.
+
+  Returns CPUSET_APPLY_OK or the step which failed, with the failed function
+  in *function and the error in GetLastError().
+*/
+int apply_cpuset(HANDLE process_handle, HANDLE thread_handle, const cpuset_t *set, const TCHAR **function) {
+  unsigned long groups = 0;
+  unsigned long g;
+  for (g = 0; g < CPUSET_MAX_GROUPS; g++) {
+    if (set->groups[g]) groups++;
+  }
+  if (! groups) return CPUSET_APPLY_EMPTY;
+
+  g = first_group(set);
+  if (groups == 1) {
+    if (! g) {
+      if (! SetProcessAffinityMask(process_handle, (DWORD_PTR) set->groups[0])) {
+        *function = _T("SetProcessAffinityMask()");
+        return CPUSET_APPLY_GROUP_FAILED;
+      }
+    }
+    else if (thread_handle && imports.SetThreadGroupAffinity) {
+      cpuset_group_affinity_t affinity;
+      ZeroMemory(&affinity, sizeof(affinity));
+      affinity.group = (WORD) g;
+      affinity.mask = (ULONG_PTR) set->groups[g];
+      if (! imports.SetThreadGroupAffinity(thread_handle, &affinity, 0)) {
+        *function = _T("SetThreadGroupAffinity()");
+        return CPUSET_APPLY_GROUP_FAILED;
+      }
+    }
+  }
+
+  if (imports.GetSystemCpuSetInformation && imports.SetProcessDefaultCpuSets) {
+    if (set_default_cpu_sets(process_handle, set, function)) return CPUSET_APPLY_CPU_SETS_FAILED;
+  }
+
+  return CPUSET_APPLY_OK;
+}
+
+#endif
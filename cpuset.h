@@ -0,0 +1,71 @@
+#ifndef CPUSET_H
+#define CPUSET_H
+
+/*
+  Processor sets which can go beyond the 64 CPUs of a single processor group.
+  An AppAffinity string is a comma-separated list of items:
+
+    3 or 0-7       CPUs in the current group, initially group 0.
+    1:0-31         CPUs in group 1.  Later items without a group stay in 1.
+    node:1         Every CPU of NUMA node 1, which is also the node the
+                   application prefers to allocate memory from.
+
+  A list with only group 0 CPUs is the classic affinity mask and is applied
+  with SetProcessAffinityMask() as before.
+*/
+#define CPUSET_MAX_GROUPS 32
+#define CPUSET_MAX_NODES 64
+#define CPUSET_NODE_PREFIX "node:"
+
+typedef struct {
+  platform_u64_t groups[CPUSET_MAX_GROUPS];
+  platform_u64_t nodes;
+} cpuset_t;
+
+/* Results of parse_cpuset(). */
+#define CPUSET_OK 0
+#define CPUSET_SYNTAX 1
+#define CPUSET_RANGE 2
+
+int parse_cpuset(const platform_char_t *, cpuset_t *);
+int format_cpuset(const cpuset_t *, platform_char_t *, unsigned long);
+bool cpuset_is_empty(const cpuset_t *);
+bool cpuset_is_extended(const cpuset_t *);
+unsigned long cpuset_count(const cpuset_t *);
+void slice_cpuset(const cpuset_t *, unsigned long, unsigned long, cpuset_t *);
+
+#ifdef _WIN32
+/* Results of apply_cpuset(). */
+#define CPUSET_APPLY_OK 0
+#define CPUSET_APPLY_EMPTY 1
+#define CPUSET_APPLY_GROUP_FAILED 2
+#define CPUSET_APPLY_CPU_SETS_FAILED 3
+
+/* GROUP_AFFINITY, which older SDKs don't have. */
+typedef struct {
+  ULONG_PTR mask;
+  WORD group;
+  WORD reserved[3];
+} cpuset_group_affinity_t;
+
+/* STARTUPINFOEX, likewise. */
+typedef struct {
+  STARTUPINFO si;
+  void *list;
+} cpuset_startupinfo_t;
+
+/* Process attributes for CreateProcess(), to be freed with close_cpuset_attributes(). */
+typedef struct {
+  cpuset_startupinfo_t startup;
+  cpuset_group_affinity_t affinity;
+  USHORT node;
+} cpuset_attributes_t;
+
+void resolve_cpuset(const cpuset_t *, cpuset_t *);
+int open_cpuset_attributes(const cpuset_t *, cpuset_attributes_t *, const TCHAR **);
+STARTUPINFO *cpuset_startupinfo(cpuset_attributes_t *, STARTUPINFO *, unsigned long *);
+void close_cpuset_attributes(cpuset_attributes_t *);
+int apply_cpuset(HANDLE, HANDLE, const cpuset_t *, const TCHAR **);
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "cpuset.h"
+
+/*
+  Tests of the AppAffinity parser, its canonical formatting and the slicing
+  of a set between instances.  Build and run them with "make check".
+*/
+
+static int failures = 0;
+
+#define CHECK(x) check((x), #x, __LINE__)
+
+static void check(bool ok, const char *what, int line) {
+  if (ok) return;
+  fprintf(stderr, "cpuset_test.cpp:%d: FAILED: %s\n", line, what);
+  failures++;
+}
+
+static bool same_cpuset(const cpuset_t *a, const cpuset_t *b) {
+  return ! memcmp(a, b, sizeof(*a));
+}
+
+/* Parse a string, format the result and check it parses back to the same set. */
+static void check_round_trip(const char *string, const char *canonical, int line) {
+  cpuset_t set, again;
+  char buffer[256];
+
+  int ret = parse_cpuset(string, &set);
+  check(ret == CPUSET_OK, string, line);
+  if (ret != CPUSET_OK) return;
+
+  check(! format_cpuset(&set, buffer, sizeof(buffer)), "format_cpuset() fits", line);
+  if (strcmp(buffer, canonical)) {
+    fprintf(stderr, "cpuset_test.cpp:%d: \"%s\" formatted as \"%s\", expected \"%s\"\n", line, string, buffer, canonical);
+    failures++;
+  }
+
+  check(parse_cpuset(buffer, &again) == CPUSET_OK, buffer, line);
+  check(same_cpuset(&set, &again), "round trip gives the same set", line);
+}
+
+#define ROUND_TRIP(string, canonical) check_round_trip((string), (canonical), __LINE__)
+
+static int parse(const char *string) {
+  cpuset_t set;
+  return parse_cpuset(string, &set);
+}
+
+static void test_parse() {
+  cpuset_t set;
+
+  CHECK(parse_cpuset("1:0-31,2", &set) == CPUSET_OK);
+  CHECK(set.groups[0] == 0);
+  CHECK(set.groups[1] == 0xffffffffULL);
+  CHECK(cpuset_is_extended(&set));
+  CHECK(cpuset_count(&set) == 32);
+
+  CHECK(parse_cpuset("0-63", &set) == CPUSET_OK);
+  CHECK(set.groups[0] == ~0ULL);
+  CHECK(! cpuset_is_extended(&set));
+  CHECK(cpuset_count(&set) == 64);
+
+  CHECK(parse_cpuset("0,2:5,7,node:3", &set) == CPUSET_OK);
+  CHECK(set.groups[0] == 1);
+  CHECK(set.groups[2] == ((1ULL << 5) | (1ULL << 7)));
+  CHECK(set.nodes == (1ULL << 3));
+
+  CHECK(parse_cpuset("", &set) == CPUSET_OK);
+  CHECK(cpuset_is_empty(&set));
+  CHECK(parse_cpuset(0, &set) == CPUSET_OK);
+  CHECK(cpuset_is_empty(&set));
+}
+
+static void test_round_trip() {
+  ROUND_TRIP("1:0-31,2", "1:0-31");
+  ROUND_TRIP("0-63", "0-63");
+  ROUND_TRIP("0,1,2,3", "0-3");
+  ROUND_TRIP("4-5", "4,5");
+  ROUND_TRIP("0,31:63,node:63", "0,31:63,node:63");
+  ROUND_TRIP("node:1,1:8-15", "1:8-15,node:1");
+}
+
+static void test_errors() {
+  CHECK(parse("64") == CPUSET_RANGE);
+  CHECK(parse("0-64") == CPUSET_RANGE);
+  CHECK(parse("32:0") == CPUSET_RANGE);
+  CHECK(parse("node:64") == CPUSET_RANGE);
+  CHECK(parse("99999") == CPUSET_RANGE);
+
+  CHECK(parse("3-1") == CPUSET_SYNTAX);
+  CHECK(parse("0,") == CPUSET_SYNTAX);
+  CHECK(parse("0-3,") == CPUSET_SYNTAX);
+  CHECK(parse(",0") == CPUSET_SYNTAX);
+  CHECK(parse("0,,1") == CPUSET_SYNTAX);
+  CHECK(parse("1:") == CPUSET_SYNTAX);
+  CHECK(parse("node:") == CPUSET_SYNTAX);
+  CHECK(parse("0 1") == CPUSET_SYNTAX);
+  CHECK(parse("x") == CPUSET_SYNTAX);
+}
+
+static void test_format_overflow() {
+  cpuset_t set;
+  char buffer[4];
+  CHECK(parse_cpuset("0-3,1:0-31", &set) == CPUSET_OK);
+  CHECK(format_cpuset(&set, buffer, sizeof(buffer)) != 0);
+  CHECK(strlen(buffer) < sizeof(buffer));
+  CHECK(format_cpuset(&set, buffer, 0) != 0);
+}
+
+static void test_slice() {
+  cpuset_t set, slice, all;
+  unsigned long i;
+
+  /* Eight CPUs across two groups shared between four instances. */
+  CHECK(parse_cpuset("0:60-63,1:0-3,node:1", &set) == CPUSET_OK);
+  memset(&all, 0, sizeof(all));
+  for (i = 0; i < 4; i++) {
+    slice_cpuset(&set, i, 4, &slice);
+    CHECK(cpuset_count(&slice) == 2);
+    CHECK(slice.nodes == set.nodes);
+    CHECK(! (slice.groups[0] & all.groups[0]) && ! (slice.groups[1] & all.groups[1]));
+    all.groups[0] |= slice.groups[0];
+    all.groups[1] |= slice.groups[1];
+  }
+  CHECK(all.groups[0] == set.groups[0] && all.groups[1] == set.groups[1]);
+
+  /* Uneven shares still cover every CPU exactly once. */
+  CHECK(parse_cpuset("0-6", &set) == CPUSET_OK);
+  memset(&all, 0, sizeof(all));
+  unsigned long total = 0;
+  for (i = 0; i < 3; i++) {
+    slice_cpuset(&set, i, 3, &slice);
+    CHECK(cpuset_count(&slice) >= 2);
+    CHECK(! (slice.groups[0] & all.groups[0]));
+    all.groups[0] |= slice.groups[0];
+    total += cpuset_count(&slice);
+  }
+  CHECK(all.groups[0] == set.groups[0]);
+  CHECK(total == 7);
+
+  /* More instances than CPUs: each gets one CPU, reused round robin. */
+  CHECK(parse_cpuset("2,5,1:0", &set) == CPUSET_OK);
+  cpuset_t expected[3];
+  CHECK(parse_cpuset("2", &expected[0]) == CPUSET_OK);
+  CHECK(parse_cpuset("5", &expected[1]) == CPUSET_OK);
+  CHECK(parse_cpuset("1:0", &expected[2]) == CPUSET_OK);
+  for (i = 0; i < 8; i++) {
+    slice_cpuset(&set, i, 8, &slice);
+    CHECK(cpuset_count(&slice) == 1);
+    CHECK(same_cpuset(&slice, &expected[i % 3]));
+  }
+
+  /* A single instance, or an empty set, is left alone. */
+  slice_cpuset(&set, 0, 1, &slice);
+  CHECK(same_cpuset(&slice, &set));
+  memset(&set, 0, sizeof(set));
+  slice_cpuset(&set, 1, 4, &slice);
+  CHECK(cpuset_is_empty(&slice));
+}
+
+int main() {
+  test_parse();
+  test_round_trip();
+  test_errors();
+  test_format_overflow();
+  test_slice();
+
+  if (failures) {
+    fprintf(stderr, "cpuset_test: %d checks failed\n", failures);
+    return 1;
+  }
+  printf("cpuset_test: all checks passed\n");
+  return 0;
+}
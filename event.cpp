@@ -4,6 +4,7 @@
 #define NSSM_ERROR_BUFSIZE 65535
 #define NSSM_NUM_EVENT_STRINGS 16
 unsigned long tls_index;
+unsigned long output_tls_index = TLS_OUT_OF_INDEXES;
 
 /* Convert error code to error string - must call LocalFree() on return value */
 TCHAR *error_string(unsigned long error) {
@@ -58,6 +59,31 @@ void log_event(unsigned short type, unsigned long id, ...) {
   DeregisterEventSource(handle);
 }
 
+/* The output being captured for the current thread, if any. */
+static output_t *captured_output() {
+  if (output_tls_index == TLS_OUT_OF_INDEXES) return 0;
+  /* TlsGetValue() resets the last error, which our callers may still want. */
+  unsigned long error = GetLastError();
+  output_t *output = (output_t *) TlsGetValue(output_tls_index);
+  SetLastError(error);
+  return output;
+}
+
+static void vprint_output(FILE *file, const TCHAR *format, va_list arg) {
+  output_t *output = captured_output();
+  if (! output) {
+    _vftprintf(file, format, arg);
+    return;
+  }
+
+  if (file == stderr) output->error = true;
+  if (output->len + 1 >= _countof(output->text)) return;
+  /* Keep as much as fits if the text is truncated. */
+  int ret = _vsntprintf_s(output->text + output->len, _countof(output->text) - output->len, _TRUNCATE, format, arg);
+  if (ret < 0) output->len = _tcslen(output->text);
+  else output->len += ret;
+}
+
 /* Log a message to the console */
 void print_message(FILE *file, unsigned long id, ...) {
   va_list arg;
@@ -66,12 +92,36 @@ void print_message(FILE *file, unsigned long id, ...) {
   if (! format) return;
 
   va_start(arg, id);
-  _vftprintf(file, format, arg);
+  vprint_output(file, format, arg);
   va_end(arg);
 
   LocalFree(format);
 }
 
+/*
+  Capture what the current thread prints with print_message() and
+  print_output(), so that threads working in parallel don't interleave their
+  lines on the console.  Pass NULL to print directly again.
+*/
+void capture_output(output_t *output) {
+  if (output_tls_index == TLS_OUT_OF_INDEXES) return;
+  TlsSetValue(output_tls_index, (void *) output);
+}
+
+/* Print to the console, or to the thread's captured output. */
+void print_output(FILE *file, const TCHAR *format, ...) {
+  va_list arg;
+  va_start(arg, format);
+  vprint_output(file, format, arg);
+  va_end(arg);
+}
+
+/* Print captured output, to stderr if any of it was an error. */
+void flush_output(output_t *output) {
+  if (! output->len) return;
+  _fputts(output->text, output->error ? stderr : stdout);
+}
+
 /* Show a GUI dialogue */
 int popup_message(HWND owner, unsigned int type, unsigned long id, ...) {
   va_list arg;
@@ -1,10 +1,23 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+/* Enough for the lines printed while controlling one service. */
+#define NSSM_OUTPUT_LENGTH 1024
+
+/* Console output captured from a thread, to be printed later in one piece. */
+typedef struct {
+  TCHAR text[NSSM_OUTPUT_LENGTH];
+  size_t len;
+  bool error;
+} output_t;
+
 TCHAR *error_string(unsigned long);
 TCHAR *message_string(unsigned long);
 void log_event(unsigned short, unsigned long, ...);
 void print_message(FILE *, unsigned long, ...);
+void capture_output(output_t *);
+void print_output(FILE *, const TCHAR *, ...);
+void flush_output(output_t *);
 int popup_message(HWND, unsigned int, unsigned long, ...);
 
 #endif
@@ -0,0 +1,376 @@
+#include "nssm.h"
+
+/* Was the command "nssm <command> --all-of <group>"? */
+bool is_group_option(int argc, TCHAR **argv) {
+  return (argc == 2 && str_equiv(argv[0], NSSM_GROUP_OPTION));
+}
+
+static void free_group(group_t *group) {
+  if (group->members) {
+    for (unsigned long i = 0; i < group->num_members; i++) {
+      if (group->members[i].dependencies) HeapFree(GetProcessHeap(), 0, group->members[i].dependencies);
+      if (group->members[i].next) HeapFree(GetProcessHeap(), 0, group->members[i].next);
+    }
+    HeapFree(GetProcessHeap(), 0, group->members);
+  }
+  if (group->queue) HeapFree(GetProcessHeap(), 0, group->queue);
+  if (group->stack) HeapFree(GetProcessHeap(), 0, group->stack);
+}
+
+/* Copy the services, but not groups, which a service depends on. */
+static TCHAR *copy_dependencies(const TCHAR *dependencies) {
+  size_t len = 0;
+  if (dependencies) {
+    while (dependencies[len]) len += _tcslen(dependencies + len) + 1;
+  }
+
+  TCHAR *copy = (TCHAR *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, (len + 1) * sizeof(TCHAR));
+  if (! copy) return 0;
+
+  size_t i = 0;
+  for (const TCHAR *s = dependencies; s && *s; s += _tcslen(s) + 1) {
+    if (*s == SC_GROUP_IDENTIFIER) continue;
+    size_t n = _tcslen(s) + 1;
+    memmove(copy + i, s, n * sizeof(TCHAR));
+    i += n;
+  }
+
+  return copy;
+}
+
+/* Find the services in the group along with their dependencies. */
+static int find_group_members(const TCHAR *name, group_t *group) {
+  SC_HANDLE services = open_service_manager(SC_MANAGER_CONNECT | SC_MANAGER_ENUMERATE_SERVICE);
+  if (! services) {
+    print_message(stderr, NSSM_MESSAGE_OPEN_SERVICE_MANAGER_FAILED);
+    return 1;
+  }
+
+  unsigned long bufsize, required, count, i;
+  unsigned long resume = 0;
+  EnumServicesStatusEx(services, SC_ENUM_PROCESS_INFO, SERVICE_WIN32, SERVICE_STATE_ALL, 0, 0, &required, &count, &resume, 0);
+  unsigned long error = GetLastError();
+  if (error != ERROR_MORE_DATA) {
+    print_message(stderr, NSSM_MESSAGE_ENUMSERVICESSTATUS_FAILED, error_string(error));
+    CloseServiceHandle(services);
+    return 2;
+  }
+
+  ENUM_SERVICE_STATUS_PROCESS *status = (ENUM_SERVICE_STATUS_PROCESS *) HeapAlloc(GetProcessHeap(), 0, required);
+  if (! status) {
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("ENUM_SERVICE_STATUS_PROCESS"), _T("find_group_members()"));
+    CloseServiceHandle(services);
+    return 3;
+  }
+
+  bufsize = required;
+  while (true) {
+    int ret = EnumServicesStatusEx(services, SC_ENUM_PROCESS_INFO, SERVICE_WIN32, SERVICE_STATE_ALL, (LPBYTE) status, bufsize, &required, &count, &resume, 0);
+    if (! ret) {
+      error = GetLastError();
+      if (error != ERROR_MORE_DATA) {
+        HeapFree(GetProcessHeap(), 0, status);
+        CloseServiceHandle(services);
+        print_message(stderr, NSSM_MESSAGE_ENUMSERVICESSTATUS_FAILED, error_string(error));
+        return 4;
+      }
+    }
+
+    /* Make room for every service we were told about. */
+    group_member_t *members;
+    if (group->members) members = (group_member_t *) HeapReAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, group->members, (group->num_members + count) * sizeof(group_member_t));
+    else members = (group_member_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, count * sizeof(group_member_t));
+    if (! members) {
+      HeapFree(GetProcessHeap(), 0, status);
+      CloseServiceHandle(services);
+      print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("group_member_t"), _T("find_group_members()"));
+      return 5;
+    }
+    group->members = members;
+
+    for (i = 0; i < count; i++) {
+      SC_HANDLE service_handle = OpenService(services, status[i].lpServiceName, SERVICE_QUERY_CONFIG);
+      if (! service_handle) continue;
+      QUERY_SERVICE_CONFIG *qsc = query_service_config(status[i].lpServiceName, service_handle);
+      CloseServiceHandle(service_handle);
+      if (! qsc) continue;
+
+      bool member = in_host_group(status[i].lpServiceName, name);
+      if (! member && qsc->lpLoadOrderGroup && str_equiv(qsc->lpLoadOrderGroup, name)) member = true;
+      if (member) {
+        group_member_t *m = &group->members[group->num_members];
+        _sntprintf_s(m->name, _countof(m->name), _TRUNCATE, _T("%s"), status[i].lpServiceName);
+        m->dependencies = copy_dependencies(qsc->lpDependencies);
+        if (! m->dependencies) {
+          HeapFree(GetProcessHeap(), 0, qsc);
+          HeapFree(GetProcessHeap(), 0, status);
+          CloseServiceHandle(services);
+          print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("dependencies"), _T("find_group_members()"));
+          return 6;
+        }
+        group->num_members++;
+      }
+      HeapFree(GetProcessHeap(), 0, qsc);
+    }
+
+    if (ret) break;
+  }
+
+  HeapFree(GetProcessHeap(), 0, status);
+  CloseServiceHandle(services);
+  return 0;
+}
+
+/*
+  Link members which must wait for each other.  When starting, a service
+  waits for the members it depends on.  When stopping, the reverse.
+  Returns non-zero if there is a dependency loop.
+*/
+static int link_group_members(group_t *group) {
+  unsigned long n = group->num_members;
+  unsigned long i, j;
+
+  for (i = 0; i < n; i++) {
+    group->members[i].next = (unsigned long *) HeapAlloc(GetProcessHeap(), 0, n * sizeof(unsigned long));
+    if (! group->members[i].next) {
+      print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("group_member_t"), _T("link_group_members()"));
+      return 1;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    for (TCHAR *s = group->members[i].dependencies; *s; s += _tcslen(s) + 1) {
+      for (j = 0; j < n; j++) {
+        if (j == i || ! str_equiv(s, group->members[j].name)) continue;
+        group_member_t *before = &group->members[j];
+        group_member_t *after = &group->members[i];
+        if (group->control == SERVICE_CONTROL_STOP) {
+          before = &group->members[i];
+          after = &group->members[j];
+        }
+
+        /* A service may list the same dependency more than once. */
+        unsigned long index = (unsigned long) (after - group->members);
+        unsigned long k;
+        for (k = 0; k < before->num_next; k++) {
+          if (before->next[k] == index) break;
+        }
+        if (k == before->num_next) {
+          before->next[before->num_next++] = index;
+          after->waiting++;
+        }
+        break;
+      }
+    }
+  }
+
+  /* Walk the graph in order.  Anything left over is in a loop. */
+  unsigned long *waiting = (unsigned long *) HeapAlloc(GetProcessHeap(), 0, n * sizeof(unsigned long));
+  if (! waiting) {
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("waiting"), _T("link_group_members()"));
+    return 2;
+  }
+
+  unsigned long head = 0, tail = 0;
+  for (i = 0; i < n; i++) {
+    waiting[i] = group->members[i].waiting;
+    if (! waiting[i]) group->stack[tail++] = i;
+  }
+  for (head = 0; head < tail; head++) {
+    group_member_t *member = &group->members[group->stack[head]];
+    for (j = 0; j < member->num_next; j++) {
+      if (! --waiting[member->next[j]]) group->stack[tail++] = member->next[j];
+    }
+  }
+  if (tail < n) {
+    for (i = 0; i < n; i++) {
+      if (waiting[i]) print_message(stderr, NSSM_MESSAGE_GROUP_LOOP, group->members[i].name);
+    }
+    HeapFree(GetProcessHeap(), 0, waiting);
+    return 3;
+  }
+
+  HeapFree(GetProcessHeap(), 0, waiting);
+  return 0;
+}
+
+/* Start or stop one service unless it is already where we want it. */
+static int control_group_member(unsigned long control, TCHAR *service_name) {
+  SC_HANDLE services = open_service_manager(SC_MANAGER_CONNECT);
+  if (services) {
+    SC_HANDLE service_handle = OpenService(services, service_name, SERVICE_QUERY_STATUS);
+    if (service_handle) {
+      SERVICE_STATUS service_status;
+      unsigned long error = ERROR_SUCCESS;
+      if (QueryServiceStatus(service_handle, &service_status)) {
+        if (control == NSSM_SERVICE_CONTROL_START && service_status.dwCurrentState == SERVICE_RUNNING) error = ERROR_SERVICE_ALREADY_RUNNING;
+        else if (control == SERVICE_CONTROL_STOP && service_status.dwCurrentState == SERVICE_STOPPED) error = ERROR_SERVICE_NOT_ACTIVE;
+      }
+      CloseServiceHandle(service_handle);
+      if (error != ERROR_SUCCESS) {
+        CloseServiceHandle(services);
+        print_output(stdout, _T("%s: %s: %s"), service_name, service_control_text(control), error_string(error));
+        return 0;
+      }
+    }
+    CloseServiceHandle(services);
+  }
+
+  return control_service(control, 1, &service_name);
+}
+
+/*
+  Mark a member as finished and queue the members which were waiting for
+  it.  Members waiting for one which failed are skipped, as are the members
+  waiting for them.  Called with the group's lock held.
+*/
+static void finish_group_member(group_t *group, unsigned long index) {
+  unsigned long depth = 0;
+  group->stack[depth++] = index;
+
+  while (depth) {
+    group_member_t *member = &group->members[group->stack[--depth]];
+    group->finished++;
+
+    for (unsigned long j = 0; j < member->num_next; j++) {
+      group_member_t *next = &group->members[member->next[j]];
+      if (member->failed || member->skipped) next->blocked = true;
+      if (--next->waiting) continue;
+
+      if (next->blocked) {
+        next->skipped = true;
+        group->stack[depth++] = member->next[j];
+      }
+      else {
+        group->queue[group->tail++] = member->next[j];
+        ReleaseSemaphore(group->ready, 1, 0);
+      }
+    }
+  }
+
+  /* Let the threads go home. */
+  if (group->finished == group->num_members) ReleaseSemaphore(group->ready, group->num_threads, 0);
+}
+
+static unsigned long WINAPI control_group_members(void *arg) {
+  group_t *group = (group_t *) arg;
+
+  while (true) {
+    WaitForSingleObject(group->ready, INFINITE);
+
+    EnterCriticalSection(&group->section);
+    if (group->head == group->tail) {
+      LeaveCriticalSection(&group->section);
+      return 0;
+    }
+    unsigned long index = group->queue[group->head++];
+    LeaveCriticalSection(&group->section);
+
+    /* Up to NSSM_GROUP_THREADS members are controlled at once so keep their output for the summary. */
+    group_member_t *member = &group->members[index];
+    unsigned long started = GetTickCount();
+    capture_output(&member->output);
+    if (control_group_member(group->control, member->name)) member->failed = true;
+    capture_output(0);
+    member->elapsed = GetTickCount() - started;
+
+    EnterCriticalSection(&group->section);
+    finish_group_member(group, index);
+    LeaveCriticalSection(&group->section);
+  }
+}
+
+/* Start or stop every service in a group, respecting their dependencies. */
+int control_group(unsigned long control, int argc, TCHAR **argv) {
+  if (! is_group_option(argc, argv)) return usage(1);
+  TCHAR *name = argv[1];
+
+  unsigned long started = GetTickCount();
+
+  group_t group;
+  ZeroMemory(&group, sizeof(group));
+  group.control = control;
+
+  int ret = find_group_members(name, &group);
+  if (ret) {
+    free_group(&group);
+    return ret;
+  }
+
+  unsigned long n = group.num_members;
+  if (! n) {
+    print_message(stderr, NSSM_MESSAGE_GROUP_EMPTY, name, name);
+    free_group(&group);
+    return 3;
+  }
+
+  group.queue = (unsigned long *) HeapAlloc(GetProcessHeap(), 0, n * sizeof(unsigned long));
+  group.stack = (unsigned long *) HeapAlloc(GetProcessHeap(), 0, n * sizeof(unsigned long));
+  if (! group.queue || ! group.stack) {
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("queue"), _T("control_group()"));
+    free_group(&group);
+    return 4;
+  }
+
+  if (link_group_members(&group)) {
+    free_group(&group);
+    return 5;
+  }
+
+  group.num_threads = n < NSSM_GROUP_THREADS ? n : NSSM_GROUP_THREADS;
+  group.ready = CreateSemaphore(0, 0, (long) (n + group.num_threads), 0);
+  if (! group.ready) {
+    print_message(stderr, NSSM_MESSAGE_CREATESEMAPHORE_FAILED, error_string(GetLastError()));
+    free_group(&group);
+    return 6;
+  }
+  InitializeCriticalSection(&group.section);
+
+  /* Queue everything which isn't waiting for something else. */
+  unsigned long i;
+  for (i = 0; i < n; i++) {
+    if (! group.members[i].waiting) group.queue[group.tail++] = i;
+  }
+  ReleaseSemaphore(group.ready, (long) group.tail, 0);
+
+  HANDLE threads[NSSM_GROUP_THREADS];
+  unsigned long num_threads = 0;
+  for (i = 0; i < group.num_threads; i++) {
+    threads[num_threads] = CreateThread(0, 0, control_group_members, (void *) &group, 0, 0);
+    if (threads[num_threads]) num_threads++;
+  }
+
+  /* With no threads at all, do the work ourselves. */
+  if (num_threads) WaitForMultipleObjects(num_threads, threads, true, INFINITE);
+  else control_group_members((void *) &group);
+  for (i = 0; i < num_threads; i++) CloseHandle(threads[i]);
+
+  DeleteCriticalSection(&group.section);
+  CloseHandle(group.ready);
+
+  /* Summarise. */
+  unsigned long succeeded = 0;
+  TCHAR elapsed[32];
+  for (i = 0; i < n; i++) {
+    group_member_t *member = &group.members[i];
+    flush_output(&member->output);
+    if (member->skipped) {
+      print_message(stderr, NSSM_MESSAGE_GROUP_SKIPPED, member->name);
+      continue;
+    }
+    _sntprintf_s(elapsed, _countof(elapsed), _TRUNCATE, _T("%lu.%03lu"), member->elapsed / 1000, member->elapsed % 1000);
+    if (member->failed) print_message(stderr, NSSM_MESSAGE_GROUP_MEMBER_FAILED, member->name, elapsed);
+    else succeeded++;
+  }
+
+  unsigned long total = GetTickCount() - started;
+  TCHAR succeeded_string[16], count_string[16];
+  _sntprintf_s(succeeded_string, _countof(succeeded_string), _TRUNCATE, _T("%lu"), succeeded);
+  _sntprintf_s(count_string, _countof(count_string), _TRUNCATE, _T("%lu"), n);
+  _sntprintf_s(elapsed, _countof(elapsed), _TRUNCATE, _T("%lu.%03lu"), total / 1000, total % 1000);
+  print_message(stdout, NSSM_MESSAGE_GROUP_CONTROLLED, service_control_text(control), succeeded_string, count_string, name, elapsed);
+
+  free_group(&group);
+  if (succeeded < n) return 1;
+  return 0;
+}
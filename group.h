@@ -0,0 +1,45 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+/*
+  Bulk control with "nssm start --all-of <group>" and friends.  A service is
+  in the group if its AppHost or its service manager load order group is
+  <group>.  Services are started once the members they depend on are
+  running and stopped once the members which depend on them are stopped,
+  with up to NSSM_GROUP_THREADS services being controlled at a time.
+*/
+#define NSSM_GROUP_OPTION _T("--all-of")
+#define NSSM_GROUP_THREADS 8
+
+typedef struct {
+  TCHAR name[SERVICE_NAME_LENGTH];
+  TCHAR *dependencies;
+  unsigned long *next;
+  unsigned long num_next;
+  unsigned long waiting;
+  bool blocked;
+  bool skipped;
+  bool failed;
+  unsigned long elapsed;
+  /* What controlling the service printed, shown in the summary. */
+  output_t output;
+} group_member_t;
+
+typedef struct {
+  unsigned long control;
+  group_member_t *members;
+  unsigned long num_members;
+  unsigned long *queue;
+  unsigned long head;
+  unsigned long tail;
+  unsigned long *stack;
+  unsigned long finished;
+  unsigned long num_threads;
+  CRITICAL_SECTION section;
+  HANDLE ready;
+} group_t;
+
+bool is_group_option(int, TCHAR **);
+int control_group(unsigned long, int, TCHAR **);
+
+#endif
@@ -142,6 +142,8 @@ int nssm_gui(int resource, nssm_service_t *service) {
         if (! (service->affinity & (1LL << (__int64) i))) SendMessage(list, LB_SETSEL, 0, i);
       }
     }
+    /* Processor groups and NUMA nodes can only be set from the command line. */
+    else if (cpuset_is_extended(&service->cpuset)) EnableWindow(GetDlgItem(tablist[NSSM_TAB_PROCESS], IDC_AFFINITY_ALL), 0);
 
     if (service->no_console) {
       SendDlgItemMessage(tablist[NSSM_TAB_PROCESS], IDC_CONSOLE, BM_SETCHECK, BST_UNCHECKED, 0);
@@ -383,11 +385,31 @@ static inline int update_hooks(TCHAR *service_name) {
   return ret;
 }
 
-static inline void check_io(HWND owner, TCHAR *name, TCHAR *buffer, unsigned long len, unsigned long control) {
-  if (! SendMessage(GetDlgItem(tablist[NSSM_TAB_IO], control), WM_GETTEXTLENGTH, 0, 0)) return;
-  if (GetDlgItemText(tablist[NSSM_TAB_IO], control, buffer, (int) len)) return;
+/*
+  Copy the text of a control into a service string, allowing at most len
+  characters including the terminating NULL.
+  Returns: 0 if the string was set.
+           1 if the control was empty.
+           2 on error.
+*/
+static int get_dlg_string(HWND dialog, int control, TCHAR **string, unsigned long len) {
+  unsigned long textlen = (unsigned long) SendMessage(GetDlgItem(dialog, control), WM_GETTEXTLENGTH, 0, 0);
+  if (! textlen) return 1;
+  if (textlen >= len) return 2;
+
+  TCHAR *buffer = (TCHAR *) HeapAlloc(GetProcessHeap(), 0, (textlen + 1) * sizeof(TCHAR));
+  if (! buffer) return 2;
+
+  int ret = 2;
+  if (GetDlgItemText(dialog, control, buffer, (int) textlen + 1)) ret = set_service_string(string, buffer) ? 2 : 0;
+  HeapFree(GetProcessHeap(), 0, buffer);
+  return ret;
+}
+
+static inline void check_io(HWND owner, TCHAR *name, TCHAR **string, unsigned long len, unsigned long control) {
+  if (get_dlg_string(tablist[NSSM_TAB_IO], control, string, len) != 2) return;
   popup_message(owner, MB_OK | MB_ICONEXCLAMATION, NSSM_MESSAGE_PATH_TOO_LONG, name);
-  ZeroMemory(buffer, len * sizeof(TCHAR));
+  free_service_string(string);
 }
 
 /* Set service parameters. */
@@ -410,23 +432,24 @@ int configure(HWND window, nssm_service_t *service, nssm_service_t *orig_service
 
   /* Get executable name */
   if (! service->native) {
-    if (! GetDlgItemText(tablist[NSSM_TAB_APPLICATION], IDC_PATH, service->exe, _countof(service->exe))) {
+    if (get_dlg_string(tablist[NSSM_TAB_APPLICATION], IDC_PATH, &service->exe, EXE_LENGTH)) {
       popup_message(window, MB_OK | MB_ICONEXCLAMATION, NSSM_GUI_MISSING_PATH);
       return 3;
     }
 
     /* Get startup directory. */
-    if (! GetDlgItemText(tablist[NSSM_TAB_APPLICATION], IDC_DIR, service->dir, _countof(service->dir))) {
-      _sntprintf_s(service->dir, _countof(service->dir), _TRUNCATE, _T("%s"), service->exe);
+    if (get_dlg_string(tablist[NSSM_TAB_APPLICATION], IDC_DIR, &service->dir, DIR_LENGTH)) {
+      if (set_service_string(&service->dir, service->exe)) {
+        popup_message(window, MB_OK | MB_ICONEXCLAMATION, NSSM_GUI_MISSING_PATH);
+        return 3;
+      }
       strip_basename(service->dir);
     }
 
     /* Get flags. */
-    if (SendMessage(GetDlgItem(tablist[NSSM_TAB_APPLICATION], IDC_FLAGS), WM_GETTEXTLENGTH, 0, 0)) {
-      if (! GetDlgItemText(tablist[NSSM_TAB_APPLICATION], IDC_FLAGS, service->flags, _countof(service->flags))) {
-        popup_message(window, MB_OK | MB_ICONEXCLAMATION, NSSM_GUI_INVALID_OPTIONS);
-        return 4;
-      }
+    if (get_dlg_string(tablist[NSSM_TAB_APPLICATION], IDC_FLAGS, &service->flags, VALUE_LENGTH) == 2) {
+      popup_message(window, MB_OK | MB_ICONEXCLAMATION, NSSM_GUI_INVALID_OPTIONS);
+      return 4;
     }
   }
 
@@ -438,11 +461,9 @@ int configure(HWND window, nssm_service_t *service, nssm_service_t *orig_service
     }
   }
 
-  if (SendMessage(GetDlgItem(tablist[NSSM_TAB_DETAILS], IDC_DESCRIPTION), WM_GETTEXTLENGTH, 0, 0)) {
-    if (! GetDlgItemText(tablist[NSSM_TAB_DETAILS], IDC_DESCRIPTION, service->description, _countof(service->description))) {
-      popup_message(window, MB_OK | MB_ICONEXCLAMATION, NSSM_GUI_INVALID_DESCRIPTION);
-      return 5;
-    }
+  if (get_dlg_string(tablist[NSSM_TAB_DETAILS], IDC_DESCRIPTION, &service->description, VALUE_LENGTH) == 2) {
+    popup_message(window, MB_OK | MB_ICONEXCLAMATION, NSSM_GUI_INVALID_DESCRIPTION);
+    return 5;
   }
 
   HWND combo = GetDlgItem(tablist[NSSM_TAB_DETAILS], IDC_STARTUP);
@@ -674,9 +695,9 @@ int configure(HWND window, nssm_service_t *service, nssm_service_t *orig_service
   check_number(tablist[NSSM_TAB_EXIT], IDC_RESTART_DELAY, &service->restart_delay);
 
   /* Get I/O stuff. */
-  check_io(window, _T("stdin"), service->stdin_path, _countof(service->stdin_path), IDC_STDIN);
-  check_io(window, _T("stdout"), service->stdout_path, _countof(service->stdout_path), IDC_STDOUT);
-  check_io(window, _T("stderr"), service->stderr_path, _countof(service->stderr_path), IDC_STDERR);
+  check_io(window, _T("stdin"), &service->stdin_path, PATH_LENGTH, IDC_STDIN);
+  check_io(window, _T("stdout"), &service->stdout_path, PATH_LENGTH, IDC_STDOUT);
+  check_io(window, _T("stderr"), &service->stderr_path, PATH_LENGTH, IDC_STDERR);
   if (SendDlgItemMessage(tablist[NSSM_TAB_IO], IDC_TIMESTAMP, BM_GETCHECK, 0, 0) & BST_CHECKED) service->timestamp_log = true;
   else service->timestamp_log = false;
 
@@ -9,8 +9,12 @@ typedef struct {
   kill_t k;
 } hook_t;
 
-const TCHAR *hook_event_strings[] = { NSSM_HOOK_EVENT_START, NSSM_HOOK_EVENT_STOP, NSSM_HOOK_EVENT_EXIT, NSSM_HOOK_EVENT_POWER, NSSM_HOOK_EVENT_ROTATE, NULL };
-const TCHAR *hook_action_strings[] = { NSSM_HOOK_ACTION_PRE, NSSM_HOOK_ACTION_POST, NSSM_HOOK_ACTION_CHANGE, NSSM_HOOK_ACTION_RESUME, NULL };
+/* Hosted services share one list of hook threads. */
+CRITICAL_SECTION hook_threads_section;
+extern CRITICAL_SECTION process_section;
+
+const TCHAR *hook_event_strings[] = { NSSM_HOOK_EVENT_START, NSSM_HOOK_EVENT_STOP, NSSM_HOOK_EVENT_EXIT, NSSM_HOOK_EVENT_POWER, NSSM_HOOK_EVENT_ROTATE, NSSM_HOOK_EVENT_HANG, NSSM_HOOK_EVENT_LIMIT, NSSM_HOOK_EVENT_RECYCLE, NULL };
+const TCHAR *hook_action_strings[] = { NSSM_HOOK_ACTION_PRE, NSSM_HOOK_ACTION_POST, NSSM_HOOK_ACTION_CHANGE, NSSM_HOOK_ACTION_RESUME, NSSM_HOOK_ACTION_MEMORY, NSSM_HOOK_ACTION_PROCESSES, NSSM_HOOK_ACTION_PREDICT, NULL };
 
 static unsigned long WINAPI await_hook(void *arg) {
   hook_t *hook = (hook_t *) arg;
@@ -74,12 +78,15 @@ static void set_hook_runtime(TCHAR *v, FILETIME *start, FILETIME *now) {
   SetEnvironmentVariable(v, _T(""));
 }
 
-static void add_thread_handle(hook_thread_t *hook_threads, HANDLE thread_handle, TCHAR *name) {
+static void add_thread_handle(hook_thread_t *hook_threads, SERVICE_STATUS_HANDLE status_handle, HANDLE thread_handle, TCHAR *name) {
   if (! hook_threads) return;
 
+  EnterCriticalSection(&hook_threads_section);
+
   int num_threads = hook_threads->num_threads + 1;
   hook_thread_data_t *data = (hook_thread_data_t *) HeapAlloc(GetProcessHeap(), 0, num_threads * sizeof(hook_thread_data_t));
   if (! data) {
+    LeaveCriticalSection(&hook_threads_section);
     log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("hook_thread_t"), _T("add_thread_handle()"), 0);
     return;
   }
@@ -88,10 +95,59 @@ static void add_thread_handle(hook_thread_t *hook_threads, HANDLE thread_handle,
   for (i = 0; i < hook_threads->num_threads; i++) memmove(&data[i], &hook_threads->data[i], sizeof(data[i]));
   memmove(data[i].name, name, sizeof(data[i].name));
   data[i].thread_handle = thread_handle;
+  data[i].status_handle = status_handle;
 
   if (hook_threads->data) HeapFree(GetProcessHeap(), 0, hook_threads->data);
   hook_threads->data = data;
   hook_threads->num_threads = num_threads;
+
+  LeaveCriticalSection(&hook_threads_section);
+}
+
+/*
+  Remove the threads belonging to one service from the list so that we can
+  wait for them without blocking other hosted services.
+*/
+static int take_thread_handles(hook_thread_t *hook_threads, SERVICE_STATUS_HANDLE status_handle, hook_thread_t *taken) {
+  ZeroMemory(taken, sizeof(*taken));
+
+  EnterCriticalSection(&hook_threads_section);
+
+  int num_threads = 0;
+  int i;
+  for (i = 0; i < hook_threads->num_threads; i++) {
+    if (hook_threads->data[i].status_handle == status_handle) num_threads++;
+  }
+
+  if (! num_threads) {
+    LeaveCriticalSection(&hook_threads_section);
+    return 0;
+  }
+
+  taken->data = (hook_thread_data_t *) HeapAlloc(GetProcessHeap(), 0, num_threads * sizeof(hook_thread_data_t));
+  if (! taken->data) {
+    LeaveCriticalSection(&hook_threads_section);
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("data"), _T("take_thread_handles()"), 0);
+    return 1;
+  }
+
+  int kept = 0;
+  for (i = 0; i < hook_threads->num_threads; i++) {
+    if (hook_threads->data[i].status_handle == status_handle) memmove(&taken->data[taken->num_threads++], &hook_threads->data[i], sizeof(taken->data[0]));
+    else {
+      if (kept != i) memmove(&hook_threads->data[kept], &hook_threads->data[i], sizeof(hook_threads->data[0]));
+      kept++;
+    }
+  }
+
+  if (kept) hook_threads->num_threads = kept;
+  else {
+    HeapFree(GetProcessHeap(), 0, hook_threads->data);
+    ZeroMemory(hook_threads, sizeof(*hook_threads));
+  }
+
+  LeaveCriticalSection(&hook_threads_section);
+  return 0;
 }
 
 bool valid_hook_name(const TCHAR *hook_event, const TCHAR *hook_action, bool quiet) {
@@ -140,6 +196,37 @@ bool valid_hook_name(const TCHAR *hook_event, const TCHAR *hook_action, bool qui
     return false;
   }
 
+  /* Hang/Pre */
+  if (str_equiv(hook_event, NSSM_HOOK_EVENT_HANG)) {
+    if (str_equiv(hook_action, NSSM_HOOK_ACTION_PRE)) return true;
+    if (quiet) return false;
+    print_message(stderr, NSSM_MESSAGE_INVALID_HOOK_ACTION, hook_event);
+    _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_ACTION_PRE);
+    return false;
+  }
+
+  /* Limit/{Memory,Processes} */
+  if (str_equiv(hook_event, NSSM_HOOK_EVENT_LIMIT)) {
+    if (str_equiv(hook_action, NSSM_HOOK_ACTION_MEMORY)) return true;
+    if (str_equiv(hook_action, NSSM_HOOK_ACTION_PROCESSES)) return true;
+    if (quiet) return false;
+    print_message(stderr, NSSM_MESSAGE_INVALID_HOOK_ACTION, hook_event);
+    _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_ACTION_MEMORY);
+    _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_ACTION_PROCESSES);
+    return false;
+  }
+
+  /* Recycle/{Pre,Predict} */
+  if (str_equiv(hook_event, NSSM_HOOK_EVENT_RECYCLE)) {
+    if (str_equiv(hook_action, NSSM_HOOK_ACTION_PRE)) return true;
+    if (str_equiv(hook_action, NSSM_HOOK_ACTION_PREDICT)) return true;
+    if (quiet) return false;
+    print_message(stderr, NSSM_MESSAGE_INVALID_HOOK_ACTION, hook_event);
+    _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_ACTION_PRE);
+    _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_ACTION_PREDICT);
+    return false;
+  }
+
   /* Stop/Pre */
   if (str_equiv(hook_event, NSSM_HOOK_EVENT_STOP)) {
     if (str_equiv(hook_action, NSSM_HOOK_ACTION_PRE)) return true;
@@ -152,7 +239,10 @@ bool valid_hook_name(const TCHAR *hook_event, const TCHAR *hook_action, bool qui
   if (quiet) return false;
   print_message(stderr, NSSM_MESSAGE_INVALID_HOOK_EVENT);
   _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_EVENT_EXIT);
+  _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_EVENT_HANG);
+  _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_EVENT_LIMIT);
   _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_EVENT_POWER);
+  _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_EVENT_RECYCLE);
   _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_EVENT_ROTATE);
   _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_EVENT_START);
   _ftprintf(stderr, _T("%s\n"), NSSM_HOOK_EVENT_STOP);
@@ -161,55 +251,33 @@ bool valid_hook_name(const TCHAR *hook_event, const TCHAR *hook_action, bool qui
 
 void await_hook_threads(hook_thread_t *hook_threads, SERVICE_STATUS_HANDLE status_handle, SERVICE_STATUS *status, unsigned long deadline) {
   if (! hook_threads) return;
-  if (! hook_threads->num_threads) return;
 
-  int *retain = (int *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, hook_threads->num_threads * sizeof(int));
-  if (! retain) {
-    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("retain"), _T("await_hook_threads()"), 0);
-    return;
-  }
+  hook_thread_t taken;
+  if (take_thread_handles(hook_threads, status_handle, &taken)) return;
+  if (! taken.num_threads) return;
 
   /*
     We could use WaitForMultipleObjects() but await_single_object() can update
-    the service status as well.
+    the service status as well.  Threads which are still running go back
+    on the list.
   */
-  int num_threads = 0;
   int i;
-  for (i = 0; i < hook_threads->num_threads; i++) {
+  for (i = 0; i < taken.num_threads; i++) {
     if (deadline) {
-      if (await_single_handle(status_handle, status, hook_threads->data[i].thread_handle, hook_threads->data[i].name, _T(__FUNCTION__), deadline) != 1) {
-        CloseHandle(hook_threads->data[i].thread_handle);
+      if (await_single_handle(status_handle, status, taken.data[i].thread_handle, taken.data[i].name, _T(__FUNCTION__), deadline) != 1) {
+        CloseHandle(taken.data[i].thread_handle);
         continue;
       }
     }
-    else if (WaitForSingleObject(hook_threads->data[i].thread_handle, 0) != WAIT_TIMEOUT) {
-      CloseHandle(hook_threads->data[i].thread_handle);
+    else if (WaitForSingleObject(taken.data[i].thread_handle, 0) != WAIT_TIMEOUT) {
+      CloseHandle(taken.data[i].thread_handle);
       continue;
     }
 
-    retain[num_threads++]= i;
+    add_thread_handle(hook_threads, status_handle, taken.data[i].thread_handle, taken.data[i].name);
   }
 
-  if (num_threads) {
-    hook_thread_data_t *data = (hook_thread_data_t *) HeapAlloc(GetProcessHeap(), 0, num_threads * sizeof(hook_thread_data_t));
-    if (! data) {
-    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("data"), _T("await_hook_threads()"), 0);
-      HeapFree(GetProcessHeap(), 0, retain);
-      return;
-    }
-
-    for (i = 0; i < num_threads; i++) memmove(&data[i], &hook_threads->data[retain[i]], sizeof(data[i]));
-
-    HeapFree(GetProcessHeap(), 0, hook_threads->data);
-    hook_threads->data = data;
-    hook_threads->num_threads = num_threads;
-  }
-  else {
-    HeapFree(GetProcessHeap(), 0, hook_threads->data);
-    ZeroMemory(hook_threads, sizeof(*hook_threads));
-  }
-
-  HeapFree(GetProcessHeap(), 0, retain);
+  HeapFree(GetProcessHeap(), 0, taken.data);
 }
 
 /*
@@ -235,6 +303,7 @@ int nssm_hook(hook_thread_t *hook_threads, nssm_service_t *service, TCHAR *hook_
   GetSystemTimeAsFileTime(&now);
 
   EnterCriticalSection(&service->hook_section);
+  EnterCriticalSection(&process_section);
 
   /* Set the environment. */
   set_service_environment(service);
@@ -254,6 +323,22 @@ int nssm_hook(hook_thread_t *hook_threads, nssm_service_t *service, TCHAR *hook_
   if (hook_control) SetEnvironmentVariable(NSSM_HOOK_ENV_TRIGGER, service_control_text(*hook_control));
   else SetEnvironmentVariable(NSSM_HOOK_ENV_TRIGGER, _T(""));
 
+  /* Why the application is being recycled.  May be empty. */
+  if (service->recycle_reason) SetEnvironmentVariable(NSSM_HOOK_ENV_RECYCLE_REASON, service->recycle_reason);
+  else SetEnvironmentVariable(NSSM_HOOK_ENV_RECYCLE_REASON, _T(""));
+
+  /* Predicted memory leak.  May be empty. */
+  if (service->leak_predicted) {
+    _sntprintf_s(number, _countof(number), _TRUNCATE, _T("%I64u"), service->leak_rate);
+    SetEnvironmentVariable(NSSM_HOOK_ENV_LEAK_RATE, number);
+    _sntprintf_s(number, _countof(number), _TRUNCATE, _T("%I64u"), service->leak_eta);
+    SetEnvironmentVariable(NSSM_HOOK_ENV_LEAK_ETA, number);
+  }
+  else {
+    SetEnvironmentVariable(NSSM_HOOK_ENV_LEAK_RATE, _T(""));
+    SetEnvironmentVariable(NSSM_HOOK_ENV_LEAK_ETA, _T(""));
+  }
+
   /* Last control handled. */
   SetEnvironmentVariable(NSSM_HOOK_ENV_LAST_CONTROL, service_control_text(service->last_control));
 
@@ -328,6 +413,7 @@ int nssm_hook(hook_thread_t *hook_threads, nssm_service_t *service, TCHAR *hook_
   if (get_hook(service->name, hook_event, hook_action, cmd, sizeof(cmd))) {
     log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_GET_HOOK_FAILED, hook_event, hook_action, service->name, 0);
     unset_service_environment(service);
+    LeaveCriticalSection(&process_section);
     LeaveCriticalSection(&service->hook_section);
     HeapFree(GetProcessHeap(), 0, hook);
     return NSSM_HOOK_STATUS_ERROR;
@@ -336,6 +422,7 @@ int nssm_hook(hook_thread_t *hook_threads, nssm_service_t *service, TCHAR *hook_
   /* No hook. */
   if (! _tcslen(cmd)) {
     unset_service_environment(service);
+    LeaveCriticalSection(&process_section);
     LeaveCriticalSection(&service->hook_section);
     HeapFree(GetProcessHeap(), 0, hook);
     return NSSM_HOOK_STATUS_NOTFOUND;
@@ -355,7 +442,14 @@ int nssm_hook(hook_thread_t *hook_threads, nssm_service_t *service, TCHAR *hook_
   flags |= CREATE_UNICODE_ENVIRONMENT;
 #endif
   ret = NSSM_HOOK_STATUS_NOTRUN;
-  if (CreateProcess(0, cmd, 0, 0, inherit_handles, flags, 0, service->dir, &si, &pi)) {
+  bool created = CreateProcess(0, cmd, 0, 0, inherit_handles, flags, 0, service->dir, &si, &pi) ? true : false;
+  unsigned long error = GetLastError();
+
+  /* Restore our environment before waiting so other services can launch. */
+  unset_service_environment(service);
+  LeaveCriticalSection(&process_section);
+
+  if (created) {
     close_output_handles(&si);
     hook->name = (TCHAR *) HeapAlloc(GetProcessHeap(), 0, HOOK_NAME_LENGTH * sizeof(TCHAR));
     if (hook->name) _sntprintf_s(hook->name, HOOK_NAME_LENGTH, _TRUNCATE, _T("%s (%s/%s)"), service->name, hook_event, hook_action);
@@ -370,7 +464,7 @@ int nssm_hook(hook_thread_t *hook_threads, nssm_service_t *service, TCHAR *hook_
       if (async) {
         ret = 0;
         await_hook_threads(hook_threads, service->status_handle, &service->status, 0);
-        add_thread_handle(hook_threads, thread_handle, hook->name);
+        add_thread_handle(hook_threads, service->status_handle, thread_handle, hook->name);
       }
       else {
         await_single_handle(service->status_handle, &service->status, thread_handle, hook->name, _T(__FUNCTION__), deadline + NSSM_SERVICE_STATUS_DEADLINE);
@@ -388,14 +482,11 @@ int nssm_hook(hook_thread_t *hook_threads, nssm_service_t *service, TCHAR *hook_
     }
   }
   else {
-    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_HOOK_CREATEPROCESS_FAILED, hook_event, hook_action, service->name, cmd, error_string(GetLastError()), 0);
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_HOOK_CREATEPROCESS_FAILED, hook_event, hook_action, service->name, cmd, error_string(error), 0);
     HeapFree(GetProcessHeap(), 0, hook);
     close_output_handles(&si);
   }
 
-  /* Restore our environment. */
-  unset_service_environment(service);
-
   LeaveCriticalSection(&service->hook_section);
 
   return ret;
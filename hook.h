@@ -6,16 +6,22 @@
 #define NSSM_HOOK_EVENT_EXIT _T("Exit")
 #define NSSM_HOOK_EVENT_POWER _T("Power")
 #define NSSM_HOOK_EVENT_ROTATE _T("Rotate")
+#define NSSM_HOOK_EVENT_HANG _T("Hang")
+#define NSSM_HOOK_EVENT_LIMIT _T("Limit")
+#define NSSM_HOOK_EVENT_RECYCLE _T("Recycle")
 
 #define NSSM_HOOK_ACTION_PRE _T("Pre")
 #define NSSM_HOOK_ACTION_POST _T("Post")
 #define NSSM_HOOK_ACTION_CHANGE _T("Change")
 #define NSSM_HOOK_ACTION_RESUME _T("Resume")
+#define NSSM_HOOK_ACTION_MEMORY _T("Memory")
+#define NSSM_HOOK_ACTION_PROCESSES _T("Processes")
+#define NSSM_HOOK_ACTION_PREDICT _T("Predict")
 
 /* Hook name will be "<service> (<event>/<action>)" */
 #define HOOK_NAME_LENGTH SERVICE_NAME_LENGTH * 2
 
-#define NSSM_HOOK_VERSION 1
+#define NSSM_HOOK_VERSION 2
 
 /* Hook ran successfully. */
 #define NSSM_HOOK_STATUS_SUCCESS 0
@@ -56,9 +62,15 @@
 #define NSSM_HOOK_ENV_RUNTIME _T("NSSM_RUNTIME")
 #define NSSM_HOOK_ENV_APPLICATION_RUNTIME _T("NSSM_APPLICATION_RUNTIME")
 
+/* Version 2. */
+#define NSSM_HOOK_ENV_RECYCLE_REASON _T("NSSM_RECYCLE_REASON")
+#define NSSM_HOOK_ENV_LEAK_RATE _T("NSSM_LEAK_RATE")
+#define NSSM_HOOK_ENV_LEAK_ETA _T("NSSM_LEAK_ETA")
+
 typedef struct {
   TCHAR name[HOOK_NAME_LENGTH];
   HANDLE thread_handle;
+  SERVICE_STATUS_HANDLE status_handle;
 } hook_thread_data_t;
 
 typedef struct {
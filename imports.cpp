@@ -65,6 +65,46 @@ int get_imports() {
     if (! imports.WakeConditionVariable) {
       if (error != ERROR_PROC_NOT_FOUND) return 5;
     }
+
+    imports.GetNumaNodeProcessorMask = (GetNumaNodeProcessorMask_ptr) get_import(imports.kernel32, "GetNumaNodeProcessorMask", &error);
+    if (! imports.GetNumaNodeProcessorMask) {
+      if (error != ERROR_PROC_NOT_FOUND) return 9;
+    }
+
+    imports.GetNumaNodeProcessorMaskEx = (GetNumaNodeProcessorMaskEx_ptr) get_import(imports.kernel32, "GetNumaNodeProcessorMaskEx", &error);
+    if (! imports.GetNumaNodeProcessorMaskEx) {
+      if (error != ERROR_PROC_NOT_FOUND) return 10;
+    }
+
+    imports.SetThreadGroupAffinity = (SetThreadGroupAffinity_ptr) get_import(imports.kernel32, "SetThreadGroupAffinity", &error);
+    if (! imports.SetThreadGroupAffinity) {
+      if (error != ERROR_PROC_NOT_FOUND) return 11;
+    }
+
+    imports.InitializeProcThreadAttributeList = (InitializeProcThreadAttributeList_ptr) get_import(imports.kernel32, "InitializeProcThreadAttributeList", &error);
+    if (! imports.InitializeProcThreadAttributeList) {
+      if (error != ERROR_PROC_NOT_FOUND) return 12;
+    }
+
+    imports.UpdateProcThreadAttribute = (UpdateProcThreadAttribute_ptr) get_import(imports.kernel32, "UpdateProcThreadAttribute", &error);
+    if (! imports.UpdateProcThreadAttribute) {
+      if (error != ERROR_PROC_NOT_FOUND) return 13;
+    }
+
+    imports.DeleteProcThreadAttributeList = (DeleteProcThreadAttributeList_ptr) get_import(imports.kernel32, "DeleteProcThreadAttributeList", &error);
+    if (! imports.DeleteProcThreadAttributeList) {
+      if (error != ERROR_PROC_NOT_FOUND) return 14;
+    }
+
+    imports.GetSystemCpuSetInformation = (GetSystemCpuSetInformation_ptr) get_import(imports.kernel32, "GetSystemCpuSetInformation", &error);
+    if (! imports.GetSystemCpuSetInformation) {
+      if (error != ERROR_PROC_NOT_FOUND) return 15;
+    }
+
+    imports.SetProcessDefaultCpuSets = (SetProcessDefaultCpuSets_ptr) get_import(imports.kernel32, "SetProcessDefaultCpuSets", &error);
+    if (! imports.SetProcessDefaultCpuSets) {
+      if (error != ERROR_PROC_NOT_FOUND) return 16;
+    }
   }
   else if (error != ERROR_MOD_NOT_FOUND) return 1;
 
@@ -14,6 +14,14 @@ typedef BOOL (WINAPI *QueryFullProcessImageName_ptr)(HANDLE, unsigned long, LPTS
 typedef void (WINAPI *WakeConditionVariable_ptr)(PCONDITION_VARIABLE);
 typedef BOOL (WINAPI *CreateWellKnownSid_ptr)(WELL_KNOWN_SID_TYPE, SID *, SID *, unsigned long *);
 typedef BOOL (WINAPI *IsWellKnownSid_ptr)(SID *, WELL_KNOWN_SID_TYPE);
+typedef BOOL (WINAPI *GetNumaNodeProcessorMask_ptr)(UCHAR, ULONGLONG *);
+typedef BOOL (WINAPI *GetNumaNodeProcessorMaskEx_ptr)(USHORT, void *);
+typedef BOOL (WINAPI *SetThreadGroupAffinity_ptr)(HANDLE, const void *, void *);
+typedef BOOL (WINAPI *InitializeProcThreadAttributeList_ptr)(void *, unsigned long, unsigned long, SIZE_T *);
+typedef BOOL (WINAPI *UpdateProcThreadAttribute_ptr)(void *, unsigned long, DWORD_PTR, void *, SIZE_T, void *, SIZE_T *);
+typedef void (WINAPI *DeleteProcThreadAttributeList_ptr)(void *);
+typedef BOOL (WINAPI *GetSystemCpuSetInformation_ptr)(void *, unsigned long, unsigned long *, HANDLE, unsigned long);
+typedef BOOL (WINAPI *SetProcessDefaultCpuSets_ptr)(HANDLE, const unsigned long *, unsigned long);
 
 typedef struct {
   HMODULE kernel32;
@@ -24,6 +32,14 @@ typedef struct {
   WakeConditionVariable_ptr WakeConditionVariable;
   CreateWellKnownSid_ptr CreateWellKnownSid;
   IsWellKnownSid_ptr IsWellKnownSid;
+  GetNumaNodeProcessorMask_ptr GetNumaNodeProcessorMask;
+  GetNumaNodeProcessorMaskEx_ptr GetNumaNodeProcessorMaskEx;
+  SetThreadGroupAffinity_ptr SetThreadGroupAffinity;
+  InitializeProcThreadAttributeList_ptr InitializeProcThreadAttributeList;
+  UpdateProcThreadAttribute_ptr UpdateProcThreadAttribute;
+  DeleteProcThreadAttributeList_ptr DeleteProcThreadAttributeList;
+  GetSystemCpuSetInformation_ptr GetSystemCpuSetInformation;
+  SetProcessDefaultCpuSets_ptr SetProcessDefaultCpuSets;
 } imports_t;
 
 HMODULE get_dll(const TCHAR *, unsigned long *);
@@ -1,8 +1,16 @@
 #include "nssm.h"
 
-#define COMPLAINED_READ (1 << 0)
-#define COMPLAINED_WRITE (1 << 1)
-#define COMPLAINED_ROTATE (1 << 2)
+#define ANSI_ESC 0x1b
+#define ANSI_BEL 0x07
+
+/* Where we are in an escape sequence which may span reads. */
+#define ANSI_STATE_TEXT 0
+#define ANSI_STATE_ESCAPE 1
+#define ANSI_STATE_INTERMEDIATE 2
+#define ANSI_STATE_CSI 3
+#define ANSI_STATE_STRING 4
+#define ANSI_STATE_STRING_ESCAPE 5
+
 #define TIMESTAMP_FORMAT "%04u-%02u-%02u %02u:%02u:%02u.%03u: "
 #define TIMESTAMP_LEN 25
 
@@ -20,21 +28,84 @@ static int dup_handle(HANDLE source_handle, HANDLE *dest_handle_ptr, TCHAR *sour
   return dup_handle(source_handle, dest_handle_ptr, source_description, dest_description, DUPLICATE_SAME_ACCESS);
 }
 
+TCHAR *copy_path(TCHAR *path) {
+  size_t len = _tcslen(path) + 1;
+  TCHAR *copy = (TCHAR *) HeapAlloc(GetProcessHeap(), 0, len * sizeof(TCHAR));
+  if (! copy) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("path"), _T("copy_path()"), 0);
+    return 0;
+  }
+  memmove(copy, path, len * sizeof(TCHAR));
+  return copy;
+}
+
+static void free_logger(logger_t *logger) {
+  close_handle(&logger->read_handle);
+  close_handle(&logger->write_handle);
+  if (logger->path) HeapFree(GetProcessHeap(), 0, logger->path);
+  if (logger->router) {
+    if (logger->route_scratch) HeapFree(GetProcessHeap(), 0, logger->route_scratch);
+    if (logger->routed) HeapFree(GetProcessHeap(), 0, logger->routed);
+    if (logger->route_buffer) HeapFree(GetProcessHeap(), 0, logger->route_buffer);
+    release_router(logger->router);
+  }
+  if (logger->ready_watch) {
+    if (logger->ready_scratch) HeapFree(GetProcessHeap(), 0, logger->ready_scratch);
+    if (logger->ready_line) HeapFree(GetProcessHeap(), 0, logger->ready_line);
+    release_ready_watch(logger->ready_watch);
+  }
+  HeapFree(GetProcessHeap(), 0, logger);
+}
+
+/* Each logger needs its own scratch space to route lines. */
+static void attach_router(logger_t *logger, router_t *router) {
+  logger->route_scratch = alloc_match_scratch(router->matcher);
+  logger->routed = (bool *) HeapAlloc(GetProcessHeap(), 0, router->num_routes * sizeof(bool));
+  logger->route_buffer = (char *) HeapAlloc(GetProcessHeap(), 0, NSSM_ROUTE_LINE_LENGTH);
+  if (! logger->route_scratch || ! logger->routed || ! logger->route_buffer) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("route buffer"), _T("attach_router()"), 0);
+    if (logger->route_scratch) HeapFree(GetProcessHeap(), 0, logger->route_scratch);
+    if (logger->routed) HeapFree(GetProcessHeap(), 0, logger->routed);
+    if (logger->route_buffer) HeapFree(GetProcessHeap(), 0, logger->route_buffer);
+    logger->route_scratch = 0;
+    logger->routed = 0;
+    logger->route_buffer = 0;
+    return;
+  }
+
+  acquire_router(router);
+  logger->router = router;
+}
+
+/* Likewise to look for the ready pattern. */
+static void attach_ready_watch(logger_t *logger, ready_watch_t *watch) {
+  logger->ready_scratch = alloc_match_scratch(watch->matcher);
+  logger->ready_line = (char *) HeapAlloc(GetProcessHeap(), 0, NSSM_READY_LINE_LENGTH);
+  if (! logger->ready_scratch || ! logger->ready_line) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("ready buffer"), _T("attach_ready_watch()"), 0);
+    if (logger->ready_scratch) HeapFree(GetProcessHeap(), 0, logger->ready_scratch);
+    if (logger->ready_line) HeapFree(GetProcessHeap(), 0, logger->ready_line);
+    logger->ready_scratch = 0;
+    logger->ready_line = 0;
+    return;
+  }
+
+  acquire_ready_watch(watch);
+  logger->ready_watch = watch;
+}
+
 /*
   read_handle:  read from application
   pipe_handle:  stdout of application
   write_handle: to file
 */
-static HANDLE create_logging_thread(TCHAR *service_name, TCHAR *path, unsigned long sharing, unsigned long disposition, unsigned long flags, HANDLE *read_handle_ptr, HANDLE *pipe_handle_ptr, HANDLE *write_handle_ptr, unsigned long rotate_bytes_low, unsigned long rotate_bytes_high, unsigned long rotate_delay, unsigned long *tid_ptr, unsigned long *rotate_online, bool timestamp_log, bool copy_and_truncate) {
+static HANDLE create_logging_thread(TCHAR *service_name, TCHAR *path, unsigned long sharing, unsigned long disposition, unsigned long flags, HANDLE *read_handle_ptr, HANDLE *pipe_handle_ptr, HANDLE *write_handle_ptr, unsigned long rotate_bytes_low, unsigned long rotate_bytes_high, unsigned long rotate_delay, unsigned long *tid_ptr, unsigned long *rotate_online, volatile long *new_run, bool timestamp_log, unsigned long group_bytes, bool strip_ansi, bool copy_and_truncate, router_t *router, ready_watch_t *ready_watch, stream_stats_t *stats) {
   *tid_ptr = 0;
 
   /* Pipe between application's stdout/stderr and our logging handle. */
   if (read_handle_ptr && ! *read_handle_ptr) {
     if (pipe_handle_ptr && ! *pipe_handle_ptr) {
-      if (CreatePipe(read_handle_ptr, pipe_handle_ptr, 0, 0)) {
-        SetHandleInformation(*pipe_handle_ptr, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
-      }
-      else {
+      if (platform_pipe(read_handle_ptr, pipe_handle_ptr)) {
         log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATEPIPE_FAILED, service_name, path, error_string(GetLastError()));
         return (HANDLE) 0;
       }
@@ -51,8 +122,17 @@ static HANDLE create_logging_thread(TCHAR *service_name, TCHAR *path, unsigned l
   size.LowPart = rotate_bytes_low;
   size.HighPart = rotate_bytes_high;
 
+  /*
+    The logging thread can outlive the application so it needs its own copy
+    of the path, which will be rewritten by get_parameters() on restart.
+  */
+  logger->path = copy_path(path);
+  if (! logger->path) {
+    HeapFree(GetProcessHeap(), 0, logger);
+    return (HANDLE) 0;
+  }
+
   logger->service_name = service_name;
-  logger->path = path;
   logger->sharing = sharing;
   logger->disposition = disposition;
   logger->flags = flags;
@@ -61,15 +141,23 @@ static HANDLE create_logging_thread(TCHAR *service_name, TCHAR *path, unsigned l
   logger->size = (__int64) size.QuadPart;
   logger->tid_ptr = tid_ptr;
   logger->timestamp_log = timestamp_log;
+  logger->group_bytes = group_bytes;
+  logger->record_length = -1LL;
+  logger->strip_ansi = strip_ansi;
+  logger->stats = stats;
   logger->line_length = 0;
   logger->rotate_online = rotate_online;
+  logger->new_run = new_run;
   logger->rotate_delay = rotate_delay;
   logger->copy_and_truncate = copy_and_truncate;
+  if (router) attach_router(logger, router);
+  if (ready_watch) attach_ready_watch(logger, ready_watch);
 
   HANDLE thread_handle = CreateThread(NULL, 0, log_and_rotate, (void *) logger, 0, logger->tid_ptr);
   if (! thread_handle) {
     log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATETHREAD_FAILED, error_string(GetLastError()), 0);
-    HeapFree(GetProcessHeap(), 0, logger);
+    logger->read_handle = logger->write_handle = 0;
+    free_logger(logger);
   }
 
   return thread_handle;
@@ -218,6 +306,31 @@ static void rotated_filename(TCHAR *path, TCHAR *rotated, unsigned long rotated_
   _sntprintf_s(rotated, rotated_len, _TRUNCATE, _T("%s%s"), buffer, extension);
 }
 
+/* Check whether a file last written at the given time has reached the rotation thresholds. */
+static bool rotation_due(SYSTEMTIME *st, FILETIME *last_write_time, unsigned long size_low, unsigned long size_high, unsigned long seconds, unsigned long low, unsigned long high) {
+  /* Check file age. */
+  if (seconds) {
+    FILETIME ft;
+    SystemTimeToFileTime(st, &ft);
+
+    ULARGE_INTEGER s;
+    s.LowPart = ft.dwLowDateTime;
+    s.HighPart = ft.dwHighDateTime;
+    s.QuadPart -= seconds * 10000000LL;
+    ft.dwLowDateTime = s.LowPart;
+    ft.dwHighDateTime = s.HighPart;
+    if (CompareFileTime(last_write_time, &ft) > 0) return false;
+  }
+
+  /* Check file size. */
+  if (low || high) {
+    if (size_high < high) return false;
+    if (size_high == high && size_low < low) return false;
+  }
+
+  return true;
+}
+
 void rotate_file(TCHAR *service_name, TCHAR *path, unsigned long seconds, unsigned long delay, unsigned long low, unsigned long high, bool copy_and_truncate) {
   unsigned long error;
 
@@ -248,25 +361,7 @@ void rotate_file(TCHAR *service_name, TCHAR *path, unsigned long seconds, unsign
     SystemTimeToFileTime(&st, &info.ftLastWriteTime);
   }
 
-  /* Check file age. */
-  if (seconds) {
-    FILETIME ft;
-    SystemTimeToFileTime(&st, &ft);
-
-    ULARGE_INTEGER s;
-    s.LowPart = ft.dwLowDateTime;
-    s.HighPart = ft.dwHighDateTime;
-    s.QuadPart -= seconds * 10000000LL;
-    ft.dwLowDateTime = s.LowPart;
-    ft.dwHighDateTime = s.HighPart;
-    if (CompareFileTime(&info.ftLastWriteTime, &ft) > 0) return;
-  }
-
-  /* Check file size. */
-  if (low || high) {
-    if (info.nFileSizeHigh < high) return;
-    if (info.nFileSizeHigh == high && info.nFileSizeLow < low) return;
-  }
+  if (! rotation_due(&st, &info.ftLastWriteTime, info.nFileSizeLow, info.nFileSizeHigh, seconds, low, high)) return;
 
   /* Get new filename. */
   FileTimeToSystemTime(&info.ftLastWriteTime, &st);
@@ -281,7 +376,7 @@ void rotate_file(TCHAR *service_name, TCHAR *path, unsigned long seconds, unsign
     function = _T("CopyFile()");
     if (CopyFile(path, rotated, TRUE)) {
       file = write_to_file(path, NSSM_STDOUT_SHARING, 0, NSSM_STDOUT_DISPOSITION, NSSM_STDOUT_FLAGS);
-      Sleep(delay);
+      platform_sleep(delay);
       SetFilePointer(file, 0, 0, FILE_BEGIN);
       SetEndOfFile(file);
       CloseHandle(file);
@@ -303,6 +398,197 @@ void rotate_file(TCHAR *service_name, TCHAR *path, unsigned long seconds, unsign
   return;
 }
 
+/*
+  Rotate a file which we have open for writing, then reopen it.
+  Returns:  0 if the file was rotated.
+            1 if the file could not be rotated but was reopened.
+           -1 if the file could not be reopened.
+*/
+int rotate_open_file(TCHAR *service_name, TCHAR *path, HANDLE *write_handle, unsigned long sharing, unsigned long *disposition, unsigned long flags, bool copy_and_truncate, unsigned long delay, int *complained) {
+  unsigned long error;
+  int ret = 0;
+
+  TCHAR rotated[PATH_LENGTH];
+  rotated_filename(path, rotated, _countof(rotated), 0);
+
+  /*
+    Ideally we'd try the rename first then close the handle but
+    MoveFile() will fail if the handle is still open so we must
+    risk losing everything.
+  */
+  if (copy_and_truncate) FlushFileBuffers(*write_handle);
+  close_handle(write_handle);
+  bool ok = true;
+  TCHAR *function;
+  if (copy_and_truncate) {
+    function = _T("CopyFile()");
+    if (CopyFile(path, rotated, TRUE)) {
+      HANDLE file = write_to_file(path, NSSM_STDOUT_SHARING, 0, NSSM_STDOUT_DISPOSITION, NSSM_STDOUT_FLAGS);
+      platform_sleep(delay);
+      SetFilePointer(file, 0, 0, FILE_BEGIN);
+      SetEndOfFile(file);
+      CloseHandle(file);
+    }
+    else ok = false;
+  }
+  else {
+    function = _T("MoveFile()");
+    if (! MoveFile(path, rotated)) ok = false;
+  }
+  if (ok) log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_ROTATED, service_name, path, rotated, 0);
+  else {
+    ret = 1;
+    error = GetLastError();
+    if (error != ERROR_FILE_NOT_FOUND) {
+      if (! (*complained & COMPLAINED_ROTATE)) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_ROTATE_FILE_FAILED, service_name, path, function, rotated, error_string(error), 0);
+      *complained |= COMPLAINED_ROTATE;
+      /* We can at least try to re-open the existing file. */
+      *disposition = OPEN_ALWAYS;
+    }
+  }
+
+  /* Reopen. */
+  *write_handle = write_to_file(path, sharing, 0, *disposition, flags);
+  if (*write_handle == INVALID_HANDLE_VALUE) {
+    error = GetLastError();
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATEFILE_FAILED, path, error_string(error), 0);
+    return -1;
+  }
+
+  return ret;
+}
+
+/*
+  A file being written by a running logging thread can't be moved aside so
+  instead of rotating it offline we ask the thread to rotate it online.
+*/
+static void rotate_logger(nssm_service_t *service, TCHAR *path, unsigned long *rotate_online) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (! GetFileAttributesEx(path, GetFileExInfoStandard, &data)) return;
+
+  SYSTEMTIME st;
+  GetSystemTime(&st);
+  if (rotation_due(&st, &data.ftLastWriteTime, data.nFileSizeLow, data.nFileSizeHigh, service->rotate_seconds, service->rotate_bytes_low, service->rotate_bytes_high)) *rotate_online = NSSM_ROTATE_ONLINE_ASAP;
+}
+
+static void get_logger_settings(nssm_service_t *service, unsigned long sharing, unsigned long disposition, unsigned long flags, bool copy_and_truncate, logger_settings_t *settings) {
+  ZeroMemory(settings, sizeof(*settings));
+  settings->sharing = sharing;
+  settings->disposition = disposition;
+  settings->flags = flags;
+  settings->rotate_bytes_low = service->rotate_bytes_low;
+  settings->rotate_bytes_high = service->rotate_bytes_high;
+  settings->rotate_delay = service->rotate_delay;
+  settings->timestamp_log = service->timestamp_log;
+  settings->group_bytes = service->timestamp_group ? service->timestamp_group_bytes : 0;
+  settings->strip_ansi = service->strip_ansi;
+  settings->copy_and_truncate = copy_and_truncate;
+  settings->router = service->router;
+  settings->ready_watch = service->ready_watch;
+}
+
+static bool same_logger_settings(logger_settings_t *a, logger_settings_t *b) {
+  if (a->sharing != b->sharing) return false;
+  if (a->disposition != b->disposition) return false;
+  if (a->flags != b->flags) return false;
+  if (a->rotate_bytes_low != b->rotate_bytes_low) return false;
+  if (a->rotate_bytes_high != b->rotate_bytes_high) return false;
+  if (a->rotate_delay != b->rotate_delay) return false;
+  if (a->timestamp_log != b->timestamp_log) return false;
+  if (a->group_bytes != b->group_bytes) return false;
+  if (a->strip_ansi != b->strip_ansi) return false;
+  if (a->copy_and_truncate != b->copy_and_truncate) return false;
+  if (a->router != b->router) return false;
+  if (a->ready_watch != b->ready_watch) return false;
+  return true;
+}
+
+/*
+  Logging threads outlive the application so that we don't have to create a
+  new pipe and thread every time it restarts.  A thread can be reused if it is
+  still running and is writing to the same file with the same settings.  If
+  the settings were changed between runs we start a fresh thread.
+*/
+static bool reuse_logger(HANDLE thread_handle, TCHAR *logger_path, TCHAR *path, bool use_pipe, logger_settings_t *logger_settings, logger_settings_t *settings) {
+  if (! thread_handle || ! logger_path || ! use_pipe) return false;
+  if (WaitForSingleObject(thread_handle, 0) != WAIT_TIMEOUT) return false;
+  if (! str_equiv(logger_path, path)) return false;
+  return same_logger_settings(logger_settings, settings);
+}
+
+/*
+  Close the write end of the pipe so the logging thread can finalise its read
+  then wait for it to exit.  If it exited it will have closed the read end.
+*/
+static void cleanup_logger(HANDLE *thread_handle, HANDLE *si, HANDLE *pipe, TCHAR **logger_path) {
+  close_handle(si);
+  if (*thread_handle) {
+    if (WaitForSingleObject(*thread_handle, NSSM_CLEANUP_LOGGERS_DEADLINE) == WAIT_OBJECT_0) *pipe = 0;
+    close_handle(thread_handle);
+  }
+  close_handle(pipe);
+  if (*logger_path) {
+    HeapFree(GetProcessHeap(), 0, *logger_path);
+    *logger_path = 0;
+  }
+}
+
+/*
+  Close loggers which can't be reused for the next run and rotate their
+  files.  This can wait for a logging thread to finish or for a file to be
+  moved aside, so it is called before taking process_section, leaving
+  get_output_handles() with nothing to wait for.
+*/
+void prepare_output_handles(nssm_service_t *service) {
+  /* Drop the router or ready watch of a previous run if no longer wanted. */
+  if (! service->use_routes && service->router) {
+    release_router(service->router);
+    service->router = 0;
+  }
+  if (! service->ready_pattern[0] && service->ready_watch) {
+    release_ready_watch(service->ready_watch);
+    service->ready_watch = 0;
+  }
+
+  /* Lines can be routed to other files by either logger. */
+  if (service->use_routes && ! service->router) service->router = open_router(service->name, service->rotate_files, service->rotate_stdout_online == NSSM_ROTATE_ONLINE, service->rotate_seconds, service->rotate_delay, service->rotate_bytes_low, service->rotate_bytes_high);
+
+  /* Either logger can see the ready pattern. */
+  if (service->ready_pattern[0] && ! service->ready_watch) service->ready_watch = open_ready_watch(service->name, service->ready_pattern);
+
+  /*
+    Without a logger of its own stderr may be a copy of stdout's pipe.  It is
+    opened again for every run so close it now, otherwise a stdout logger
+    which can't be reused won't see the end of its pipe.
+  */
+  if (! service->stderr_thread) close_handle(&service->stderr_si);
+
+  logger_settings_t settings;
+  if (service->stdout_path[0]) {
+    get_logger_settings(service, service->stdout_sharing, service->stdout_disposition, service->stdout_flags, service->stdout_copy_and_truncate, &settings);
+    if (! reuse_logger(service->stdout_thread, service->stdout_logger_path, service->stdout_path, service->use_stdout_pipe, &service->stdout_logger_settings, &settings)) {
+      cleanup_logger(&service->stdout_thread, &service->stdout_si, &service->stdout_pipe, &service->stdout_logger_path);
+      if (service->rotate_files) rotate_file(service->name, service->stdout_path, service->rotate_seconds, service->rotate_delay, service->rotate_bytes_low, service->rotate_bytes_high, service->stdout_copy_and_truncate);
+    }
+  }
+
+  if (service->stderr_path[0]) {
+    if (str_equiv(service->stderr_path, service->stdout_path)) cleanup_logger(&service->stderr_thread, &service->stderr_si, &service->stderr_pipe, &service->stderr_logger_path);
+    else {
+      get_logger_settings(service, service->stderr_sharing, service->stderr_disposition, service->stderr_flags, service->stderr_copy_and_truncate, &settings);
+      if (! reuse_logger(service->stderr_thread, service->stderr_logger_path, service->stderr_path, service->use_stderr_pipe, &service->stderr_logger_settings, &settings)) {
+        cleanup_logger(&service->stderr_thread, &service->stderr_si, &service->stderr_pipe, &service->stderr_logger_path);
+        if (service->rotate_files) rotate_file(service->name, service->stderr_path, service->rotate_seconds, service->rotate_delay, service->rotate_bytes_low, service->rotate_bytes_high, service->stderr_copy_and_truncate);
+      }
+    }
+  }
+}
+
+/*
+  Set up the standard handles of the application.  Called after
+  prepare_output_handles() so a logger which can't be reused has already
+  been closed and its file rotated.
+*/
 int get_output_handles(nssm_service_t *service, STARTUPINFO *si) {
   if (! si) return 1;
   bool inherit_handles = false;
@@ -318,23 +604,35 @@ int get_output_handles(nssm_service_t *service, STARTUPINFO *si) {
       return 2;
     }
 
-    inherit_handles = true;
+    inherit_handles = true;
   }
 
   /* stdout */
-  if (service->stdout_path[0]) {
-    if (service->rotate_files) rotate_file(service->name, service->stdout_path, service->rotate_seconds, service->rotate_bytes_low, service->rotate_bytes_high, service->rotate_delay, service->stdout_copy_and_truncate);
+  logger_settings_t settings;
+  get_logger_settings(service, service->stdout_sharing, service->stdout_disposition, service->stdout_flags, service->stdout_copy_and_truncate, &settings);
+  if (service->stdout_path[0] && reuse_logger(service->stdout_thread, service->stdout_logger_path, service->stdout_path, service->use_stdout_pipe, &service->stdout_logger_settings, &settings)) {
+    InterlockedExchange(&service->stdout_new_run, 1);
+    if (service->rotate_files) rotate_logger(service, service->stdout_path, &service->rotate_stdout_online);
+  }
+  else if (service->stdout_path[0]) {
+    /* Only a logger which exited since prepare_output_handles() is left. */
+    cleanup_logger(&service->stdout_thread, &service->stdout_si, &service->stdout_pipe, &service->stdout_logger_path);
     HANDLE stdout_handle = write_to_file(service->stdout_path, service->stdout_sharing, 0, service->stdout_disposition, service->stdout_flags);
     if (stdout_handle == INVALID_HANDLE_VALUE) return 4;
     service->stdout_si = 0;
 
     if (service->use_stdout_pipe) {
       service->stdout_pipe = si->hStdOutput = 0;
-      service->stdout_thread = create_logging_thread(service->name, service->stdout_path, service->stdout_sharing, service->stdout_disposition, service->stdout_flags, &service->stdout_pipe, &service->stdout_si, &stdout_handle, service->rotate_bytes_low, service->rotate_bytes_high, service->rotate_delay, &service->stdout_tid, &service->rotate_stdout_online, service->timestamp_log, service->stdout_copy_and_truncate);
+      service->stdout_new_run = 0;
+      service->stdout_thread = create_logging_thread(service->name, service->stdout_path, service->stdout_sharing, service->stdout_disposition, service->stdout_flags, &service->stdout_pipe, &service->stdout_si, &stdout_handle, service->rotate_bytes_low, service->rotate_bytes_high, service->rotate_delay, &service->stdout_tid, &service->rotate_stdout_online, &service->stdout_new_run, service->timestamp_log, service->timestamp_group ? service->timestamp_group_bytes : 0, service->strip_ansi, service->stdout_copy_and_truncate, service->router, service->ready_watch, service->stats ? &service->stats->streams[NSSM_STATS_STDOUT] : 0);
       if (! service->stdout_thread) {
         CloseHandle(service->stdout_pipe);
         CloseHandle(service->stdout_si);
       }
+      else {
+        service->stdout_logger_path = copy_path(service->stdout_path);
+        service->stdout_logger_settings = settings;
+      }
     }
     else service->stdout_thread = 0;
 
@@ -342,13 +640,16 @@ int get_output_handles(nssm_service_t *service, STARTUPINFO *si) {
       if (dup_handle(stdout_handle, &service->stdout_si, NSSM_REG_STDOUT, _T("stdout"), DUPLICATE_CLOSE_SOURCE | DUPLICATE_SAME_ACCESS)) return 4;
       service->rotate_stdout_online = NSSM_ROTATE_OFFLINE;
     }
+  }
 
+  if (service->stdout_path[0]) {
     if (dup_handle(service->stdout_si, &si->hStdOutput, _T("stdout_si"), _T("stdout"))) close_handle(&service->stdout_thread);
 
     inherit_handles = true;
   }
 
   /* stderr */
+  get_logger_settings(service, service->stderr_sharing, service->stderr_disposition, service->stderr_flags, service->stderr_copy_and_truncate, &settings);
   if (service->stderr_path[0]) {
     /* Same as stdout? */
     if (str_equiv(service->stderr_path, service->stdout_path)) {
@@ -359,21 +660,31 @@ int get_output_handles(nssm_service_t *service, STARTUPINFO *si) {
 
       /* Two handles to the same file will create a race. */
       /* XXX: Here we assume that either both or neither handle must be a pipe. */
+      cleanup_logger(&service->stderr_thread, &service->stderr_si, &service->stderr_pipe, &service->stderr_logger_path);
       if (dup_handle(service->stdout_si, &service->stderr_si, _T("stdout"), _T("stderr"))) return 6;
     }
+    else if (reuse_logger(service->stderr_thread, service->stderr_logger_path, service->stderr_path, service->use_stderr_pipe, &service->stderr_logger_settings, &settings)) {
+      InterlockedExchange(&service->stderr_new_run, 1);
+      if (service->rotate_files) rotate_logger(service, service->stderr_path, &service->rotate_stderr_online);
+    }
     else {
-      if (service->rotate_files) rotate_file(service->name, service->stderr_path, service->rotate_seconds, service->rotate_bytes_low, service->rotate_bytes_high, service->rotate_delay, service->stderr_copy_and_truncate);
+      cleanup_logger(&service->stderr_thread, &service->stderr_si, &service->stderr_pipe, &service->stderr_logger_path);
       HANDLE stderr_handle = write_to_file(service->stderr_path, service->stderr_sharing, 0, service->stderr_disposition, service->stderr_flags);
       if (stderr_handle == INVALID_HANDLE_VALUE) return 7;
       service->stderr_si = 0;
 
       if (service->use_stderr_pipe) {
         service->stderr_pipe = si->hStdError = 0;
-        service->stderr_thread = create_logging_thread(service->name, service->stderr_path, service->stderr_sharing, service->stderr_disposition, service->stderr_flags, &service->stderr_pipe, &service->stderr_si, &stderr_handle, service->rotate_bytes_low, service->rotate_bytes_high, service->rotate_delay, &service->stderr_tid, &service->rotate_stderr_online, service->timestamp_log, service->stderr_copy_and_truncate);
+        service->stderr_new_run = 0;
+        service->stderr_thread = create_logging_thread(service->name, service->stderr_path, service->stderr_sharing, service->stderr_disposition, service->stderr_flags, &service->stderr_pipe, &service->stderr_si, &stderr_handle, service->rotate_bytes_low, service->rotate_bytes_high, service->rotate_delay, &service->stderr_tid, &service->rotate_stderr_online, &service->stderr_new_run, service->timestamp_log, service->timestamp_group ? service->timestamp_group_bytes : 0, service->strip_ansi, service->stderr_copy_and_truncate, service->router, service->ready_watch, service->stats ? &service->stats->streams[NSSM_STATS_STDERR] : 0);
         if (! service->stderr_thread) {
           CloseHandle(service->stderr_pipe);
           CloseHandle(service->stderr_si);
         }
+        else {
+          service->stderr_logger_path = copy_path(service->stderr_path);
+          service->stderr_logger_settings = settings;
+        }
       }
       else service->stderr_thread = 0;
 
@@ -426,22 +737,31 @@ void close_output_handles(STARTUPINFO *si) {
   if (si->hStdError) CloseHandle(si->hStdError);
 }
 
-void cleanup_loggers(nssm_service_t *service) {
-  unsigned long interval = NSSM_CLEANUP_LOGGERS_DEADLINE;
-  HANDLE thread_handle = INVALID_HANDLE_VALUE;
+/*
+  Called when the application exits but will be restarted.  Logging threads
+  are left running but handles to plain files must be closed so the files can
+  be rotated before the next run.
+*/
+void detach_loggers(nssm_service_t *service) {
+  if (! service->stdout_thread) close_handle(&service->stdout_si);
+  if (! service->stderr_thread) close_handle(&service->stderr_si);
+}
 
-  close_handle(&service->stdout_thread, &thread_handle);
-  /* Close write end of the data pipe so logging thread can finalise read. */
+void cleanup_loggers(nssm_service_t *service) {
+  service->rotate_stdout_online = service->rotate_stderr_online = NSSM_ROTATE_OFFLINE;
+  /* Close both write ends first as stderr may be a copy of stdout's pipe. */
   close_handle(&service->stdout_si);
-  /* Await logging thread then close read end. */
-  if (thread_handle != INVALID_HANDLE_VALUE) WaitForSingleObject(thread_handle, interval);
-  close_handle(&service->stdout_pipe);
-
-  thread_handle = INVALID_HANDLE_VALUE;
-  close_handle(&service->stderr_thread, &thread_handle);
   close_handle(&service->stderr_si);
-  if (thread_handle != INVALID_HANDLE_VALUE) WaitForSingleObject(thread_handle, interval);
-  close_handle(&service->stderr_pipe);
+  cleanup_logger(&service->stdout_thread, &service->stdout_si, &service->stdout_pipe, &service->stdout_logger_path);
+  cleanup_logger(&service->stderr_thread, &service->stderr_si, &service->stderr_pipe, &service->stderr_logger_path);
+  if (service->router) {
+    release_router(service->router);
+    service->router = 0;
+  }
+  if (service->ready_watch) {
+    release_ready_watch(service->ready_watch);
+    service->ready_watch = 0;
+  }
 }
 
 /*
@@ -465,7 +785,7 @@ static int try_read(logger_t *logger, void *address, unsigned long bufsize, unsi
 
       /* Couldn't lock the buffer. */
       case ERROR_NOT_ENOUGH_QUOTA:
-        Sleep(2000 + tries * 3000);
+        platform_sleep(2000 + tries * 3000);
         ret = 1;
         continue;
 
@@ -487,6 +807,46 @@ complain_read:
   return ret;
 }
 
+static void count_read(logger_t *logger, char *data, unsigned long in) {
+  if (! logger->stats) return;
+
+  unsigned long lines = 0;
+  char *end = data + in;
+  while ((data = (char *) memchr(data, '\n', end - data))) {
+    lines++;
+    data++;
+  }
+
+  begin_stats(logger->stats);
+  logger->stats->reads++;
+  logger->stats->bytes_read += in;
+  logger->stats->lines_read += lines;
+  end_stats(logger->stats);
+}
+
+static void count_write(logger_t *logger, unsigned __int64 start, unsigned long writes, unsigned long retries, unsigned long out, bool dropped) {
+  if (! logger->stats) return;
+
+  unsigned __int64 elapsed = stats_ticks() - start;
+  begin_stats(logger->stats);
+  logger->stats->writes += writes;
+  logger->stats->bytes_written += out;
+  logger->stats->write_ticks += elapsed;
+  logger->stats->retries += retries;
+  if (dropped) logger->stats->drops++;
+  end_stats(logger->stats);
+}
+
+static void count_rotation(logger_t *logger, unsigned __int64 start, bool rotated) {
+  if (! logger->stats) return;
+
+  unsigned __int64 elapsed = stats_ticks() - start;
+  begin_stats(logger->stats);
+  if (rotated) logger->stats->rotations++;
+  logger->stats->rotate_ticks += elapsed;
+  end_stats(logger->stats);
+}
+
 /*
   Try multiple times to write to a file.
   Returns:  0 on success.
@@ -496,12 +856,19 @@ complain_read:
 static int try_write(logger_t *logger, void *address, unsigned long bufsize, unsigned long *out, int *complained) {
   int ret = 1;
   unsigned long error;
-  for (int tries = 0; tries < 5; tries++) {
-    if (WriteFile(logger->write_handle, address, bufsize, out, 0)) return 0;
+  unsigned long retries = 0;
+  unsigned __int64 start = logger->stats ? stats_ticks() : 0;
+  int tries;
+  for (tries = 0; tries < 5; tries++) {
+    if (WriteFile(logger->write_handle, address, bufsize, out, 0)) {
+      count_write(logger, start, tries + 1, retries, *out, false);
+      return 0;
+    }
 
     error = GetLastError();
     if (error == ERROR_IO_PENDING) {
       /* Operation was successful pending flush to disk. */
+      count_write(logger, start, tries + 1, retries, *out, false);
       return 0;
     }
 
@@ -515,7 +882,8 @@ static int try_write(logger_t *logger, void *address, unsigned long bufsize, uns
       case ERROR_NOT_ENOUGH_QUOTA:
       /* Out of disk space. */
       case ERROR_DISK_FULL:
-        Sleep(2000 + tries * 3000);
+        retries++;
+        platform_sleep(2000 + tries * 3000);
         ret = 1;
         continue;
 
@@ -526,30 +894,125 @@ static int try_write(logger_t *logger, void *address, unsigned long bufsize, uns
   }
 
 complain_write:
+  count_write(logger, start, tries < 5 ? tries + 1 : tries, retries, 0, true);
   if (! (*complained & COMPLAINED_WRITE)) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_WRITEFILE_FAILED, logger->service_name, logger->path, error_string(error), 0);
   *complained |= COMPLAINED_WRITE;
   return ret;
 }
 
+static inline void format_timestamp(char *timestamp, size_t len) {
+  SYSTEMTIME now;
+  GetSystemTime(&now);
+  _snprintf_s(timestamp, len, _TRUNCATE, TIMESTAMP_FORMAT, now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond, now.wMilliseconds);
+}
+
 /* Note that the timestamp is created in UTF-8. */
 static inline int write_timestamp(logger_t *logger, unsigned long charsize, unsigned long *out, int *complained) {
   char timestamp[TIMESTAMP_LEN + 1];
-
-  SYSTEMTIME now;
-  GetSystemTime(&now);
-  _snprintf_s(timestamp, _countof(timestamp), _TRUNCATE, TIMESTAMP_FORMAT, now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond, now.wMilliseconds);
+  format_timestamp(timestamp, _countof(timestamp));
 
   if (charsize == sizeof(char)) return try_write(logger, (void *) timestamp, TIMESTAMP_LEN, out, complained);
 
   wchar_t *utf16;
   unsigned long utf16len;
   if (to_utf16(timestamp, &utf16, &utf16len)) return -1;
-  int ret = try_write(logger, (void *) *utf16, utf16len * sizeof(wchar_t), out, complained);
+  int ret = try_write(logger, (void *) utf16, utf16len * sizeof(wchar_t), out, complained);
   HeapFree(GetProcessHeap(), 0, utf16);
   return ret;
 }
 
+/* Lines starting with whitespace or one of these continue the previous record. */
+static const char *continuation_prefixes[] = { "at ", "Caused by:", 0 };
+
+/*
+  Check whether the start of a line continues the previous record, as do
+  the lines of a Java or .NET stack trace.
+  Returns:  1 if the line continues the record.
+            0 if the line starts a new record.
+           -1 if more of the line is needed to decide.
+*/
+static int is_continuation(const char *line, unsigned long len) {
+  if (! len) return -1;
+  if (line[0] == ' ' || line[0] == '\t') return 1;
+
+  int ret = 0;
+  for (int i = 0; continuation_prefixes[i]; i++) {
+    const char *prefix = continuation_prefixes[i];
+    unsigned long j;
+    for (j = 0; j < len && prefix[j]; j++) if (line[j] != prefix[j]) break;
+    if (! prefix[j]) return 1;
+    if (j == len) ret = -1;
+  }
+
+  return ret;
+}
+
+/* Write the start of a line held back by write_grouped(). */
+static int write_line_start(logger_t *logger, unsigned long *out, int *complained) {
+  unsigned long written;
+  int ret;
+
+  /* Start a new record if the line isn't a continuation or the record is too big. */
+  if (is_continuation(logger->line_start, logger->line_start_len) != 1 || logger->record_length < 0LL || logger->record_length >= (__int64) logger->group_bytes) {
+    written = 0;
+    ret = write_timestamp(logger, sizeof(char), &written, complained);
+    *out += written;
+    if (ret < 0) return ret;
+    logger->record_length = 0LL;
+  }
+
+  written = 0;
+  ret = try_write(logger, logger->line_start, logger->line_start_len, &written, complained);
+  *out += written;
+  logger->record_length += (__int64) logger->line_start_len;
+  logger->line_start_len = 0;
+  return ret;
+}
+
+/*
+  Write 8-bit output with one timestamp per record rather than per line.
+  The start of each line is held back until we can tell whether it needs
+  a timestamp, so lines may be split across reads.
+*/
+static int write_grouped(logger_t *logger, char *data, unsigned long bufsize, unsigned long *out, int *complained) {
+  unsigned long written;
+  unsigned long i = 0;
+  int ret = 0;
+
+  while (i < bufsize) {
+    if (! logger->line_decided) {
+      char c = data[i++];
+      logger->line_start[logger->line_start_len++] = c;
+      int continued = is_continuation(logger->line_start, logger->line_start_len);
+      if (continued < 0 && c != '\n' && logger->line_start_len < sizeof(logger->line_start)) continue;
+
+      ret = write_line_start(logger, out, complained);
+      if (ret < 0) return ret;
+      if (c != '\n') logger->line_decided = true;
+      continue;
+    }
+
+    /* Write through to the end of the line. */
+    unsigned long len = bufsize - i;
+    char *newline = (char *) memchr(data + i, '\n', len);
+    if (newline) {
+      len = (unsigned long) (newline - (data + i)) + 1;
+      logger->line_decided = false;
+    }
+
+    written = 0;
+    ret = try_write(logger, data + i, len, &written, complained);
+    *out += written;
+    logger->record_length += (__int64) len;
+    i += len;
+  }
+
+  return ret;
+}
+
 static int write_with_timestamp(logger_t *logger, void *address, unsigned long bufsize, unsigned long *out, int *complained, unsigned long charsize) {
+  if (logger->timestamp_log && logger->group_bytes && charsize == sizeof(char)) return write_grouped(logger, (char *) address, bufsize, out, complained);
+
   if (logger->timestamp_log) {
     unsigned long log_out;
     int log_complained;
@@ -565,7 +1028,7 @@ static int write_with_timestamp(logger_t *logger, void *address, unsigned long b
     unsigned long i;
     void *line = address;
     unsigned long offset = 0;
-    int ret;
+    int ret = 0;
     for (i = 0; i < bufsize; i++) {
       if (((char *) address)[i] == '\n') {
         ret = try_write(logger, line, i - offset + 1, &log_out, &log_complained);
@@ -594,17 +1057,274 @@ static int write_with_timestamp(logger_t *logger, void *address, unsigned long b
   else return try_write(logger, address, bufsize, out, complained);
 }
 
+/*
+  Write data to the log file, rotating it first if necessary.
+  Returns: 0 on success.
+           3 if the data could not be written.
+           4 if the file could not be reopened after rotation.
+*/
+static int log_data(logger_t *logger, void *address, unsigned long in, __int64 *size, unsigned long *charsize, int *complained) {
+  unsigned long out = 0;
+  int ret;
+
+  if (*logger->rotate_online == NSSM_ROTATE_ONLINE_ASAP || (logger->size && *size + (__int64) in >= logger->size)) {
+    /* Look for newline. */
+    unsigned long i;
+    for (i = 0; i < in; i++) {
+      if (((char *) address)[i] == '\n') {
+        if (! *charsize) *charsize = guess_charsize(address, in);
+        i += *charsize;
+
+        /* Write up to the newline. */
+        ret = write_with_timestamp(logger, address, i, &out, complained, *charsize);
+        if (ret < 0) return 3;
+        *size += (__int64) out;
+
+        /* Rotate. */
+        *logger->rotate_online = NSSM_ROTATE_ONLINE;
+        /* The new file starts with a new record. */
+        logger->record_length = -1LL;
+        unsigned __int64 start = logger->stats ? stats_ticks() : 0;
+        ret = rotate_open_file(logger->service_name, logger->path, &logger->write_handle, logger->sharing, &logger->disposition, logger->flags, logger->copy_and_truncate, logger->rotate_delay, complained);
+        count_rotation(logger, start, ! ret);
+        /* Oh dear.  Now we can't log anything further. */
+        if (ret < 0) return 4;
+        if (! ret) *size = 0LL;
+
+        /* Resume writing after the newline. */
+        address = (void *) ((char *) address + i);
+        in -= i;
+        break;
+      }
+    }
+  }
+
+  if (! *size || logger->timestamp_log) if (! *charsize) *charsize = guess_charsize(address, in);
+  if (! *size) {
+    /* Write a BOM to the new file. */
+    out = 0;
+    if (*charsize == sizeof(wchar_t)) write_bom(logger, &out);
+    *size += (__int64) out;
+  }
+
+  /* Write the data, if any. */
+  if (! in) return 0;
+
+  out = 0;
+  ret = write_with_timestamp(logger, address, in, &out, complained, *charsize);
+  *size += (__int64) out;
+  if (ret < 0) return 3;
+
+  return 0;
+}
+
+/* Send a complete line to matching routes and, unless moved, to the log. */
+static int route_and_log_line(logger_t *logger, char *line, unsigned long len, __int64 *size, unsigned long *charsize, int *complained) {
+  char timestamp[TIMESTAMP_LEN + 1];
+  char *prefix = 0;
+  if (logger->timestamp_log && ! (logger->group_bytes && is_continuation(line, len) == 1)) {
+    format_timestamp(timestamp, _countof(timestamp));
+    prefix = timestamp;
+  }
+
+  if (route_line(logger->router, logger->route_scratch, logger->routed, line, len, prefix, prefix ? TIMESTAMP_LEN : 0)) return 0;
+  return log_data(logger, line, len, size, charsize, complained);
+}
+
+static int flush_route_buffer(logger_t *logger, __int64 *size, unsigned long *charsize, int *complained) {
+  unsigned long len = logger->route_buffered;
+  if (! len) return 0;
+  logger->route_buffered = 0;
+  return route_and_log_line(logger, logger->route_buffer, len, size, charsize, complained);
+}
+
+/*
+  Write out a partial line held back at the end of a run, so the last words
+  of an application which crashed aren't lost and the next run doesn't
+  carry on from them.  The next run starts a new record.
+*/
+static int flush_logger(logger_t *logger, __int64 *size, unsigned long *charsize, int *complained) {
+  int ret = 0;
+  if (logger->router) ret = flush_route_buffer(logger, size, charsize, complained);
+
+  if (logger->line_start_len) {
+    unsigned long out = 0;
+    int written = write_line_start(logger, &out, complained);
+    *size += (__int64) out;
+    if (written < 0 && ! ret) ret = 3;
+  }
+
+  logger->line_decided = false;
+  logger->record_length = -1LL;
+  logger->line_length = 0LL;
+  logger->ansi_state = ANSI_STATE_TEXT;
+  return ret;
+}
+
+/*
+  Routing needs whole lines so partial lines are buffered until the rest
+  arrives.  A line which doesn't fit in the buffer is routed in pieces.
+*/
+static int route_data(logger_t *logger, char *data, unsigned long in, __int64 *size, unsigned long *charsize, int *complained) {
+  if (! *charsize) *charsize = guess_charsize(data, in);
+  /* We only route 8-bit output. */
+  if (*charsize != sizeof(char)) {
+    int ret = flush_route_buffer(logger, size, charsize, complained);
+    if (ret) return ret;
+    return log_data(logger, data, in, size, charsize, complained);
+  }
+
+  unsigned long i, start = 0;
+  int ret;
+  for (i = 0; i <= in; i++) {
+    bool complete = (i < in && data[i] == '\n');
+    if (! complete && i < in) continue;
+
+    unsigned long len = i - start;
+    if (complete) len++;
+
+    /* Route straight from the read buffer if nothing is pending. */
+    if (complete && ! logger->route_buffered) {
+      ret = route_and_log_line(logger, data + start, len, size, charsize, complained);
+      if (ret) return ret;
+      start = i + 1;
+      continue;
+    }
+
+    while (len) {
+      unsigned long n = NSSM_ROUTE_LINE_LENGTH - logger->route_buffered;
+      if (n > len) n = len;
+      memmove(logger->route_buffer + logger->route_buffered, data + start, n);
+      logger->route_buffered += n;
+      start += n;
+      len -= n;
+      if (logger->route_buffered == NSSM_ROUTE_LINE_LENGTH) {
+        ret = flush_route_buffer(logger, size, charsize, complained);
+        if (ret) return ret;
+      }
+    }
+
+    if (complete) {
+      ret = flush_route_buffer(logger, size, charsize, complained);
+      if (ret) return ret;
+    }
+  }
+
+  return 0;
+}
+
+/*
+  Remove ANSI/VT escape sequences from 8-bit output in place: CSI sequences
+  such as colour codes, OSC and other string sequences terminated by BEL or
+  ST, and two-character escapes.  The state is kept in the logger so that
+  sequences split across reads are removed too.
+  Returns the length of the remaining data.
+*/
+static unsigned long strip_ansi(logger_t *logger, char *data, unsigned long len) {
+  /* Most output has no escapes at all so don't touch it. */
+  if (logger->ansi_state == ANSI_STATE_TEXT) {
+    char *escape = (char *) memchr(data, ANSI_ESC, len);
+    if (! escape) return len;
+  }
+
+  unsigned long i, out = 0;
+  unsigned long state = logger->ansi_state;
+  for (i = 0; i < len; i++) {
+    unsigned char c = (unsigned char) data[i];
+    switch (state) {
+      case ANSI_STATE_TEXT:
+        if (c == ANSI_ESC) state = ANSI_STATE_ESCAPE;
+        else data[out++] = (char) c;
+        break;
+
+      case ANSI_STATE_ESCAPE:
+        if (c == '[') state = ANSI_STATE_CSI;
+        /* OSC, DCS, SOS, PM and APC are all terminated by BEL or ST. */
+        else if (c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_') state = ANSI_STATE_STRING;
+        else if (c >= 0x20 && c <= 0x2f) state = ANSI_STATE_INTERMEDIATE;
+        else if (c == ANSI_ESC) state = ANSI_STATE_ESCAPE;
+        else {
+          /* A lone ESC before a control byte such as a newline.  Keep the byte. */
+          state = ANSI_STATE_TEXT;
+          if (c < 0x20) data[out++] = (char) c;
+        }
+        break;
+
+      case ANSI_STATE_INTERMEDIATE:
+        if (c == ANSI_ESC) state = ANSI_STATE_ESCAPE;
+        else if (c < 0x20) {
+          /* Malformed.  Keep the control byte as for CSI. */
+          state = ANSI_STATE_TEXT;
+          data[out++] = (char) c;
+        }
+        else if (c > 0x2f) state = ANSI_STATE_TEXT;
+        break;
+
+      case ANSI_STATE_CSI:
+        /* Parameter and intermediate bytes until the final byte. */
+        if (c >= 0x40 && c <= 0x7e) state = ANSI_STATE_TEXT;
+        else if (c < 0x20 || c > 0x3f) {
+          /* Malformed.  Keep the byte rather than lose output. */
+          state = ANSI_STATE_TEXT;
+          if (c == ANSI_ESC) state = ANSI_STATE_ESCAPE;
+          else data[out++] = (char) c;
+        }
+        break;
+
+      case ANSI_STATE_STRING:
+        if (c == ANSI_BEL) state = ANSI_STATE_TEXT;
+        else if (c == ANSI_ESC) state = ANSI_STATE_STRING_ESCAPE;
+        /* Don't swallow the rest of the output if the terminator was lost. */
+        else if (c == '\n') {
+          state = ANSI_STATE_TEXT;
+          data[out++] = (char) c;
+        }
+        break;
+
+      case ANSI_STATE_STRING_ESCAPE:
+        if (c == '\\') state = ANSI_STATE_TEXT;
+        else if (c != ANSI_ESC) state = ANSI_STATE_STRING;
+        break;
+    }
+  }
+
+  logger->ansi_state = state;
+  return out;
+}
+
+/*
+  Look for the ready pattern while the supervisor is waiting for it.  A
+  partial line is tested too, so a prompt without a newline still counts.
+*/
+static void watch_ready_data(logger_t *logger, char *data, unsigned long len) {
+  if (! logger->ready_watch->armed) {
+    logger->ready_line_len = 0;
+    return;
+  }
+
+  for (unsigned long i = 0; i < len; i++) {
+    if (data[i] == '\n') {
+      if (logger->ready_line_len && logger->ready_line[logger->ready_line_len - 1] == '\r') logger->ready_line_len--;
+      watch_ready_line(logger->ready_watch, logger->ready_scratch, logger->ready_line, logger->ready_line_len);
+      logger->ready_line_len = 0;
+      if (! logger->ready_watch->armed) return;
+    }
+    else if (logger->ready_line_len < NSSM_READY_LINE_LENGTH) logger->ready_line[logger->ready_line_len++] = data[i];
+  }
+
+  if (logger->ready_line_len) watch_ready_line(logger->ready_watch, logger->ready_scratch, logger->ready_line, logger->ready_line_len);
+}
+
 /* Wrapper to be called in a new thread for logging. */
 unsigned long WINAPI log_and_rotate(void *arg) {
   logger_t *logger = (logger_t *) arg;
   if (! logger) return 1;
 
-  __int64 size;
+  __int64 size = 0LL;
   BY_HANDLE_FILE_INFORMATION info;
 
   /* Find initial file size. */
-  if (! GetFileInformationByHandle(logger->write_handle, &info)) logger->size = 0LL;
-  else {
+  if (GetFileInformationByHandle(logger->write_handle, &info)) {
     ULARGE_INTEGER l;
     l.HighPart = info.nFileSizeHigh;
     l.LowPart = info.nFileSizeLow;
@@ -613,9 +1333,8 @@ unsigned long WINAPI log_and_rotate(void *arg) {
 
   char buffer[1024];
   void *address;
-  unsigned long in, out;
+  unsigned long in;
   unsigned long charsize = 0;
-  unsigned long error;
   int ret;
   int complained = 0;
 
@@ -624,115 +1343,45 @@ unsigned long WINAPI log_and_rotate(void *arg) {
     address = &buffer;
     ret = try_read(logger, address, sizeof(buffer), &in, &complained);
     if (ret < 0) {
-      close_handle(&logger->read_handle);
-      close_handle(&logger->write_handle);
-      HeapFree(GetProcessHeap(), 0, logger);
+      (void) flush_logger(logger, &size, &charsize, &complained);
+      free_logger(logger);
       return 2;
     }
     else if (ret) continue;
 
-    if (*logger->rotate_online == NSSM_ROTATE_ONLINE_ASAP || (logger->size && size + (__int64) in >= logger->size)) {
-      /* Look for newline. */
-      unsigned long i;
-      for (i = 0; i < in; i++) {
-        if (buffer[i] == '\n') {
-          if (! charsize) charsize = guess_charsize(address, in);
-          i += charsize;
-
-          /* Write up to the newline. */
-          ret = try_write(logger, address, i, &out, &complained);
-          if (ret < 0) {
-            close_handle(&logger->read_handle);
-            close_handle(&logger->write_handle);
-            HeapFree(GetProcessHeap(), 0, logger);
-            return 3;
-          }
-          size += (__int64) out;
-
-          /* Rotate. */
-          *logger->rotate_online = NSSM_ROTATE_ONLINE;
-          TCHAR rotated[PATH_LENGTH];
-          rotated_filename(logger->path, rotated, _countof(rotated), 0);
-
-          /*
-            Ideally we'd try the rename first then close the handle but
-            MoveFile() will fail if the handle is still open so we must
-            risk losing everything.
-          */
-          if (logger->copy_and_truncate) FlushFileBuffers(logger->write_handle);
-          close_handle(&logger->write_handle);
-          bool ok = true;
-          TCHAR *function;
-          if (logger->copy_and_truncate) {
-            function = _T("CopyFile()");
-            if (CopyFile(logger->path, rotated, TRUE)) {
-              HANDLE file = write_to_file(logger->path, NSSM_STDOUT_SHARING, 0, NSSM_STDOUT_DISPOSITION, NSSM_STDOUT_FLAGS);
-              Sleep(logger->rotate_delay);
-              SetFilePointer(file, 0, 0, FILE_BEGIN);
-              SetEndOfFile(file);
-              CloseHandle(file);
-            }
-            else ok = false;
-          }
-          else {
-            function = _T("MoveFile()");
-            if (! MoveFile(logger->path, rotated)) ok = false;
-          }
-          if (ok) {
-            log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_ROTATED, logger->service_name, logger->path, rotated, 0);
-            size = 0LL;
-          }
-          else {
-            error = GetLastError();
-            if (error != ERROR_FILE_NOT_FOUND) {
-              if (! (complained & COMPLAINED_ROTATE)) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_ROTATE_FILE_FAILED, logger->service_name, logger->path, function, rotated, error_string(error), 0);
-              complained |= COMPLAINED_ROTATE;
-              /* We can at least try to re-open the existing file. */
-              logger->disposition = OPEN_ALWAYS;
-            }
-          }
-
-          /* Reopen. */
-          logger->write_handle = write_to_file(logger->path, logger->sharing, 0, logger->disposition, logger->flags);
-          if (logger->write_handle == INVALID_HANDLE_VALUE) {
-            error = GetLastError();
-            log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATEFILE_FAILED, logger->path, error_string(error), 0);
-            /* Oh dear.  Now we can't log anything further. */
-            close_handle(&logger->read_handle);
-            close_handle(&logger->write_handle);
-            HeapFree(GetProcessHeap(), 0, logger);
-            return 4;
-          }
-
-          /* Resume writing after the newline. */
-          address = (void *) ((char *) address + i);
-          in -= i;
-        }
+    /* The application was restarted since the last read. */
+    if (logger->new_run && InterlockedExchange(logger->new_run, 0)) {
+      ret = flush_logger(logger, &size, &charsize, &complained);
+      if (ret) {
+        free_logger(logger);
+        return ret;
       }
     }
 
-    if (! size || logger->timestamp_log) if (! charsize) charsize = guess_charsize(address, in);
-    if (! size) {
-      /* Write a BOM to the new file. */
-      if (charsize == sizeof(wchar_t)) write_bom(logger, &out);
-      size += (__int64) out;
+    count_read(logger, (char *) address, in);
+
+    if (logger->strip_ansi && in) {
+      if (! charsize) charsize = guess_charsize(address, in);
+      if (charsize == sizeof(char)) {
+        in = strip_ansi(logger, (char *) address, in);
+        if (! in) continue;
+      }
     }
 
-    /* Write the data, if any. */
-    if (! in) continue;
+    /* The pattern is only tested against 8-bit output. */
+    if (logger->ready_watch && in) {
+      if (! charsize) charsize = guess_charsize(address, in);
+      if (charsize == sizeof(char)) watch_ready_data(logger, (char *) address, in);
+    }
 
-    ret = write_with_timestamp(logger, address, in, &out, &complained, charsize);
-    size += (__int64) out;
-    if (ret < 0) {
-      close_handle(&logger->read_handle);
-      close_handle(&logger->write_handle);
-      HeapFree(GetProcessHeap(), 0, logger);
-      return 3;
+    if (logger->router) ret = route_data(logger, (char *) address, in, &size, &charsize, &complained);
+    else ret = log_data(logger, address, in, &size, &charsize, &complained);
+    if (ret) {
+      free_logger(logger);
+      return ret;
     }
   }
 
-  close_handle(&logger->read_handle);
-  close_handle(&logger->write_handle);
-  HeapFree(GetProcessHeap(), 0, logger);
+  free_logger(logger);
   return 0;
 }
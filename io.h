@@ -11,6 +11,13 @@
 #define NSSM_STDERR_DISPOSITION OPEN_ALWAYS
 #define NSSM_STDERR_FLAGS FILE_ATTRIBUTE_NORMAL
 
+#define COMPLAINED_READ (1 << 0)
+#define COMPLAINED_WRITE (1 << 1)
+#define COMPLAINED_ROTATE (1 << 2)
+
+/* Enough of the start of a line to decide whether it continues a record. */
+#define NSSM_TIMESTAMP_GROUP_PREFIX 16
+
 typedef struct {
   TCHAR *service_name;
   TCHAR *path;
@@ -22,10 +29,28 @@ typedef struct {
   __int64 size;
   unsigned long *tid_ptr;
   unsigned long *rotate_online;
+  volatile long *new_run;
   bool timestamp_log;
   __int64 line_length;
+  unsigned long group_bytes;
+  __int64 record_length;
+  char line_start[NSSM_TIMESTAMP_GROUP_PREFIX];
+  unsigned long line_start_len;
+  bool line_decided;
+  bool strip_ansi;
+  unsigned long ansi_state;
+  stream_stats_t *stats;
   bool copy_and_truncate;
   unsigned long rotate_delay;
+  router_t *router;
+  unsigned long *route_scratch;
+  bool *routed;
+  char *route_buffer;
+  unsigned long route_buffered;
+  ready_watch_t *ready_watch;
+  unsigned long *ready_scratch;
+  char *ready_line;
+  unsigned long ready_line_len;
 } logger_t;
 
 void close_handle(HANDLE *, HANDLE *);
@@ -34,10 +59,14 @@ int get_createfile_parameters(HKEY, TCHAR *, TCHAR *, unsigned long *, unsigned
 int set_createfile_parameter(HKEY, TCHAR *, TCHAR *, unsigned long);
 int delete_createfile_parameter(HKEY, TCHAR *, TCHAR *);
 HANDLE write_to_file(TCHAR *, unsigned long, SECURITY_ATTRIBUTES *, unsigned long, unsigned long);
+TCHAR *copy_path(TCHAR *);
 void rotate_file(TCHAR *, TCHAR *, unsigned long, unsigned long, unsigned long, unsigned long, bool);
+int rotate_open_file(TCHAR *, TCHAR *, HANDLE *, unsigned long, unsigned long *, unsigned long, bool, unsigned long, int *);
+void prepare_output_handles(nssm_service_t *);
 int get_output_handles(nssm_service_t *, STARTUPINFO *);
 int use_output_handles(nssm_service_t *, STARTUPINFO *);
 void close_output_handles(STARTUPINFO *);
+void detach_loggers(nssm_service_t *);
 void cleanup_loggers(nssm_service_t *);
 unsigned long WINAPI log_and_rotate(void *);
 
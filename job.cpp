@@ -0,0 +1,130 @@
+#include "nssm.h"
+
+extern hook_thread_t hook_threads;
+
+/* One completion port and thread serve the jobs of every hosted service. */
+static HANDLE volatile job_port;
+
+/* Indexed by the result of platform_limit(). */
+static const TCHAR *job_steps[] = { _T(""), _T("CreateJobObject()"), _T("SetInformationJobObject()"), _T("SetInformationJobObject(JobObjectCpuRateControlInformation)"), _T("AssignProcessToJobObject()") };
+
+bool has_limits(nssm_service_t *service) {
+  return (service->memory_limit || service->cpu_rate_limit || service->process_limit || service->max_working_set);
+}
+
+/* Log and run the Limit hook the first time a limit is hit in each run. */
+static void limit_breached(nssm_service_t *service, long *breached, unsigned long limit, TCHAR *hook_action, unsigned long event) {
+  if (InterlockedExchange(breached, 1)) return;
+
+  TCHAR number[16];
+  _sntprintf_s(number, _countof(number), _TRUNCATE, _T("%lu"), limit);
+  log_event(EVENTLOG_WARNING_TYPE, event, service->name, number, 0);
+  (void) nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_LIMIT, hook_action, 0, NSSM_HOOK_DEADLINE, true);
+}
+
+static unsigned long WINAPI monitor_jobs(void *arg) {
+  unsigned long message;
+  ULONG_PTR key;
+  OVERLAPPED *overlapped;
+
+  while (GetQueuedCompletionStatus(job_port, &message, &key, &overlapped, INFINITE)) {
+    /* Services live as long as the process. */
+    nssm_service_t *service = (nssm_service_t *) key;
+    if (! service || ! service->job) continue;
+
+    switch (message) {
+      case JOB_OBJECT_MSG_JOB_MEMORY_LIMIT:
+        limit_breached(service, &service->memory_limit_breached, service->memory_limit, NSSM_HOOK_ACTION_MEMORY, NSSM_EVENT_JOB_MEMORY_LIMIT);
+        break;
+
+      case JOB_OBJECT_MSG_ACTIVE_PROCESS_LIMIT:
+        limit_breached(service, &service->process_limit_breached, service->process_limit, NSSM_HOOK_ACTION_PROCESSES, NSSM_EVENT_JOB_PROCESS_LIMIT);
+        break;
+    }
+  }
+
+  return 0;
+}
+
+static HANDLE get_job_port(const TCHAR *service_name) {
+  if (job_port) return job_port;
+
+  HANDLE port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 1);
+  if (! port) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_JOB_FAILED, service_name, _T("CreateIoCompletionPort()"), error_string(GetLastError()), 0);
+    return 0;
+  }
+
+  /* Another service got there first. */
+  if (InterlockedCompareExchangePointer((void * volatile *) &job_port, port, 0)) {
+    CloseHandle(port);
+    return job_port;
+  }
+
+  HANDLE thread = CreateThread(0, 0, monitor_jobs, 0, 0, 0);
+  if (thread) CloseHandle(thread);
+  else log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_CREATETHREAD_FAILED, error_string(GetLastError()), 0);
+
+  return job_port;
+}
+
+/* Sizes are configured in megabytes. */
+static void get_limits(nssm_service_t *service, platform_limits_t *limits) {
+  ZeroMemory(limits, sizeof(*limits));
+  limits->memory = (platform_u64_t) service->memory_limit << 20;
+  limits->cpu_rate = service->cpu_rate_limit * 100;
+  limits->processes = service->process_limit;
+  if (service->max_working_set) {
+    /* Windows needs both bounds. */
+    limits->min_working_set = (platform_u64_t) (service->min_working_set ? service->min_working_set : 1) << 20;
+    limits->max_working_set = (platform_u64_t) service->max_working_set << 20;
+  }
+}
+
+/*
+  Place the application, which must still be suspended, in a job object
+  with the service's limits.
+*/
+int open_job(nssm_service_t *service) {
+  platform_limits_t limits;
+  get_limits(service, &limits);
+
+  service->memory_limit_breached = service->process_limit_breached = 0;
+  int ret = platform_limit(service->process_handle, &limits, &service->job);
+  if (ret) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_JOB_FAILED, service->name, job_steps[ret], error_string(GetLastError()), 0);
+    return ret;
+  }
+
+  /* Limits are enforced even if we can't be told when they are hit. */
+  HANDLE port = get_job_port(service->name);
+  if (port) {
+    JOBOBJECT_ASSOCIATE_COMPLETION_PORT association;
+    association.CompletionKey = (void *) service;
+    association.CompletionPort = port;
+    if (! SetInformationJobObject(service->job, JobObjectAssociateCompletionPortInformation, &association, sizeof(association))) {
+      log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_JOB_FAILED, service->name, _T("SetInformationJobObject(JobObjectAssociateCompletionPortInformation)"), error_string(GetLastError()), 0);
+    }
+  }
+
+  return 0;
+}
+
+/*
+  Place a worker, which must still be suspended, in a job of its own with
+  the same limits.  The job isn't associated with the completion port so
+  the Limit hook only runs for instance 0.
+*/
+int open_worker_job(nssm_service_t *service, HANDLE process_handle, HANDLE *job) {
+  platform_limits_t limits;
+  get_limits(service, &limits);
+
+  int ret = platform_limit(process_handle, &limits, job);
+  if (ret) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_JOB_FAILED, service->name, job_steps[ret], error_string(GetLastError()), 0);
+  return ret;
+}
+
+/* Closing the job doesn't kill any processes left in it. */
+void close_job(nssm_service_t *service) {
+  platform_close_job(&service->job);
+}
@@ -0,0 +1,9 @@
+#ifndef JOB_H
+#define JOB_H
+
+bool has_limits(nssm_service_t *);
+int open_job(nssm_service_t *);
+int open_worker_job(nssm_service_t *, HANDLE, HANDLE *);
+void close_job(nssm_service_t *);
+
+#endif
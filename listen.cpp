@@ -0,0 +1,180 @@
+#include "nssm.h"
+#include <ws2tcpip.h>
+
+/*
+  Split the next endpoint from a list, advancing the list pointer.  The
+  address is empty if only a port was given.
+  Returns: 0 if an endpoint was found.
+           1 if the list is empty.
+           2 if the endpoint is invalid.
+*/
+static int next_endpoint(const TCHAR **list, TCHAR *address, TCHAR *port) {
+  const TCHAR *s = *list;
+  s += _tcsspn(s, NSSM_LISTEN_SEPARATORS);
+  if (! *s) return 1;
+
+  size_t len = _tcscspn(s, NSSM_LISTEN_SEPARATORS);
+  *list = s + len;
+  if (len >= NSSM_LISTEN_ENDPOINT_LENGTH) return 2;
+
+  TCHAR endpoint[NSSM_LISTEN_ENDPOINT_LENGTH];
+  memmove(endpoint, s, len * sizeof(TCHAR));
+  endpoint[len] = _T('\0');
+
+  /* [address]:port, address:port or port. */
+  TCHAR *colon;
+  address[0] = _T('\0');
+  if (endpoint[0] == _T('[')) {
+    TCHAR *close = _tcschr(endpoint, _T(']'));
+    if (! close || close[1] != _T(':')) return 2;
+    *close = _T('\0');
+    _tcsncpy_s(address, NSSM_LISTEN_ENDPOINT_LENGTH, endpoint + 1, _TRUNCATE);
+    colon = close + 1;
+  }
+  else {
+    colon = _tcsrchr(endpoint, _T(':'));
+    if (colon) {
+      *colon = _T('\0');
+      _tcsncpy_s(address, NSSM_LISTEN_ENDPOINT_LENGTH, endpoint, _TRUNCATE);
+    }
+  }
+  _tcsncpy_s(port, NSSM_LISTEN_ENDPOINT_LENGTH, colon ? colon + 1 : endpoint, _TRUNCATE);
+
+  /* Port must be a number between 1 and 65535. */
+  if (! port[0] || port[_tcsspn(port, _T("0123456789"))]) return 2;
+  unsigned long number = _tcstoul(port, 0, 10);
+  if (! number || number > 65535) return 2;
+  if (colon && ! address[0]) return 2;
+
+  return 0;
+}
+
+/*
+  Check an AppListen string, optionally counting its endpoints.
+  Returns: 0 if it is valid.
+           1 if it isn't.
+*/
+int parse_listen(const TCHAR *spec, unsigned long *count) {
+  TCHAR address[NSSM_LISTEN_ENDPOINT_LENGTH], port[NSSM_LISTEN_ENDPOINT_LENGTH];
+  unsigned long n = 0;
+  int ret;
+  while (! (ret = next_endpoint(&spec, address, port))) n++;
+  if (ret != 1 || ! n) return 1;
+  if (count) *count = n;
+  return 0;
+}
+
+static SOCKET open_listen_socket(const TCHAR *service_name, const TCHAR *address, const TCHAR *port) {
+  ADDRINFOT hints, *info;
+  ZeroMemory(&hints, sizeof(hints));
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+  hints.ai_family = address[0] ? AF_UNSPEC : AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  int error = GetAddrInfo(address[0] ? address : 0, port, &hints, &info);
+  if (error) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_LISTEN_FAILED, service_name, address, port, _T("GetAddrInfo()"), error_string(error), 0);
+    return INVALID_SOCKET;
+  }
+
+  SOCKET s = open_socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+  if (s == INVALID_SOCKET) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_LISTEN_FAILED, service_name, address, port, _T("socket()"), error_string(WSAGetLastError()), 0);
+    FreeAddrInfo(info);
+    return INVALID_SOCKET;
+  }
+
+  /* Don't let another process steal the port while the application restarts. */
+  int exclusive = 1;
+  setsockopt(s, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char *) &exclusive, sizeof(exclusive));
+
+  if (bind(s, info->ai_addr, (int) info->ai_addrlen) == SOCKET_ERROR) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_LISTEN_FAILED, service_name, address, port, _T("bind()"), error_string(WSAGetLastError()), 0);
+    closesocket(s);
+    FreeAddrInfo(info);
+    return INVALID_SOCKET;
+  }
+  FreeAddrInfo(info);
+
+  if (listen(s, SOMAXCONN) == SOCKET_ERROR) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_LISTEN_FAILED, service_name, address, port, _T("listen()"), error_string(WSAGetLastError()), 0);
+    closesocket(s);
+    return INVALID_SOCKET;
+  }
+
+  return s;
+}
+
+/*
+  Open every socket in an AppListen string.
+  Returns NULL if any of them couldn't be opened.
+*/
+listen_sockets_t *open_listen_sockets(const TCHAR *service_name, const TCHAR *spec) {
+  unsigned long count;
+  if (parse_listen(spec, &count)) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_BOGUS_LISTEN, service_name, spec, 0);
+    return 0;
+  }
+
+  if (start_winsock()) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_WSASTARTUP_FAILED, service_name, error_string(WSAGetLastError()), 0);
+    return 0;
+  }
+
+  listen_sockets_t *listeners = (listen_sockets_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(listen_sockets_t));
+  if (! listeners) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("listen sockets"), _T("open_listen_sockets()"), 0);
+    return 0;
+  }
+
+  /* Each handle needs at most 20 digits and a separator. */
+  size_t len = count * 21 + 1;
+  listeners->spec = copy_path((TCHAR *) spec);
+  listeners->sockets = (SOCKET *) HeapAlloc(GetProcessHeap(), 0, count * sizeof(SOCKET));
+  listeners->variable = (TCHAR *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, len * sizeof(TCHAR));
+  if (! listeners->spec || ! listeners->sockets || ! listeners->variable) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("listen sockets"), _T("open_listen_sockets()"), 0);
+    close_listen_sockets(&listeners);
+    return 0;
+  }
+
+  TCHAR address[NSSM_LISTEN_ENDPOINT_LENGTH], port[NSSM_LISTEN_ENDPOINT_LENGTH];
+  size_t used = 0;
+  while (! next_endpoint(&spec, address, port)) {
+    SOCKET s = open_listen_socket(service_name, address, port);
+    if (s == INVALID_SOCKET) {
+      close_listen_sockets(&listeners);
+      return 0;
+    }
+
+    listeners->sockets[listeners->count++] = s;
+    int ret = _sntprintf_s(listeners->variable + used, len - used, _TRUNCATE, _T("%s%Iu"), used ? _T(",") : _T(""), (size_t) s);
+    if (ret > 0) used += ret;
+  }
+
+  return listeners;
+}
+
+/*
+  Toggle inheritance around CreateProcess() so other children don't get them.
+  The caller must hold process_section until inheritance is turned off
+  again, as hooks and other hosted services are launched under it.
+*/
+void inherit_listen_sockets(listen_sockets_t *listeners, bool inherit) {
+  if (! listeners) return;
+  for (unsigned long i = 0; i < listeners->count; i++) {
+    SetHandleInformation((HANDLE) listeners->sockets[i], HANDLE_FLAG_INHERIT, inherit ? HANDLE_FLAG_INHERIT : 0);
+  }
+}
+
+void close_listen_sockets(listen_sockets_t **listeners_ptr) {
+  listen_sockets_t *listeners = *listeners_ptr;
+  if (! listeners) return;
+
+  for (unsigned long i = 0; i < listeners->count; i++) closesocket(listeners->sockets[i]);
+  if (listeners->spec) HeapFree(GetProcessHeap(), 0, listeners->spec);
+  if (listeners->sockets) HeapFree(GetProcessHeap(), 0, listeners->sockets);
+  if (listeners->variable) HeapFree(GetProcessHeap(), 0, listeners->variable);
+  HeapFree(GetProcessHeap(), 0, listeners);
+  *listeners_ptr = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef LISTEN_H
+#define LISTEN_H
+
+/*
+  Listening sockets owned by NSSM.  AppListen is a list of endpoints
+  separated by spaces or commas, each of the form
+
+    8080             all IPv4 interfaces, port 8080
+    127.0.0.1:8080   one IPv4 address
+    [::1]:8080       one IPv6 address
+
+  NSSM opens the sockets when the service first starts and keeps them open
+  until the service stops, so connections queue in the kernel backlog while
+  the application restarts.  The application inherits the sockets and finds
+  their handles, in the order they were configured, as a comma-separated
+  list of decimal numbers in the NSSM_LISTEN_SOCKETS environment variable.
+  The sockets are only inheritable while the application is being launched
+  under process_section.
+
+  A bare port is bound on IPv4 only.  Add an endpoint such as [::]:8080 to
+  accept IPv6 connections on the same port.
+*/
+#define NSSM_LISTEN_VARIABLE _T("NSSM_LISTEN_SOCKETS")
+#define NSSM_LISTEN_SEPARATORS _T(" ,")
+/* Longest endpoint we will parse. */
+#define NSSM_LISTEN_ENDPOINT_LENGTH 64
+
+typedef struct {
+  TCHAR *spec;
+  SOCKET *sockets;
+  unsigned long count;
+  TCHAR *variable;
+} listen_sockets_t;
+
+int parse_listen(const TCHAR *, unsigned long *);
+listen_sockets_t *open_listen_sockets(const TCHAR *, const TCHAR *);
+void inherit_listen_sockets(listen_sockets_t *, bool);
+void close_listen_sockets(listen_sockets_t **);
+
+#endif
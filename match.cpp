@@ -0,0 +1,273 @@
+#include "nssm.h"
+
+#define MATCH_NO_STATE ((unsigned long) -1)
+#define MATCH_ALPHABET 256
+
+static void *match_alloc(size_t size, TCHAR *description) {
+  if (! size) size = 1;
+  void *ret = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size);
+  if (! ret) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, description, _T("compile_matcher()"), 0);
+  return ret;
+}
+
+static void match_free(void *p) {
+  if (p) HeapFree(GetProcessHeap(), 0, p);
+}
+
+void free_matcher(matcher_t *matcher) {
+  if (! matcher) return;
+  match_free(matcher->terms);
+  match_free(matcher->fragments);
+  match_free(matcher->delta);
+  match_free(matcher->output_index);
+  match_free(matcher->outputs);
+  HeapFree(GetProcessHeap(), 0, matcher);
+}
+
+/* Finish the fragment which started at offset start, if it isn't empty. */
+static void add_fragment(matcher_t *matcher, unsigned long *offsets, size_t *start, size_t used) {
+  if (used == *start) return;
+
+  match_term_t *term = &matcher->terms[matcher->num_terms];
+  match_fragment_t *fragment = &matcher->fragments[matcher->num_fragments];
+  fragment->term = matcher->num_terms;
+  fragment->index = term->fragments++;
+  fragment->length = (unsigned long) (used - *start);
+  offsets[matcher->num_fragments++] = (unsigned long) *start;
+  *start = used;
+}
+
+/*
+  Compile an array of patterns.
+  Returns a matcher to be freed with free_matcher() or NULL on error.
+*/
+matcher_t *compile_matcher(char **patterns, unsigned long count) {
+  matcher_t *matcher = (matcher_t *) match_alloc(sizeof(matcher_t), _T("matcher"));
+  if (! matcher) return 0;
+  matcher->num_patterns = count;
+
+  /* Every character could start a new term or fragment. */
+  size_t total = 0;
+  unsigned long p;
+  for (p = 0; p < count; p++) total += strlen(patterns[p]) + 1;
+
+  char *text = (char *) match_alloc(total, _T("pattern text"));
+  unsigned long *offsets = (unsigned long *) match_alloc(total * sizeof(unsigned long), _T("fragment offsets"));
+  matcher->terms = (match_term_t *) match_alloc(total * sizeof(match_term_t), _T("terms"));
+  matcher->fragments = (match_fragment_t *) match_alloc(total * sizeof(match_fragment_t), _T("fragments"));
+  if (! text || ! offsets || ! matcher->terms || ! matcher->fragments) {
+    match_free(text);
+    match_free(offsets);
+    free_matcher(matcher);
+    return 0;
+  }
+
+  /* Split patterns into terms and terms into fragments. */
+  size_t used = 0;
+  for (p = 0; p < count; p++) {
+    char *s = patterns[p];
+    while (true) {
+      match_term_t *term = &matcher->terms[matcher->num_terms];
+      term->pattern = p;
+      if (*s == '^') {
+        term->anchored = true;
+        s++;
+      }
+
+      size_t start = used;
+      while (*s && *s != '|') {
+        if (*s == '.' && s[1] == '*') {
+          /* ^.*foo isn't really anchored. */
+          if (! term->fragments && used == start) term->anchored = false;
+          add_fragment(matcher, offsets, &start, used);
+          s += 2;
+          continue;
+        }
+        if (*s == '\\' && s[1]) s++;
+        text[used++] = *s++;
+      }
+      add_fragment(matcher, offsets, &start, used);
+      matcher->num_terms++;
+
+      if (! *s) break;
+      s++;
+    }
+  }
+
+  /* Build the trie. */
+  unsigned long max_states = (unsigned long) used + 1;
+  unsigned long *terminal = (unsigned long *) match_alloc(matcher->num_fragments * sizeof(unsigned long), _T("terminal states"));
+  unsigned long *fail = (unsigned long *) match_alloc(max_states * sizeof(unsigned long), _T("failure links"));
+  unsigned long *queue = (unsigned long *) match_alloc(max_states * sizeof(unsigned long), _T("state queue"));
+  unsigned long *own = (unsigned long *) match_alloc((max_states + 1) * sizeof(unsigned long), _T("state outputs"));
+  matcher->delta = (unsigned long *) match_alloc(max_states * MATCH_ALPHABET * sizeof(unsigned long), _T("transitions"));
+  matcher->output_index = (unsigned long *) match_alloc((max_states + 1) * sizeof(unsigned long), _T("output index"));
+  if (! terminal || ! fail || ! queue || ! own || ! matcher->delta || ! matcher->output_index) {
+    match_free(text);
+    match_free(offsets);
+    match_free(terminal);
+    match_free(fail);
+    match_free(queue);
+    match_free(own);
+    free_matcher(matcher);
+    return 0;
+  }
+  memset(matcher->delta, 0xff, max_states * MATCH_ALPHABET * sizeof(unsigned long));
+
+  unsigned long f, i, c;
+  matcher->num_states = 1;
+  for (f = 0; f < matcher->num_fragments; f++) {
+    unsigned long state = 0;
+    for (i = 0; i < matcher->fragments[f].length; i++) {
+      unsigned long *next = &matcher->delta[state * MATCH_ALPHABET + (unsigned char) text[offsets[f] + i]];
+      if (*next == MATCH_NO_STATE) *next = matcher->num_states++;
+      state = *next;
+    }
+    terminal[f] = state;
+    own[state]++;
+  }
+  match_free(text);
+  match_free(offsets);
+
+  /*
+    Breadth-first walk to compute failure links and fill in the missing
+    transitions, so matching never needs to follow a failure link.
+  */
+  unsigned long head = 0, tail = 0;
+  queue[tail++] = 0;
+  for (c = 0; c < MATCH_ALPHABET; c++) {
+    unsigned long *next = &matcher->delta[c];
+    if (*next == MATCH_NO_STATE) *next = 0;
+    else {
+      fail[*next] = 0;
+      queue[tail++] = *next;
+    }
+  }
+  for (head = 1; head < tail; head++) {
+    unsigned long state = queue[head];
+    for (c = 0; c < MATCH_ALPHABET; c++) {
+      unsigned long *next = &matcher->delta[state * MATCH_ALPHABET + c];
+      unsigned long fallback = matcher->delta[fail[state] * MATCH_ALPHABET + c];
+      if (*next == MATCH_NO_STATE) *next = fallback;
+      else {
+        fail[*next] = fallback;
+        queue[tail++] = *next;
+      }
+    }
+  }
+
+  /* A state outputs its own fragments plus those of its failure state. */
+  unsigned long total_outputs = 0;
+  unsigned long *output_count = (unsigned long *) match_alloc(matcher->num_states * sizeof(unsigned long), _T("output counts"));
+  if (! output_count) {
+    match_free(terminal);
+    match_free(fail);
+    match_free(queue);
+    match_free(own);
+    free_matcher(matcher);
+    return 0;
+  }
+  for (head = 0; head < tail; head++) {
+    unsigned long state = queue[head];
+    output_count[state] = own[state];
+    if (state) output_count[state] += output_count[fail[state]];
+  }
+  for (i = 0; i < matcher->num_states; i++) {
+    matcher->output_index[i] = total_outputs;
+    total_outputs += output_count[i];
+  }
+  matcher->output_index[matcher->num_states] = total_outputs;
+
+  matcher->outputs = (unsigned long *) match_alloc(total_outputs * sizeof(unsigned long), _T("outputs"));
+  if (! matcher->outputs) {
+    match_free(output_count);
+    match_free(terminal);
+    match_free(fail);
+    match_free(queue);
+    match_free(own);
+    free_matcher(matcher);
+    return 0;
+  }
+
+  /* Own fragments first, using own[] as a fill pointer... */
+  for (i = 0; i < matcher->num_states; i++) own[i] = matcher->output_index[i];
+  for (f = 0; f < matcher->num_fragments; f++) matcher->outputs[own[terminal[f]]++] = f;
+
+  /* ...then inherited fragments, in breadth-first order so they're ready. */
+  for (head = 1; head < tail; head++) {
+    unsigned long state = queue[head];
+    unsigned long from = matcher->output_index[fail[state]];
+    unsigned long to = matcher->output_index[fail[state] + 1];
+    for (i = from; i < to; i++) matcher->outputs[own[state]++] = matcher->outputs[i];
+  }
+
+  match_free(output_count);
+  match_free(terminal);
+  match_free(fail);
+  match_free(queue);
+  match_free(own);
+
+  return matcher;
+}
+
+/* Scratch space for match_line(), to be freed with HeapFree(). */
+unsigned long *alloc_match_scratch(matcher_t *matcher) {
+  size_t len = matcher->num_terms * 2 * sizeof(unsigned long);
+  if (! len) len = sizeof(unsigned long);
+  unsigned long *scratch = (unsigned long *) HeapAlloc(GetProcessHeap(), 0, len);
+  if (! scratch) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("match scratch"), _T("alloc_match_scratch()"), 0);
+  return scratch;
+}
+
+/*
+  Test a line against every pattern in a single pass.  The matched array
+  must have room for one entry per pattern.  The scratch space keeps each
+  term's progress so that matchers can be shared between threads.
+
+  Fragments of a term are accepted greedily: an occurrence is taken if it is
+  the next fragment the term needs and it starts after the end of the
+  previous one.  Earliest-ending occurrences never rule out a later match.
+
+  Returns the number of patterns which matched.
+*/
+unsigned long match_line(matcher_t *matcher, unsigned long *scratch, const char *line, size_t len, bool *matched) {
+  unsigned long *progress = scratch;
+  unsigned long *position = scratch + matcher->num_terms;
+  unsigned long count = 0;
+  unsigned long t;
+
+  ZeroMemory(matched, matcher->num_patterns * sizeof(bool));
+  for (t = 0; t < matcher->num_terms; t++) {
+    progress[t] = position[t] = 0;
+    /* An empty term matches everything. */
+    if (! matcher->terms[t].fragments && ! matched[matcher->terms[t].pattern]) {
+      matched[matcher->terms[t].pattern] = true;
+      count++;
+    }
+  }
+
+  unsigned long state = 0;
+  for (size_t i = 0; i < len && count < matcher->num_patterns; i++) {
+    state = matcher->delta[state * MATCH_ALPHABET + (unsigned char) line[i]];
+
+    unsigned long to = matcher->output_index[state + 1];
+    for (unsigned long o = matcher->output_index[state]; o < to; o++) {
+      match_fragment_t *fragment = &matcher->fragments[matcher->outputs[o]];
+      match_term_t *term = &matcher->terms[fragment->term];
+      if (matched[term->pattern]) continue;
+      if (progress[fragment->term] != fragment->index) continue;
+
+      size_t start = i + 1 - fragment->length;
+      if (start < position[fragment->term]) continue;
+      if (term->anchored && ! fragment->index && start) continue;
+
+      position[fragment->term] = (unsigned long) i + 1;
+      if (++progress[fragment->term] == term->fragments) {
+        matched[term->pattern] = true;
+        count++;
+      }
+    }
+  }
+
+  return count;
+}
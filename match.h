@@ -0,0 +1,45 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+/*
+  A pattern is a list of alternatives separated by |.  Each alternative is a
+  list of literal fragments separated by .* which must appear in the line in
+  order.  An alternative starting with ^ only matches at the start of a line.
+  A backslash causes the following character to be treated literally.
+
+  All fragments of all patterns are compiled into a single Aho-Corasick
+  automaton so a line is tested against every pattern in one pass.
+*/
+
+/* One alternative of a pattern. */
+typedef struct {
+  unsigned long pattern;
+  unsigned long fragments;
+  bool anchored;
+} match_term_t;
+
+/* A literal which must appear in a line. */
+typedef struct {
+  unsigned long term;
+  unsigned long index;
+  unsigned long length;
+} match_fragment_t;
+
+typedef struct {
+  unsigned long num_patterns;
+  unsigned long num_terms;
+  unsigned long num_fragments;
+  unsigned long num_states;
+  match_term_t *terms;
+  match_fragment_t *fragments;
+  unsigned long *delta;
+  unsigned long *output_index;
+  unsigned long *outputs;
+} matcher_t;
+
+matcher_t *compile_matcher(char **, unsigned long);
+void free_matcher(matcher_t *);
+unsigned long *alloc_match_scratch(matcher_t *);
+unsigned long match_line(matcher_t *, unsigned long *, const char *, size_t, bool *);
+
+#endif
@@ -0,0 +1,317 @@
+#include "nssm.h"
+
+static const char *metrics_stream_names[] = { "stdout", "stderr" };
+static const char *metrics_phase_names[] = { "parameters", "throttle", "output", "hook", "environment", "createprocess", "affinity", "wait" };
+static const unsigned long metrics_quantiles[] = { 50, 90, 99 };
+
+/* Append formatted text, growing the buffer as needed. */
+static int emit(metrics_buffer_t *buffer, const char *format, ...) {
+  va_list arg;
+  size_t need = 256;
+  while (true) {
+    if (buffer->size - buffer->len < need) {
+      size_t size = buffer->size ? buffer->size : 8192;
+      while (size - buffer->len < need) size *= 2;
+      char *data;
+      if (buffer->data) data = (char *) HeapReAlloc(GetProcessHeap(), 0, buffer->data, size);
+      else data = (char *) HeapAlloc(GetProcessHeap(), 0, size);
+      if (! data) return 1;
+      buffer->data = data;
+      buffer->size = size;
+    }
+
+    va_start(arg, format);
+    int ret = _vsnprintf_s(buffer->data + buffer->len, buffer->size - buffer->len, _TRUNCATE, format, arg);
+    va_end(arg);
+    if (ret >= 0) {
+      buffer->len += ret;
+      return 0;
+    }
+
+    /* Didn't fit. */
+    need = buffer->size - buffer->len + 1;
+  }
+}
+
+static void emit_header(metrics_buffer_t *buffer, const char *name, const char *type, const char *help) {
+  emit(buffer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Render a histogram as a summary, scaling values by the divisor. */
+static void emit_summary(metrics_buffer_t *buffer, const char *label, const char *name, const char *help, histogram_t *histogram, double divisor) {
+  emit_header(buffer, name, "summary", help);
+  for (unsigned long i = 0; i < _countof(metrics_quantiles); i++) {
+    emit(buffer, "%s{service=\"%s\",quantile=\"0.%02lu\"} %.6g\n", name, label, metrics_quantiles[i], (double) histogram_percentile(histogram, metrics_quantiles[i]) / divisor);
+  }
+  emit(buffer, "%s_sum{service=\"%s\"} %.6g\n", name, label, (double) histogram->sum / divisor);
+  emit(buffer, "%s_count{service=\"%s\"} %I64u\n", name, label, histogram->count);
+}
+
+static void render_metrics(metrics_t *metrics, metrics_buffer_t *buffer) {
+  const char *label = metrics->label;
+  nssm_stats_t *stats = metrics->stats;
+  int i;
+
+  supervisor_stats_t supervisor;
+  read_supervisor_stats(&stats->supervisor, &supervisor);
+
+  emit_header(buffer, "nssm_start_requests_total", "counter", "Number of times the application was requested to start.");
+  emit(buffer, "nssm_start_requests_total{service=\"%s\"} %lu\n", label, supervisor.start_requested_count);
+  emit_header(buffer, "nssm_starts_total", "counter", "Number of times the application successfully started.");
+  emit(buffer, "nssm_starts_total{service=\"%s\"} %lu\n", label, supervisor.start_count);
+  emit_header(buffer, "nssm_exits_total", "counter", "Number of times the application exited.");
+  emit(buffer, "nssm_exits_total{service=\"%s\"} %lu\n", label, supervisor.exit_count);
+  emit_header(buffer, "nssm_throttle", "gauge", "Current restart throttle level.");
+  emit(buffer, "nssm_throttle{service=\"%s\"} %lu\n", label, supervisor.throttle);
+  emit_header(buffer, "nssm_last_exit_code", "gauge", "Exit code of the application when it last exited.");
+  emit(buffer, "nssm_last_exit_code{service=\"%s\"} %lu\n", label, supervisor.exitcode);
+  emit_header(buffer, "nssm_breaker_state", "gauge", "Circuit breaker state: 0 closed, 1 tripped, 2 half-open.");
+  emit(buffer, "nssm_breaker_state{service=\"%s\"} %lu\n", label, supervisor.breaker);
+  emit_header(buffer, "nssm_up", "gauge", "Whether the application is running.");
+  emit(buffer, "nssm_up{service=\"%s\"} %d\n", label, supervisor.pid ? 1 : 0);
+
+  double uptime = 0.0;
+  if (supervisor.pid && supervisor.creation_time) {
+    FILETIME now_ft;
+    GetSystemTimeAsFileTime(&now_ft);
+    unsigned __int64 now = filetime_value(&now_ft);
+    if (now > supervisor.creation_time) uptime = (double) (now - supervisor.creation_time) / 10000000.0;
+  }
+  emit_header(buffer, "nssm_uptime_seconds", "gauge", "Seconds since the application was started, or 0 if it isn't running.");
+  emit(buffer, "nssm_uptime_seconds{service=\"%s\"} %.3f\n", label, uptime);
+  emit_summary(buffer, label, "nssm_restart_latency_seconds", "Time from the application exiting to its replacement being created.", &supervisor.restart_latency, 1000.0);
+
+  /* Too big for the stack of a thread which only serves scrapes. */
+  start_stats_t *start = (start_stats_t *) HeapAlloc(GetProcessHeap(), 0, sizeof(start_stats_t));
+  if (start) {
+    read_start_stats(&stats->start, start);
+    emit_summary(buffer, label, "nssm_start_seconds", "Time from a start request to the application being reported as running.", &start->total, 1000000.0);
+    emit_header(buffer, "nssm_start_phase_seconds", "summary", "Time spent in each phase of starting the application.");
+    for (i = 0; i < NSSM_START_PHASES; i++) {
+      histogram_t *h = &start->phases[i];
+      for (unsigned long q = 0; q < _countof(metrics_quantiles); q++) {
+        emit(buffer, "nssm_start_phase_seconds{service=\"%s\",phase=\"%s\",quantile=\"0.%02lu\"} %.6g\n", label, metrics_phase_names[i], metrics_quantiles[q], (double) histogram_percentile(h, metrics_quantiles[q]) / 1000000.0);
+      }
+      emit(buffer, "nssm_start_phase_seconds_sum{service=\"%s\",phase=\"%s\"} %.6g\n", label, metrics_phase_names[i], (double) h->sum / 1000000.0);
+      emit(buffer, "nssm_start_phase_seconds_count{service=\"%s\",phase=\"%s\"} %I64u\n", label, metrics_phase_names[i], h->count);
+    }
+    HeapFree(GetProcessHeap(), 0, start);
+  }
+
+  stream_stats_t streams[NSSM_STATS_STREAMS];
+  for (i = 0; i < NSSM_STATS_STREAMS; i++) read_stream_stats(&stats->streams[i], &streams[i]);
+
+  emit_header(buffer, "nssm_log_read_bytes_total", "counter", "Bytes of output read from the application.");
+  for (i = 0; i < NSSM_STATS_STREAMS; i++) emit(buffer, "nssm_log_read_bytes_total{service=\"%s\",stream=\"%s\"} %I64u\n", label, metrics_stream_names[i], streams[i].bytes_read);
+  emit_header(buffer, "nssm_log_read_lines_total", "counter", "Lines of output read from the application.");
+  for (i = 0; i < NSSM_STATS_STREAMS; i++) emit(buffer, "nssm_log_read_lines_total{service=\"%s\",stream=\"%s\"} %I64u\n", label, metrics_stream_names[i], streams[i].lines_read);
+  emit_header(buffer, "nssm_log_written_bytes_total", "counter", "Bytes written to log files.");
+  for (i = 0; i < NSSM_STATS_STREAMS; i++) emit(buffer, "nssm_log_written_bytes_total{service=\"%s\",stream=\"%s\"} %I64u\n", label, metrics_stream_names[i], streams[i].bytes_written);
+  emit_header(buffer, "nssm_log_write_blocked_seconds_total", "counter", "Time spent blocked writing to log files.");
+  for (i = 0; i < NSSM_STATS_STREAMS; i++) emit(buffer, "nssm_log_write_blocked_seconds_total{service=\"%s\",stream=\"%s\"} %.6f\n", label, metrics_stream_names[i], stats->frequency ? (double) streams[i].write_ticks / (double) stats->frequency : 0.0);
+  emit_header(buffer, "nssm_log_dropped_writes_total", "counter", "Writes dropped after repeated failures.");
+  for (i = 0; i < NSSM_STATS_STREAMS; i++) emit(buffer, "nssm_log_dropped_writes_total{service=\"%s\",stream=\"%s\"} %I64u\n", label, metrics_stream_names[i], streams[i].drops);
+  emit_header(buffer, "nssm_log_rotations_total", "counter", "Online log rotations.");
+  for (i = 0; i < NSSM_STATS_STREAMS; i++) emit(buffer, "nssm_log_rotations_total{service=\"%s\",stream=\"%s\"} %I64u\n", label, metrics_stream_names[i], streams[i].rotations);
+
+  usage_stats_t usage;
+  read_usage_stats(&stats->usage, &usage);
+  if (! usage.samples) return;
+
+  emit_header(buffer, "nssm_processes", "gauge", "Processes in the application's tree at the last sample.");
+  emit(buffer, "nssm_processes{service=\"%s\"} %lu\n", label, usage.processes);
+  emit_header(buffer, "nssm_cpu_seconds_total", "counter", "CPU time used by the application's process tree.");
+  emit(buffer, "nssm_cpu_seconds_total{service=\"%s\"} %.3f\n", label, (double) usage.cpu_time / 10000000.0);
+  emit_header(buffer, "nssm_io_bytes_total", "counter", "Bytes read and written by the application's process tree.");
+  emit(buffer, "nssm_io_bytes_total{service=\"%s\"} %I64u\n", label, usage.io_bytes);
+  emit_summary(buffer, label, "nssm_cpu_ratio", "CPU usage of the process tree as a fraction of one processor.", &usage.metrics[NSSM_USAGE_CPU], 10000.0);
+  emit_summary(buffer, label, "nssm_private_bytes", "Private bytes of the process tree.", &usage.metrics[NSSM_USAGE_PRIVATE_BYTES], 1.0);
+  emit_summary(buffer, label, "nssm_working_set_bytes", "Working set of the process tree.", &usage.metrics[NSSM_USAGE_WORKING_SET], 1.0);
+  emit_summary(buffer, label, "nssm_handles", "Open handles in the process tree.", &usage.metrics[NSSM_USAGE_HANDLES], 1.0);
+  emit_summary(buffer, label, "nssm_io_bytes_per_second", "I/O rate of the process tree.", &usage.metrics[NSSM_USAGE_IO], 1.0);
+}
+
+static int send_all(SOCKET s, const char *data, size_t len) {
+  while (len) {
+    int ret = send(s, data, (int) len, 0);
+    if (ret == SOCKET_ERROR) return 1;
+    data += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+static void send_response(SOCKET s, const char *status, const char *content_type, const char *body, size_t len) {
+  char header[256];
+  _snprintf_s(header, sizeof(header), _TRUNCATE, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", status, content_type, (unsigned long) len);
+  if (send_all(s, header, strlen(header))) return;
+  send_all(s, body, len);
+}
+
+static void serve_scrape(metrics_t *metrics, SOCKET s) {
+  unsigned long timeout = NSSM_METRICS_TIMEOUT;
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout));
+  setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char *) &timeout, sizeof(timeout));
+
+  /* Read until the end of the headers.  We don't accept request bodies. */
+  char request[NSSM_METRICS_REQUEST_LENGTH];
+  int len = 0;
+  while (len < (int) sizeof(request) - 1) {
+    int ret = recv(s, request + len, (int) sizeof(request) - 1 - len, 0);
+    if (ret <= 0) break;
+    len += ret;
+    request[len] = '\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+  }
+  request[len] = '\0';
+
+  if (strncmp(request, "GET ", 4)) {
+    const char *body = "Method not allowed\n";
+    send_response(s, "405 Method Not Allowed", "text/plain", body, strlen(body));
+    return;
+  }
+
+  char *path = request + 4;
+  size_t path_len = strcspn(path, " \r\n?");
+  if (! ((path_len == 1 && *path == '/') || (path_len == strlen(NSSM_METRICS_PATH) && ! strncmp(path, NSSM_METRICS_PATH, path_len)))) {
+    const char *body = "Not found\n";
+    send_response(s, "404 Not Found", "text/plain", body, strlen(body));
+    return;
+  }
+
+  metrics_buffer_t buffer;
+  ZeroMemory(&buffer, sizeof(buffer));
+  render_metrics(metrics, &buffer);
+  if (buffer.data) {
+    send_response(s, "200 OK", NSSM_METRICS_CONTENT_TYPE, buffer.data, buffer.len);
+    HeapFree(GetProcessHeap(), 0, buffer.data);
+  }
+  else {
+    const char *body = "Out of memory\n";
+    send_response(s, "500 Internal Server Error", "text/plain", body, strlen(body));
+  }
+}
+
+/* Scrapes are served one at a time. */
+static unsigned long WINAPI serve_metrics(void *arg) {
+  metrics_t *metrics = (metrics_t *) arg;
+
+  while (true) {
+    SOCKET s = accept(metrics->listener, 0, 0);
+    if (s == INVALID_SOCKET) {
+      /* close_metrics() closed the listener. */
+      if (metrics->stopping) break;
+      Sleep(100);
+      continue;
+    }
+
+    serve_scrape(metrics, s);
+    shutdown(s, SD_SEND);
+    closesocket(s);
+  }
+
+  return 0;
+}
+
+/* Escape a service name for use as a label value. */
+static char *metrics_label(const TCHAR *service_name) {
+  char *name;
+  if (to_utf8(service_name, &name, 0)) return 0;
+
+  size_t len = strlen(name);
+  char *label = (char *) HeapAlloc(GetProcessHeap(), 0, len * 2 + 1);
+  if (label) {
+    char *p = label;
+    for (size_t i = 0; i < len; i++) {
+      if (name[i] == '\\' || name[i] == '"') *p++ = '\\';
+      *p++ = name[i];
+    }
+    *p = '\0';
+  }
+
+  HeapFree(GetProcessHeap(), 0, name);
+  return label;
+}
+
+static void metrics_failed(const TCHAR *service_name, const TCHAR *function, unsigned long error) {
+  log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_METRICS_FAILED, service_name, function, error_string(error), 0);
+}
+
+/* Start serving metrics on the loopback interface. */
+metrics_t *open_metrics(const TCHAR *service_name, unsigned short port, nssm_stats_t *stats) {
+  if (start_winsock()) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_WSASTARTUP_FAILED, service_name, error_string(WSAGetLastError()), 0);
+    return 0;
+  }
+
+  metrics_t *metrics = (metrics_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(metrics_t));
+  if (! metrics) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("metrics"), _T("open_metrics()"), 0);
+    return 0;
+  }
+
+  metrics->service_name = service_name;
+  metrics->port = port;
+  metrics->stats = stats;
+  metrics->listener = INVALID_SOCKET;
+
+  metrics->label = metrics_label(service_name);
+  if (! metrics->label) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("metrics label"), _T("open_metrics()"), 0);
+    close_metrics(&metrics);
+    return 0;
+  }
+
+  metrics->listener = open_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (metrics->listener == INVALID_SOCKET) {
+    metrics_failed(service_name, _T("socket()"), WSAGetLastError());
+    close_metrics(&metrics);
+    return 0;
+  }
+
+  /* Don't let another process steal the port. */
+  int exclusive = 1;
+  setsockopt(metrics->listener, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char *) &exclusive, sizeof(exclusive));
+
+  struct sockaddr_in address;
+  ZeroMemory(&address, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(metrics->listener, (struct sockaddr *) &address, sizeof(address)) == SOCKET_ERROR) {
+    metrics_failed(service_name, _T("bind()"), WSAGetLastError());
+    close_metrics(&metrics);
+    return 0;
+  }
+
+  if (listen(metrics->listener, SOMAXCONN) == SOCKET_ERROR) {
+    metrics_failed(service_name, _T("listen()"), WSAGetLastError());
+    close_metrics(&metrics);
+    return 0;
+  }
+
+  metrics->thread = CreateThread(0, 0, serve_metrics, (void *) metrics, 0, 0);
+  if (! metrics->thread) {
+    metrics_failed(service_name, _T("CreateThread()"), GetLastError());
+    close_metrics(&metrics);
+    return 0;
+  }
+
+  return metrics;
+}
+
+/* Stop listening, waiting for a scrape in progress to finish. */
+void close_metrics(metrics_t **metrics_ptr) {
+  metrics_t *metrics = *metrics_ptr;
+  if (! metrics) return;
+
+  InterlockedExchange(&metrics->stopping, 1);
+  if (metrics->listener != INVALID_SOCKET) closesocket(metrics->listener);
+  if (metrics->thread) {
+    WaitForSingleObject(metrics->thread, INFINITE);
+    CloseHandle(metrics->thread);
+  }
+  if (metrics->label) HeapFree(GetProcessHeap(), 0, metrics->label);
+  HeapFree(GetProcessHeap(), 0, metrics);
+  *metrics_ptr = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*
+  Prometheus metrics endpoint.  NSSM listens on 127.0.0.1:AppMetricsPort and
+  answers GET /metrics with the service's statistics in the Prometheus text
+  exposition format.  Every scrape renders a fresh copy of the shared
+  statistics block, so it never waits for the service.
+*/
+#define NSSM_METRICS_PATH "/metrics"
+#define NSSM_METRICS_CONTENT_TYPE "text/plain; version=0.0.4"
+/* Enough for a request line and typical headers. */
+#define NSSM_METRICS_REQUEST_LENGTH 2048
+/* Slow clients are dropped after this many milliseconds. */
+#define NSSM_METRICS_TIMEOUT 5000
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+} metrics_buffer_t;
+
+typedef struct {
+  const TCHAR *service_name;
+  char *label;
+  unsigned short port;
+  nssm_stats_t *stats;
+  SOCKET listener;
+  HANDLE thread;
+  volatile long stopping;
+} metrics_t;
+
+metrics_t *open_metrics(const TCHAR *, unsigned short, nssm_stats_t *);
+void close_metrics(metrics_t **);
+
+#endif
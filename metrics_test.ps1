@@ -0,0 +1,141 @@
+<#
+  Integration test of the AppMetricsPort endpoint.  Installs a throwaway
+  service whose application exits every couple of seconds, checks that each
+  scrape is valid Prometheus text exposition format and that the counters
+  go up as the application is restarted.
+
+  Needs Windows and an elevated PowerShell:
+
+    powershell -ExecutionPolicy Bypass -File metrics_test.ps1 -Nssm out\Release\win64\nssm.exe
+#>
+param(
+  [string] $Nssm = "nssm.exe",
+  [string] $Service = "nssm-metrics-test",
+  [int] $Port = 19100
+)
+
+$ErrorActionPreference = "Stop"
+$Nssm = (Resolve-Path $Nssm).Path
+$base = "http://127.0.0.1:$Port"
+
+# The application runs for longer than the default AppThrottle so restarts aren't delayed.
+$runtime = 2
+$exitcode = 3
+
+$failures = 0
+function Check([bool] $ok, [string] $what) {
+  if ($ok) { return }
+  Write-Host "FAIL: $what"
+  $script:failures++
+}
+
+function Get-Status([string] $method, [string] $path) {
+  try {
+    return [int] (Invoke-WebRequest -UseBasicParsing -Method $method "$base$path").StatusCode
+  }
+  catch {
+    if (-not $_.Exception.Response) { throw }
+    return [int] $_.Exception.Response.StatusCode
+  }
+}
+
+<#
+  Scrape /metrics and check the format.  Returns a hashtable of samples,
+  keyed by name and labels, and the type of each metric family.
+#>
+function Get-Metrics {
+  $response = Invoke-WebRequest -UseBasicParsing "$base/metrics"
+  Check ($response.StatusCode -eq 200) "scrape returned $($response.StatusCode)"
+  Check ($response.Headers["Content-Type"] -eq "text/plain; version=0.0.4") "scrape returned Content-Type $($response.Headers["Content-Type"])"
+
+  $samples = @{}
+  $types = @{}
+  $help = @{}
+  foreach ($line in ($response.Content -split "`n")) {
+    if (-not $line) { continue }
+
+    if ($line -match "^# HELP ([a-zA-Z_:][a-zA-Z0-9_:]*) \S") {
+      Check (-not $help.ContainsKey($Matches[1])) "HELP repeated for $($Matches[1])"
+      $help[$Matches[1]] = $true
+      continue
+    }
+
+    if ($line -match "^# TYPE ([a-zA-Z_:][a-zA-Z0-9_:]*) (counter|gauge|summary)$") {
+      Check (-not $types.ContainsKey($Matches[1])) "TYPE repeated for $($Matches[1])"
+      Check ($help.ContainsKey($Matches[1])) "TYPE before HELP for $($Matches[1])"
+      $types[$Matches[1]] = $Matches[2]
+      continue
+    }
+
+    if (-not ($line -match '^([a-zA-Z_:][a-zA-Z0-9_:]*)\{((?:[a-zA-Z_][a-zA-Z0-9_]*="[^"\\]*",?)+)\} (\S+)$')) {
+      Check $false "malformed line: $line"
+      continue
+    }
+    $name = $Matches[1]
+    $labels = $Matches[2]
+    $value = 0.0
+    Check ([double]::TryParse($Matches[3], [System.Globalization.NumberStyles]::Float, [System.Globalization.CultureInfo]::InvariantCulture, [ref] $value)) "bad value: $line"
+    Check ($labels -match "(^|,)service=""$Service""(,|$)") "no service label: $line"
+    Check (-not $samples.ContainsKey("$name{$labels}")) "duplicate sample: $line"
+
+    # Summaries have _sum and _count samples under the family's name.
+    $family = $name
+    if (-not $types.ContainsKey($family)) { $family = $name -replace "_(sum|count)$", "" }
+    Check ($types.ContainsKey($family)) "sample before TYPE: $line"
+    if ($types[$family] -eq "counter") { Check ($name -like "*_total") "counter without _total: $name" }
+    if ($types[$family] -eq "summary" -and $name -eq $family) { Check ($labels -match 'quantile="0\.\d+"') "summary sample without quantile: $line" }
+
+    $samples["$name{$labels}"] = $value
+  }
+
+  return @{ Samples = $samples; Types = $types }
+}
+
+function Get-Sample($metrics, [string] $name) {
+  return $metrics.Samples["$name{service=""$Service""}"]
+}
+
+try {
+  $app = Join-Path $env:SystemRoot "System32\WindowsPowerShell\v1.0\powershell.exe"
+  & $Nssm install $Service $app "-NoProfile -Command Start-Sleep -Seconds $runtime; exit $exitcode" | Out-Null
+  & $Nssm set $Service AppMetricsPort $Port | Out-Null
+  & $Nssm set $Service AppRestartDelay 0 | Out-Null
+  & $Nssm start $Service | Out-Null
+
+  Check ((Get-Status "GET" "/metrics") -eq 200) "GET /metrics failed"
+  Check ((Get-Status "GET" "/nothing") -eq 404) "GET /nothing was not 404"
+  Check ((Get-Status "POST" "/metrics") -eq 405) "POST /metrics was not 405"
+
+  $first = Get-Metrics
+  foreach ($name in "nssm_start_requests_total", "nssm_starts_total", "nssm_exits_total", "nssm_throttle", "nssm_up", "nssm_uptime_seconds", "nssm_restart_latency_seconds_count", "nssm_start_seconds_count") {
+    Check ($null -ne (Get-Sample $first $name)) "no $name"
+  }
+  Check ((Get-Sample $first "nssm_starts_total") -ge 1) "application never started"
+
+  # Let the application exit and be restarted a few times.
+  Start-Sleep -Seconds ($runtime * 4 + 1)
+  $second = Get-Metrics
+
+  foreach ($name in "nssm_starts_total", "nssm_exits_total", "nssm_restart_latency_seconds_count", "nssm_start_seconds_count") {
+    Check ((Get-Sample $second $name) -gt (Get-Sample $first $name)) "$name didn't increase across restarts"
+  }
+  Check ((Get-Sample $second "nssm_exits_total") -ge 3) "only $(Get-Sample $second "nssm_exits_total") exits"
+  Check ((Get-Sample $second "nssm_last_exit_code") -eq $exitcode) "last exit code $(Get-Sample $second "nssm_last_exit_code")"
+
+  # No counter may go backwards between scrapes.
+  foreach ($key in $first.Samples.Keys) {
+    $family = $key -replace "\{.*", ""
+    if ($first.Types[$family] -ne "counter") { continue }
+    Check ($second.Samples[$key] -ge $first.Samples[$key]) "$key went from $($first.Samples[$key]) to $($second.Samples[$key])"
+  }
+}
+finally {
+  & $Nssm stop $Service | Out-Null
+  & $Nssm remove $Service confirm | Out-Null
+}
+
+if ($failures) {
+  Write-Host "metrics_test: $failures checks failed"
+  exit 1
+}
+Write-Host "metrics_test: all checks passed"
@@ -0,0 +1,305 @@
+#include "nssm.h"
+
+/* Create a pipe for the service's next process. */
+notifier_t *open_notifier(const TCHAR *service_name, unsigned long count) {
+  notifier_t *notifier = (notifier_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(notifier_t));
+  if (! notifier) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("notifier"), _T("open_notifier()"), 0);
+    return 0;
+  }
+  notifier->pipe = INVALID_HANDLE_VALUE;
+
+  TCHAR name[NSSM_NOTIFY_PIPE_LENGTH];
+  if (_sntprintf_s(name, _countof(name), _TRUNCATE, NSSM_NOTIFY_PIPE, service_name, GetCurrentProcessId(), count) < 0) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("pipe name"), _T("open_notifier()"), 0);
+    close_notifier(&notifier);
+    return 0;
+  }
+
+  size_t len = _tcslen(name) + 1;
+  notifier->name = (TCHAR *) HeapAlloc(GetProcessHeap(), 0, len * sizeof(TCHAR));
+  if (! notifier->name) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("pipe name"), _T("open_notifier()"), 0);
+    close_notifier(&notifier);
+    return 0;
+  }
+  memmove(notifier->name, name, len * sizeof(TCHAR));
+
+  notifier->overlapped.hEvent = CreateEvent(0, true, false, 0);
+  if (! notifier->overlapped.hEvent) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATENAMEDPIPE_FAILED, service_name, notifier->name, error_string(GetLastError()), 0);
+    close_notifier(&notifier);
+    return 0;
+  }
+
+  /*
+    The application runs under the same account as us, so the default
+    security descriptor lets it write.
+  */
+  notifier->pipe = CreateNamedPipe(notifier->name, PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 0, NSSM_NOTIFY_BUFFER_SIZE, 0, 0);
+  if (notifier->pipe == INVALID_HANDLE_VALUE) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATENAMEDPIPE_FAILED, service_name, notifier->name, error_string(GetLastError()), 0);
+    close_notifier(&notifier);
+    return 0;
+  }
+
+  return notifier;
+}
+
+void close_notifier(notifier_t **notifier) {
+  if (! *notifier) return;
+  if ((*notifier)->pipe != INVALID_HANDLE_VALUE) {
+    CancelIo((*notifier)->pipe);
+    CloseHandle((*notifier)->pipe);
+  }
+  if ((*notifier)->overlapped.hEvent) CloseHandle((*notifier)->overlapped.hEvent);
+  if ((*notifier)->name) HeapFree(GetProcessHeap(), 0, (*notifier)->name);
+  HeapFree(GetProcessHeap(), 0, *notifier);
+  *notifier = 0;
+}
+
+/* Look for READY=1 on a line of its own.  Returns true if found. */
+static bool parse_notification(notifier_t *notifier, bool eof) {
+  unsigned long start = 0;
+  for (unsigned long i = 0; i < notifier->used; i++) {
+    if (notifier->buffer[i] != '\n') continue;
+    unsigned long end = i;
+    if (end > start && notifier->buffer[end - 1] == '\r') end--;
+    if (end - start == sizeof(NSSM_NOTIFY_READY) - 1 && ! memcmp(notifier->buffer + start, NSSM_NOTIFY_READY, end - start)) return true;
+    start = i + 1;
+  }
+
+  /* The last line needn't be terminated if the client hung up. */
+  if (eof) {
+    unsigned long end = notifier->used;
+    if (end - start == sizeof(NSSM_NOTIFY_READY) - 1 && ! memcmp(notifier->buffer + start, NSSM_NOTIFY_READY, end - start)) return true;
+    notifier->used = 0;
+    return false;
+  }
+
+  /* Keep the incomplete line unless it can never fit. */
+  if (start) memmove(notifier->buffer, notifier->buffer + start, notifier->used - start);
+  notifier->used -= start;
+  if (notifier->used == sizeof(notifier->buffer)) notifier->used = 0;
+  return false;
+}
+
+/*
+  Start the next asynchronous operation on the pipe: a connection if no
+  client is connected, otherwise a read.  Returns 0 if the operation is
+  pending or completed, 1 if the client hung up, -1 on error.
+*/
+static int notifier_io(notifier_t *notifier) {
+  ResetEvent(notifier->overlapped.hEvent);
+
+  unsigned long error;
+  if (! notifier->connected) {
+    if (! ConnectNamedPipe(notifier->pipe, &notifier->overlapped)) {
+      error = GetLastError();
+      if (error == ERROR_IO_PENDING) return 0;
+      /* The client connected before we started listening. */
+      if (error != ERROR_PIPE_CONNECTED) return -1;
+    }
+    notifier->connected = true;
+  }
+
+  if (ReadFile(notifier->pipe, notifier->buffer + notifier->used, sizeof(notifier->buffer) - notifier->used, 0, &notifier->overlapped)) return 0;
+  error = GetLastError();
+  if (error == ERROR_IO_PENDING) return 0;
+  if (error == ERROR_BROKEN_PIPE) return 1;
+  return -1;
+}
+
+/* Prepare to accept the next client. */
+static int notifier_reset(notifier_t *notifier) {
+  DisconnectNamedPipe(notifier->pipe);
+  notifier->connected = false;
+  notifier->used = 0;
+  return notifier_io(notifier);
+}
+
+/*
+  Handle completion of I/O on the pipe.
+  Returns NSSM_NOTIFY_STATUS_TIMEOUT if we should keep waiting.
+*/
+static int notifier_event(notifier_t *notifier, const TCHAR *service_name) {
+  unsigned long transferred;
+  int ret = 0;
+  if (! GetOverlappedResult(notifier->pipe, &notifier->overlapped, &transferred, false)) {
+    if (GetLastError() != ERROR_BROKEN_PIPE) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CONNECTNAMEDPIPE_FAILED, service_name, notifier->name, error_string(GetLastError()), 0);
+      return NSSM_NOTIFY_STATUS_FAILED;
+    }
+    ret = 1;
+  }
+  else if (! notifier->connected) {
+    notifier->connected = true;
+    ret = notifier_io(notifier);
+  }
+  else {
+    notifier->used += transferred;
+    if (parse_notification(notifier, false)) return NSSM_NOTIFY_STATUS_READY;
+    ret = notifier_io(notifier);
+  }
+
+  /* Broken pipe: the client may have written its line and hung up. */
+  if (ret > 0) {
+    if (parse_notification(notifier, true)) return NSSM_NOTIFY_STATUS_READY;
+    ret = notifier_reset(notifier);
+  }
+  if (ret < 0) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CONNECTNAMEDPIPE_FAILED, service_name, notifier->name, error_string(GetLastError()), 0);
+    return NSSM_NOTIFY_STATUS_FAILED;
+  }
+
+  return NSSM_NOTIFY_STATUS_TIMEOUT;
+}
+
+/*
+  Wait until the application writes READY=1 to the pipe, prints a line
+  matching its ready pattern, exits or the timeout elapses, updating the
+  service's checkpoint as we go.  Either the notifier or the watch may be
+  NULL.
+*/
+int await_ready(notifier_t *notifier, ready_watch_t *watch, const TCHAR *service_name, SERVICE_STATUS_HANDLE status_handle, SERVICE_STATUS *status, HANDLE process_handle, unsigned long timeout) {
+  HANDLE handles[3];
+  unsigned long count = 0;
+  unsigned long notifier_index = 0, watch_index = 0;
+
+  handles[count++] = process_handle;
+  if (notifier) {
+    if (notifier_io(notifier) < 0) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CONNECTNAMEDPIPE_FAILED, service_name, notifier->name, error_string(GetLastError()), 0);
+      return NSSM_NOTIFY_STATUS_FAILED;
+    }
+    notifier_index = count;
+    handles[count++] = notifier->overlapped.hEvent;
+  }
+  if (watch) {
+    watch_index = count;
+    handles[count++] = watch->event;
+  }
+
+  unsigned long started = GetTickCount();
+  unsigned long next_update = 0;
+  unsigned long waited = 0;
+  while (waited < timeout) {
+    /* Keep the service control manager informed. */
+    if (waited >= next_update) {
+      unsigned long interval = timeout - waited;
+      if (interval > NSSM_SERVICE_STATUS_DEADLINE) interval = NSSM_SERVICE_STATUS_DEADLINE;
+      next_update = waited + interval;
+      if (status) {
+        status->dwWaitHint = interval + NSSM_WAITHINT_MARGIN;
+        status->dwCheckPoint++;
+        SetServiceStatus(status_handle, status);
+      }
+    }
+
+    unsigned long ret = WaitForMultipleObjects(count, handles, false, next_update - waited);
+    if (ret == WAIT_OBJECT_0) return NSSM_NOTIFY_STATUS_EXITED;
+    else if (watch && ret == WAIT_OBJECT_0 + watch_index) return NSSM_NOTIFY_STATUS_READY;
+    else if (notifier && ret == WAIT_OBJECT_0 + notifier_index) {
+      int result = notifier_event(notifier, service_name);
+      if (result != NSSM_NOTIFY_STATUS_TIMEOUT) return result;
+    }
+    else if (ret != WAIT_TIMEOUT) return NSSM_NOTIFY_STATUS_FAILED;
+
+    waited = GetTickCount() - started;
+  }
+
+  return NSSM_NOTIFY_STATUS_TIMEOUT;
+}
+
+/*
+  Check that a ready pattern can be used.
+  Returns: 0 if it can.
+           1 if it is too long.
+           2 if an alternative has no literal text and would match any line.
+           3 if it couldn't be compiled.
+*/
+int check_ready_pattern(const TCHAR *pattern) {
+  if (_tcslen(pattern) > NSSM_READY_PATTERN_LENGTH) return 1;
+
+  char *utf8;
+  if (to_utf8(pattern, &utf8, 0)) return 3;
+  matcher_t *matcher = compile_matcher(&utf8, 1);
+  HeapFree(GetProcessHeap(), 0, utf8);
+  if (! matcher) return 3;
+
+  int ret = 0;
+  for (unsigned long i = 0; i < matcher->num_terms; i++) {
+    if (! matcher->terms[i].fragments) ret = 2;
+  }
+
+  free_matcher(matcher);
+  return ret;
+}
+
+/*
+  Compile the pattern which means the application is ready.
+  Returns a watch with one reference or NULL on error.
+*/
+ready_watch_t *open_ready_watch(const TCHAR *service_name, const TCHAR *pattern) {
+  ready_watch_t *watch = (ready_watch_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(ready_watch_t));
+  if (! watch) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("ready watch"), _T("open_ready_watch()"), 0);
+    return 0;
+  }
+
+  char *utf8;
+  if (to_utf8(pattern, &utf8, 0)) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("ready pattern"), _T("open_ready_watch()"), 0);
+    HeapFree(GetProcessHeap(), 0, watch);
+    return 0;
+  }
+  watch->matcher = compile_matcher(&utf8, 1);
+  HeapFree(GetProcessHeap(), 0, utf8);
+  if (! watch->matcher) {
+    HeapFree(GetProcessHeap(), 0, watch);
+    return 0;
+  }
+
+  /* Manual reset so the supervisor sees a match made before it waited. */
+  watch->event = CreateEvent(0, true, false, 0);
+  if (! watch->event) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_READY_WATCH_FAILED, service_name, pattern, error_string(GetLastError()), 0);
+    free_matcher(watch->matcher);
+    HeapFree(GetProcessHeap(), 0, watch);
+    return 0;
+  }
+
+  watch->refcount = 1;
+  return watch;
+}
+
+void acquire_ready_watch(ready_watch_t *watch) {
+  InterlockedIncrement(&watch->refcount);
+}
+
+void release_ready_watch(ready_watch_t *watch) {
+  if (InterlockedDecrement(&watch->refcount)) return;
+  CloseHandle(watch->event);
+  free_matcher(watch->matcher);
+  HeapFree(GetProcessHeap(), 0, watch);
+}
+
+/* Start looking for the pattern in output from a new process. */
+void arm_ready_watch(ready_watch_t *watch) {
+  ResetEvent(watch->event);
+  InterlockedExchange(&watch->armed, 1);
+}
+
+void disarm_ready_watch(ready_watch_t *watch) {
+  InterlockedExchange(&watch->armed, 0);
+}
+
+/*
+  Called by a logging thread for each line of output while the watch is
+  armed.  The scratch space must come from alloc_match_scratch().
+*/
+void watch_ready_line(ready_watch_t *watch, unsigned long *scratch, const char *line, size_t len) {
+  bool matched;
+  if (! match_line(watch->matcher, scratch, line, len, &matched)) return;
+  if (InterlockedExchange(&watch->armed, 0)) SetEvent(watch->event);
+}
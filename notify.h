@@ -0,0 +1,56 @@
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+/*
+  Readiness notification.  The application finds the name of a pipe in its
+  environment and writes the line READY=1 to it once it is ready to serve.
+*/
+#define NSSM_NOTIFY_PIPE _T("\\\\.\\pipe\\nssm-notify-%s-%lu-%lu")
+#define NSSM_NOTIFY_PIPE_LENGTH 256
+#define NSSM_NOTIFY_VARIABLE _T("NSSM_NOTIFY_PIPE")
+#define NSSM_NOTIFY_READY "READY=1"
+#define NSSM_NOTIFY_BUFFER_SIZE 256
+
+/* Results of await_ready(). */
+#define NSSM_NOTIFY_STATUS_READY 0
+#define NSSM_NOTIFY_STATUS_TIMEOUT 1
+#define NSSM_NOTIFY_STATUS_EXITED 2
+#define NSSM_NOTIFY_STATUS_FAILED -1
+
+typedef struct {
+  TCHAR *name;
+  HANDLE pipe;
+  OVERLAPPED overlapped;
+  bool connected;
+  char buffer[NSSM_NOTIFY_BUFFER_SIZE];
+  unsigned long used;
+} notifier_t;
+
+/*
+  Readiness inferred from output.  Logging threads test lines against the
+  pattern while the watch is armed and set the event on a match.
+*/
+typedef struct {
+  matcher_t *matcher;
+  HANDLE event;
+  volatile long armed;
+  long refcount;
+} ready_watch_t;
+
+/* Lines longer than this are matched on their start only. */
+#define NSSM_READY_LINE_LENGTH 4096
+/* Longer patterns make for a needlessly large automaton. */
+#define NSSM_READY_PATTERN_LENGTH 1024
+
+notifier_t *open_notifier(const TCHAR *, unsigned long);
+void close_notifier(notifier_t **);
+int await_ready(notifier_t *, ready_watch_t *, const TCHAR *, SERVICE_STATUS_HANDLE, SERVICE_STATUS *, HANDLE, unsigned long);
+int check_ready_pattern(const TCHAR *);
+ready_watch_t *open_ready_watch(const TCHAR *, const TCHAR *);
+void acquire_ready_watch(ready_watch_t *);
+void release_ready_watch(ready_watch_t *);
+void arm_ready_watch(ready_watch_t *);
+void disarm_ready_watch(ready_watch_t *);
+void watch_ready_line(ready_watch_t *, unsigned long *, const char *, size_t);
+
+#endif
@@ -1,8 +1,11 @@
 #include "nssm.h"
 
 extern unsigned long tls_index;
+extern unsigned long output_tls_index;
 extern bool is_admin;
 extern imports_t imports;
+extern CRITICAL_SECTION process_section;
+extern CRITICAL_SECTION hook_threads_section;
 
 static TCHAR unquoted_imagepath[PATH_LENGTH];
 static TCHAR imagepath[PATH_LENGTH];
@@ -255,17 +258,35 @@ int _tmain(int argc, TCHAR **argv) {
   GetModuleFileName(0, imagepath, _countof(imagepath));
   PathQuoteSpaces(imagepath);
 
+  /*
+    Thread local storage for the error message buffer and captured console
+    output.  Commands such as "nssm start --all-of" use them from several
+    threads.
+  */
+  tls_index = TlsAlloc();
+  output_tls_index = TlsAlloc();
+
   /* Elevate */
   if (argc > 1) {
     /*
       Valid commands are:
       start, stop, pause, continue, install, edit, get, set, reset, unset, remove
-      status, statuscode, rotate, list, processes, version
+      status, statuscode, rotate, reload, scale, list, processes, stats, trace, host, version
     */
     if (is_version(argv[1])) {
       _tprintf(_T("%s %s %s %s\n"), NSSM, NSSM_VERSION, NSSM_CONFIGURATION, NSSM_DATE);
       nssm_exit(0);
     }
+    /* nssm start|stop|restart --all-of <group> */
+    if (is_group_option(argc - 2, argv + 2)) {
+      if (str_equiv(argv[1], _T("start"))) nssm_exit(control_group(NSSM_SERVICE_CONTROL_START, argc - 2, argv + 2));
+      if (str_equiv(argv[1], _T("stop"))) nssm_exit(control_group(SERVICE_CONTROL_STOP, argc - 2, argv + 2));
+      if (str_equiv(argv[1], _T("restart"))) {
+        int ret = control_group(SERVICE_CONTROL_STOP, argc - 2, argv + 2);
+        if (ret) nssm_exit(ret);
+        nssm_exit(control_group(NSSM_SERVICE_CONTROL_START, argc - 2, argv + 2));
+      }
+    }
     if (str_equiv(argv[1], _T("start"))) nssm_exit(control_service(NSSM_SERVICE_CONTROL_START, argc - 2, argv + 2));
     if (str_equiv(argv[1], _T("stop"))) nssm_exit(control_service(SERVICE_CONTROL_STOP, argc - 2, argv + 2));
     if (str_equiv(argv[1], _T("restart"))) {
@@ -278,6 +299,8 @@ int _tmain(int argc, TCHAR **argv) {
     if (str_equiv(argv[1], _T("status"))) nssm_exit(control_service(SERVICE_CONTROL_INTERROGATE, argc - 2, argv + 2));
     if (str_equiv(argv[1], _T("statuscode"))) nssm_exit(control_service(SERVICE_CONTROL_INTERROGATE, argc - 2, argv + 2, true));
     if (str_equiv(argv[1], _T("rotate"))) nssm_exit(control_service(NSSM_SERVICE_CONTROL_ROTATE, argc - 2, argv + 2));
+    if (str_equiv(argv[1], _T("reload"))) nssm_exit(control_service(NSSM_SERVICE_CONTROL_RELOAD, argc - 2, argv + 2));
+    if (str_equiv(argv[1], _T("scale"))) nssm_exit(control_service(NSSM_SERVICE_CONTROL_SCALE, argc - 2, argv + 2));
     if (str_equiv(argv[1], _T("install"))) {
       if (! is_admin) nssm_exit(elevate(argc, argv, NSSM_MESSAGE_NOT_ADMINISTRATOR_CANNOT_INSTALL));
       create_messages();
@@ -292,14 +315,17 @@ int _tmain(int argc, TCHAR **argv) {
     }
     if (str_equiv(argv[1], _T("list"))) nssm_exit(list_nssm_services(argc - 2, argv + 2));
     if (str_equiv(argv[1], _T("processes"))) nssm_exit(service_process_tree(argc - 2, argv + 2));
+    if (str_equiv(argv[1], _T("stats"))) nssm_exit(print_stats(argc - 2, argv + 2));
+    if (str_equiv(argv[1], _T("trace"))) nssm_exit(print_trace(argc - 2, argv + 2));
     if (str_equiv(argv[1], _T("remove"))) {
       if (! is_admin) nssm_exit(elevate(argc, argv, NSSM_MESSAGE_NOT_ADMINISTRATOR_CANNOT_REMOVE));
       nssm_exit(pre_remove_service(argc - 2, argv + 2));
     }
   }
 
-  /* Thread local storage for error message buffer */
-  tls_index = TlsAlloc();
+  /* Hosted services share our environment, console and hook threads. */
+  InitializeCriticalSection(&process_section);
+  InitializeCriticalSection(&hook_threads_section);
 
   /* Register messages */
   if (is_admin) create_messages();
@@ -315,6 +341,9 @@ int _tmain(int argc, TCHAR **argv) {
     This will save time when running with no arguments from a command prompt.
   */
   if (! GetStdHandle(STD_INPUT_HANDLE)) {
+    /* Run a group of services in this process. */
+    if (argc > 2 && str_equiv(argv[1], _T("host"))) nssm_exit(host_services(argv[2]));
+
     /* Start service magic */
     SERVICE_TABLE_ENTRY table[] = { { NSSM, service_main }, { 0, 0 } };
     if (! StartServiceCtrlDispatcher(table)) {
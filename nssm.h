@@ -35,6 +35,10 @@
 #define _WIN32_WINNT 0x0500
 
 #define APSTUDIO_HIDDEN_SYMBOLS
+#ifndef NSSM_COMPILE_RC
+/* Must be included before windows.h. */
+#include <winsock2.h>
+#endif
 #include <windows.h>
 #include <prsht.h>
 #undef APSTUDIO_HIDDEN_SYMBOLS
@@ -47,6 +51,19 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include "utf8.h"
+#include "match.h"
+#include "route.h"
+#include "stats.h"
+#include "platform.h"
+#include "cpuset.h"
+#include "backoff.h"
+#include "notify.h"
+#include "probe.h"
+#include "watchdog.h"
+#include "sampler.h"
+#include "recycle.h"
+#include "metrics.h"
+#include "listen.h"
 #include "service.h"
 #include "account.h"
 #include "console.h"
@@ -54,6 +71,9 @@
 #include "event.h"
 #include "hook.h"
 #include "imports.h"
+#include "job.h"
+#include "worker.h"
+#include "group.h"
 #include "messages.h"
 #include "process.h"
 #include "registry.h"
@@ -94,6 +114,26 @@ const TCHAR *nssm_exe();
 */
 #define NSSM_RESET_THROTTLE_RESTART 1500
 
+/*
+  Throttled restarts are delayed by this many milliseconds, growing
+  according to the throttle policy up to the cap.  Override in registry.
+*/
+#define NSSM_THROTTLE_BASE 1000
+#define NSSM_THROTTLE_CAP 128000
+/*
+  With the Decaying policy one throttled restart is forgiven for every
+  this many milliseconds of uptime.  Override in registry.
+*/
+#define NSSM_THROTTLE_DECAY 60000
+
+/*
+  A tripped circuit breaker counts failures within this many milliseconds
+  and then waits this many milliseconds between trial restarts.  Override
+  in registry.
+*/
+#define NSSM_BREAKER_WINDOW 300000
+#define NSSM_BREAKER_RETRY 600000
+
 /*
   How many milliseconds to wait for the application to die after sending
   a Control-C event to its console.  Override in registry.
@@ -113,6 +153,27 @@ const TCHAR *nssm_exe();
 /* How many milliseconds to pause after rotating logs. */
 #define NSSM_ROTATE_DELAY 0
 
+/* Maximum size of a multi-line record before a new timestamp is forced. */
+#define NSSM_TIMESTAMP_GROUP_BYTES 65536
+
+/*
+  How many milliseconds to wait for an application which uses readiness
+  notification to report that it is ready.  Override in registry.
+*/
+#define NSSM_READY_TIMEOUT 30000
+
+/*
+  Health probes run every this many milliseconds and fail if they don't
+  succeed within the timeout.  Override in registry.
+*/
+#define NSSM_PROBE_INTERVAL 10000
+#define NSSM_PROBE_TIMEOUT 5000
+/*
+  How many consecutive health probes must fail before the application is
+  considered unhealthy.  Override in registry.
+*/
+#define NSSM_PROBE_FAILURES 3
+
 /* Margin of error for service status wait hints in milliseconds. */
 #define NSSM_WAITHINT_MARGIN 2000
 
@@ -135,6 +196,9 @@ const TCHAR *nssm_exe();
 #define NSSM_EXIT_UNCLEAN 3
 #define NSSM_NUM_EXIT_ACTIONS 4
 
+/* Exit code used to look up the exit action for an application killed as unhealthy. */
+#define NSSM_UNHEALTHY_EXITCODE ERROR_TIMEOUT
+
 /* Process priority. */
 #define NSSM_REALTIME_PRIORITY 0
 #define NSSM_HIGH_PRIORITY 1
@@ -149,6 +213,8 @@ const TCHAR *nssm_exe();
 /* User-defined service controls can be in the range 128-255. */
 #define NSSM_SERVICE_CONTROL_START 0
 #define NSSM_SERVICE_CONTROL_ROTATE 128
+#define NSSM_SERVICE_CONTROL_RELOAD 129
+#define NSSM_SERVICE_CONTROL_SCALE 130
 
 /* How many milliseconds to wait for a hook. */
 #define NSSM_HOOK_DEADLINE 60000
@@ -0,0 +1,90 @@
+#include "nssm.h"
+
+/* Milliseconds from an arbitrary starting point. */
+platform_u64_t platform_clock() {
+  LARGE_INTEGER frequency, now;
+  if (QueryPerformanceFrequency(&frequency) && QueryPerformanceCounter(&now)) return (platform_u64_t) (now.QuadPart / (frequency.QuadPart / 1000));
+  return (platform_u64_t) GetTickCount();
+}
+
+void platform_sleep(unsigned long ms) {
+  Sleep(ms == PLATFORM_INFINITE ? INFINITE : ms);
+}
+
+/* The write end is inheritable so it can be given to a child process. */
+int platform_pipe(platform_file_t *read_handle, platform_file_t *write_handle) {
+  if (! CreatePipe(read_handle, write_handle, 0, 0)) return 1;
+  SetHandleInformation(*write_handle, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+  return 0;
+}
+
+/* CPU rate control needs Windows 8 headers. */
+#define PLATFORM_JOB_CPU_RATE_CONTROL_INFORMATION 15
+#define PLATFORM_JOB_CPU_RATE_CONTROL_ENABLE 0x1
+#define PLATFORM_JOB_CPU_RATE_CONTROL_HARD_CAP 0x4
+
+typedef struct {
+  unsigned long flags;
+  unsigned long rate;
+} platform_cpu_rate_t;
+
+/*
+  Place a process, which should still be suspended, in a new job object
+  with the given limits.  The job doesn't kill the tree when it is closed.
+  Returns PLATFORM_LIMIT_OK or the step which failed, with the error in
+  GetLastError().
+*/
+int platform_limit(platform_process_t process, const platform_limits_t *limits, platform_job_t *job) {
+  *job = CreateJobObject(0, 0);
+  if (! *job) return PLATFORM_LIMIT_CREATE_FAILED;
+
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION info;
+  ZeroMemory(&info, sizeof(info));
+  if (limits->memory) {
+    info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+    info.JobMemoryLimit = (SIZE_T) limits->memory;
+  }
+  if (limits->processes) {
+    info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_ACTIVE_PROCESS;
+    info.BasicLimitInformation.ActiveProcessLimit = limits->processes;
+  }
+  if (limits->max_working_set) {
+    info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_WORKINGSET;
+    info.BasicLimitInformation.MinimumWorkingSetSize = (SIZE_T) limits->min_working_set;
+    info.BasicLimitInformation.MaximumWorkingSetSize = (SIZE_T) limits->max_working_set;
+  }
+
+  unsigned long error;
+  if (info.BasicLimitInformation.LimitFlags && ! SetInformationJobObject(*job, JobObjectExtendedLimitInformation, &info, sizeof(info))) {
+    error = GetLastError();
+    platform_close_job(job);
+    SetLastError(error);
+    return PLATFORM_LIMIT_SET_FAILED;
+  }
+
+  if (limits->cpu_rate) {
+    platform_cpu_rate_t rate;
+    rate.flags = PLATFORM_JOB_CPU_RATE_CONTROL_ENABLE | PLATFORM_JOB_CPU_RATE_CONTROL_HARD_CAP;
+    rate.rate = limits->cpu_rate;
+    if (! SetInformationJobObject(*job, (JOBOBJECTINFOCLASS) PLATFORM_JOB_CPU_RATE_CONTROL_INFORMATION, &rate, sizeof(rate))) {
+      error = GetLastError();
+      platform_close_job(job);
+      SetLastError(error);
+      return PLATFORM_LIMIT_CPU_RATE_FAILED;
+    }
+  }
+
+  if (! AssignProcessToJobObject(*job, process)) {
+    error = GetLastError();
+    platform_close_job(job);
+    SetLastError(error);
+    return PLATFORM_LIMIT_ASSIGN_FAILED;
+  }
+
+  return PLATFORM_LIMIT_OK;
+}
+
+void platform_close_job(platform_job_t *job) {
+  if (*job) CloseHandle(*job);
+  *job = 0;
+}
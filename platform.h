@@ -0,0 +1,49 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/*
+  Thin wrappers around the operating system facilities used by the logging
+  and supervision code: clock, sleep, the logging pipe and resource limits.
+  Only the types are defined for other systems, so that the portable parts
+  of NSSM such as the restart policies and AppAffinity parser can be built
+  and tested there with "make check".
+*/
+#ifdef _WIN32
+typedef TCHAR platform_char_t;
+typedef HANDLE platform_file_t;
+typedef HANDLE platform_process_t;
+typedef unsigned __int64 platform_u64_t;
+typedef HANDLE platform_job_t;
+#else
+typedef char platform_char_t;
+typedef unsigned long long platform_u64_t;
+#endif
+
+#ifdef _WIN32
+#define PLATFORM_INFINITE 0xffffffffUL
+
+/* Limits for a process tree.  Zero means no limit. */
+typedef struct {
+  platform_u64_t memory;
+  /* Hundredths of a percent of all CPUs. */
+  unsigned long cpu_rate;
+  unsigned long processes;
+  platform_u64_t min_working_set;
+  platform_u64_t max_working_set;
+} platform_limits_t;
+
+/* Results of platform_limit(). */
+#define PLATFORM_LIMIT_OK 0
+#define PLATFORM_LIMIT_CREATE_FAILED 1
+#define PLATFORM_LIMIT_SET_FAILED 2
+#define PLATFORM_LIMIT_CPU_RATE_FAILED 3
+#define PLATFORM_LIMIT_ASSIGN_FAILED 4
+
+platform_u64_t platform_clock();
+void platform_sleep(unsigned long);
+int platform_pipe(platform_file_t *, platform_file_t *);
+int platform_limit(platform_process_t, const platform_limits_t *, platform_job_t *);
+void platform_close_job(platform_job_t *);
+#endif
+
+#endif
@@ -0,0 +1,418 @@
+#include "nssm.h"
+
+extern CRITICAL_SECTION process_section;
+
+static const TCHAR *probe_type_strings[] = { _T("tcp"), _T("http"), _T("cmd"), NULL };
+
+static long winsock_started;
+
+/* Winsock is only needed if a service actually uses the network. */
+int start_winsock() {
+  if (InterlockedCompareExchange(&winsock_started, 1, 0)) return 0;
+
+  WSADATA data;
+  int error = WSAStartup(MAKEWORD(2, 2), &data);
+  if (error) {
+    InterlockedExchange(&winsock_started, 0);
+    WSASetLastError(error);
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+  Create a socket which no child process will inherit.  Sockets are
+  inheritable when they are created, so the flag is cleared while holding
+  process_section, which every launcher holds while it creates a process
+  which inherits handles.
+*/
+SOCKET open_socket(int family, int type, int protocol) {
+  EnterCriticalSection(&process_section);
+  SOCKET s = socket(family, type, protocol);
+  int error = WSAGetLastError();
+  if (s != INVALID_SOCKET) SetHandleInformation((HANDLE) s, HANDLE_FLAG_INHERIT, 0);
+  LeaveCriticalSection(&process_section);
+  WSASetLastError(error);
+  return s;
+}
+
+/*
+  Split a probe string into its type and argument.  For network probes the
+  argument is the port, optionally followed by a path.
+  Returns: 0 if the probe is valid.
+           1 if it isn't.
+*/
+int parse_probe(const TCHAR *spec, unsigned long *type, unsigned short *port, const TCHAR **argument) {
+  const TCHAR *separator = _tcschr(spec, NSSM_PROBE_SEPARATOR);
+  if (! separator) return 1;
+
+  size_t len = separator - spec;
+  unsigned long i;
+  for (i = 0; probe_type_strings[i]; i++) {
+    if (_tcslen(probe_type_strings[i]) == len && ! _tcsnicmp(spec, probe_type_strings[i], len)) break;
+  }
+  if (! probe_type_strings[i]) return 1;
+
+  const TCHAR *s = separator + 1;
+  if (i == NSSM_PROBE_COMMAND) {
+    if (! *s) return 1;
+    if (type) *type = i;
+    if (argument) *argument = s;
+    return 0;
+  }
+
+  unsigned long number = 0;
+  const TCHAR *digits = s;
+  while (*s >= _T('0') && *s <= _T('9')) {
+    number = number * 10 + (*s++ - _T('0'));
+    if (number > 65535) return 1;
+  }
+  if (s == digits || ! number) return 1;
+  if (*s && (i != NSSM_PROBE_HTTP || *s != _T('/'))) return 1;
+
+  if (type) *type = i;
+  if (port) *port = (unsigned short) number;
+  if (argument) *argument = s;
+  return 0;
+}
+
+/* Milliseconds left before the probe times out. */
+static inline unsigned long probe_remaining(probe_t *probe, unsigned long started) {
+  unsigned long elapsed = GetTickCount() - started;
+  if (elapsed >= probe->timeout) return 0;
+  return probe->timeout - elapsed;
+}
+
+/*
+  Wait for a socket to become readable or writable.
+  Returns: 0 if it did.
+           1 on error or timeout, with the error in *error.
+*/
+static int probe_select(SOCKET s, bool write, unsigned long timeout, unsigned long *error) {
+  fd_set ready, failed;
+  FD_ZERO(&ready);
+  FD_ZERO(&failed);
+  FD_SET(s, &ready);
+  FD_SET(s, &failed);
+
+  struct timeval tv;
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+
+  int ret = select(0, write ? 0 : &ready, write ? &ready : 0, &failed, &tv);
+  if (ret == SOCKET_ERROR) {
+    *error = WSAGetLastError();
+    return 1;
+  }
+  if (! ret) {
+    *error = WSAETIMEDOUT;
+    return 1;
+  }
+
+  /* A failed connection is reported as an exception. */
+  if (FD_ISSET(s, &failed)) {
+    int so_error = 0;
+    int len = sizeof(so_error);
+    getsockopt(s, SOL_SOCKET, SO_ERROR, (char *) &so_error, &len);
+    *error = so_error ? so_error : WSAECONNREFUSED;
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Connect to the probe port on the loopback interface. */
+static SOCKET probe_connect(probe_t *probe, unsigned long started, unsigned long *error) {
+  SOCKET s = open_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (s == INVALID_SOCKET) {
+    *error = WSAGetLastError();
+    return s;
+  }
+
+  unsigned long nonblocking = 1;
+  ioctlsocket(s, FIONBIO, &nonblocking);
+
+  struct sockaddr_in address;
+  ZeroMemory(&address, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(probe->port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (connect(s, (struct sockaddr *) &address, sizeof(address)) == SOCKET_ERROR) {
+    *error = WSAGetLastError();
+    if (*error == WSAEWOULDBLOCK && ! probe_select(s, true, probe_remaining(probe, started), error)) return s;
+    closesocket(s);
+    return INVALID_SOCKET;
+  }
+
+  return s;
+}
+
+static int probe_tcp(probe_t *probe, TCHAR *reason, unsigned long reasonlen) {
+  unsigned long started = GetTickCount();
+  unsigned long error = 0;
+  SOCKET s = probe_connect(probe, started, &error);
+  if (s == INVALID_SOCKET) {
+    _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("%s"), error_string(error));
+    return 1;
+  }
+
+  closesocket(s);
+  return 0;
+}
+
+static int probe_http(probe_t *probe, TCHAR *reason, unsigned long reasonlen) {
+  unsigned long started = GetTickCount();
+  unsigned long error = 0;
+  SOCKET s = probe_connect(probe, started, &error);
+  if (s == INVALID_SOCKET) {
+    _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("%s"), error_string(error));
+    return 1;
+  }
+
+  /* Send the request. */
+  int len = (int) strlen(probe->request);
+  int sent = 0;
+  while (sent < len) {
+    int ret = send(s, probe->request + sent, len - sent, 0);
+    if (ret == SOCKET_ERROR) {
+      error = WSAGetLastError();
+      if (error == WSAEWOULDBLOCK && ! probe_select(s, true, probe_remaining(probe, started), &error)) continue;
+      _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("%s"), error_string(error));
+      closesocket(s);
+      return 1;
+    }
+    sent += ret;
+  }
+
+  /* Read the status line. */
+  char response[NSSM_PROBE_RESPONSE_LENGTH + 1];
+  int received = 0;
+  while (received < NSSM_PROBE_RESPONSE_LENGTH) {
+    if (probe_select(s, false, probe_remaining(probe, started), &error)) {
+      _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("%s"), error_string(error));
+      closesocket(s);
+      return 1;
+    }
+    int ret = recv(s, response + received, NSSM_PROBE_RESPONSE_LENGTH - received, 0);
+    if (ret == SOCKET_ERROR) {
+      if (WSAGetLastError() == WSAEWOULDBLOCK) continue;
+      _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("%s"), error_string(WSAGetLastError()));
+      closesocket(s);
+      return 1;
+    }
+    if (! ret) break;
+    received += ret;
+    response[received] = '\0';
+    if (strchr(response, '\n')) break;
+  }
+  closesocket(s);
+  response[received] = '\0';
+
+  /* HTTP/1.x NNN */
+  char *eol = strpbrk(response, "\r\n");
+  if (eol) *eol = '\0';
+  int status = 0;
+  if (! strncmp(response, "HTTP/", 5)) {
+    char *code = strchr(response, ' ');
+    if (code) status = atoi(code + 1);
+  }
+  if (status >= 200 && status < 400) return 0;
+
+  if (status) _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("HTTP status %d"), status);
+  else _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("invalid response"));
+  return 1;
+}
+
+static int probe_command(probe_t *probe, TCHAR *reason, unsigned long reasonlen) {
+  /* CreateProcess() may modify the command line. */
+  size_t len = _tcslen(probe->command) + 1;
+  TCHAR *cmd = (TCHAR *) HeapAlloc(GetProcessHeap(), 0, len * sizeof(TCHAR));
+  if (! cmd) {
+    _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("%s"), error_string(ERROR_OUTOFMEMORY));
+    return 1;
+  }
+  memmove(cmd, probe->command, len * sizeof(TCHAR));
+
+  STARTUPINFO si;
+  ZeroMemory(&si, sizeof(si));
+  si.cb = sizeof(si);
+  PROCESS_INFORMATION pi;
+  ZeroMemory(&pi, sizeof(pi));
+
+  if (! CreateProcess(0, cmd, 0, 0, false, CREATE_NO_WINDOW, 0, probe->dir, &si, &pi)) {
+    _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("%s"), error_string(GetLastError()));
+    HeapFree(GetProcessHeap(), 0, cmd);
+    return 1;
+  }
+  HeapFree(GetProcessHeap(), 0, cmd);
+  CloseHandle(pi.hThread);
+
+  int ret = 0;
+  unsigned long exitcode;
+  if (WaitForSingleObject(pi.hProcess, probe->timeout) != WAIT_OBJECT_0) {
+    TerminateProcess(pi.hProcess, ERROR_TIMEOUT);
+    _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("%s"), error_string(ERROR_TIMEOUT));
+    ret = 1;
+  }
+  else if (! GetExitCodeProcess(pi.hProcess, &exitcode) || exitcode) {
+    _sntprintf_s(reason, reasonlen, _TRUNCATE, _T("exit code %lu"), exitcode);
+    ret = 1;
+  }
+  CloseHandle(pi.hProcess);
+
+  return ret;
+}
+
+/* Timer queue callback. */
+static void CALLBACK run_probe(void *arg, BOOLEAN fired) {
+  probe_t *probe = (probe_t *) arg;
+  if (probe->tripped) return;
+
+  /* A slow probe may still be running when the timer fires again. */
+  if (InterlockedCompareExchange(&probe->busy, 1, 0)) return;
+
+  TCHAR reason[256];
+  int ret;
+  switch (probe->type) {
+    case NSSM_PROBE_TCP: ret = probe_tcp(probe, reason, _countof(reason)); break;
+    case NSSM_PROBE_HTTP: ret = probe_http(probe, reason, _countof(reason)); break;
+    default: ret = probe_command(probe, reason, _countof(reason)); break;
+  }
+
+  if (! ret) {
+    if (probe->failures) log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_PROBE_RECOVERED, probe->service_name, probe->spec, 0);
+    probe->failures = 0;
+    SetEvent(probe->healthy);
+  }
+  else {
+    TCHAR count[16], threshold[16];
+    _sntprintf_s(count, _countof(count), _TRUNCATE, _T("%lu"), ++probe->failures);
+    _sntprintf_s(threshold, _countof(threshold), _TRUNCATE, _T("%lu"), probe->threshold);
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_PROBE_FAILED, probe->service_name, probe->spec, count, threshold, reason, 0);
+
+    if (probe->failures >= probe->threshold) {
+      InterlockedExchange(&probe->tripped, 1);
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_PROBE_UNHEALTHY, probe->service_name, count, 0);
+      probe->unhealthy(probe->arg);
+    }
+  }
+
+  InterlockedExchange(&probe->busy, 0);
+}
+
+/*
+  Start probing every interval milliseconds.  The unhealthy callback runs
+  on a timer thread after threshold consecutive failures, and no more
+  probes are made after that.
+  Returns a probe to be closed with close_probe() or NULL on error.
+*/
+probe_t *open_probe(const TCHAR *service_name, const TCHAR *spec, const TCHAR *dir, unsigned long interval, unsigned long timeout, unsigned long threshold, probe_unhealthy_t unhealthy, void *arg) {
+  unsigned long type;
+  unsigned short port;
+  const TCHAR *argument;
+  if (parse_probe(spec, &type, &port, &argument)) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_BOGUS_PROBE, service_name, spec, 0);
+    return 0;
+  }
+
+  if (type != NSSM_PROBE_COMMAND && start_winsock()) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_WSASTARTUP_FAILED, service_name, error_string(WSAGetLastError()), 0);
+    return 0;
+  }
+
+  probe_t *probe = (probe_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(probe_t));
+  if (! probe) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("probe"), _T("open_probe()"), 0);
+    return 0;
+  }
+
+  probe->service_name = service_name;
+  probe->type = type;
+  probe->port = port;
+  probe->timeout = timeout;
+  probe->threshold = threshold ? threshold : 1;
+  probe->unhealthy = unhealthy;
+  probe->arg = arg;
+
+  /* The service's strings are reallocated when it restarts. */
+  probe->spec = copy_path((TCHAR *) spec);
+  probe->dir = copy_path((TCHAR *) dir);
+  if (! probe->spec || ! probe->dir) {
+    close_probe(&probe);
+    return 0;
+  }
+  probe->command = probe->spec + (argument - spec);
+
+  if (type == NSSM_PROBE_HTTP) {
+    char *path;
+    if (to_utf8(*argument ? argument : _T("/"), &path, 0)) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("probe request"), _T("open_probe()"), 0);
+      close_probe(&probe);
+      return 0;
+    }
+
+    const char *format = "GET %s HTTP/1.0\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    size_t len = strlen(format) + strlen(path) + 1;
+    probe->request = (char *) HeapAlloc(GetProcessHeap(), 0, len);
+    if (! probe->request) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("probe request"), _T("open_probe()"), 0);
+      HeapFree(GetProcessHeap(), 0, path);
+      close_probe(&probe);
+      return 0;
+    }
+    _snprintf_s(probe->request, len, _TRUNCATE, format, path);
+    HeapFree(GetProcessHeap(), 0, path);
+  }
+
+  /* Manual reset so await_probe() sees a success made before it waited. */
+  probe->healthy = CreateEvent(0, true, false, 0);
+  if (! probe->healthy) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("probe event"), _T("open_probe()"), 0);
+    close_probe(&probe);
+    return 0;
+  }
+
+  if (! CreateTimerQueueTimer(&probe->timer, 0, run_probe, (void *) probe, interval, interval, WT_EXECUTELONGFUNCTION)) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATETIMERQUEUETIMER_FAILED, service_name, error_string(GetLastError()), 0);
+    probe->timer = 0;
+    close_probe(&probe);
+    return 0;
+  }
+
+  return probe;
+}
+
+/*
+  Wait for the first successful probe.  Pass a duplicate of the probe's
+  healthy event if the probe might be closed while we wait.
+  Returns: 0 if a probe succeeded.
+           1 if the process exited first.
+           2 if no probe succeeded within timeout milliseconds.
+*/
+int await_probe(HANDLE healthy, HANDLE process_handle, unsigned long timeout) {
+  HANDLE handles[2] = { healthy, process_handle };
+  switch (WaitForMultipleObjects(2, handles, false, timeout)) {
+    case WAIT_OBJECT_0: return 0;
+    case WAIT_OBJECT_0 + 1: return 1;
+  }
+  return 2;
+}
+
+/*
+  Stop probing, waiting for a probe in progress to finish.  Must not be
+  called from the unhealthy callback.
+*/
+void close_probe(probe_t **probe_ptr) {
+  probe_t *probe = *probe_ptr;
+  if (! probe) return;
+
+  if (probe->timer) DeleteTimerQueueTimer(0, probe->timer, INVALID_HANDLE_VALUE);
+  if (probe->healthy) CloseHandle(probe->healthy);
+  if (probe->spec) HeapFree(GetProcessHeap(), 0, probe->spec);
+  if (probe->dir) HeapFree(GetProcessHeap(), 0, probe->dir);
+  if (probe->request) HeapFree(GetProcessHeap(), 0, probe->request);
+  HeapFree(GetProcessHeap(), 0, probe);
+  *probe_ptr = 0;
+}
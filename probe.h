@@ -0,0 +1,51 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+/*
+  Active health probes.  A probe is a string such as
+
+    tcp:8080            connect to 127.0.0.1:8080
+    http:8080/health    GET /health from 127.0.0.1:8080 and expect 2xx or 3xx
+    cmd:<command line>  run a command and expect it to exit with code 0
+
+  Probes run on the process's shared timer queue so one thread pool serves
+  every hosted service.
+*/
+#define NSSM_PROBE_TCP 0
+#define NSSM_PROBE_HTTP 1
+#define NSSM_PROBE_COMMAND 2
+
+#define NSSM_PROBE_SEPARATOR _T(':')
+
+/* Enough of an HTTP response to read the status line. */
+#define NSSM_PROBE_RESPONSE_LENGTH 64
+
+typedef void (*probe_unhealthy_t)(void *);
+
+typedef struct {
+  const TCHAR *service_name;
+  TCHAR *spec;
+  unsigned long type;
+  unsigned short port;
+  char *request;
+  const TCHAR *command;
+  TCHAR *dir;
+  unsigned long timeout;
+  unsigned long threshold;
+  unsigned long failures;
+  volatile long busy;
+  volatile long tripped;
+  HANDLE timer;
+  HANDLE healthy;
+  probe_unhealthy_t unhealthy;
+  void *arg;
+} probe_t;
+
+int start_winsock();
+SOCKET open_socket(int, int, int);
+int parse_probe(const TCHAR *, unsigned long *, unsigned short *, const TCHAR **);
+probe_t *open_probe(const TCHAR *, const TCHAR *, const TCHAR *, unsigned long, unsigned long, unsigned long, probe_unhealthy_t, void *);
+int await_probe(HANDLE, HANDLE, unsigned long);
+void close_probe(probe_t **);
+
+#endif
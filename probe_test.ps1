@@ -0,0 +1,148 @@
+<#
+  Integration test of AppProbe against a stand-in HTTP server.  Installs a
+  throwaway service whose probe points at the server, switches the server
+  between healthy, slow, failing and flapping responses and checks from
+  "nssm stats" whether NSSM restarted the application.
+
+  Needs Windows and an elevated PowerShell:
+
+    powershell -ExecutionPolicy Bypass -File probe_test.ps1 -Nssm out\Release\win64\nssm.exe
+#>
+param(
+  [string] $Nssm = "nssm.exe",
+  [string] $Service = "nssm-probe-test",
+  [int] $Port = 18080
+)
+
+$ErrorActionPreference = "Stop"
+$Nssm = (Resolve-Path $Nssm).Path
+
+# Probe every half second, give up after 300ms and restart after 3 failures.
+$interval = 500
+$timeout = 300
+$threshold = 3
+$unhealthy = 1460
+
+$failures = 0
+function Check([bool] $ok, [string] $what) {
+  if ($ok) { return }
+  Write-Host "FAIL: $what"
+  $script:failures++
+}
+
+# The stand-in server runs in its own runspace and answers one request at a time.
+$state = [hashtable]::Synchronized(@{ Mode = "healthy"; Delay = $timeout * 3; Requests = 0; Stop = $false })
+$listener = New-Object System.Net.Sockets.TcpListener ([System.Net.IPAddress]::Loopback), $Port
+$listener.Start()
+
+$server = {
+  param($listener, $state)
+  while (-not $state.Stop) {
+    if (-not $listener.Pending()) {
+      Start-Sleep -Milliseconds 20
+      continue
+    }
+    $client = $listener.AcceptTcpClient()
+    try {
+      $stream = $client.GetStream()
+      $buffer = New-Object byte[] 1024
+      [void] $stream.Read($buffer, 0, $buffer.Length)
+      $state.Requests++
+      $status = "200 OK"
+      switch ($state.Mode) {
+        "slow" { Start-Sleep -Milliseconds $state.Delay }
+        "failing" { $status = "500 Internal Server Error" }
+        "flapping" { if ($state.Requests % 2) { $status = "503 Service Unavailable" } }
+      }
+      $response = [System.Text.Encoding]::ASCII.GetBytes("HTTP/1.0 $status`r`nContent-Length: 0`r`nConnection: close`r`n`r`n")
+      $stream.Write($response, 0, $response.Length)
+    }
+    catch {}
+    finally {
+      $client.Close()
+    }
+  }
+}
+
+$thread = [powershell]::Create()
+[void] $thread.AddScript($server).AddArgument($listener).AddArgument($state)
+$handle = $thread.BeginInvoke()
+
+# Exit count and last exit code from "nssm stats".
+function Get-Exits {
+  $line = & $Nssm stats $Service | Select-String "exits (\d+) .*exit code (\d+)"
+  if (-not $line) { throw "nssm stats $Service printed no supervision counters" }
+  return @([int] $line.Matches[0].Groups[1].Value, [int] $line.Matches[0].Groups[2].Value)
+}
+
+function Set-Mode([string] $mode) {
+  $state.Mode = $mode
+  $state.Requests = 0
+}
+
+function Wait-Probes([int] $count) {
+  Start-Sleep -Milliseconds ($interval * $count + $timeout)
+}
+
+try {
+  $app = Join-Path $env:SystemRoot "System32\WindowsPowerShell\v1.0\powershell.exe"
+  & $Nssm install $Service $app "-NoProfile -Command Start-Sleep -Seconds 86400" | Out-Null
+  & $Nssm set $Service AppProbe "http:$Port/health" | Out-Null
+  & $Nssm set $Service AppProbeInterval $interval | Out-Null
+  & $Nssm set $Service AppProbeTimeout $timeout | Out-Null
+  & $Nssm set $Service AppProbeFailures $threshold | Out-Null
+  & $Nssm set $Service AppRestartDelay 0 | Out-Null
+  & $Nssm start $Service | Out-Null
+
+  # Healthy: probes reach the server and nothing is restarted.
+  Set-Mode "healthy"
+  Wait-Probes 10
+  $exits = Get-Exits
+  Check ($state.Requests -ge 5) "healthy server saw $($state.Requests) probes"
+  Check ($exits[0] -eq 0) "healthy application exited $($exits[0]) times"
+
+  # Flapping: failures are never consecutive so the application stays up.
+  Set-Mode "flapping"
+  Wait-Probes 10
+  $before = $exits[0]
+  $exits = Get-Exits
+  Check ($exits[0] -eq $before) "flapping server caused $($exits[0] - $before) restarts"
+
+  # Failing: the application is killed after $threshold failures.
+  Set-Mode "failing"
+  Wait-Probes ($threshold + 2)
+  $before = $exits[0]
+  $exits = Get-Exits
+  Check ($exits[0] -gt $before) "failing server caused no restart"
+  Check ($exits[1] -eq $unhealthy) "failing server left exit code $($exits[1])"
+
+  # Healthy again: the replacement is left alone.
+  Set-Mode "healthy"
+  Wait-Probes ($threshold + 2)
+  $before = (Get-Exits)[0]
+  Wait-Probes 10
+  $exits = Get-Exits
+  Check ($exits[0] -eq $before) "recovered server caused $($exits[0] - $before) restarts"
+
+  # Slow: a probe which times out counts as a failure.
+  Set-Mode "slow"
+  Wait-Probes (($threshold + 2) * 3)
+  $before = $exits[0]
+  $exits = Get-Exits
+  Check ($exits[0] -gt $before) "slow server caused no restart"
+  Check ($exits[1] -eq $unhealthy) "slow server left exit code $($exits[1])"
+}
+finally {
+  & $Nssm stop $Service | Out-Null
+  & $Nssm remove $Service confirm | Out-Null
+  $state.Stop = $true
+  [void] $thread.EndInvoke($handle)
+  $thread.Dispose()
+  $listener.Stop()
+}
+
+if ($failures) {
+  Write-Host "probe_test: $failures checks failed"
+  exit 1
+}
+Write-Host "probe_test: all checks passed"
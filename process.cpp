@@ -1,6 +1,10 @@
 #include "nssm.h"
 
 extern imports_t imports;
+extern CRITICAL_SECTION process_section;
+
+/* How many hosted services are ignoring console events, guarded by process_section. */
+static unsigned long console_ignore_count;
 
 HANDLE get_debug_token() {
   long error;
@@ -259,9 +263,13 @@ int kill_console(nssm_service_t *service, kill_t *k) {
   /* Check we loaded AttachConsole(). */
   if (! imports.AttachConsole) return 4;
 
+  /* We can only be attached to one console at a time. */
+  EnterCriticalSection(&process_section);
+
   /* Try to attach to the process's console. */
   if (! imports.AttachConsole(k->pid)) {
     ret = GetLastError();
+    LeaveCriticalSection(&process_section);
 
     switch (ret) {
       case ERROR_INVALID_HANDLE:
@@ -280,10 +288,12 @@ int kill_console(nssm_service_t *service, kill_t *k) {
     }
   }
 
-  /* Ignore the event ourselves. */
+  /* Ignore the event ourselves, unless another service already is. */
   ret = 0;
-  BOOL ignored = SetConsoleCtrlHandler(0, TRUE);
-  if (! ignored) {
+  BOOL ignored = TRUE;
+  if (! console_ignore_count) ignored = SetConsoleCtrlHandler(0, TRUE);
+  if (ignored) console_ignore_count++;
+  else {
     log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_SETCONSOLECTRLHANDLER_FAILED, k->name, error_string(GetLastError()), 0);
     ret = 4;
   }
@@ -301,12 +311,18 @@ int kill_console(nssm_service_t *service, kill_t *k) {
     log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_FREECONSOLE_FAILED, k->name, error_string(GetLastError()), 0);
   }
 
+  LeaveCriticalSection(&process_section);
+
   /* Wait for process to exit. */
   if (await_single_handle(k->status_handle, k->status, k->process_handle, k->name, _T(__FUNCTION__), k->kill_console_delay)) ret = 6;
 
-  /* Remove our handler. */
-  if (ignored && ! SetConsoleCtrlHandler(0, FALSE)) {
-    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_SETCONSOLECTRLHANDLER_FAILED, k->name, error_string(GetLastError()), 0);
+  /* Remove our handler if nobody else needs it. */
+  if (ignored) {
+    EnterCriticalSection(&process_section);
+    if (! --console_ignore_count && ! SetConsoleCtrlHandler(0, FALSE)) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_SETCONSOLECTRLHANDLER_FAILED, k->name, error_string(GetLastError()), 0);
+    }
+    LeaveCriticalSection(&process_section);
   }
 
   return ret;
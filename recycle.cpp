@@ -0,0 +1,393 @@
+#include "nssm.h"
+
+/* FILETIME units per minute. */
+#define RECYCLE_MINUTE 600000000ULL
+
+static int parse_schedule_number(const TCHAR **s, unsigned long min, unsigned long max, unsigned long *number) {
+  if (**s < _T('0') || **s > _T('9')) return 1;
+
+  TCHAR *end;
+  unsigned long n = _tcstoul(*s, &end, 10);
+  if (n < min || n > max) return 2;
+
+  *s = end;
+  *number = n;
+  return 0;
+}
+
+/*
+  Parse one field of a schedule, setting bit n of the mask if n matches.
+  The field is unrestricted if it starts with *, even if it has a step.
+*/
+static int parse_schedule_field(const TCHAR **s, unsigned long min, unsigned long max, unsigned __int64 *bits, bool *any) {
+  while (**s == _T(' ') || **s == _T('\t')) (*s)++;
+  *bits = 0;
+  *any = (**s == _T('*'));
+
+  while (true) {
+    unsigned long from, to, step = 1;
+    bool range = true;
+    if (**s == _T('*')) {
+      from = min;
+      to = max;
+      (*s)++;
+    }
+    else {
+      if (parse_schedule_number(s, min, max, &from)) return 1;
+      to = from;
+      if (**s == _T('-')) {
+        (*s)++;
+        if (parse_schedule_number(s, from, max, &to)) return 2;
+      }
+      else range = false;
+    }
+
+    if (**s == _T('/')) {
+      (*s)++;
+      if (parse_schedule_number(s, 1, max, &step)) return 3;
+      /* 5/15 means 5-59/15. */
+      if (! range) to = max;
+    }
+
+    for (unsigned long i = from; i <= to; i += step) *bits |= 1ULL << i;
+
+    if (**s != _T(',')) break;
+    (*s)++;
+  }
+
+  if (**s && **s != _T(' ') && **s != _T('\t')) return 4;
+  return 0;
+}
+
+/*
+  Parse a crontab-style schedule.
+  Returns 0 on success or the number of the first bad field.
+*/
+int parse_schedule(const TCHAR *string, schedule_t *schedule) {
+  schedule_t s;
+  ZeroMemory(&s, sizeof(s));
+  const TCHAR *p = string;
+  unsigned __int64 bits;
+  bool any;
+
+  if (parse_schedule_field(&p, 0, 59, &s.minutes, &any)) return 1;
+  if (parse_schedule_field(&p, 0, 23, &bits, &any)) return 2;
+  s.hours = (unsigned long) bits;
+  if (parse_schedule_field(&p, 1, 31, &bits, &s.any_day)) return 3;
+  s.days = (unsigned long) bits;
+  if (parse_schedule_field(&p, 1, 12, &bits, &any)) return 4;
+  s.months = (unsigned long) bits;
+  if (parse_schedule_field(&p, 0, 7, &bits, &s.any_weekday)) return 5;
+  /* Sunday is 0 or 7. */
+  if (bits & (1 << 7)) bits |= 1;
+  s.weekdays = (unsigned long) bits & 0x7f;
+
+  while (*p == _T(' ') || *p == _T('\t')) p++;
+  if (*p) return 6;
+
+  if (schedule) *schedule = s;
+  return 0;
+}
+
+static int parse_window_time(const TCHAR **s, unsigned long *minute) {
+  unsigned long hour, minutes;
+  while (**s == _T(' ') || **s == _T('\t')) (*s)++;
+  if (parse_schedule_number(s, 0, 23, &hour)) return 1;
+  if (**s != _T(':')) return 2;
+  (*s)++;
+  if (parse_schedule_number(s, 0, 59, &minutes)) return 3;
+  while (**s == _T(' ') || **s == _T('\t')) (*s)++;
+  *minute = hour * 60 + minutes;
+  return 0;
+}
+
+/*
+  Parse a maintenance window such as 02:00-04:30 into minutes since
+  midnight.  The window may span midnight.
+*/
+int parse_window(const TCHAR *string, unsigned long *start, unsigned long *end) {
+  const TCHAR *p = string;
+  unsigned long from, to;
+
+  if (parse_window_time(&p, &from)) return 1;
+  if (*p != _T('-')) return 2;
+  p++;
+  if (parse_window_time(&p, &to)) return 3;
+  if (*p) return 4;
+  if (from == to) return 5;
+
+  if (start) *start = from;
+  if (end) *end = to;
+  return 0;
+}
+
+static bool schedule_matches(schedule_t *schedule, SYSTEMTIME *st) {
+  if (! (schedule->minutes & (1ULL << st->wMinute))) return false;
+  if (! (schedule->hours & (1UL << st->wHour))) return false;
+  if (! (schedule->months & (1UL << st->wMonth))) return false;
+
+  bool day = (schedule->days & (1UL << st->wDay)) ? true : false;
+  bool weekday = (schedule->weekdays & (1UL << st->wDayOfWeek)) ? true : false;
+  if (schedule->any_day || schedule->any_weekday) return day && weekday;
+  return day || weekday;
+}
+
+/* Minutes since 1601 in local time. */
+static unsigned __int64 local_minute() {
+  SYSTEMTIME st;
+  FILETIME ft;
+  GetLocalTime(&st);
+  if (! SystemTimeToFileTime(&st, &ft)) return 0;
+  return filetime_value(&ft) / RECYCLE_MINUTE;
+}
+
+/* Check whether any minute since the last check matches the schedule. */
+static bool schedule_due(recycler_t *recycler) {
+  unsigned __int64 now = local_minute();
+  if (! now) return false;
+
+  unsigned __int64 minute = recycler->last_minute;
+  recycler->last_minute = now;
+
+  /* Don't repeat an hour when the clock goes back. */
+  if (now <= minute) return false;
+  if (now - minute > NSSM_RECYCLE_CATCH_UP) minute = now - NSSM_RECYCLE_CATCH_UP;
+
+  for (minute++; minute <= now; minute++) {
+    unsigned __int64 value = minute * RECYCLE_MINUTE;
+    FILETIME ft;
+    ft.dwLowDateTime = (unsigned long) value;
+    ft.dwHighDateTime = (unsigned long) (value >> 32);
+    SYSTEMTIME st;
+    if (! FileTimeToSystemTime(&ft, &st)) continue;
+    if (schedule_matches(&recycler->schedule, &st)) return true;
+  }
+
+  return false;
+}
+
+/*
+  Ask for the application to be recycled, unless another policy already
+  did.  If the request is vetoed, policies other than the schedule hold off
+  for a while rather than asking again at every check.
+*/
+static void trigger_recycle(recycler_t *recycler, const TCHAR *reason, bool hold) {
+  if (InterlockedExchange(&recycler->tripped, 1)) return;
+  if (recycler->recycle(recycler->arg, reason)) return;
+
+  if (hold) recycler->hold_until = platform_clock() + NSSM_RECYCLE_HOLDOFF;
+  InterlockedExchange(&recycler->tripped, 0);
+}
+
+static void CALLBACK run_recycler(void *arg, unsigned char fired) {
+  recycler_t *recycler = (recycler_t *) arg;
+  if (recycler->tripped) return;
+
+  if (recycler->scheduled && schedule_due(recycler)) {
+    trigger_recycle(recycler, NSSM_RECYCLE_REASON_SCHEDULE, false);
+    return;
+  }
+
+  if (! recycler->uptime || platform_clock() < recycler->hold_until) return;
+
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  unsigned __int64 value = filetime_value(&now);
+  if (value <= recycler->creation_time) return;
+  if ((value - recycler->creation_time) / 10000000ULL >= recycler->uptime) trigger_recycle(recycler, NSSM_RECYCLE_REASON_UPTIME, true);
+}
+
+/*
+  Seconds until the maintenance window next opens, or until it opens again
+  if it is open now.
+*/
+static unsigned long window_opens(recycler_t *recycler, bool *open) {
+  SYSTEMTIME st;
+  GetLocalTime(&st);
+  unsigned long minute = st.wHour * 60 + st.wMinute;
+
+  if (recycler->window_start < recycler->window_end) *open = (minute >= recycler->window_start && minute < recycler->window_end);
+  else *open = (minute >= recycler->window_start || minute < recycler->window_end);
+
+  unsigned long now = minute * 60 + st.wSecond;
+  unsigned long start = recycler->window_start * 60;
+  unsigned long seconds = (start + 86400 - now) % 86400;
+  return seconds ? seconds : 86400;
+}
+
+/* Record private bytes, keeping points evenly spread over the trend period. */
+static void record_point(recycler_t *recycler, unsigned __int64 now, unsigned __int64 bytes) {
+  if (recycler->num_points) {
+    recycle_point_t *last = &recycler->points[(recycler->next_point + NSSM_RECYCLE_TREND_POINTS - 1) % NSSM_RECYCLE_TREND_POINTS];
+    if (now - last->time < (unsigned __int64) recycler->trend * 1000 / NSSM_RECYCLE_TREND_POINTS) return;
+  }
+
+  recycler->points[recycler->next_point].time = now;
+  recycler->points[recycler->next_point].bytes = bytes;
+  recycler->next_point = (recycler->next_point + 1) % NSSM_RECYCLE_TREND_POINTS;
+  if (recycler->num_points < NSSM_RECYCLE_TREND_POINTS) recycler->num_points++;
+}
+
+/*
+  Fit a least-squares line through the recorded points.  Returns false
+  unless there is at least half a trend period of history and memory is
+  growing steadily rather than going up and down with the garbage collector.
+  The slope is in bytes per second and fitted is the value of the line now.
+*/
+static bool fit_trend(recycler_t *recycler, unsigned __int64 now, double *slope, double *fitted) {
+  unsigned long n = recycler->num_points;
+  if (n < NSSM_RECYCLE_TREND_MIN_POINTS) return false;
+
+  unsigned long first = (recycler->next_point + NSSM_RECYCLE_TREND_POINTS - n) % NSSM_RECYCLE_TREND_POINTS;
+  unsigned __int64 origin = recycler->points[first].time;
+  if (now - origin < (unsigned __int64) recycler->trend * 500) return false;
+
+  double mean_x = 0, mean_y = 0;
+  unsigned long i;
+  for (i = 0; i < n; i++) {
+    recycle_point_t *point = &recycler->points[(first + i) % NSSM_RECYCLE_TREND_POINTS];
+    mean_x += (double) (point->time - origin) / 1000.0;
+    mean_y += (double) point->bytes;
+  }
+  mean_x /= n;
+  mean_y /= n;
+
+  double sxx = 0, sxy = 0, syy = 0;
+  for (i = 0; i < n; i++) {
+    recycle_point_t *point = &recycler->points[(first + i) % NSSM_RECYCLE_TREND_POINTS];
+    double x = (double) (point->time - origin) / 1000.0 - mean_x;
+    double y = (double) point->bytes - mean_y;
+    sxx += x * x;
+    sxy += x * y;
+    syy += y * y;
+  }
+  if (sxx <= 0 || syy <= 0 || sxy <= 0) return false;
+
+  /* Compare the squared correlation coefficient with the minimum. */
+  double r = NSSM_RECYCLE_TREND_CORRELATION / 100.0;
+  if (sxy * sxy < sxx * syy * r * r) return false;
+
+  *slope = sxy / sxx;
+  *fitted = mean_y + *slope * ((double) (now - origin) / 1000.0 - mean_x);
+  return true;
+}
+
+/*
+  Predict when the application will reach its memory limit and decide when
+  to recycle it: as soon as the window opens if the limit would be reached
+  before the window after that, straight away if the limit is imminent.
+  Returns true if the application should be recycled now.
+*/
+static bool predict_leak(recycler_t *recycler, unsigned __int64 now) {
+  double slope, fitted;
+  if (! fit_trend(recycler, now, &slope, &fitted)) return false;
+
+  unsigned __int64 eta = 0;
+  if (fitted < (double) recycler->cap) eta = (unsigned __int64) (((double) recycler->cap - fitted) / slope);
+
+  unsigned __int64 delay;
+  if (eta <= NSSM_RECYCLE_LEAK_MARGIN) delay = 0;
+  else if (recycler->windowed) {
+    bool open;
+    unsigned long opens = window_opens(recycler, &open);
+    if (open && eta < opens) delay = 0;
+    else if (eta < (unsigned __int64) opens + 86400) delay = opens;
+    else return false;
+  }
+  else if (eta < NSSM_RECYCLE_LEAK_HORIZON) delay = eta - NSSM_RECYCLE_LEAK_MARGIN;
+  else return false;
+
+  if (! recycler->predicted) {
+    recycler->predicted = true;
+    if (recycler->predicted_leak) recycler->predicted_leak(recycler->arg, (unsigned __int64) (slope * 3600.0), eta, delay);
+  }
+
+  return (delay == 0);
+}
+
+/* Track how long a value has been above its threshold. */
+static bool sustained(unsigned __int64 *since, unsigned __int64 threshold, unsigned __int64 value, unsigned __int64 now, unsigned long sustain) {
+  if (! threshold || value <= threshold) {
+    *since = 0;
+    return false;
+  }
+
+  if (! *since) *since = now ? now : 1;
+  return (now - *since >= sustain);
+}
+
+/* Called by the sampler with the memory usage of the process tree. */
+void recycler_sample(void *arg, unsigned __int64 private_bytes, unsigned __int64 working_set) {
+  recycler_t *recycler = (recycler_t *) arg;
+  if (recycler->tripped) return;
+
+  unsigned __int64 now = platform_clock();
+  bool private_bytes_over = sustained(&recycler->private_bytes_since, recycler->private_bytes, private_bytes, now, recycler->sustain);
+  bool working_set_over = sustained(&recycler->working_set_since, recycler->working_set, working_set, now, recycler->sustain);
+  if (recycler->trend) record_point(recycler, now, private_bytes);
+  if (now < recycler->hold_until) return;
+
+  if (private_bytes_over) trigger_recycle(recycler, NSSM_RECYCLE_REASON_PRIVATE_BYTES, true);
+  else if (working_set_over) trigger_recycle(recycler, NSSM_RECYCLE_REASON_WORKING_SET, true);
+  else if (recycler->trend && predict_leak(recycler, now)) trigger_recycle(recycler, NSSM_RECYCLE_REASON_LEAK, true);
+}
+
+/*
+  Watch for private bytes growing towards cap megabytes, using trend
+  seconds of history, and plan to recycle during the window, if given.
+  Must be called before the sampler starts calling recycler_sample().
+*/
+void watch_leaks(recycler_t *recycler, unsigned long trend, unsigned long cap, const TCHAR *window, leak_predicted_t predicted_leak) {
+  if (! trend || ! cap) return;
+
+  recycler->trend = trend;
+  recycler->cap = (unsigned __int64) cap << 20;
+  if (window && window[0] && ! parse_window(window, &recycler->window_start, &recycler->window_end)) recycler->windowed = true;
+  recycler->predicted_leak = predicted_leak;
+}
+
+/*
+  Start applying recycling policies to an application created at
+  creation_time.  Uptime is in seconds and memory thresholds in megabytes.
+  Memory is checked by recycler_sample(), which the caller must arrange to
+  have called.
+*/
+recycler_t *open_recycler(const TCHAR *service_name, const TCHAR *schedule, FILETIME *creation_time, unsigned long uptime, unsigned long private_bytes, unsigned long working_set, unsigned long sustain, recycle_t recycle, void *arg) {
+  recycler_t *recycler = (recycler_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(recycler_t));
+  if (! recycler) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("recycler"), _T("open_recycler()"), 0);
+    return 0;
+  }
+
+  recycler->service_name = service_name;
+  if (schedule && schedule[0] && ! parse_schedule(schedule, &recycler->schedule)) recycler->scheduled = true;
+  recycler->last_minute = local_minute();
+  recycler->creation_time = filetime_value(creation_time);
+  recycler->uptime = uptime;
+  recycler->private_bytes = (unsigned __int64) private_bytes << 20;
+  recycler->working_set = (unsigned __int64) working_set << 20;
+  recycler->sustain = sustain;
+  recycler->recycle = recycle;
+  recycler->arg = arg;
+
+  if (recycler->scheduled || recycler->uptime) {
+    if (! CreateTimerQueueTimer(&recycler->timer, 0, run_recycler, (void *) recycler, NSSM_RECYCLE_CHECK_INTERVAL, NSSM_RECYCLE_CHECK_INTERVAL, WT_EXECUTELONGFUNCTION)) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATETIMERQUEUETIMER_FAILED, service_name, error_string(GetLastError()), 0);
+      recycler->timer = 0;
+      close_recycler(&recycler);
+      return 0;
+    }
+  }
+
+  return recycler;
+}
+
+/* Stop recycling, waiting for a check in progress to finish. */
+void close_recycler(recycler_t **recycler_ptr) {
+  recycler_t *recycler = *recycler_ptr;
+  if (! recycler) return;
+
+  if (recycler->timer) DeleteTimerQueueTimer(0, recycler->timer, INVALID_HANDLE_VALUE);
+  HeapFree(GetProcessHeap(), 0, recycler);
+  *recycler_ptr = 0;
+}
@@ -0,0 +1,108 @@
+#ifndef RECYCLE_H
+#define RECYCLE_H
+
+/*
+  Recycling.  NSSM restarts the application, gracefully and without going
+  through the service manager, when the local time matches AppRecycleSchedule,
+  when it has been running for AppRecycleUptime seconds or when its private
+  bytes or working set stay above AppRecyclePrivateBytes or
+  AppRecycleWorkingSet megabytes for AppRecycleSustain milliseconds.
+
+  The schedule has the five fields of a crontab entry:
+
+    minute hour day-of-month month day-of-week
+
+  Each field is * or a comma-separated list of numbers and ranges, any of
+  which may be followed by /step.  Day of week 0 and 7 are both Sunday.  As
+  with cron, if both day fields are restricted a day matching either will do.
+
+  With AppRecycleTrend set NSSM also fits a least-squares line through the
+  private bytes sampled over that many seconds.  If the application is
+  steadily leaking it predicts when it will reach AppRecyclePrivateBytes, or
+  AppMemoryLimit, and recycles it during the AppRecycleWindow before then,
+  eg 02:00-04:00 local time.
+*/
+#define NSSM_RECYCLE_CHECK_INTERVAL 15000
+#define NSSM_RECYCLE_SAMPLE_INTERVAL 10000
+#define NSSM_RECYCLE_SUSTAIN 60000
+/* How long to wait after the Recycle/Pre hook vetoes recycling. */
+#define NSSM_RECYCLE_HOLDOFF 600000
+/* How far back to look for missed schedule times, eg after standby. */
+#define NSSM_RECYCLE_CATCH_UP 60
+/* Points kept for the trend, spread evenly over AppRecycleTrend. */
+#define NSSM_RECYCLE_TREND_POINTS 240
+#define NSSM_RECYCLE_TREND_MIN_POINTS 10
+/* Minimum correlation, in percent, for memory growth to count as a leak. */
+#define NSSM_RECYCLE_TREND_CORRELATION 80
+/* Recycle regardless of the window this many seconds before the limit. */
+#define NSSM_RECYCLE_LEAK_MARGIN 900
+/* Don't plan further ahead than this many seconds without a window. */
+#define NSSM_RECYCLE_LEAK_HORIZON 86400
+
+#define NSSM_RECYCLE_REASON_SCHEDULE _T("Schedule")
+#define NSSM_RECYCLE_REASON_UPTIME _T("Uptime")
+#define NSSM_RECYCLE_REASON_PRIVATE_BYTES _T("PrivateBytes")
+#define NSSM_RECYCLE_REASON_WORKING_SET _T("WorkingSet")
+#define NSSM_RECYCLE_REASON_LEAK _T("Leak")
+
+typedef struct {
+  unsigned __int64 minutes;
+  unsigned long hours;
+  unsigned long days;
+  unsigned long months;
+  unsigned long weekdays;
+  bool any_day;
+  bool any_weekday;
+} schedule_t;
+
+/* Return true if the application is being recycled or false to hold off. */
+typedef bool (*recycle_t)(void *, const TCHAR *);
+
+/*
+  Called once per run when a leak is predicted, with the growth in bytes per
+  hour, seconds until the limit is reached and seconds until recycling.
+*/
+typedef void (*leak_predicted_t)(void *, unsigned __int64, unsigned __int64, unsigned __int64);
+
+typedef struct {
+  unsigned __int64 time;
+  unsigned __int64 bytes;
+} recycle_point_t;
+
+typedef struct {
+  const TCHAR *service_name;
+  bool scheduled;
+  schedule_t schedule;
+  unsigned __int64 last_minute;
+  unsigned __int64 creation_time;
+  unsigned long uptime;
+  unsigned __int64 private_bytes;
+  unsigned __int64 working_set;
+  unsigned long sustain;
+  unsigned __int64 private_bytes_since;
+  unsigned __int64 working_set_since;
+  unsigned __int64 hold_until;
+  unsigned long trend;
+  unsigned __int64 cap;
+  bool windowed;
+  unsigned long window_start;
+  unsigned long window_end;
+  recycle_point_t points[NSSM_RECYCLE_TREND_POINTS];
+  unsigned long num_points;
+  unsigned long next_point;
+  bool predicted;
+  volatile long tripped;
+  HANDLE timer;
+  recycle_t recycle;
+  leak_predicted_t predicted_leak;
+  void *arg;
+} recycler_t;
+
+int parse_schedule(const TCHAR *, schedule_t *);
+int parse_window(const TCHAR *, unsigned long *, unsigned long *);
+recycler_t *open_recycler(const TCHAR *, const TCHAR *, FILETIME *, unsigned long, unsigned long, unsigned long, unsigned long, recycle_t, void *);
+void watch_leaks(recycler_t *, unsigned long, unsigned long, const TCHAR *, leak_predicted_t);
+void recycler_sample(void *, unsigned __int64, unsigned __int64);
+void close_recycler(recycler_t **);
+
+#endif
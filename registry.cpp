@@ -1,6 +1,7 @@
 #include "nssm.h"
 
 extern const TCHAR *exit_action_strings[];
+extern const TCHAR *throttle_policy_strings[];
 
 static int service_registry_path(const TCHAR *service_name, bool parameters, const TCHAR *sub, TCHAR *buffer, unsigned long buflen) {
   int ret;
@@ -115,7 +116,26 @@ int create_parameters(nssm_service_t *service, bool editing) {
     }
     if (string) HeapFree(GetProcessHeap(), 0, string);
   }
+  else if (cpuset_is_extended(&service->cpuset)) {
+    TCHAR string[512];
+    if (! format_cpuset(&service->cpuset, string, _countof(string))) {
+      if (RegSetValueEx(key, NSSM_REG_AFFINITY, 0, REG_SZ, (const unsigned char *) string, (unsigned long) (_tcslen(string) + 1) * sizeof(TCHAR)) != ERROR_SUCCESS) {
+        log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_SETVALUE_FAILED, NSSM_REG_AFFINITY, error_string(GetLastError()), 0);
+        return 5;
+      }
+    }
+  }
   else if (editing) RegDeleteValue(key, NSSM_REG_AFFINITY);
+  if (service->memory_limit) set_number(key, NSSM_REG_MEMORY_LIMIT, service->memory_limit);
+  else if (editing) RegDeleteValue(key, NSSM_REG_MEMORY_LIMIT);
+  if (service->cpu_rate_limit) set_number(key, NSSM_REG_CPU_RATE_LIMIT, service->cpu_rate_limit);
+  else if (editing) RegDeleteValue(key, NSSM_REG_CPU_RATE_LIMIT);
+  if (service->process_limit) set_number(key, NSSM_REG_PROCESS_LIMIT, service->process_limit);
+  else if (editing) RegDeleteValue(key, NSSM_REG_PROCESS_LIMIT);
+  if (service->min_working_set) set_number(key, NSSM_REG_MIN_WORKING_SET, service->min_working_set);
+  else if (editing) RegDeleteValue(key, NSSM_REG_MIN_WORKING_SET);
+  if (service->max_working_set) set_number(key, NSSM_REG_MAX_WORKING_SET, service->max_working_set);
+  else if (editing) RegDeleteValue(key, NSSM_REG_MAX_WORKING_SET);
   unsigned long stop_method_skip = ~service->stop_method;
   if (stop_method_skip) set_number(key, NSSM_REG_STOP_METHOD_SKIP, stop_method_skip);
   else if (editing) RegDeleteValue(key, NSSM_REG_STOP_METHOD_SKIP);
@@ -124,6 +144,22 @@ int create_parameters(nssm_service_t *service, bool editing) {
   else if (editing) RegDeleteValue(key, NSSM_REG_RESTART_DELAY);
   if (service->throttle_delay != NSSM_RESET_THROTTLE_RESTART) set_number(key, NSSM_REG_THROTTLE, service->throttle_delay);
   else if (editing) RegDeleteValue(key, NSSM_REG_THROTTLE);
+  if (service->backoff.policy != NSSM_BACKOFF_EXPONENTIAL && service->backoff.policy < NSSM_NUM_BACKOFF_POLICIES) set_string(key, NSSM_REG_THROTTLE_POLICY, (TCHAR *) throttle_policy_strings[service->backoff.policy]);
+  else if (editing) RegDeleteValue(key, NSSM_REG_THROTTLE_POLICY);
+  if (service->backoff.base != NSSM_THROTTLE_BASE) set_number(key, NSSM_REG_THROTTLE_BASE, service->backoff.base);
+  else if (editing) RegDeleteValue(key, NSSM_REG_THROTTLE_BASE);
+  if (service->backoff.cap != NSSM_THROTTLE_CAP) set_number(key, NSSM_REG_THROTTLE_CAP, service->backoff.cap);
+  else if (editing) RegDeleteValue(key, NSSM_REG_THROTTLE_CAP);
+  if (service->backoff.jitter) set_number(key, NSSM_REG_THROTTLE_JITTER, 1);
+  else if (editing) RegDeleteValue(key, NSSM_REG_THROTTLE_JITTER);
+  if (service->backoff.decay != NSSM_THROTTLE_DECAY) set_number(key, NSSM_REG_THROTTLE_DECAY, service->backoff.decay);
+  else if (editing) RegDeleteValue(key, NSSM_REG_THROTTLE_DECAY);
+  if (service->breaker.failures) set_number(key, NSSM_REG_BREAKER_FAILURES, service->breaker.failures);
+  else if (editing) RegDeleteValue(key, NSSM_REG_BREAKER_FAILURES);
+  if (service->breaker.window != NSSM_BREAKER_WINDOW) set_number(key, NSSM_REG_BREAKER_WINDOW, service->breaker.window);
+  else if (editing) RegDeleteValue(key, NSSM_REG_BREAKER_WINDOW);
+  if (service->breaker.retry != NSSM_BREAKER_RETRY) set_number(key, NSSM_REG_BREAKER_RETRY, service->breaker.retry);
+  else if (editing) RegDeleteValue(key, NSSM_REG_BREAKER_RETRY);
   if (service->kill_console_delay != NSSM_KILL_CONSOLE_GRACE_PERIOD) set_number(key, NSSM_REG_KILL_CONSOLE_GRACE_PERIOD, service->kill_console_delay);
   else if (editing) RegDeleteValue(key, NSSM_REG_KILL_CONSOLE_GRACE_PERIOD);
   if (service->kill_window_delay != NSSM_KILL_WINDOW_GRACE_PERIOD) set_number(key, NSSM_REG_KILL_WINDOW_GRACE_PERIOD, service->kill_window_delay);
@@ -168,6 +204,14 @@ int create_parameters(nssm_service_t *service, bool editing) {
   }
   if (service->timestamp_log) set_number(key, NSSM_REG_TIMESTAMP_LOG, 1);
   else if (editing) RegDeleteValue(key, NSSM_REG_TIMESTAMP_LOG);
+  if (service->timestamp_group) set_number(key, NSSM_REG_TIMESTAMP_GROUP, 1);
+  else if (editing) RegDeleteValue(key, NSSM_REG_TIMESTAMP_GROUP);
+  if (service->timestamp_group_bytes && service->timestamp_group_bytes != NSSM_TIMESTAMP_GROUP_BYTES) set_number(key, NSSM_REG_TIMESTAMP_GROUP_BYTES, service->timestamp_group_bytes);
+  else if (editing) RegDeleteValue(key, NSSM_REG_TIMESTAMP_GROUP_BYTES);
+  if (service->strip_ansi) set_number(key, NSSM_REG_STRIP_ANSI, 1);
+  else if (editing) RegDeleteValue(key, NSSM_REG_STRIP_ANSI);
+  if (service->host[0]) set_string(key, NSSM_REG_HOST, service->host);
+  else if (editing) RegDeleteValue(key, NSSM_REG_HOST);
   if (service->hook_share_output_handles) set_number(key, NSSM_REG_HOOK_SHARE_OUTPUT_HANDLES, 1);
   else if (editing) RegDeleteValue(key, NSSM_REG_HOOK_SHARE_OUTPUT_HANDLES);
   if (service->rotate_files) set_number(key, NSSM_REG_ROTATE, 1);
@@ -184,6 +228,44 @@ int create_parameters(nssm_service_t *service, bool editing) {
   else if (editing) RegDeleteValue(key, NSSM_REG_ROTATE_DELAY);
   if (service->no_console) set_number(key, NSSM_REG_NO_CONSOLE, 1);
   else if (editing) RegDeleteValue(key, NSSM_REG_NO_CONSOLE);
+  if (service->notify) set_number(key, NSSM_REG_NOTIFY, 1);
+  else if (editing) RegDeleteValue(key, NSSM_REG_NOTIFY);
+  if (service->ready_timeout != NSSM_READY_TIMEOUT) set_number(key, NSSM_REG_READY_TIMEOUT, service->ready_timeout);
+  else if (editing) RegDeleteValue(key, NSSM_REG_READY_TIMEOUT);
+  if (service->ready_pattern[0]) set_string(key, NSSM_REG_READY_PATTERN, service->ready_pattern);
+  else if (editing) RegDeleteValue(key, NSSM_REG_READY_PATTERN);
+  if (service->probe[0]) set_expand_string(key, NSSM_REG_PROBE, service->probe);
+  else if (editing) RegDeleteValue(key, NSSM_REG_PROBE);
+  if (service->probe_interval != NSSM_PROBE_INTERVAL) set_number(key, NSSM_REG_PROBE_INTERVAL, service->probe_interval);
+  else if (editing) RegDeleteValue(key, NSSM_REG_PROBE_INTERVAL);
+  if (service->probe_timeout != NSSM_PROBE_TIMEOUT) set_number(key, NSSM_REG_PROBE_TIMEOUT, service->probe_timeout);
+  else if (editing) RegDeleteValue(key, NSSM_REG_PROBE_TIMEOUT);
+  if (service->probe_failures != NSSM_PROBE_FAILURES) set_number(key, NSSM_REG_PROBE_FAILURES, service->probe_failures);
+  else if (editing) RegDeleteValue(key, NSSM_REG_PROBE_FAILURES);
+  if (service->watchdog_timeout) set_number(key, NSSM_REG_WATCHDOG_TIMEOUT, service->watchdog_timeout);
+  else if (editing) RegDeleteValue(key, NSSM_REG_WATCHDOG_TIMEOUT);
+  if (service->sample_interval) set_number(key, NSSM_REG_SAMPLE_INTERVAL, service->sample_interval);
+  else if (editing) RegDeleteValue(key, NSSM_REG_SAMPLE_INTERVAL);
+  if (service->recycle_schedule[0]) set_string(key, NSSM_REG_RECYCLE_SCHEDULE, service->recycle_schedule);
+  else if (editing) RegDeleteValue(key, NSSM_REG_RECYCLE_SCHEDULE);
+  if (service->recycle_uptime) set_number(key, NSSM_REG_RECYCLE_UPTIME, service->recycle_uptime);
+  else if (editing) RegDeleteValue(key, NSSM_REG_RECYCLE_UPTIME);
+  if (service->recycle_private_bytes) set_number(key, NSSM_REG_RECYCLE_PRIVATE_BYTES, service->recycle_private_bytes);
+  else if (editing) RegDeleteValue(key, NSSM_REG_RECYCLE_PRIVATE_BYTES);
+  if (service->recycle_working_set) set_number(key, NSSM_REG_RECYCLE_WORKING_SET, service->recycle_working_set);
+  else if (editing) RegDeleteValue(key, NSSM_REG_RECYCLE_WORKING_SET);
+  if (service->recycle_sustain != NSSM_RECYCLE_SUSTAIN) set_number(key, NSSM_REG_RECYCLE_SUSTAIN, service->recycle_sustain);
+  else if (editing) RegDeleteValue(key, NSSM_REG_RECYCLE_SUSTAIN);
+  if (service->recycle_trend) set_number(key, NSSM_REG_RECYCLE_TREND, service->recycle_trend);
+  else if (editing) RegDeleteValue(key, NSSM_REG_RECYCLE_TREND);
+  if (service->recycle_window[0]) set_string(key, NSSM_REG_RECYCLE_WINDOW, service->recycle_window);
+  else if (editing) RegDeleteValue(key, NSSM_REG_RECYCLE_WINDOW);
+  if (service->metrics_port) set_number(key, NSSM_REG_METRICS_PORT, service->metrics_port);
+  else if (editing) RegDeleteValue(key, NSSM_REG_METRICS_PORT);
+  if (service->listen[0]) set_string(key, NSSM_REG_LISTEN, service->listen);
+  else if (editing) RegDeleteValue(key, NSSM_REG_LISTEN);
+  if (service->instances > 1) set_number(key, NSSM_REG_INSTANCES, service->instances);
+  else if (editing) RegDeleteValue(key, NSSM_REG_INSTANCES);
 
   /* Environment */
   if (service->env) {
@@ -707,25 +789,43 @@ HKEY open_registry(const TCHAR *service_name, REGSAM sam) {
   return open_registry(service_name, 0, sam, true);
 }
 
+/*
+  Read a string into a service string, using buffer (of buflen characters)
+  as scratch space.  Returns as get_string().
+*/
+static int get_service_string(HKEY key, TCHAR *value, TCHAR **string, TCHAR *buffer, unsigned long buflen, bool expand, bool sanitise, bool must_exist) {
+  int ret = get_string(key, value, buffer, buflen * sizeof(TCHAR), expand, sanitise, must_exist);
+  if (ret) return ret;
+
+  if (set_service_string(string, buffer)) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, value, _T("get_service_string()"), 0);
+    return 1;
+  }
+
+  return 0;
+}
+
 int get_io_parameters(nssm_service_t *service, HKEY key) {
+  TCHAR path[PATH_LENGTH];
+
   /* stdin */
-  if (get_createfile_parameters(key, NSSM_REG_STDIN, service->stdin_path, &service->stdin_sharing, NSSM_STDIN_SHARING, &service->stdin_disposition, NSSM_STDIN_DISPOSITION, &service->stdin_flags, NSSM_STDIN_FLAGS, 0)) {
+  if (get_createfile_parameters(key, NSSM_REG_STDIN, path, &service->stdin_sharing, NSSM_STDIN_SHARING, &service->stdin_disposition, NSSM_STDIN_DISPOSITION, &service->stdin_flags, NSSM_STDIN_FLAGS, 0) || set_service_string(&service->stdin_path, path)) {
     service->stdin_sharing = service->stdin_disposition = service->stdin_flags = 0;
-    ZeroMemory(service->stdin_path, _countof(service->stdin_path) * sizeof(TCHAR));
+    free_service_string(&service->stdin_path);
     return 1;
   }
 
   /* stdout */
-  if (get_createfile_parameters(key, NSSM_REG_STDOUT, service->stdout_path, &service->stdout_sharing, NSSM_STDOUT_SHARING, &service->stdout_disposition, NSSM_STDOUT_DISPOSITION, &service->stdout_flags, NSSM_STDOUT_FLAGS, &service->stdout_copy_and_truncate)) {
+  if (get_createfile_parameters(key, NSSM_REG_STDOUT, path, &service->stdout_sharing, NSSM_STDOUT_SHARING, &service->stdout_disposition, NSSM_STDOUT_DISPOSITION, &service->stdout_flags, NSSM_STDOUT_FLAGS, &service->stdout_copy_and_truncate) || set_service_string(&service->stdout_path, path)) {
     service->stdout_sharing = service->stdout_disposition = service->stdout_flags = 0;
-    ZeroMemory(service->stdout_path, _countof(service->stdout_path) * sizeof(TCHAR));
+    free_service_string(&service->stdout_path);
     return 2;
   }
 
   /* stderr */
-  if (get_createfile_parameters(key, NSSM_REG_STDERR, service->stderr_path, &service->stderr_sharing, NSSM_STDERR_SHARING, &service->stderr_disposition, NSSM_STDERR_DISPOSITION, &service->stderr_flags, NSSM_STDERR_FLAGS, &service->stderr_copy_and_truncate)) {
+  if (get_createfile_parameters(key, NSSM_REG_STDERR, path, &service->stderr_sharing, NSSM_STDERR_SHARING, &service->stderr_disposition, NSSM_STDERR_DISPOSITION, &service->stderr_flags, NSSM_STDERR_FLAGS, &service->stderr_copy_and_truncate) || set_service_string(&service->stderr_path, path)) {
     service->stderr_sharing = service->stderr_disposition = service->stderr_flags = 0;
-    ZeroMemory(service->stderr_path, _countof(service->stderr_path) * sizeof(TCHAR));
+    free_service_string(&service->stderr_path);
     return 3;
   }
 
@@ -750,40 +850,61 @@ int get_parameters(nssm_service_t *service, STARTUPINFO *si) {
   /* Set environment if we are starting the service. */
   if (si) set_service_environment(service);
 
+  /* Strings are read here then copied into the service at their real size. */
+  TCHAR path[PATH_LENGTH];
+
   /* Try to get executable file - MUST succeed */
-  if (get_string(key, NSSM_REG_EXE, service->exe, sizeof(service->exe), expand, false, true)) {
+  if (get_service_string(key, NSSM_REG_EXE, &service->exe, path, EXE_LENGTH, expand, false, true)) {
     RegCloseKey(key);
     return 3;
   }
 
+  /* Try to get host group - may fail. */
+  if (get_service_string(key, NSSM_REG_HOST, &service->host, path, SERVICE_NAME_LENGTH, false, false, false)) free_service_string(&service->host);
+
   /* Try to get flags - may fail and we don't care */
-  if (get_string(key, NSSM_REG_FLAGS, service->flags, sizeof(service->flags), expand, false, true)) {
+  if (get_service_string(key, NSSM_REG_FLAGS, &service->flags, path, VALUE_LENGTH, expand, false, true)) {
     log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_NO_FLAGS, NSSM_REG_FLAGS, service->name, service->exe, 0);
-    ZeroMemory(service->flags, sizeof(service->flags));
+    free_service_string(&service->flags);
   }
 
   /* Try to get startup directory - may fail and we fall back to a default */
-  if (get_string(key, NSSM_REG_DIR, service->dir, sizeof(service->dir), expand, true, true) || ! service->dir[0]) {
-    _sntprintf_s(service->dir, _countof(service->dir), _TRUNCATE, _T("%s"), service->exe);
-    strip_basename(service->dir);
-    if (service->dir[0] == _T('\0')) {
+  if (get_service_string(key, NSSM_REG_DIR, &service->dir, path, DIR_LENGTH, expand, true, true) || ! service->dir[0]) {
+    _sntprintf_s(path, DIR_LENGTH, _TRUNCATE, _T("%s"), service->exe);
+    strip_basename(path);
+    if (path[0] == _T('\0')) {
       /* Help! */
-      ret = GetWindowsDirectory(service->dir, sizeof(service->dir));
-      if (! ret || ret > sizeof(service->dir)) {
+      ret = GetWindowsDirectory(path, DIR_LENGTH);
+      if (! ret || ret > (DIR_LENGTH)) {
         log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_NO_DIR_AND_NO_FALLBACK, NSSM_REG_DIR, service->name, 0);
         RegCloseKey(key);
         return 4;
       }
     }
+    if (set_service_string(&service->dir, path)) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, NSSM_REG_DIR, _T("get_parameters()"), 0);
+      RegCloseKey(key);
+      return 4;
+    }
     log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_NO_DIR, NSSM_REG_DIR, service->name, service->dir, 0);
   }
 
   /* Try to get processor affinity - may fail. */
   TCHAR buffer[512];
+  ZeroMemory(&service->cpuset, sizeof(service->cpuset));
   if (get_string(key, NSSM_REG_AFFINITY, buffer, sizeof(buffer), false, false, false) || ! buffer[0]) service->affinity = 0LL;
   else if (affinity_string_to_mask(buffer, &service->affinity)) {
-    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_AFFINITY_MASK, service->name, buffer);
+    /* Maybe it names processor groups or NUMA nodes. */
     service->affinity = 0LL;
+    if (parse_cpuset(buffer, &service->cpuset) || ! cpuset_is_extended(&service->cpuset)) {
+      log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_AFFINITY_MASK, service->name, buffer);
+      ZeroMemory(&service->cpuset, sizeof(service->cpuset));
+    }
+    else {
+      cpuset_t resolved;
+      resolve_cpuset(&service->cpuset, &resolved);
+      if (! cpuset_count(&resolved)) log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_EMPTY_CPUSET, service->name, buffer, 0);
+    }
   }
   else {
     DWORD_PTR affinity, system_affinity;
@@ -804,6 +925,21 @@ int get_parameters(nssm_service_t *service, STARTUPINFO *si) {
     }
   }
 
+  /* Try to get resource limits - may fail. */
+  if (get_number(key, NSSM_REG_MEMORY_LIMIT, &service->memory_limit, false) != 1) service->memory_limit = 0;
+  if (get_number(key, NSSM_REG_CPU_RATE_LIMIT, &service->cpu_rate_limit, false) != 1) service->cpu_rate_limit = 0;
+  if (service->cpu_rate_limit > 100) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_CPU_RATE_LIMIT, service->name, NSSM_REG_CPU_RATE_LIMIT, 0);
+    service->cpu_rate_limit = 0;
+  }
+  if (get_number(key, NSSM_REG_PROCESS_LIMIT, &service->process_limit, false) != 1) service->process_limit = 0;
+  if (get_number(key, NSSM_REG_MIN_WORKING_SET, &service->min_working_set, false) != 1) service->min_working_set = 0;
+  if (get_number(key, NSSM_REG_MAX_WORKING_SET, &service->max_working_set, false) != 1) service->max_working_set = 0;
+  if (service->min_working_set > service->max_working_set) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_WORKING_SET, service->name, NSSM_REG_MIN_WORKING_SET, NSSM_REG_MAX_WORKING_SET, 0);
+    service->min_working_set = service->max_working_set = 0;
+  }
+
   /* Try to get priority - may fail. */
   unsigned long priority;
   if (get_number(key, NSSM_REG_PRIORITY, &priority, false) == 1) {
@@ -837,10 +973,29 @@ int get_parameters(nssm_service_t *service, STARTUPINFO *si) {
     else service->timestamp_log = false;
   }
   else service->timestamp_log = false;
-
-  /* Hook I/O sharing and online rotation need a pipe. */
-  service->use_stdout_pipe = service->rotate_stdout_online || service->timestamp_log || hook_share_output_handles;
-  service->use_stderr_pipe = service->rotate_stderr_online || service->timestamp_log || hook_share_output_handles;
+  /* Continuation lines can share their record's timestamp. */
+  unsigned long timestamp_group;
+  if (get_number(key, NSSM_REG_TIMESTAMP_GROUP, &timestamp_group, false) == 1) {
+    if (timestamp_group) service->timestamp_group = true;
+    else service->timestamp_group = false;
+  }
+  else service->timestamp_group = false;
+  if (get_number(key, NSSM_REG_TIMESTAMP_GROUP_BYTES, &service->timestamp_group_bytes, false) != 1 || ! service->timestamp_group_bytes) service->timestamp_group_bytes = NSSM_TIMESTAMP_GROUP_BYTES;
+  /* Escape sequences are stripped by the logging threads. */
+  unsigned long strip_ansi;
+  if (get_number(key, NSSM_REG_STRIP_ANSI, &strip_ansi, false) == 1) {
+    if (strip_ansi) service->strip_ansi = true;
+    else service->strip_ansi = false;
+  }
+  else service->strip_ansi = false;
+  /* Routes are applied by the logging threads. */
+  service->use_routes = has_routes(service->name);
+  /* So is the ready pattern. */
+  if (get_service_string(key, NSSM_REG_READY_PATTERN, &service->ready_pattern, path, VALUE_LENGTH, false, false, false)) free_service_string(&service->ready_pattern);
+
+  /* Hook I/O sharing, online rotation, stripping, routing and ready patterns need a pipe. */
+  service->use_stdout_pipe = service->rotate_stdout_online || service->timestamp_log || hook_share_output_handles || service->strip_ansi || service->use_routes || service->ready_pattern[0];
+  service->use_stderr_pipe = service->rotate_stderr_online || service->timestamp_log || hook_share_output_handles || service->strip_ansi || service->use_routes || service->ready_pattern[0];
   if (get_number(key, NSSM_REG_ROTATE_SECONDS, &service->rotate_seconds, false) != 1) service->rotate_seconds = 0;
   if (get_number(key, NSSM_REG_ROTATE_BYTES_LOW, &service->rotate_bytes_low, false) != 1) service->rotate_bytes_low = 0;
   if (get_number(key, NSSM_REG_ROTATE_BYTES_HIGH, &service->rotate_bytes_high, false) != 1) service->rotate_bytes_high = 0;
@@ -849,6 +1004,63 @@ int get_parameters(nssm_service_t *service, STARTUPINFO *si) {
   /* Try to get force new console setting - may fail. */
   if (get_number(key, NSSM_REG_NO_CONSOLE, &service->no_console, false) != 1) service->no_console = 0;
 
+  /* Try to get readiness notification settings - may fail. */
+  unsigned long notify;
+  if (get_number(key, NSSM_REG_NOTIFY, &notify, false) == 1) service->notify = notify ? true : false;
+  else service->notify = false;
+  override_milliseconds(service->name, key, NSSM_REG_READY_TIMEOUT, &service->ready_timeout, NSSM_READY_TIMEOUT, NSSM_EVENT_BOGUS_READY_TIMEOUT);
+
+  /* Try to get health probe settings - may fail. */
+  if (get_service_string(key, NSSM_REG_PROBE, &service->probe, path, VALUE_LENGTH, true, false, false)) free_service_string(&service->probe);
+  else if (service->probe[0] && parse_probe(service->probe, 0, 0, 0)) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_PROBE, service->name, service->probe, 0);
+    free_service_string(&service->probe);
+  }
+  override_milliseconds(service->name, key, NSSM_REG_PROBE_INTERVAL, &service->probe_interval, NSSM_PROBE_INTERVAL, NSSM_EVENT_BOGUS_PROBE_SETTING);
+  override_milliseconds(service->name, key, NSSM_REG_PROBE_TIMEOUT, &service->probe_timeout, NSSM_PROBE_TIMEOUT, NSSM_EVENT_BOGUS_PROBE_SETTING);
+  if (! service->probe_interval) service->probe_interval = NSSM_PROBE_INTERVAL;
+  if (get_number(key, NSSM_REG_PROBE_FAILURES, &service->probe_failures, false) != 1 || ! service->probe_failures) service->probe_failures = NSSM_PROBE_FAILURES;
+
+  /* Try to get watchdog timeout - may fail. */
+  if (get_number(key, NSSM_REG_WATCHDOG_TIMEOUT, &service->watchdog_timeout, false) != 1) service->watchdog_timeout = 0;
+
+  /* Try to get resource usage sampling interval - may fail. */
+  if (get_number(key, NSSM_REG_SAMPLE_INTERVAL, &service->sample_interval, false) != 1) service->sample_interval = 0;
+
+  /* Try to get recycling policies - may fail. */
+  if (get_service_string(key, NSSM_REG_RECYCLE_SCHEDULE, &service->recycle_schedule, path, VALUE_LENGTH, false, false, false)) free_service_string(&service->recycle_schedule);
+  else if (service->recycle_schedule[0] && parse_schedule(service->recycle_schedule, 0)) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_RECYCLE_SCHEDULE, service->name, service->recycle_schedule, 0);
+    free_service_string(&service->recycle_schedule);
+  }
+  if (get_number(key, NSSM_REG_RECYCLE_UPTIME, &service->recycle_uptime, false) != 1) service->recycle_uptime = 0;
+  if (get_number(key, NSSM_REG_RECYCLE_PRIVATE_BYTES, &service->recycle_private_bytes, false) != 1) service->recycle_private_bytes = 0;
+  if (get_number(key, NSSM_REG_RECYCLE_WORKING_SET, &service->recycle_working_set, false) != 1) service->recycle_working_set = 0;
+  override_milliseconds(service->name, key, NSSM_REG_RECYCLE_SUSTAIN, &service->recycle_sustain, NSSM_RECYCLE_SUSTAIN, NSSM_EVENT_BOGUS_RECYCLE_SUSTAIN);
+  if (get_number(key, NSSM_REG_RECYCLE_TREND, &service->recycle_trend, false) != 1) service->recycle_trend = 0;
+  if (get_service_string(key, NSSM_REG_RECYCLE_WINDOW, &service->recycle_window, path, VALUE_LENGTH, false, false, false)) free_service_string(&service->recycle_window);
+  else if (service->recycle_window[0] && parse_window(service->recycle_window, 0, 0)) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_RECYCLE_WINDOW, service->name, service->recycle_window, 0);
+    free_service_string(&service->recycle_window);
+  }
+
+  /* Try to get metrics port - may fail. */
+  if (get_number(key, NSSM_REG_METRICS_PORT, &service->metrics_port, false) != 1) service->metrics_port = 0;
+  if (service->metrics_port > 65535) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_METRICS_PORT, service->name, NSSM_REG_METRICS_PORT, 0);
+    service->metrics_port = 0;
+  }
+
+  /* Try to get listening sockets - may fail. */
+  if (get_service_string(key, NSSM_REG_LISTEN, &service->listen, path, VALUE_LENGTH, false, false, false)) free_service_string(&service->listen);
+  else if (service->listen[0] && parse_listen(service->listen, 0)) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_LISTEN, service->name, service->listen, 0);
+    free_service_string(&service->listen);
+  }
+
+  /* Try to get number of instances - may fail. */
+  get_instances(service, key);
+
   /* Change to startup directory in case stdout/stderr are relative paths. */
   TCHAR cwd[PATH_LENGTH];
   GetCurrentDirectory(_countof(cwd), cwd);
@@ -871,6 +1083,29 @@ int get_parameters(nssm_service_t *service, STARTUPINFO *si) {
   /* Try to get throttle restart delay */
   override_milliseconds(service->name, key, NSSM_REG_THROTTLE, &service->throttle_delay, NSSM_RESET_THROTTLE_RESTART, NSSM_EVENT_BOGUS_THROTTLE);
 
+  /* Try to get throttle policy - may fail. */
+  service->backoff.policy = NSSM_BACKOFF_EXPONENTIAL;
+  if (! get_string(key, NSSM_REG_THROTTLE_POLICY, buffer, sizeof(buffer), false, false, false) && buffer[0]) {
+    int i;
+    for (i = 0; throttle_policy_strings[i]; i++) {
+      if (str_equiv(buffer, throttle_policy_strings[i])) {
+        service->backoff.policy = i;
+        break;
+      }
+    }
+    if (! throttle_policy_strings[i]) log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_THROTTLE_POLICY, service->name, NSSM_REG_THROTTLE_POLICY, buffer, throttle_policy_strings[NSSM_BACKOFF_EXPONENTIAL], 0);
+  }
+  override_milliseconds(service->name, key, NSSM_REG_THROTTLE_BASE, &service->backoff.base, NSSM_THROTTLE_BASE, NSSM_EVENT_BOGUS_THROTTLE_SETTING);
+  override_milliseconds(service->name, key, NSSM_REG_THROTTLE_CAP, &service->backoff.cap, NSSM_THROTTLE_CAP, NSSM_EVENT_BOGUS_THROTTLE_SETTING);
+  override_milliseconds(service->name, key, NSSM_REG_THROTTLE_DECAY, &service->backoff.decay, NSSM_THROTTLE_DECAY, NSSM_EVENT_BOGUS_THROTTLE_SETTING);
+
+  /* Try to get circuit breaker settings - may fail. */
+  if (get_number(key, NSSM_REG_BREAKER_FAILURES, &service->breaker.failures, false) != 1) service->breaker.failures = 0;
+  override_milliseconds(service->name, key, NSSM_REG_BREAKER_WINDOW, &service->breaker.window, NSSM_BREAKER_WINDOW, NSSM_EVENT_BOGUS_THROTTLE_SETTING);
+  override_milliseconds(service->name, key, NSSM_REG_BREAKER_RETRY, &service->breaker.retry, NSSM_BREAKER_RETRY, NSSM_EVENT_BOGUS_THROTTLE_SETTING);
+  if (! service->breaker.failures) close_breaker(&service->breaker);
+  if (get_number(key, NSSM_REG_THROTTLE_JITTER, &service->backoff.jitter, false) != 1) service->backoff.jitter = 0;
+
   /* Try to get service stop flags. */
   unsigned long type = REG_DWORD;
   unsigned long stop_method_skip;
@@ -1028,3 +1263,51 @@ int get_hook(const TCHAR *service_name, const TCHAR *hook_event, const TCHAR *ho
 
   return ret;
 }
+
+int set_route(const TCHAR *service_name, const TCHAR *path, TCHAR *rule) {
+  HKEY key;
+  long error;
+
+  /* Don't create keys needlessly. */
+  if (! _tcslen(rule)) {
+    key = open_registry(service_name, NSSM_REG_ROUTES, KEY_READ, false);
+    if (! key) return 0;
+    error = RegQueryValueEx(key, path, 0, 0, 0, 0);
+    RegCloseKey(key);
+    if (error == ERROR_FILE_NOT_FOUND) return 0;
+  }
+
+  key = open_registry(service_name, NSSM_REG_ROUTES, KEY_WRITE);
+  if (! key) return 1;
+
+  int ret = 1;
+  if (_tcslen(rule)) ret = set_string(key, (TCHAR *) path, rule, false);
+  else {
+    error = RegDeleteValue(key, path);
+    if (error == ERROR_SUCCESS || error == ERROR_FILE_NOT_FOUND) ret = 0;
+  }
+
+  /* Close registry */
+  RegCloseKey(key);
+
+  return ret;
+}
+
+int get_route(const TCHAR *service_name, const TCHAR *path, TCHAR *buffer, unsigned long buflen) {
+  HKEY key;
+  long error = open_registry(service_name, NSSM_REG_ROUTES, KEY_READ, &key, false);
+  if (! key) {
+    if (error == ERROR_FILE_NOT_FOUND) {
+      ZeroMemory(buffer, buflen);
+      return 0;
+    }
+    return 1;
+  }
+
+  int ret = get_string(key, (TCHAR *) path, buffer, buflen, false, false, false);
+
+  /* Close registry */
+  RegCloseKey(key);
+
+  return ret;
+}
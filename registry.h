@@ -13,6 +13,14 @@
 #define NSSM_REG_EXIT _T("AppExit")
 #define NSSM_REG_RESTART_DELAY _T("AppRestartDelay")
 #define NSSM_REG_THROTTLE _T("AppThrottle")
+#define NSSM_REG_THROTTLE_POLICY _T("AppThrottlePolicy")
+#define NSSM_REG_THROTTLE_BASE _T("AppThrottleBase")
+#define NSSM_REG_THROTTLE_CAP _T("AppThrottleCap")
+#define NSSM_REG_THROTTLE_JITTER _T("AppThrottleJitter")
+#define NSSM_REG_THROTTLE_DECAY _T("AppThrottleDecay")
+#define NSSM_REG_BREAKER_FAILURES _T("AppBreakerFailures")
+#define NSSM_REG_BREAKER_WINDOW _T("AppBreakerWindow")
+#define NSSM_REG_BREAKER_RETRY _T("AppBreakerRetry")
 #define NSSM_REG_STOP_METHOD_SKIP _T("AppStopMethodSkip")
 #define NSSM_REG_KILL_CONSOLE_GRACE_PERIOD _T("AppStopMethodConsole")
 #define NSSM_REG_KILL_WINDOW_GRACE_PERIOD _T("AppStopMethodWindow")
@@ -33,10 +41,39 @@
 #define NSSM_REG_ROTATE_BYTES_HIGH _T("AppRotateBytesHigh")
 #define NSSM_REG_ROTATE_DELAY _T("AppRotateDelay")
 #define NSSM_REG_TIMESTAMP_LOG _T("AppTimestampLog")
+#define NSSM_REG_TIMESTAMP_GROUP _T("AppTimestampGroup")
+#define NSSM_REG_TIMESTAMP_GROUP_BYTES _T("AppTimestampGroupBytes")
+#define NSSM_REG_STRIP_ANSI _T("AppStripAnsi")
 #define NSSM_REG_PRIORITY _T("AppPriority")
 #define NSSM_REG_AFFINITY _T("AppAffinity")
+#define NSSM_REG_MEMORY_LIMIT _T("AppMemoryLimit")
+#define NSSM_REG_CPU_RATE_LIMIT _T("AppCpuRateLimit")
+#define NSSM_REG_PROCESS_LIMIT _T("AppProcessLimit")
+#define NSSM_REG_MIN_WORKING_SET _T("AppMinWorkingSet")
+#define NSSM_REG_MAX_WORKING_SET _T("AppMaxWorkingSet")
 #define NSSM_REG_NO_CONSOLE _T("AppNoConsole")
 #define NSSM_REG_HOOK _T("AppEvents")
+#define NSSM_REG_ROUTES _T("AppRoutes")
+#define NSSM_REG_HOST _T("AppHost")
+#define NSSM_REG_NOTIFY _T("AppNotify")
+#define NSSM_REG_READY_TIMEOUT _T("AppReadyTimeout")
+#define NSSM_REG_READY_PATTERN _T("AppReadyPattern")
+#define NSSM_REG_PROBE _T("AppProbe")
+#define NSSM_REG_PROBE_INTERVAL _T("AppProbeInterval")
+#define NSSM_REG_PROBE_TIMEOUT _T("AppProbeTimeout")
+#define NSSM_REG_PROBE_FAILURES _T("AppProbeFailures")
+#define NSSM_REG_WATCHDOG_TIMEOUT _T("AppWatchdogTimeout")
+#define NSSM_REG_SAMPLE_INTERVAL _T("AppSampleInterval")
+#define NSSM_REG_RECYCLE_SCHEDULE _T("AppRecycleSchedule")
+#define NSSM_REG_RECYCLE_UPTIME _T("AppRecycleUptime")
+#define NSSM_REG_RECYCLE_PRIVATE_BYTES _T("AppRecyclePrivateBytes")
+#define NSSM_REG_RECYCLE_WORKING_SET _T("AppRecycleWorkingSet")
+#define NSSM_REG_RECYCLE_SUSTAIN _T("AppRecycleSustain")
+#define NSSM_REG_RECYCLE_TREND _T("AppRecycleTrend")
+#define NSSM_REG_RECYCLE_WINDOW _T("AppRecycleWindow")
+#define NSSM_REG_METRICS_PORT _T("AppMetricsPort")
+#define NSSM_REG_LISTEN _T("AppListen")
+#define NSSM_REG_INSTANCES _T("AppInstances")
 #define NSSM_STDIO_LENGTH 29
 
 HKEY open_service_registry(const TCHAR *, REGSAM sam, bool);
@@ -70,5 +107,7 @@ int get_parameters(nssm_service_t *, STARTUPINFO *);
 int get_exit_action(const TCHAR *, unsigned long *, TCHAR *, bool *);
 int set_hook(const TCHAR *, const TCHAR *, const TCHAR *, TCHAR *);
 int get_hook(const TCHAR *, const TCHAR *, const TCHAR *, TCHAR *, unsigned long);
+int set_route(const TCHAR *, const TCHAR *, TCHAR *);
+int get_route(const TCHAR *, const TCHAR *, TCHAR *, unsigned long);
 
 #endif
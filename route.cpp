@@ -0,0 +1,197 @@
+#include "nssm.h"
+
+/* Are there any routes configured for the service? */
+bool has_routes(const TCHAR *service_name) {
+  HKEY key = open_registry(service_name, NSSM_REG_ROUTES, KEY_READ, false);
+  if (! key) return false;
+
+  unsigned long values = 0;
+  if (RegQueryInfoKey(key, 0, 0, 0, 0, 0, 0, &values, 0, 0, 0, 0) != ERROR_SUCCESS) values = 0;
+  RegCloseKey(key);
+
+  return values > 0;
+}
+
+/*
+  A rule is a pattern optionally prefixed by Copy: or Move:.
+  Returns a pointer to the pattern.
+*/
+const TCHAR *parse_route(const TCHAR *rule, bool *move) {
+  *move = false;
+
+  size_t len = _tcslen(NSSM_ROUTE_MOVE);
+  if (! _tcsnicmp(rule, NSSM_ROUTE_MOVE, len) && rule[len] == NSSM_ROUTE_SEPARATOR) {
+    *move = true;
+    return rule + len + 1;
+  }
+
+  len = _tcslen(NSSM_ROUTE_COPY);
+  if (! _tcsnicmp(rule, NSSM_ROUTE_COPY, len) && rule[len] == NSSM_ROUTE_SEPARATOR) return rule + len + 1;
+
+  return rule;
+}
+
+static void free_router(router_t *router) {
+  unsigned long i;
+  for (i = 0; i < router->num_routes; i++) {
+    route_t *route = &router->routes[i];
+    if (route->handle && route->handle != INVALID_HANDLE_VALUE) CloseHandle(route->handle);
+    if (route->path) HeapFree(GetProcessHeap(), 0, route->path);
+  }
+  if (router->routes) HeapFree(GetProcessHeap(), 0, router->routes);
+  if (router->matcher) free_matcher(router->matcher);
+  HeapFree(GetProcessHeap(), 0, router);
+}
+
+/*
+  Read routes from the registry, compile their patterns and open their
+  destination files.  The value name is the destination path and the value
+  data is the rule.
+  Returns a router with one reference or NULL if there are no usable routes.
+*/
+router_t *open_router(TCHAR *service_name, bool rotate_files, bool rotate_online, unsigned long seconds, unsigned long delay, unsigned long low, unsigned long high) {
+  HKEY key = open_registry(service_name, NSSM_REG_ROUTES, KEY_READ, false);
+  if (! key) return 0;
+
+  unsigned long values = 0;
+  if (RegQueryInfoKey(key, 0, 0, 0, 0, 0, 0, &values, 0, 0, 0, 0) != ERROR_SUCCESS || ! values) {
+    RegCloseKey(key);
+    return 0;
+  }
+
+  router_t *router = (router_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(router_t));
+  char **patterns = (char **) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, values * sizeof(char *));
+  if (router) router->routes = (route_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, values * sizeof(route_t));
+  if (! router || ! patterns || ! router->routes) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("router"), _T("open_router()"), 0);
+    if (patterns) HeapFree(GetProcessHeap(), 0, patterns);
+    if (router) free_router(router);
+    RegCloseKey(key);
+    return 0;
+  }
+  router->service_name = service_name;
+
+  TCHAR path[PATH_LENGTH];
+  TCHAR rule[VALUE_LENGTH];
+  unsigned long index = 0;
+  while (router->num_routes < values) {
+    long error = enumerate_registry_values(key, &index, path, _countof(path));
+    if (error == ERROR_NO_MORE_ITEMS) break;
+    /* The index doesn't advance on failure so we can't skip the value. */
+    if (error != ERROR_SUCCESS) break;
+
+    if (expand_parameter(key, path, rule, sizeof(rule), false, false)) continue;
+
+    route_t *route = &router->routes[router->num_routes];
+    const TCHAR *pattern = parse_route(rule, &route->move);
+    if (to_utf8(pattern, &patterns[router->num_routes], 0)) continue;
+
+    route->path = copy_path(path);
+    if (! route->path) {
+      HeapFree(GetProcessHeap(), 0, patterns[router->num_routes]);
+      patterns[router->num_routes] = 0;
+      continue;
+    }
+
+    router->num_routes++;
+  }
+  RegCloseKey(key);
+
+  if (router->num_routes) router->matcher = compile_matcher(patterns, router->num_routes);
+
+  unsigned long i;
+  for (i = 0; i < router->num_routes; i++) HeapFree(GetProcessHeap(), 0, patterns[i]);
+  HeapFree(GetProcessHeap(), 0, patterns);
+
+  if (! router->matcher) {
+    free_router(router);
+    return 0;
+  }
+
+  for (i = 0; i < router->num_routes; i++) {
+    route_t *route = &router->routes[i];
+    if (rotate_files) rotate_file(service_name, route->path, seconds, delay, low, high, false);
+
+    route->disposition = OPEN_ALWAYS;
+    route->handle = write_to_file(route->path, NSSM_STDOUT_SHARING, 0, route->disposition, NSSM_STDOUT_FLAGS);
+    if (route->handle == INVALID_HANDLE_VALUE) continue;
+
+    /* Append. */
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(route->handle, &size)) route->size = size.QuadPart;
+    SetFilePointer(route->handle, 0, 0, FILE_END);
+  }
+
+  ULARGE_INTEGER bytes;
+  bytes.LowPart = low;
+  bytes.HighPart = high;
+  router->rotate_bytes = rotate_files ? (__int64) bytes.QuadPart : 0LL;
+  router->rotate_online = rotate_files && rotate_online;
+  router->rotate_delay = delay;
+  router->refcount = 1;
+  InitializeCriticalSection(&router->section);
+
+  return router;
+}
+
+void acquire_router(router_t *router) {
+  InterlockedIncrement(&router->refcount);
+}
+
+void release_router(router_t *router) {
+  if (InterlockedDecrement(&router->refcount)) return;
+  DeleteCriticalSection(&router->section);
+  free_router(router);
+}
+
+/* Routes will be rotated when they are next written. */
+void rotate_router(router_t *router) {
+  if (router->rotate_online) InterlockedIncrement(&router->rotate_generation);
+}
+
+static void write_route(router_t *router, route_t *route, char *data, unsigned long len) {
+  unsigned long out;
+  if (WriteFile(route->handle, data, len, &out, 0)) {
+    route->size += (__int64) out;
+    return;
+  }
+
+  if (! (route->complained & COMPLAINED_WRITE)) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_WRITEFILE_FAILED, router->service_name, route->path, error_string(GetLastError()), 0);
+  route->complained |= COMPLAINED_WRITE;
+}
+
+/*
+  Copy a complete line to every route whose pattern matches it.  The
+  timestamp, if any, is written before the line.
+  Returns: 1 if a matching route asked for the line to be moved.
+           0 otherwise.
+*/
+int route_line(router_t *router, unsigned long *scratch, bool *matched, char *line, unsigned long len, char *timestamp, unsigned long timestamp_len) {
+  if (! match_line(router->matcher, scratch, line, len, matched)) return 0;
+
+  int ret = 0;
+  unsigned long i;
+  EnterCriticalSection(&router->section);
+  for (i = 0; i < router->num_routes; i++) {
+    if (! matched[i]) continue;
+    route_t *route = &router->routes[i];
+    if (route->handle == INVALID_HANDLE_VALUE) continue;
+    if (route->move) ret = 1;
+
+    if (router->rotate_online) {
+      long generation = router->rotate_generation;
+      if (route->rotate_generation != generation || (router->rotate_bytes && route->size + (__int64) len >= router->rotate_bytes)) {
+        route->rotate_generation = generation;
+        int rotated = rotate_open_file(router->service_name, route->path, &route->handle, NSSM_STDOUT_SHARING, &route->disposition, NSSM_STDOUT_FLAGS, false, router->rotate_delay, &route->complained);
+        if (rotated < 0) continue;
+        if (! rotated) route->size = 0LL;
+      }
+    }
+
+    if (timestamp_len) write_route(router, route, timestamp, timestamp_len);
+    write_route(router, route, line, len);
+  }
+  LeaveCriticalSection(&router->section);
+
+  return ret;
+}
@@ -0,0 +1,42 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#define NSSM_ROUTE_COPY _T("Copy")
+#define NSSM_ROUTE_MOVE _T("Move")
+#define NSSM_ROUTE_SEPARATOR _T(':')
+
+/* Lines longer than this will be routed in pieces. */
+#define NSSM_ROUTE_LINE_LENGTH 65536
+
+typedef struct {
+  TCHAR *path;
+  bool move;
+  HANDLE handle;
+  __int64 size;
+  unsigned long disposition;
+  long rotate_generation;
+  int complained;
+} route_t;
+
+typedef struct {
+  TCHAR *service_name;
+  matcher_t *matcher;
+  route_t *routes;
+  unsigned long num_routes;
+  CRITICAL_SECTION section;
+  long refcount;
+  __int64 rotate_bytes;
+  bool rotate_online;
+  unsigned long rotate_delay;
+  long rotate_generation;
+} router_t;
+
+bool has_routes(const TCHAR *);
+const TCHAR *parse_route(const TCHAR *, bool *);
+router_t *open_router(TCHAR *, bool, bool, unsigned long, unsigned long, unsigned long, unsigned long);
+void acquire_router(router_t *);
+void release_router(router_t *);
+void rotate_router(router_t *);
+int route_line(router_t *, unsigned long *, bool *, char *, unsigned long, char *, unsigned long);
+
+#endif
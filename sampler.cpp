@@ -0,0 +1,228 @@
+#include "nssm.h"
+
+/* Make room for at least one more element. */
+static int grow_array(void **array, unsigned long count, unsigned long *max, size_t size) {
+  if (count < *max) return 0;
+
+  unsigned long len = *max ? *max * 2 : 16;
+  void *ret;
+  if (*array) ret = HeapReAlloc(GetProcessHeap(), 0, *array, len * size);
+  else ret = HeapAlloc(GetProcessHeap(), 0, len * size);
+  if (! ret) return 1;
+
+  *array = ret;
+  *max = len;
+  return 0;
+}
+
+static void sample_failed(sampler_t *sampler, const TCHAR *function, unsigned long error) {
+  if (sampler->complained) return;
+  sampler->complained = true;
+  log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_SAMPLE_FAILED, sampler->service_name, function, error_string(error), 0);
+}
+
+/* Record the parent of every process in the system. */
+static int snapshot_processes(sampler_t *sampler) {
+  sampler->num_entries = 0;
+
+  HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+  if (snapshot == INVALID_HANDLE_VALUE) {
+    sample_failed(sampler, _T("CreateToolhelp32Snapshot()"), GetLastError());
+    return 1;
+  }
+
+  PROCESSENTRY32 pe;
+  ZeroMemory(&pe, sizeof(pe));
+  pe.dwSize = sizeof(pe);
+
+  if (! Process32First(snapshot, &pe)) {
+    sample_failed(sampler, _T("Process32First()"), GetLastError());
+    CloseHandle(snapshot);
+    return 2;
+  }
+
+  do {
+    if (grow_array((void **) &sampler->entries, sampler->num_entries, &sampler->max_entries, sizeof(sampler_entry_t))) {
+      sample_failed(sampler, _T("HeapAlloc()"), ERROR_NOT_ENOUGH_MEMORY);
+      CloseHandle(snapshot);
+      return 3;
+    }
+    sampler->entries[sampler->num_entries].pid = pe.th32ProcessID;
+    sampler->entries[sampler->num_entries].ppid = pe.th32ParentProcessID;
+    sampler->num_entries++;
+  } while (Process32Next(snapshot, &pe));
+
+  CloseHandle(snapshot);
+  return 0;
+}
+
+/*
+  Add a process to the current sample and its usage to the totals.
+  As in check_parent(), a process created before its supposed parent must
+  have inherited a reused process ID and is ignored.
+*/
+static int sample_process(sampler_t *sampler, unsigned long pid, unsigned __int64 not_before, unsigned __int64 *private_bytes, unsigned __int64 *working_set, unsigned __int64 *handles) {
+  HANDLE process_handle = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, false, pid);
+  if (! process_handle) return 1;
+
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (! GetProcessTimes(process_handle, &creation_time, &exit_time, &kernel_time, &user_time) || filetime_value(&creation_time) < not_before) {
+    CloseHandle(process_handle);
+    return 2;
+  }
+
+  if (grow_array((void **) &sampler->current, sampler->num_current, &sampler->max_current, sizeof(sampled_process_t))) {
+    sample_failed(sampler, _T("HeapAlloc()"), ERROR_NOT_ENOUGH_MEMORY);
+    CloseHandle(process_handle);
+    return 3;
+  }
+
+  sampled_process_t *process = &sampler->current[sampler->num_current++];
+  process->pid = pid;
+  process->creation_time = filetime_value(&creation_time);
+  process->cpu_time = filetime_value(&kernel_time) + filetime_value(&user_time);
+  process->io_bytes = 0;
+
+  PROCESS_MEMORY_COUNTERS_EX memory;
+  ZeroMemory(&memory, sizeof(memory));
+  if (GetProcessMemoryInfo(process_handle, (PROCESS_MEMORY_COUNTERS *) &memory, sizeof(memory))) {
+    *private_bytes += memory.PrivateUsage;
+    *working_set += memory.WorkingSetSize;
+  }
+
+  unsigned long count;
+  if (GetProcessHandleCount(process_handle, &count)) *handles += count;
+
+  IO_COUNTERS io;
+  if (GetProcessIoCounters(process_handle, &io)) process->io_bytes = io.ReadTransferCount + io.WriteTransferCount;
+
+  CloseHandle(process_handle);
+  return 0;
+}
+
+/* How much CPU time and I/O a process used since the last sample. */
+static void sample_delta(sampler_t *sampler, sampled_process_t *process, unsigned __int64 *cpu_time, unsigned __int64 *io_bytes) {
+  for (unsigned long i = 0; i < sampler->num_previous; i++) {
+    sampled_process_t *previous = &sampler->previous[i];
+    if (previous->pid != process->pid || previous->creation_time != process->creation_time) continue;
+    if (process->cpu_time > previous->cpu_time) *cpu_time += process->cpu_time - previous->cpu_time;
+    if (process->io_bytes > previous->io_bytes) *io_bytes += process->io_bytes - previous->io_bytes;
+    return;
+  }
+
+  /* New since the last sample. */
+  *cpu_time += process->cpu_time;
+  *io_bytes += process->io_bytes;
+}
+
+/*
+  Take one sample.  Usage of processes which exited since the previous
+  sample is lost, so short-lived children are undercounted.
+*/
+static void sample(sampler_t *sampler) {
+  if (snapshot_processes(sampler)) return;
+
+  unsigned __int64 private_bytes = 0, working_set = 0, handles = 0;
+  sampler->num_current = 0;
+  if (sample_process(sampler, sampler->pid, sampler->creation_time, &private_bytes, &working_set, &handles)) return;
+
+  /* Breadth-first walk, using the sample itself as the queue. */
+  unsigned long i, j;
+  for (i = 0; i < sampler->num_current; i++) {
+    unsigned long ppid = sampler->current[i].pid;
+    unsigned __int64 not_before = sampler->current[i].creation_time;
+    for (j = 0; j < sampler->num_entries; j++) {
+      if (sampler->entries[j].ppid != ppid || sampler->entries[j].pid == ppid) continue;
+      (void) sample_process(sampler, sampler->entries[j].pid, not_before, &private_bytes, &working_set, &handles);
+    }
+  }
+
+  FILETIME now_ft;
+  GetSystemTimeAsFileTime(&now_ft);
+  unsigned __int64 now = filetime_value(&now_ft);
+  unsigned __int64 since = sampler->sample_time ? sampler->sample_time : sampler->creation_time;
+  if (now <= since) return;
+  unsigned __int64 elapsed = now - since;
+
+  unsigned __int64 cpu_time = 0, io_bytes = 0;
+  for (i = 0; i < sampler->num_current; i++) sample_delta(sampler, &sampler->current[i], &cpu_time, &io_bytes);
+
+  usage_stats_t *stats = sampler->stats;
+  if (stats) {
+    begin_stats(stats);
+    stats->samples++;
+    stats->processes = sampler->num_current;
+    stats->cpu_time += cpu_time;
+    stats->io_bytes += io_bytes;
+    record_histogram(&stats->metrics[NSSM_USAGE_CPU], (unsigned __int64) ((double) cpu_time * 10000.0 / (double) elapsed));
+    record_histogram(&stats->metrics[NSSM_USAGE_PRIVATE_BYTES], private_bytes);
+    record_histogram(&stats->metrics[NSSM_USAGE_WORKING_SET], working_set);
+    record_histogram(&stats->metrics[NSSM_USAGE_HANDLES], handles);
+    record_histogram(&stats->metrics[NSSM_USAGE_IO], (unsigned __int64) ((double) io_bytes * 10000000.0 / (double) elapsed));
+    end_stats(stats);
+  }
+
+  /* This sample is the baseline for the next. */
+  sampled_process_t *swap = sampler->previous;
+  unsigned long max = sampler->max_previous;
+  sampler->previous = sampler->current;
+  sampler->num_previous = sampler->num_current;
+  sampler->max_previous = sampler->max_current;
+  sampler->current = swap;
+  sampler->max_current = max;
+  sampler->num_current = 0;
+  sampler->sample_time = now;
+
+  if (sampler->sampled) sampler->sampled(sampler->arg, private_bytes, working_set);
+}
+
+static void CALLBACK run_sampler(void *arg, unsigned char fired) {
+  sampler_t *sampler = (sampler_t *) arg;
+
+  /* Skip this tick if the last sample is taking too long. */
+  if (InterlockedExchange(&sampler->busy, 1)) return;
+  sample(sampler);
+  InterlockedExchange(&sampler->busy, 0);
+}
+
+/*
+  Start sampling the process tree rooted at pid, which was created at
+  creation_time, every interval milliseconds.  Samples are recorded in
+  stats, if given, and passed to the sampled callback, if given.
+*/
+sampler_t *open_sampler(const TCHAR *service_name, unsigned long pid, FILETIME *creation_time, usage_stats_t *stats, unsigned long interval, sampled_t sampled, void *arg) {
+  sampler_t *sampler = (sampler_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(sampler_t));
+  if (! sampler) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("sampler"), _T("open_sampler()"), 0);
+    return 0;
+  }
+
+  sampler->service_name = service_name;
+  sampler->pid = pid;
+  sampler->creation_time = filetime_value(creation_time);
+  sampler->stats = stats;
+  sampler->sampled = sampled;
+  sampler->arg = arg;
+
+  if (! CreateTimerQueueTimer(&sampler->timer, 0, run_sampler, (void *) sampler, interval, interval, WT_EXECUTELONGFUNCTION)) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATETIMERQUEUETIMER_FAILED, service_name, error_string(GetLastError()), 0);
+    sampler->timer = 0;
+    close_sampler(&sampler);
+    return 0;
+  }
+
+  return sampler;
+}
+
+/* Stop sampling, waiting for a sample in progress to finish. */
+void close_sampler(sampler_t **sampler_ptr) {
+  sampler_t *sampler = *sampler_ptr;
+  if (! sampler) return;
+
+  if (sampler->timer) DeleteTimerQueueTimer(0, sampler->timer, INVALID_HANDLE_VALUE);
+  if (sampler->entries) HeapFree(GetProcessHeap(), 0, sampler->entries);
+  if (sampler->previous) HeapFree(GetProcessHeap(), 0, sampler->previous);
+  if (sampler->current) HeapFree(GetProcessHeap(), 0, sampler->current);
+  HeapFree(GetProcessHeap(), 0, sampler);
+  *sampler_ptr = 0;
+}
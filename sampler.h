@@ -0,0 +1,52 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+/*
+  Resource usage sampling.  Every AppSampleInterval milliseconds the sampler
+  finds the application's process tree and records its CPU usage, private
+  bytes, working set, handle count and I/O rate in the service's statistics
+  block, where "nssm stats" can read them without involving the service.
+*/
+
+/* A process and its counters at the time of the last sample. */
+typedef struct {
+  unsigned long pid;
+  unsigned __int64 creation_time;
+  unsigned __int64 cpu_time;
+  unsigned __int64 io_bytes;
+} sampled_process_t;
+
+typedef struct {
+  unsigned long pid;
+  unsigned long ppid;
+} sampler_entry_t;
+
+/* Called after each sample with the private bytes and working set of the tree. */
+typedef void (*sampled_t)(void *, unsigned __int64, unsigned __int64);
+
+typedef struct {
+  const TCHAR *service_name;
+  unsigned long pid;
+  unsigned __int64 creation_time;
+  usage_stats_t *stats;
+  unsigned __int64 sample_time;
+  sampler_entry_t *entries;
+  unsigned long num_entries;
+  unsigned long max_entries;
+  sampled_process_t *previous;
+  unsigned long num_previous;
+  unsigned long max_previous;
+  sampled_process_t *current;
+  unsigned long num_current;
+  unsigned long max_current;
+  volatile long busy;
+  bool complained;
+  HANDLE timer;
+  sampled_t sampled;
+  void *arg;
+} sampler_t;
+
+sampler_t *open_sampler(const TCHAR *, unsigned long, FILETIME *, usage_stats_t *, unsigned long, sampled_t, void *);
+void close_sampler(sampler_t **);
+
+#endif
@@ -2,6 +2,10 @@
 
 bool is_admin;
 bool use_critical_section;
+bool hosting;
+
+/* Guards our environment, working directory and console, which hosted services share. */
+CRITICAL_SECTION process_section;
 
 extern imports_t imports;
 extern settings_t settings[];
@@ -9,8 +13,9 @@ extern settings_t settings[];
 const TCHAR *exit_action_strings[] = { _T("Restart"), _T("Ignore"), _T("Exit"), _T("Suicide"), 0 };
 const TCHAR *startup_strings[] = { _T("SERVICE_AUTO_START"), _T("SERVICE_DELAYED_AUTO_START"), _T("SERVICE_DEMAND_START"), _T("SERVICE_DISABLED"), 0 };
 const TCHAR *priority_strings[] = { _T("REALTIME_PRIORITY_CLASS"), _T("HIGH_PRIORITY_CLASS"), _T("ABOVE_NORMAL_PRIORITY_CLASS"), _T("NORMAL_PRIORITY_CLASS"), _T("BELOW_NORMAL_PRIORITY_CLASS"), _T("IDLE_PRIORITY_CLASS"), 0 };
+const TCHAR *throttle_policy_strings[] = { _T("Exponential"), _T("Linear"), _T("Decaying"), 0 };
 
-static hook_thread_t hook_threads = { NULL, 0 };
+hook_thread_t hook_threads = { NULL, 0 };
 
 typedef struct {
   int first;
@@ -77,6 +82,8 @@ static inline int service_control_response(unsigned long control, unsigned long
 
     case SERVICE_CONTROL_INTERROGATE:
     case NSSM_SERVICE_CONTROL_ROTATE:
+    case NSSM_SERVICE_CONTROL_RELOAD:
+    case NSSM_SERVICE_CONTROL_SCALE:
       return 0;
   }
 
@@ -276,11 +283,45 @@ unsigned long priority_index_to_constant(int index) {
   return NORMAL_PRIORITY_CLASS;
 }
 
-static inline unsigned long throttle_milliseconds(unsigned long throttle) {
-  if (throttle > 7) throttle = 8;
-  /* pow() operates on doubles. */
-  unsigned long ret = 1; for (unsigned long i = 1; i < throttle; i++) ret *= 2;
-  return ret * 1000;
+/* How long the application ran before it last exited, in milliseconds. */
+static platform_u64_t application_uptime(nssm_service_t *service) {
+  ULARGE_INTEGER s, e;
+  s.LowPart = service->creation_time.dwLowDateTime;
+  s.HighPart = service->creation_time.dwHighDateTime;
+  e.LowPart = service->exit_time.dwLowDateTime;
+  e.HighPart = service->exit_time.dwHighDateTime;
+  if (! s.QuadPart || e.QuadPart < s.QuadPart) return 0;
+  return (platform_u64_t) ((e.QuadPart - s.QuadPart) / 10000LL);
+}
+
+/*
+  Copy the supervision counters to the shared statistics block so readers
+  never need the service's locks.  Pass started when the application was just
+  created to record how long it took to replace the previous one.  Several
+  threads publish so they take turns, otherwise two could leave the sequence
+  even while they write or lose an update to the restart latency histogram.
+*/
+static void publish_stats(nssm_service_t *service, bool started) {
+  if (! service->stats) return;
+
+  supervisor_stats_t *stats = &service->stats->supervisor;
+  unsigned __int64 creation_time = filetime_value(&service->creation_time);
+  unsigned __int64 exit_time = filetime_value(&service->exit_time);
+
+  EnterCriticalSection(&service->stats_section);
+  begin_stats(stats);
+  stats->start_requested_count = service->start_requested_count;
+  stats->start_count = service->start_count;
+  stats->exit_count = service->exit_count;
+  stats->throttle = service->throttle;
+  stats->exitcode = service->exitcode;
+  stats->pid = service->pid;
+  stats->breaker = service->breaker.state;
+  stats->creation_time = creation_time;
+  stats->exit_time = exit_time;
+  if (started && service->exit_count && exit_time && creation_time >= exit_time) record_histogram(&stats->restart_latency, (creation_time - exit_time) / 10000LL);
+  end_stats(stats);
+  LeaveCriticalSection(&service->stats_section);
 }
 
 void set_service_environment(nssm_service_t *service) {
@@ -320,6 +361,55 @@ static unsigned long WINAPI launch_service(void *arg) {
   return monitor_service((nssm_service_t *) arg);
 }
 
+/* Host group names end up on the command line so keep them simple. */
+bool valid_host_name(const TCHAR *group) {
+  if (! group || ! group[0]) return false;
+  for (const TCHAR *s = group; *s; s++) {
+    if (_istalnum(*s)) continue;
+    if (*s == _T('-') || *s == _T('_') || *s == _T('.')) continue;
+    return false;
+  }
+  return true;
+}
+
+/* The command line the service manager uses to start a service. */
+int host_imagepath(const TCHAR *group, TCHAR *buffer, unsigned long buflen) {
+  if (group && group[0]) {
+    if (_sntprintf_s(buffer, buflen, _TRUNCATE, _T("%s host %s"), nssm_imagepath(), group) < 0) return 1;
+  }
+  else if (_sntprintf_s(buffer, buflen, _TRUNCATE, _T("%s"), nssm_imagepath()) < 0) return 1;
+  return 0;
+}
+
+/* Move a service into a host group, or back into its own process. */
+int set_service_host(const TCHAR *service_name, SC_HANDLE service_handle, const TCHAR *group) {
+  QUERY_SERVICE_CONFIG *qsc = query_service_config(service_name, service_handle);
+  if (! qsc) return 1;
+
+  if (check_host_account(service_name, group, qsc->lpServiceStartName)) {
+    HeapFree(GetProcessHeap(), 0, qsc);
+    return 4;
+  }
+
+  unsigned long type = qsc->dwServiceType & SERVICE_INTERACTIVE_PROCESS;
+  if (group && group[0]) type |= SERVICE_WIN32_SHARE_PROCESS;
+  else type |= SERVICE_WIN32_OWN_PROCESS;
+  HeapFree(GetProcessHeap(), 0, qsc);
+
+  TCHAR image[PATH_LENGTH];
+  if (host_imagepath(group, image, _countof(image))) {
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("image"), _T("set_service_host()"));
+    return 2;
+  }
+
+  if (! ChangeServiceConfig(service_handle, type, SERVICE_NO_CHANGE, SERVICE_NO_CHANGE, image, 0, 0, 0, 0, 0, 0)) {
+    print_message(stderr, NSSM_MESSAGE_CHANGESERVICECONFIG_FAILED, error_string(GetLastError()));
+    return 3;
+  }
+
+  return 0;
+}
+
 /* Connect to the service manager */
 SC_HANDLE open_service_manager(unsigned long access) {
   SC_HANDLE ret = OpenSCManager(0, SERVICES_ACTIVE_DATABASE, access);
@@ -810,6 +900,17 @@ void set_nssm_service_defaults(nssm_service_t *service) {
   service->stderr_disposition = NSSM_STDERR_DISPOSITION;
   service->stderr_flags = NSSM_STDERR_FLAGS;
   service->throttle_delay = NSSM_RESET_THROTTLE_RESTART;
+  service->ready_timeout = NSSM_READY_TIMEOUT;
+  service->probe_interval = NSSM_PROBE_INTERVAL;
+  service->probe_timeout = NSSM_PROBE_TIMEOUT;
+  service->probe_failures = NSSM_PROBE_FAILURES;
+  service->instances = 1;
+  service->backoff.policy = NSSM_BACKOFF_EXPONENTIAL;
+  service->backoff.base = NSSM_THROTTLE_BASE;
+  service->backoff.cap = NSSM_THROTTLE_CAP;
+  service->backoff.decay = NSSM_THROTTLE_DECAY;
+  service->breaker.window = NSSM_BREAKER_WINDOW;
+  service->breaker.retry = NSSM_BREAKER_RETRY;
   service->stop_method = ~0;
   service->kill_console_delay = NSSM_KILL_CONSOLE_GRACE_PERIOD;
   service->kill_window_delay = NSSM_KILL_WINDOW_GRACE_PERIOD;
@@ -817,10 +918,44 @@ void set_nssm_service_defaults(nssm_service_t *service) {
   service->kill_process_tree = 1;
 }
 
+/*
+  Strings in nssm_service_t are allocated at their exact size.  Unset strings
+  point to empty_string so they can always be read.
+*/
+static TCHAR empty_string[] = _T("");
+
+void free_service_string(TCHAR **string) {
+  if (*string && *string != empty_string) HeapFree(GetProcessHeap(), 0, *string);
+  *string = empty_string;
+}
+
+/* Replace a service string with a copy of value, which may be the old string. */
+int set_service_string(TCHAR **string, const TCHAR *value) {
+  TCHAR *copy = empty_string;
+  if (value && value[0]) {
+    size_t len = _tcslen(value) + 1;
+    copy = (TCHAR *) HeapAlloc(GetProcessHeap(), 0, len * sizeof(TCHAR));
+    if (! copy) return 1;
+    memmove(copy, value, len * sizeof(TCHAR));
+  }
+
+  free_service_string(string);
+  *string = copy;
+  return 0;
+}
+
 /* Allocate and zero memory for a service. */
 nssm_service_t *alloc_nssm_service() {
   nssm_service_t *service = (nssm_service_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(nssm_service_t));
-  if (! service) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("service"), _T("alloc_nssm_service()"), 0);
+  if (! service) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("service"), _T("alloc_nssm_service()"), 0);
+    return 0;
+  }
+
+  service->description = service->image = service->host = empty_string;
+  service->exe = service->flags = service->dir = empty_string;
+  service->stdin_path = service->stdout_path = service->stderr_path = empty_string;
+  service->ready_pattern = service->probe = service->listen = service->recycle_schedule = service->recycle_window = empty_string;
   return service;
 }
 
@@ -835,13 +970,48 @@ void cleanup_nssm_service(nssm_service_t *service) {
   if (service->dependencies) HeapFree(GetProcessHeap(), 0, service->dependencies);
   if (service->env) HeapFree(GetProcessHeap(), 0, service->env);
   if (service->env_extra) HeapFree(GetProcessHeap(), 0, service->env_extra);
+  if (service->stdout_logger_path) HeapFree(GetProcessHeap(), 0, service->stdout_logger_path);
+  if (service->stderr_logger_path) HeapFree(GetProcessHeap(), 0, service->stderr_logger_path);
+  if (service->router) release_router(service->router);
+  close_sampler(&service->sampler);
+  close_recycler(&service->recycler);
+  close_metrics(&service->metrics);
+  close_listen_sockets(&service->listeners);
+  close_stats(&service->stats, &service->stats_mapping);
+  if (service->stats_section_initialised) DeleteCriticalSection(&service->stats_section);
+  close_notifier(&service->notifier);
+  if (service->ready_watch) release_ready_watch(service->ready_watch);
+  close_probe(&service->prober);
+  close_watchdog(&service->watchdog);
+  close_job(service);
+  platform_close_job(&service->old_job);
   if (service->handle) CloseServiceHandle(service->handle);
   if (service->process_handle) CloseHandle(service->process_handle);
+  if (service->old_process_handle) CloseHandle(service->old_process_handle);
   if (service->wait_handle) UnregisterWait(service->wait_handle);
   if (service->throttle_section_initialised) DeleteCriticalSection(&service->throttle_section);
   if (service->throttle_timer) CloseHandle(service->throttle_timer);
   if (service->hook_section_initialised) DeleteCriticalSection(&service->hook_section);
+  if (service->instance_section_initialised) DeleteCriticalSection(&service->instance_section);
+  if (service->worker_section_initialised) {
+    stop_workers(service);
+    DeleteCriticalSection(&service->worker_section);
+  }
   if (service->initial_env) HeapFree(GetProcessHeap(), 0, service->initial_env);
+  free_service_string(&service->description);
+  free_service_string(&service->image);
+  free_service_string(&service->host);
+  free_service_string(&service->exe);
+  free_service_string(&service->flags);
+  free_service_string(&service->dir);
+  free_service_string(&service->stdin_path);
+  free_service_string(&service->stdout_path);
+  free_service_string(&service->stderr_path);
+  free_service_string(&service->ready_pattern);
+  free_service_string(&service->probe);
+  free_service_string(&service->listen);
+  free_service_string(&service->recycle_schedule);
+  free_service_string(&service->recycle_window);
   HeapFree(GetProcessHeap(), 0, service);
 }
 
@@ -858,7 +1028,11 @@ int pre_install_service(int argc, TCHAR **argv) {
     print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("service"), _T("pre_install_service()"));
     return 1;
   }
-  _sntprintf_s(service->exe, _countof(service->exe), _TRUNCATE, _T("%s"), argv[1]);
+  if (set_service_string(&service->exe, argv[1])) {
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("exe"), _T("pre_install_service()"));
+    cleanup_nssm_service(service);
+    return 1;
+  }
 
   /* Arguments are optional */
   size_t flagslen = 0;
@@ -866,20 +1040,34 @@ int pre_install_service(int argc, TCHAR **argv) {
   int i;
   for (i = 2; i < argc; i++) flagslen += _tcslen(argv[i]) + 1;
   if (! flagslen) flagslen = 1;
-  if (flagslen > _countof(service->flags)) {
+  if (flagslen > VALUE_LENGTH) {
     print_message(stderr, NSSM_MESSAGE_FLAGS_TOO_LONG);
     return 2;
   }
 
+  TCHAR *flags = (TCHAR *) HeapAlloc(GetProcessHeap(), 0, flagslen * sizeof(TCHAR));
+  if (! flags) {
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("flags"), _T("pre_install_service()"));
+    cleanup_nssm_service(service);
+    return 1;
+  }
+
   for (i = 2; i < argc; i++) {
     size_t len = _tcslen(argv[i]);
-    memmove(service->flags + s, argv[i], len * sizeof(TCHAR));
+    memmove(flags + s, argv[i], len * sizeof(TCHAR));
     s += len;
-    if (i < argc - 1) service->flags[s++] = _T(' ');
+    if (i < argc - 1) flags[s++] = _T(' ');
   }
+  flags[s] = _T('\0');
 
   /* Work out directory name */
-  _sntprintf_s(service->dir, _countof(service->dir), _TRUNCATE, _T("%s"), service->exe);
+  if (set_service_string(&service->flags, flags) || set_service_string(&service->dir, service->exe)) {
+    HeapFree(GetProcessHeap(), 0, flags);
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("flags"), _T("pre_install_service()"));
+    cleanup_nssm_service(service);
+    return 1;
+  }
+  HeapFree(GetProcessHeap(), 0, flags);
   strip_basename(service->dir);
 
   int ret = install_service(service);
@@ -994,7 +1182,7 @@ int pre_edit_service(int argc, TCHAR **argv) {
   }
 
   service->type = qsc->dwServiceType;
-  if (! (service->type & SERVICE_WIN32_OWN_PROCESS)) {
+  if (! (service->type & (SERVICE_WIN32_OWN_PROCESS | SERVICE_WIN32_SHARE_PROCESS))) {
     if (mode != MODE_GETTING && mode != MODE_DUMPING) {
       HeapFree(GetProcessHeap(), 0, qsc);
       CloseServiceHandle(service->handle);
@@ -1029,17 +1217,30 @@ int pre_edit_service(int argc, TCHAR **argv) {
   GetServiceKeyName(services, service->displayname, service->name, &bufsize);
 
   /* Remember the executable in case it isn't NSSM. */
-  _sntprintf_s(service->image, _countof(service->image), _TRUNCATE, _T("%s"), qsc->lpBinaryPathName);
+  if (set_service_string(&service->image, qsc->lpBinaryPathName)) {
+    HeapFree(GetProcessHeap(), 0, qsc);
+    CloseServiceHandle(service->handle);
+    CloseServiceHandle(services);
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("image"), _T("pre_edit_service()"));
+    return 4;
+  }
   HeapFree(GetProcessHeap(), 0, qsc);
 
   /* Get extended system details. */
-  if (get_service_description(service->name, service->handle, _countof(service->description), service->description)) {
+  TCHAR description[VALUE_LENGTH];
+  if (get_service_description(service->name, service->handle, _countof(description), description)) {
     if (mode != MODE_GETTING && mode != MODE_DUMPING) {
       CloseServiceHandle(service->handle);
       CloseServiceHandle(services);
       return 6;
     }
   }
+  else if (set_service_string(&service->description, description)) {
+    CloseServiceHandle(service->handle);
+    CloseServiceHandle(services);
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("description"), _T("pre_edit_service()"));
+    return 6;
+  }
 
   if (get_service_dependencies(service->name, service->handle, &service->dependencies, &service->dependencieslen)) {
     if (mode != MODE_GETTING && mode != MODE_DUMPING) {
@@ -1054,6 +1255,15 @@ int pre_edit_service(int argc, TCHAR **argv) {
 
   CloseServiceHandle(services);
 
+  /* A shared process is only ours if we're hosting it. */
+  if ((service->type & SERVICE_WIN32_SHARE_PROCESS) && ! service->host[0]) {
+    if (mode != MODE_GETTING && mode != MODE_DUMPING) {
+      CloseServiceHandle(service->handle);
+      print_message(stderr, NSSM_MESSAGE_CANNOT_EDIT, service->name, NSSM_WIN32_OWN_PROCESS, 0);
+      return 3;
+    }
+  }
+
   if (! service->exe[0]) {
     service->native = true;
     if (mode != MODE_GETTING && mode != MODE_DUMPING) print_message(stderr, NSSM_MESSAGE_INVALID_SERVICE, service->name, NSSM, service->image);
@@ -1229,7 +1439,11 @@ int install_service(nssm_service_t *service) {
   }
 
   /* Get path of this program */
-  _sntprintf_s(service->image, _countof(service->image), _TRUNCATE, _T("%s"), nssm_imagepath());
+  if (set_service_string(&service->image, nssm_imagepath())) {
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("image"), _T("install_service()"));
+    CloseServiceHandle(services);
+    return 3;
+  }
 
   /* Create the service - settings will be changed in edit_service() */
   service->handle = CreateService(services, service->name, service->name, SERVICE_ALL_ACCESS, SERVICE_WIN32_OWN_PROCESS, SERVICE_AUTO_START, SERVICE_ERROR_NORMAL, service->image, 0, 0, 0, 0, 0);
@@ -1257,12 +1471,29 @@ int install_service(nssm_service_t *service) {
 int edit_service(nssm_service_t *service, bool editing) {
   if (! service) return 1;
 
+  /* Check before anything is changed. */
+  if (! service->native && check_instances(service, editing)) return 5;
+
   /*
     The only two valid flags for service type are SERVICE_WIN32_OWN_PROCESS
-    and SERVICE_INTERACTIVE_PROCESS.
+    and SERVICE_INTERACTIVE_PROCESS, unless the service belongs to a host
+    group, in which case it must be SERVICE_WIN32_SHARE_PROCESS.
   */
+  bool hosted = (editing && ! service->native && (service->type & SERVICE_WIN32_SHARE_PROCESS)) ? true : false;
   service->type &= SERVICE_INTERACTIVE_PROCESS;
-  service->type |= SERVICE_WIN32_OWN_PROCESS;
+
+  /* Joining or leaving a host group changes the command line. */
+  TCHAR *image = 0;
+  if (service->host[0] || hosted) {
+    TCHAR path[PATH_LENGTH];
+    if (host_imagepath(service->host, path, _countof(path)) || set_service_string(&service->image, path)) {
+      print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("image"), _T("edit_service()"));
+      return 2;
+    }
+    image = service->image;
+  }
+  if (service->host[0]) service->type |= SERVICE_WIN32_SHARE_PROCESS;
+  else service->type |= SERVICE_WIN32_OWN_PROCESS;
 
   /* Startup type. */
   unsigned long startup;
@@ -1303,6 +1534,11 @@ int edit_service(nssm_service_t *service, bool editing) {
   }
   else if (editing) username = canon = NSSM_LOCALSYSTEM_ACCOUNT;
 
+  if (check_host_account(service->name, service->host, canon)) {
+    if (canon != username) HeapFree(GetProcessHeap(), 0, canon);
+    return 5;
+  }
+
   if (! virtual_account) {
     if (well_known_username(canon)) password = _T("");
     else {
@@ -1317,7 +1553,7 @@ int edit_service(nssm_service_t *service, bool editing) {
   TCHAR *dependencies = _T("");
   if (service->dependencieslen) dependencies = 0; /* Change later. */
 
-  if (! ChangeServiceConfig(service->handle, service->type, startup, SERVICE_NO_CHANGE, 0, 0, 0, dependencies, canon, password, service->displayname)) {
+  if (! ChangeServiceConfig(service->handle, service->type, startup, SERVICE_NO_CHANGE, image, 0, 0, dependencies, canon, password, service->displayname)) {
     if (canon != username) HeapFree(GetProcessHeap(), 0, canon);
     print_message(stderr, NSSM_MESSAGE_CHANGESERVICECONFIG_FAILED, error_string(GetLastError()));
     return 5;
@@ -1388,6 +1624,8 @@ int control_service(unsigned long control, int argc, TCHAR **argv, bool return_s
       break;
 
     case NSSM_SERVICE_CONTROL_ROTATE:
+    case NSSM_SERVICE_CONTROL_RELOAD:
+    case NSSM_SERVICE_CONTROL_SCALE:
       access |= SERVICE_USER_DEFINED_CONTROL;
       break;
   }
@@ -1436,12 +1674,12 @@ int control_service(unsigned long control, int argc, TCHAR **argv, bool return_s
         if (return_status) return 0;
         return 1;
       }
-      else _tprintf(_T("%s: %s: %s"), canonical_name, service_control_text(control), error_string(error));
+      else print_output(stdout, _T("%s: %s: %s"), canonical_name, service_control_text(control), error_string(error));
       return 0;
     }
     else {
       CloseServiceHandle(service_handle);
-      _ftprintf(stderr, _T("%s: %s: %s"), canonical_name, service_control_text(control), error_string(error));
+      print_output(stderr, _T("%s: %s: %s"), canonical_name, service_control_text(control), error_string(error));
       if (return_status) return 0;
       return 1;
     }
@@ -1456,12 +1694,17 @@ int control_service(unsigned long control, int argc, TCHAR **argv, bool return_s
     error = GetLastError();
 
     if (ret) {
-      _tprintf(_T("%s\n"), service_status_text(service_status.dwCurrentState));
+      /* The service manager can't tell a tripped breaker from a throttle. */
+      supervisor_stats_t supervisor;
+      if (service_status.dwCurrentState == SERVICE_PAUSED && ! get_published_supervisor_stats(canonical_name, &supervisor) && supervisor.breaker == NSSM_BREAKER_TRIPPED) {
+        print_output(stdout, _T("%s (tripped)\n"), service_status_text(service_status.dwCurrentState));
+      }
+      else print_output(stdout, _T("%s\n"), service_status_text(service_status.dwCurrentState));
       if (return_status) return service_status.dwCurrentState;
       return 0;
     }
     else {
-      _ftprintf(stderr, _T("%s: %s\n"), canonical_name, error_string(error));
+      print_output(stderr, _T("%s: %s\n"), canonical_name, error_string(error));
       if (return_status) return 0;
       return 1;
     }
@@ -1486,13 +1729,13 @@ int control_service(unsigned long control, int argc, TCHAR **argv, bool return_s
         if (return_status) return 0;
         return 1;
       }
-      else _tprintf(_T("%s: %s: %s"), canonical_name, service_control_text(control), error_string(error));
+      else print_output(stdout, _T("%s: %s: %s"), canonical_name, service_control_text(control), error_string(error));
       if (return_status) return service_status.dwCurrentState;
       return 0;
     }
     else {
       CloseServiceHandle(service_handle);
-      _ftprintf(stderr, _T("%s: %s: %s"), canonical_name, service_control_text(control), error_string(error));
+      print_output(stderr, _T("%s: %s: %s"), canonical_name, service_control_text(control), error_string(error));
       if (error == ERROR_SERVICE_NOT_ACTIVE) {
         if (control == SERVICE_CONTROL_SHUTDOWN || control == SERVICE_CONTROL_STOP) {
           if (return_status) return SERVICE_STOPPED;
@@ -1566,7 +1809,8 @@ void WINAPI service_main(unsigned long argc, TCHAR **argv) {
 
   /* Initialise status */
   ZeroMemory(&service->status, sizeof(service->status));
-  service->status.dwServiceType = SERVICE_WIN32_OWN_PROCESS | SERVICE_INTERACTIVE_PROCESS;
+  if (hosting) service->status.dwServiceType = SERVICE_WIN32_SHARE_PROCESS | SERVICE_INTERACTIVE_PROCESS;
+  else service->status.dwServiceType = SERVICE_WIN32_OWN_PROCESS | SERVICE_INTERACTIVE_PROCESS;
   service->status.dwControlsAccepted = 0;
   service->status.dwWin32ExitCode = NO_ERROR;
   service->status.dwServiceSpecificExitCode = 0;
@@ -1577,8 +1821,8 @@ void WINAPI service_main(unsigned long argc, TCHAR **argv) {
   service->process_handle = 0;
   service->pid = 0;
 
-  /* Register control handler */
-  service->status_handle = RegisterServiceCtrlHandlerEx(NSSM, service_control_handler, (void *) service);
+  /* Register control handler.  The name is ignored unless we're hosting. */
+  service->status_handle = RegisterServiceCtrlHandlerEx(service->name, service_control_handler, (void *) service);
   if (! service->status_handle) {
     log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_REGISTERSERVICECTRLHANDER_FAILED, error_string(GetLastError()), 0);
     return;
@@ -1623,12 +1867,28 @@ void WINAPI service_main(unsigned long argc, TCHAR **argv) {
   InitializeCriticalSection(&service->hook_section);
   service->hook_section_initialised = true;
 
+  /* Critical section for the application, which a reload can swap. */
+  InitializeCriticalSection(&service->instance_section);
+  service->instance_section_initialised = true;
+
+  /* Critical section for worker instances. */
+  InitializeCriticalSection(&service->worker_section);
+  service->worker_section_initialised = true;
+
+  /* Publish logging statistics.  The critical section serialises writers of the supervision counters. */
+  InitializeCriticalSection(&service->stats_section);
+  service->stats_section_initialised = true;
+  service->stats = open_stats(service->name, &service->stats_mapping);
+
   /* Remember our initial environment. */
   service->initial_env = copy_environment();
 
   /* Remember our creation time. */
   if (get_process_creation_time(GetCurrentProcess(), &service->nssm_creation_time)) ZeroMemory(&service->nssm_creation_time, sizeof(service->nssm_creation_time));
 
+  /* Jitter must differ between services which fail together. */
+  seed_backoff(&service->backoff, service->nssm_creation_time.dwLowDateTime ^ GetCurrentProcessId() ^ (unsigned long) (ULONG_PTR) service);
+
   service->allow_restart = true;
   if (! CreateThread(NULL, 0, launch_service, (void *) service, 0, NULL)) {
     log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATETHREAD_FAILED, error_string(GetLastError()), 0);
@@ -1652,6 +1912,170 @@ void set_service_recovery(nssm_service_t *service) {
   }
 }
 
+/*
+  Kill an application which failed its health probes or watchdog.
+  Killing it makes end_service() run the exit action.
+*/
+static void kill_unhealthy(nssm_service_t *service) {
+  EnterCriticalSection(&service->instance_section);
+  if (service->allow_restart && service->pid) {
+    InterlockedExchange(&service->unhealthy, 1);
+    kill_t k;
+    service_kill_t(service, &k);
+    k.exitcode = NSSM_UNHEALTHY_EXITCODE;
+    kill_process(&k);
+  }
+  LeaveCriticalSection(&service->instance_section);
+}
+
+/* Called on a timer thread when the application fails too many health probes in a row. */
+static void probe_unhealthy(void *arg) {
+  nssm_service_t *service = (nssm_service_t *) arg;
+  if (! service->allow_restart || ! service->pid) return;
+  kill_unhealthy(service);
+}
+
+/*
+  Called on a timer thread when the application stops updating its
+  heartbeat.  The Hang/Pre hook can veto killing it.
+*/
+static bool watchdog_expired(void *arg) {
+  nssm_service_t *service = (nssm_service_t *) arg;
+  if (! service->allow_restart || ! service->pid) return true;
+
+  if (nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_HANG, NSSM_HOOK_ACTION_PRE, 0, NSSM_HOOK_DEADLINE, false) == NSSM_HOOK_STATUS_ABORT) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_HANG_HOOK_ABORT, NSSM_HOOK_EVENT_HANG, NSSM_HOOK_ACTION_PRE, service->name, 0);
+    return false;
+  }
+
+  kill_unhealthy(service);
+  return true;
+}
+
+/*
+  Called on a timer thread when a recycling policy is triggered.  The
+  Recycle/Pre hook can veto restarting the application.
+*/
+static bool recycle_application(void *arg, const TCHAR *reason) {
+  nssm_service_t *service = (nssm_service_t *) arg;
+  if (! service->allow_restart || ! service->pid || service->reloading) return true;
+
+  service->recycle_reason = reason;
+  if (nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_RECYCLE, NSSM_HOOK_ACTION_PRE, 0, NSSM_HOOK_DEADLINE, false) == NSSM_HOOK_STATUS_ABORT) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_RECYCLE_HOOK_ABORT, NSSM_HOOK_EVENT_RECYCLE, NSSM_HOOK_ACTION_PRE, service->name, reason, 0);
+    service->recycle_reason = 0;
+    return false;
+  }
+
+  /* Stop the application gracefully.  Killing it makes end_service() restart it. */
+  EnterCriticalSection(&service->instance_section);
+  if (service->allow_restart && service->pid) {
+    log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_RECYCLING, service->name, service->exe, reason, 0);
+    InterlockedExchange(&service->recycling, 1);
+    kill_t k;
+    service_kill_t(service, &k);
+    k.exitcode = 0;
+    kill_process(&k);
+  }
+  LeaveCriticalSection(&service->instance_section);
+  return true;
+}
+
+/* Called on the sampler's timer thread when the application seems to be leaking memory. */
+static void leak_predicted(void *arg, unsigned __int64 rate, unsigned __int64 eta, unsigned __int64 delay) {
+  nssm_service_t *service = (nssm_service_t *) arg;
+  EnterCriticalSection(&service->instance_section);
+  bool running = service->pid ? true : false;
+  if (running) {
+    service->leak_rate = rate;
+    service->leak_eta = eta;
+    service->leak_predicted = true;
+  }
+  LeaveCriticalSection(&service->instance_section);
+  if (! running) return;
+
+  TCHAR rate_string[32], eta_string[32], delay_string[32];
+  _sntprintf_s(rate_string, _countof(rate_string), _TRUNCATE, _T("%I64u"), rate >> 20);
+  _sntprintf_s(eta_string, _countof(eta_string), _TRUNCATE, _T("%I64u"), eta / 60);
+  _sntprintf_s(delay_string, _countof(delay_string), _TRUNCATE, _T("%I64u"), delay / 60);
+  log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_LEAK_PREDICTED, service->name, rate_string, eta_string, delay_string, 0);
+
+  (void) nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_RECYCLE, NSSM_HOOK_ACTION_PREDICT, 0, NSSM_HOOK_DEADLINE, true);
+}
+
+/* Start health probes, watching the heartbeat, recycling and sampling resource usage. */
+static void open_monitors(nssm_service_t *service) {
+  EnterCriticalSection(&service->instance_section);
+  if (! service->process_handle || ! service->allow_restart) {
+    watchdog_t *watchdog = service->watchdog;
+    service->watchdog = 0;
+    LeaveCriticalSection(&service->instance_section);
+    close_watchdog(&watchdog);
+    return;
+  }
+
+  if (service->probe[0]) {
+    service->unhealthy = 0;
+    service->prober = open_probe(service->name, service->probe, service->dir, service->probe_interval, service->probe_timeout, service->probe_failures, probe_unhealthy, (void *) service);
+  }
+
+  if (service->watchdog) {
+    service->unhealthy = 0;
+    if (start_watchdog(service->watchdog, watchdog_expired, (void *) service)) close_watchdog(&service->watchdog);
+  }
+
+  /* Leaks are predicted against the recycling threshold or the job's limit. */
+  unsigned long leak_cap = service->recycle_private_bytes ? service->recycle_private_bytes : service->memory_limit;
+  bool recycle_memory = (service->recycle_private_bytes || service->recycle_working_set || (service->recycle_trend && leak_cap));
+  if (service->recycle_schedule[0] || service->recycle_uptime || recycle_memory) {
+    InterlockedExchange(&service->recycling, 0);
+    service->leak_predicted = false;
+    service->recycler = open_recycler(service->name, service->recycle_schedule, &service->creation_time, service->recycle_uptime, service->recycle_private_bytes, service->recycle_working_set, service->recycle_sustain, recycle_application, (void *) service);
+    if (service->recycler) watch_leaks(service->recycler, service->recycle_trend, leak_cap, service->recycle_window, leak_predicted);
+  }
+
+  /* Memory thresholds need samples even if statistics don't. */
+  unsigned long sample_interval = service->stats ? service->sample_interval : 0;
+  if (service->recycler && recycle_memory && ! sample_interval) sample_interval = NSSM_RECYCLE_SAMPLE_INTERVAL;
+  if (sample_interval) {
+    usage_stats_t *stats = service->stats ? &service->stats->usage : 0;
+    if (service->recycler && recycle_memory) service->sampler = open_sampler(service->name, service->pid, &service->creation_time, stats, sample_interval, recycler_sample, (void *) service->recycler);
+    else service->sampler = open_sampler(service->name, service->pid, &service->creation_time, stats, sample_interval, 0, 0);
+  }
+  LeaveCriticalSection(&service->instance_section);
+}
+
+/*
+  Stop the monitors.  They are detached under instance_section but closed
+  outside it, because closing waits for their callbacks, which take it.
+*/
+static void close_monitors(nssm_service_t *service) {
+  EnterCriticalSection(&service->instance_section);
+  probe_t *prober = service->prober;
+  watchdog_t *watchdog = service->watchdog;
+  sampler_t *sampler = service->sampler;
+  recycler_t *recycler = service->recycler;
+  service->prober = 0;
+  service->watchdog = 0;
+  service->sampler = 0;
+  service->recycler = 0;
+  LeaveCriticalSection(&service->instance_section);
+
+  close_probe(&prober);
+  close_watchdog(&watchdog);
+  close_sampler(&sampler);
+  close_recycler(&recycler);
+}
+
+/* Call end_service() when the application exits. */
+static void watch_application(nssm_service_t *service) {
+  EnterCriticalSection(&service->instance_section);
+  if (service->process_handle && ! RegisterWaitForSingleObject(&service->wait_handle, service->process_handle, end_service, (void *) service, INFINITE, WT_EXECUTEONLYONCE | WT_EXECUTELONGFUNCTION)) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_REGISTERWAITFORSINGLEOBJECT_FAILED, service->name, service->exe, error_string(GetLastError()), 0);
+  }
+  LeaveCriticalSection(&service->instance_section);
+}
+
 int monitor_service(nssm_service_t *service) {
   /* Set service status to started */
   int ret = start_service(service);
@@ -1664,10 +2088,181 @@ int monitor_service(nssm_service_t *service) {
   log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_STARTED_SERVICE, service->exe, service->flags, service->name, service->dir, 0);
 
   /* Monitor service */
-  if (! RegisterWaitForSingleObject(&service->wait_handle, service->process_handle, end_service, (void *) service, INFINITE, WT_EXECUTEONLYONCE | WT_EXECUTELONGFUNCTION)) {
-    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_REGISTERWAITFORSINGLEOBJECT_FAILED, service->name, service->exe, error_string(GetLastError()), 0);
+  watch_application(service);
+
+  return 0;
+}
+
+/*
+  Stop the instance of the application which a reload replaced, with the
+  same escalation as stop_service().  Whichever thread takes the handle
+  does the killing.
+*/
+static void kill_old_instance(nssm_service_t *service) {
+  EnterCriticalSection(&service->instance_section);
+  HANDLE process_handle = (HANDLE) InterlockedExchangePointer(&service->old_process_handle, 0);
+  if (! process_handle) {
+    LeaveCriticalSection(&service->instance_section);
+    return;
   }
 
+  kill_t k;
+  service_kill_t(service, &k);
+  k.process_handle = process_handle;
+  k.pid = service->old_pid;
+  k.creation_time = service->old_creation_time;
+  k.exitcode = 0;
+  kill_process(&k);
+
+  GetSystemTimeAsFileTime(&k.exit_time);
+  if (service->kill_process_tree) kill_process_tree(&k, service->old_pid);
+
+  CloseHandle(process_handle);
+  platform_close_job(&service->old_job);
+  service->old_pid = 0;
+  service->exit_count++;
+  LeaveCriticalSection(&service->instance_section);
+  publish_stats(service, false);
+}
+
+/* Kill a new instance which didn't become ready. */
+static void kill_new_instance(nssm_service_t *service) {
+  close_monitors(service);
+
+  EnterCriticalSection(&service->instance_section);
+  if (service->process_handle) {
+    kill_t k;
+    service_kill_t(service, &k);
+    k.exitcode = 0;
+    kill_process(&k);
+
+    GetSystemTimeAsFileTime(&k.exit_time);
+    if (service->kill_process_tree) kill_process_tree(&k, service->pid);
+
+    CloseHandle(service->process_handle);
+    service->process_handle = 0;
+    service->exit_count++;
+  }
+  service->pid = 0;
+  close_job(service);
+  InterlockedExchange(&service->unhealthy, 0);
+  LeaveCriticalSection(&service->instance_section);
+}
+
+/*
+  Start a second instance of the application and wait for it to be ready
+  before stopping the first, so there is no gap in service.  If the new
+  instance doesn't become ready it is killed and the old one carries on.
+*/
+static unsigned long WINAPI reload_service(void *arg) {
+  nssm_service_t *service = (nssm_service_t *) arg;
+
+  /*
+    Stop watching the old instance and set it aside.  If end_service() is
+    already running the application exited and there is nothing to reload.
+    Everything which stops the service takes instance_section too, so it
+    either sees the old instance as current or as set aside.
+  */
+  EnterCriticalSection(&service->instance_section);
+  HANDLE process_handle = service->process_handle;
+  bool watching = false;
+  if (process_handle && service->wait_handle && service->allow_restart && ! service->stopping) watching = UnregisterWaitEx(service->wait_handle, 0) ? true : false;
+  if (watching) {
+    service->wait_handle = 0;
+
+    /* The old instance keeps its job, and its limits, until it is stopped. */
+    service->old_pid = service->pid;
+    service->old_creation_time = service->creation_time;
+    service->old_job = service->job;
+    service->job = 0;
+    InterlockedExchangePointer(&service->old_process_handle, process_handle);
+    service->process_handle = 0;
+    service->pid = 0;
+  }
+  LeaveCriticalSection(&service->instance_section);
+
+  if (! watching) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_RELOAD_NOT_RUNNING, service->name, 0);
+    InterlockedExchange(&service->reloading, 0);
+    return 1;
+  }
+
+  log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_RELOADING, service->name, service->exe, 0);
+
+  close_monitors(service);
+
+  /* A reload is deliberate so it isn't throttled. */
+  service->throttle = 0;
+  if (start_service(service)) {
+    /* The service is stopping and stop_service() killed the old instance. */
+    InterlockedExchange(&service->reloading, 0);
+    return 2;
+  }
+
+  /*
+    start_service() waited for a readiness notification, the ready pattern
+    or the throttle period.  If there is a health probe wait for it to pass
+    as well.  A failing probe kills the new instance so its handle will be
+    signalled.  Wait on duplicates in case the service is stopped meanwhile.
+  */
+  HANDLE handles[2] = { 0, 0 };
+  EnterCriticalSection(&service->instance_section);
+  if (service->process_handle && service->allow_restart) {
+    DuplicateHandle(GetCurrentProcess(), service->process_handle, GetCurrentProcess(), &handles[0], SYNCHRONIZE, false, 0);
+    if (service->prober) DuplicateHandle(GetCurrentProcess(), service->prober->healthy, GetCurrentProcess(), &handles[1], SYNCHRONIZE, false, 0);
+  }
+  unsigned long probe_timeout = service->probe_interval * (service->probe_failures + 1) + service->probe_timeout;
+  LeaveCriticalSection(&service->instance_section);
+
+  bool ready = false;
+  if (handles[0]) {
+    if (WaitForSingleObject(handles[0], 0) == WAIT_TIMEOUT) ready = true;
+    if (ready && handles[1]) {
+      if (await_probe(handles[1], handles[0], probe_timeout)) ready = false;
+    }
+  }
+  if (handles[0]) CloseHandle(handles[0]);
+  if (handles[1]) CloseHandle(handles[1]);
+
+  TCHAR pid_string[16];
+  _sntprintf_s(pid_string, _countof(pid_string), _TRUNCATE, _T("%lu"), service->old_pid);
+
+  if (ready) {
+    log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_STARTED_SERVICE, service->exe, service->flags, service->name, service->dir, 0);
+    watch_application(service);
+    log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_RELOADED, service->name, pid_string, 0);
+    kill_old_instance(service);
+  }
+  else {
+    kill_new_instance(service);
+
+    /*
+      Put the old instance back unless the service is stopping, in which
+      case it's killed like the new one.  Only end_service() sets stopping
+      and only start_service() clears it.
+    */
+    EnterCriticalSection(&service->instance_section);
+    HANDLE old_process_handle = 0;
+    if (service->allow_restart && ! service->stopping) old_process_handle = (HANDLE) InterlockedExchangePointer(&service->old_process_handle, 0);
+    if (old_process_handle) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_RELOAD_FAILED, service->name, pid_string, 0);
+
+      service->process_handle = old_process_handle;
+      service->pid = service->old_pid;
+      service->creation_time = service->old_creation_time;
+      service->job = service->old_job;
+      service->old_job = 0;
+      service->old_pid = 0;
+      watch_application(service);
+      open_monitors(service);
+    }
+    LeaveCriticalSection(&service->instance_section);
+
+    if (old_process_handle) publish_stats(service, false);
+    else kill_old_instance(service);
+  }
+
+  InterlockedExchange(&service->reloading, 0);
   return 0;
 }
 
@@ -1681,6 +2276,8 @@ TCHAR *service_control_text(unsigned long control) {
     case SERVICE_CONTROL_CONTINUE: return _T("CONTINUE");
     case SERVICE_CONTROL_INTERROGATE: return _T("INTERROGATE");
     case NSSM_SERVICE_CONTROL_ROTATE: return _T("ROTATE");
+    case NSSM_SERVICE_CONTROL_RELOAD: return _T("RELOAD");
+    case NSSM_SERVICE_CONTROL_SCALE: return _T("SCALE");
     case SERVICE_CONTROL_POWEREVENT: return _T("POWEREVENT");
     default: return 0;
   }
@@ -1775,6 +2372,8 @@ unsigned long WINAPI service_control_handler(unsigned long control, unsigned lon
       service->last_control = control;
       log_service_control(service->name, control, true);
       service->throttle = 0;
+      close_breaker(&service->breaker);
+      publish_stats(service, false);
       if (use_critical_section) imports.WakeConditionVariable(&service->throttle_condition);
       else {
         if (! service->throttle_timer) return ERROR_CALL_NOT_IMPLEMENTED;
@@ -1783,7 +2382,7 @@ unsigned long WINAPI service_control_handler(unsigned long control, unsigned lon
       }
       /* We can't continue if the application is running! */
       if (! service->process_handle) service->status.dwCurrentState = SERVICE_CONTINUE_PENDING;
-      service->status.dwWaitHint = throttle_milliseconds(service->throttle) + NSSM_WAITHINT_MARGIN;
+      service->status.dwWaitHint = backoff_milliseconds(&service->backoff, service->throttle) + NSSM_WAITHINT_MARGIN;
       log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_RESET_THROTTLE, service->name, 0);
       SetServiceStatus(service->status_handle, &service->status);
       return NO_ERROR;
@@ -1802,9 +2401,38 @@ unsigned long WINAPI service_control_handler(unsigned long control, unsigned lon
       (void) nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_ROTATE, NSSM_HOOK_ACTION_PRE, &control, NSSM_HOOK_DEADLINE, false);
       if (service->rotate_stdout_online == NSSM_ROTATE_ONLINE) service->rotate_stdout_online = NSSM_ROTATE_ONLINE_ASAP;
       if (service->rotate_stderr_online == NSSM_ROTATE_ONLINE) service->rotate_stderr_online = NSSM_ROTATE_ONLINE_ASAP;
+      if (service->router) rotate_router(service->router);
       (void) nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_ROTATE, NSSM_HOOK_ACTION_POST, &control);
       return NO_ERROR;
 
+    case NSSM_SERVICE_CONTROL_RELOAD:
+      service->last_control = control;
+      log_service_control(service->name, control, true);
+      if (InterlockedCompareExchange(&service->reloading, 1, 0)) return ERROR_SERVICE_CANNOT_ACCEPT_CTRL;
+      {
+        HANDLE thread_handle = CreateThread(NULL, 0, reload_service, context, 0, NULL);
+        if (! thread_handle) {
+          log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATETHREAD_FAILED, error_string(GetLastError()), 0);
+          InterlockedExchange(&service->reloading, 0);
+          return ERROR_SERVICE_CANNOT_ACCEPT_CTRL;
+        }
+        CloseHandle(thread_handle);
+      }
+      return NO_ERROR;
+
+    case NSSM_SERVICE_CONTROL_SCALE:
+      service->last_control = control;
+      log_service_control(service->name, control, true);
+      {
+        HANDLE thread_handle = CreateThread(NULL, 0, scale_workers, context, 0, NULL);
+        if (! thread_handle) {
+          log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATETHREAD_FAILED, error_string(GetLastError()), 0);
+          return ERROR_SERVICE_CANNOT_ACCEPT_CTRL;
+        }
+        CloseHandle(thread_handle);
+      }
+      return NO_ERROR;
+
     case SERVICE_CONTROL_POWEREVENT:
       /* Resume from suspend. */
       if (event == PBT_APMRESUMEAUTOMATIC) {
@@ -1832,10 +2460,20 @@ unsigned long WINAPI service_control_handler(unsigned long control, unsigned lon
 
 /* Start the service */
 int start_service(nssm_service_t *service) {
-  service->stopping = false;
+  /* A reload mustn't undo a stop which raced with it. */
+  EnterCriticalSection(&service->instance_section);
+  if (! service->reloading) service->stopping = false;
+  LeaveCriticalSection(&service->instance_section);
 
   if (service->process_handle) return 0;
   service->start_requested_count++;
+  publish_stats(service, false);
+
+  /* Time each phase so slow starts can be diagnosed with "nssm trace". */
+  start_trace_t trace;
+  ZeroMemory(&trace, sizeof(trace));
+  trace.start_requested_count = service->start_requested_count;
+  trace.begin = stats_ticks();
 
   /* Allocate a STARTUPINFO structure for a new process */
   STARTUPINFO si;
@@ -1846,11 +2484,18 @@ int start_service(nssm_service_t *service) {
   PROCESS_INFORMATION pi;
   ZeroMemory(&pi, sizeof(pi));
 
-  /* Get startup parameters */
+  /*
+    Get startup parameters.  Reading them changes our environment and working
+    directory so other hosted services must wait.
+  */
+  EnterCriticalSection(&process_section);
+  begin_phase(&trace, NSSM_PHASE_PARAMETERS);
   int ret = get_parameters(service, &si);
+  end_phase(&trace, NSSM_PHASE_PARAMETERS);
   if (ret) {
     log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_GET_PARAMETERS_FAILED, service->name, 0);
     unset_service_environment(service);
+    LeaveCriticalSection(&process_section);
     return stop_service(service, 2, true, true);
   }
 
@@ -1859,63 +2504,135 @@ int start_service(nssm_service_t *service) {
   if (_sntprintf_s(cmd, _countof(cmd), _TRUNCATE, _T("\"%s\" %s"), service->exe, service->flags) < 0) {
     log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("command line"), _T("start_service"), 0);
     unset_service_environment(service);
+    LeaveCriticalSection(&process_section);
     return stop_service(service, 2, true, true);
   }
 
+  /* Restore our environment while we wait. */
+  unset_service_environment(service);
+  LeaveCriticalSection(&process_section);
+
+  begin_phase(&trace, NSSM_PHASE_THROTTLE);
   throttle_restart(service);
+  end_phase(&trace, NSSM_PHASE_THROTTLE);
 
-  service->status.dwCurrentState = SERVICE_START_PENDING;
-  service->status.dwControlsAccepted = SERVICE_ACCEPT_POWEREVENT | SERVICE_ACCEPT_SHUTDOWN | SERVICE_ACCEPT_STOP;
-  SetServiceStatus(service->status_handle, &service->status);
+  /* The old instance is still serving during a reload. */
+  if (! service->reloading) {
+    service->status.dwCurrentState = SERVICE_START_PENDING;
+    service->status.dwControlsAccepted = SERVICE_ACCEPT_POWEREVENT | SERVICE_ACCEPT_SHUTDOWN | SERVICE_ACCEPT_STOP;
+    SetServiceStatus(service->status_handle, &service->status);
+  }
 
   unsigned long control = NSSM_SERVICE_CONTROL_START;
 
   /* Did another thread receive a stop control? */
   if (service->allow_restart) {
-    /* Set up I/O redirection. */
+    /*
+      Set up I/O redirection.  We may need to allocate a console, which other
+      hosted services share, but we don't hold the lock while waiting for an
+      old logger to finish or for a log file to be rotated.
+    */
+    begin_phase(&trace, NSSM_PHASE_OUTPUT);
+    prepare_output_handles(service);
+    EnterCriticalSection(&process_section);
     if (get_output_handles(service, &si)) {
       log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_GET_OUTPUT_HANDLES_FAILED, service->name, 0);
       FreeConsole();
+      LeaveCriticalSection(&process_section);
       close_output_handles(&si);
-      unset_service_environment(service);
       return stop_service(service, 4, true, true);
     }
     FreeConsole();
+    LeaveCriticalSection(&process_section);
+    end_phase(&trace, NSSM_PHASE_OUTPUT);
 
     /* Pre-start hook. May need I/O to have been redirected already. */
-    if (nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_START, NSSM_HOOK_ACTION_PRE, &control, NSSM_SERVICE_STATUS_DEADLINE, false) == NSSM_HOOK_STATUS_ABORT) {
+    begin_phase(&trace, NSSM_PHASE_HOOK);
+    int hook_status = nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_START, NSSM_HOOK_ACTION_PRE, &control, NSSM_SERVICE_STATUS_DEADLINE, false);
+    end_phase(&trace, NSSM_PHASE_HOOK);
+    if (hook_status == NSSM_HOOK_STATUS_ABORT) {
       TCHAR code[16];
       _sntprintf_s(code, _countof(code), _TRUNCATE, _T("%lu"), NSSM_HOOK_STATUS_ABORT);
       log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_PRESTART_HOOK_ABORT, NSSM_HOOK_EVENT_START, NSSM_HOOK_ACTION_PRE, service->name, code, 0);
-      unset_service_environment(service);
       return stop_service(service, 5, true, true);
     }
 
-    /* The pre-start hook will have cleaned the environment. */
+    /* Readiness notification needs a fresh pipe for every process. */
+    begin_phase(&trace, NSSM_PHASE_ENVIRONMENT);
+    close_notifier(&service->notifier);
+    if (service->notify) service->notifier = open_notifier(service->name, service->start_requested_count);
+    close_watchdog(&service->watchdog);
+    if (service->watchdog_timeout) service->watchdog = open_watchdog(service->name, service->start_requested_count, service->watchdog_timeout);
+    if (service->ready_watch) arm_ready_watch(service->ready_watch);
+
+    /* Listening sockets survive restarts unless their configuration changed. */
+    if (service->listeners && _tcscmp(service->listeners->spec, service->listen)) close_listen_sockets(&service->listeners);
+    if (service->listen[0] && ! service->listeners) service->listeners = open_listen_sockets(service->name, service->listen);
+
+    /* Set our environment only for as long as it takes to launch. */
+    EnterCriticalSection(&process_section);
     set_service_environment(service);
+    if (service->notifier) SetEnvironmentVariable(NSSM_NOTIFY_VARIABLE, service->notifier->name);
+    if (service->watchdog) SetEnvironmentVariable(NSSM_WATCHDOG_VARIABLE, service->watchdog->name);
+    if (service->listeners) SetEnvironmentVariable(NSSM_LISTEN_VARIABLE, service->listeners->variable);
+    if (service->instances > 1) SetEnvironmentVariable(NSSM_INSTANCE_VARIABLE, _T("0"));
 
     bool inherit_handles = false;
     if (si.dwFlags & STARTF_USESTDHANDLES) inherit_handles = true;
+    if (service->listeners) {
+      inherit_listen_sockets(service->listeners, true);
+      inherit_handles = true;
+    }
     unsigned long flags = service->priority & priority_mask();
-    if (service->affinity) flags |= CREATE_SUSPENDED;
+    __int64 instance_mask = 0;
+    cpuset_t instance_set;
+    cpuset_attributes_t attributes;
+    ZeroMemory(&attributes, sizeof(attributes));
+    STARTUPINFO *startup = &si;
+    bool extended_affinity = instance_cpuset(service, 0, &instance_set);
+    if (extended_affinity) startup = instance_startupinfo(service, &instance_set, &attributes, &si, &flags);
+    else if (service->affinity || service->instances > 1) instance_mask = instance_affinity(service, 0);
+    if (extended_affinity || instance_mask || has_limits(service)) flags |= CREATE_SUSPENDED;
     if (! service->no_console) flags |= CREATE_NEW_CONSOLE;
-    if (! CreateProcess(0, cmd, 0, 0, inherit_handles, flags, 0, service->dir, &si, &pi)) {
+    end_phase(&trace, NSSM_PHASE_ENVIRONMENT);
+    begin_phase(&trace, NSSM_PHASE_CREATE_PROCESS);
+    bool created = CreateProcess(0, cmd, 0, 0, inherit_handles, flags, 0, service->dir, startup, &pi) ? true : false;
+    unsigned long error = GetLastError();
+    end_phase(&trace, NSSM_PHASE_CREATE_PROCESS);
+    if (! created) {
       unsigned long exitcode = 3;
-      unsigned long error = GetLastError();
+      close_cpuset_attributes(&attributes);
       log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATEPROCESS_FAILED, service->name, service->exe, error_string(error), 0);
       close_output_handles(&si);
+      close_notifier(&service->notifier);
+      close_watchdog(&service->watchdog);
+      if (service->ready_watch) disarm_ready_watch(service->ready_watch);
+      inherit_listen_sockets(service->listeners, false);
       unset_service_environment(service);
+      LeaveCriticalSection(&process_section);
       return stop_service(service, exitcode, true, true);
     }
+
+    close_cpuset_attributes(&attributes);
+
+    /* Restore our environment. */
+    inherit_listen_sockets(service->listeners, false);
+    unset_service_environment(service);
+    LeaveCriticalSection(&process_section);
+
     service->start_count++;
+    EnterCriticalSection(&service->instance_section);
     service->process_handle = pi.hProcess;
     service->pid = pi.dwProcessId;
-
     if (get_process_creation_time(service->process_handle, &service->creation_time)) ZeroMemory(&service->creation_time, sizeof(service->creation_time));
+    LeaveCriticalSection(&service->instance_section);
+    publish_stats(service, true);
 
     close_output_handles(&si);
 
-    if (service->affinity) {
+    begin_phase(&trace, NSSM_PHASE_AFFINITY);
+    if (extended_affinity) set_instance_affinity(service, service->process_handle, pi.hThread, 0);
+    else if (instance_mask) {
       /*
         We are explicitly storing service->affinity as a 64-bit unsigned integer
         so that we can parse it regardless of whether we're running in 32-bit
@@ -1931,29 +2648,64 @@ int start_service(nssm_service_t *service) {
       */
       DWORD_PTR affinity, system_affinity;
 
-      if (GetProcessAffinityMask(service->process_handle, &affinity, &system_affinity)) affinity = service->affinity & system_affinity;
+      if (GetProcessAffinityMask(service->process_handle, &affinity, &system_affinity)) affinity = (DWORD_PTR) instance_mask & system_affinity;
       else {
-        affinity = (DWORD_PTR) service->affinity;
+        affinity = (DWORD_PTR) instance_mask;
         log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_GETPROCESSAFFINITYMASK_FAILED, service->name, error_string(GetLastError()), 0);
       }
 
       if (! SetProcessAffinityMask(service->process_handle, affinity)) {
         log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_SETPROCESSAFFINITYMASK_FAILED, service->name, error_string(GetLastError()), 0);
       }
-
-      ResumeThread(pi.hThread);
     }
-  }
 
-  /* Restore our environment. */
-  unset_service_environment(service);
+    /* Limits must be in place before the application can start children. */
+    close_job(service);
+    if (has_limits(service)) open_job(service);
+
+    if (flags & CREATE_SUSPENDED) ResumeThread(pi.hThread);
+    end_phase(&trace, NSSM_PHASE_AFFINITY);
+  }
 
   /*
     Wait for a clean startup before changing the service status to RUNNING
     but be mindful of the fact that we are blocking the service control manager
     so abandon the wait before too much time has elapsed.
+
+    If the application sends readiness notifications, or prints a line
+    matching its ready pattern, wait for it to say it's ready instead, so
+    dependent services start when it can serve them.
   */
-  if (await_single_handle(service->status_handle, &service->status, service->process_handle, service->name, _T("start_service"), service->throttle_delay) == 1) service->throttle = 0;
+  bool started = false;
+  int notified = NSSM_NOTIFY_STATUS_FAILED;
+  begin_phase(&trace, NSSM_PHASE_WAIT);
+  if ((service->notifier || service->ready_watch) && service->process_handle) {
+    notified = await_ready(service->notifier, service->ready_watch, service->name, service->status_handle, &service->status, service->process_handle, service->ready_timeout);
+    close_notifier(&service->notifier);
+    if (service->ready_watch) disarm_ready_watch(service->ready_watch);
+
+    if (notified == NSSM_NOTIFY_STATUS_READY) started = true;
+    else if (notified == NSSM_NOTIFY_STATUS_TIMEOUT) {
+      TCHAR milliseconds[16];
+      _sntprintf_s(milliseconds, _countof(milliseconds), _TRUNCATE, _T("%lu"), service->ready_timeout);
+      if (service->notify) log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_READY_TIMEOUT, service->name, milliseconds, NSSM_NOTIFY_VARIABLE, 0);
+      else log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_READY_PATTERN_TIMEOUT, service->name, milliseconds, service->ready_pattern, 0);
+      started = true;
+    }
+  }
+  if (notified == NSSM_NOTIFY_STATUS_FAILED) {
+    if (await_single_handle(service->status_handle, &service->status, service->process_handle, service->name, _T("start_service"), service->throttle_delay) == 1) started = true;
+  }
+  end_phase(&trace, NSSM_PHASE_WAIT);
+
+  /* A trial run which survived the throttle period closes the breaker. */
+  if (record_start(&service->backoff, &service->breaker, &service->throttle, started, service->restart_delay)) {
+    log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_BREAKER_CLOSED, service->name, 0);
+  }
+  publish_stats(service, false);
+  EnterCriticalSection(&service->stats_section);
+  publish_start_trace(service->stats, &trace);
+  LeaveCriticalSection(&service->stats_section);
 
   /* Did another thread receive a stop control? */
   if (! service->allow_restart) return 0;
@@ -1964,23 +2716,34 @@ int start_service(nssm_service_t *service) {
   SetServiceStatus(service->status_handle, &service->status);
 
   /* Post-start hook. */
-  if (! service->throttle) {
+  if (started) {
     (void) nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_START, NSSM_HOOK_ACTION_POST, &control);
   }
 
-  /* Ensure the restart delay is always applied. */
-  if (service->restart_delay && ! service->throttle) service->throttle++;
+  open_monitors(service);
+
+  /* Start or rebalance other instances. */
+  if (service->instances > 1 || service->num_workers) start_workers(service);
+
+  /* The metrics endpoint outlives the application so scrapes can see it exit. */
+  if (service->metrics && service->metrics->port != service->metrics_port) close_metrics(&service->metrics);
+  if (service->metrics_port && ! service->metrics && service->stats) {
+    service->metrics = open_metrics(service->name, (unsigned short) service->metrics_port, service->stats);
+  }
 
   return 0;
 }
 
 /* Stop the service */
 int stop_service(nssm_service_t *service, unsigned long exitcode, bool graceful, bool default_action) {
+  EnterCriticalSection(&service->instance_section);
   service->allow_restart = false;
   if (service->wait_handle) {
     UnregisterWait(service->wait_handle);
     service->wait_handle = 0;
   }
+  LeaveCriticalSection(&service->instance_section);
+  close_monitors(service);
 
   service->rotate_stdout_online = service->rotate_stderr_online = NSSM_ROTATE_OFFLINE;
 
@@ -1997,6 +2760,7 @@ int stop_service(nssm_service_t *service, unsigned long exitcode, bool graceful,
   }
 
   /* Nothing to do if service isn't running */
+  EnterCriticalSection(&service->instance_section);
   if (service->pid) {
     /* Shut down service */
     log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_TERMINATEPROCESS, service->name, service->exe, 0);
@@ -2006,9 +2770,18 @@ int stop_service(nssm_service_t *service, unsigned long exitcode, bool graceful,
     kill_process(&k);
   }
   else log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_PROCESS_ALREADY_STOPPED, service->name, service->exe, 0);
+  LeaveCriticalSection(&service->instance_section);
+
+  /* We might have been reloading. */
+  kill_old_instance(service);
+
+  stop_workers(service);
 
   end_service((void *) service, true);
 
+  /* The application may have exited earlier, leaving the loggers running. */
+  cleanup_loggers(service);
+
   /* Signal we stopped */
   if (graceful) {
     service->status.dwCurrentState = SERVICE_STOP_PENDING;
@@ -2032,9 +2805,14 @@ int stop_service(nssm_service_t *service, unsigned long exitcode, bool graceful,
 void CALLBACK end_service(void *arg, unsigned char why) {
   nssm_service_t *service = (nssm_service_t *) arg;
 
-  if (service->stopping) return;
-
+  EnterCriticalSection(&service->instance_section);
+  bool stopping = service->stopping;
   service->stopping = true;
+  LeaveCriticalSection(&service->instance_section);
+  if (stopping) return;
+
+  /* Wait for a probe or watchdog which may be killing the application. */
+  close_monitors(service);
 
   service->rotate_stdout_online = service->rotate_stderr_online = NSSM_ROTATE_OFFLINE;
 
@@ -2044,6 +2822,7 @@ void CALLBACK end_service(void *arg, unsigned char why) {
   /* Check exit code */
   unsigned long exitcode = 0;
   TCHAR code[16];
+  EnterCriticalSection(&service->instance_section);
   if (service->process_handle) {
     GetExitCodeProcess(service->process_handle, &exitcode);
     service->exitcode = exitcode;
@@ -2054,6 +2833,12 @@ void CALLBACK end_service(void *arg, unsigned char why) {
 
   service->process_handle = 0;
 
+  /* An application killed as unhealthy gets its own exit action. */
+  if (InterlockedExchange(&service->unhealthy, 0)) exitcode = NSSM_UNHEALTHY_EXITCODE;
+
+  /* A recycled application is restarted whatever its exit code. */
+  bool recycled = InterlockedExchange(&service->recycling, 0) ? true : false;
+
   /*
     Log that the service ended BEFORE logging about killing the process
     tree.  See below for the possible values of the why argument.
@@ -2071,13 +2856,32 @@ void CALLBACK end_service(void *arg, unsigned char why) {
     kill_process_tree(&k, service->pid);
   }
   service->pid = 0;
+  close_job(service);
+  LeaveCriticalSection(&service->instance_section);
 
-  /* Exit hook. */
+  /* Count quick exits towards the circuit breaker. */
   service->exit_count++;
+  if (service->breaker.failures && ! recycled) {
+    unsigned long state = service->breaker.state;
+    if (record_exit(&service->breaker, platform_clock(), application_uptime(service), service->throttle_delay) == NSSM_BREAKER_TRIPPED) {
+      TCHAR failures[16], window[16], retry[16];
+      _sntprintf_s(failures, _countof(failures), _TRUNCATE, _T("%lu"), service->breaker.count);
+      _sntprintf_s(window, _countof(window), _TRUNCATE, _T("%lu"), service->breaker.window);
+      _sntprintf_s(retry, _countof(retry), _TRUNCATE, _T("%lu"), service->breaker.retry);
+      if (state == NSSM_BREAKER_HALF_OPEN) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_BREAKER_TRIAL_FAILED, service->name, retry, 0);
+      else log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_BREAKER_TRIPPED, service->name, failures, window, retry, 0);
+    }
+  }
+  publish_stats(service, false);
+
+  /* Exit hook. */
   (void) nssm_hook(&hook_threads, service, NSSM_HOOK_EVENT_EXIT, NSSM_HOOK_ACTION_POST, NULL, NSSM_HOOK_DEADLINE, true);
+  service->recycle_reason = 0;
+  service->leak_predicted = false;
 
-  /* Exit logging threads. */
-  cleanup_loggers(service);
+  /* Exit logging threads unless we might restart the application. */
+  if (why || ! service->allow_restart) cleanup_loggers(service);
+  else detach_loggers(service);
 
   /*
     The why argument is true if our wait timed out or false otherwise.
@@ -2088,6 +2892,17 @@ void CALLBACK end_service(void *arg, unsigned char why) {
   if (why) return;
   if (! service->allow_restart) return;
 
+  /* Recycling is deliberate so it isn't throttled. */
+  if (recycled) {
+    log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_RECYCLE_RESTART, service->name, code, service->exe, 0);
+    service->throttle = 0;
+    while (monitor_service(service)) {
+      log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_RESTART_SERVICE_FAILED, service->exe, service->name, 0);
+      Sleep(30000);
+    }
+    return;
+  }
+
   /* What action should we take? */
   int action = NSSM_EXIT_RESTART;
   TCHAR action_string[ACTION_LEN];
@@ -2115,6 +2930,8 @@ void CALLBACK end_service(void *arg, unsigned char why) {
     case NSSM_EXIT_IGNORE:
       log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_EXIT_IGNORE, service->name, code, exit_action_strings[action], service->exe, 0);
       wait_for_hooks(service, false);
+      /* Nothing will write to the pipes again so let the loggers finish. */
+      cleanup_loggers(service);
       Sleep(INFINITE);
     break;
 
@@ -2127,6 +2944,11 @@ void CALLBACK end_service(void *arg, unsigned char why) {
     /* Fake a crash so pre-Vista service managers will run recovery actions. */
     case NSSM_EXIT_UNCLEAN:
       log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_EXIT_UNCLEAN, service->name, code, exit_action_strings[action], 0);
+      /* Crashing would take the rest of the host group with us. */
+      if (hosting) {
+        stop_service(service, exitcode, true, default_action);
+        break;
+      }
       stop_service(service, exitcode, false, default_action);
       wait_for_hooks(service, false);
       nssm_exit(exitcode);
@@ -2134,19 +2956,20 @@ void CALLBACK end_service(void *arg, unsigned char why) {
 }
 
 void throttle_restart(nssm_service_t *service) {
-  /* This can't be a restart if the service is already running. */
-  if (! service->throttle++) return;
-
   unsigned long ms;
-  unsigned long throttle_ms = throttle_milliseconds(service->throttle);
-  TCHAR threshold[8], milliseconds[8];
-
-  if (service->restart_delay > throttle_ms) ms = service->restart_delay;
-  else ms = throttle_ms;
+  unsigned long reason = plan_restart(&service->backoff, &service->breaker, &service->throttle, application_uptime(service), service->restart_delay, &ms);
+  if (reason == NSSM_RESTART_NOW) return;
 
+  TCHAR threshold[16], milliseconds[16];
   _sntprintf_s(milliseconds, _countof(milliseconds), _TRUNCATE, _T("%lu"), ms);
 
-  if (service->throttle == 1 && service->restart_delay > throttle_ms) log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_RESTART_DELAY, service->name, milliseconds, 0);
+  /* A tripped breaker was logged when it tripped. */
+  if (reason == NSSM_RESTART_TRIPPED) publish_stats(service, false);
+  else if (reason == NSSM_RESTART_DELAYED) log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_RESTART_DELAY, service->name, milliseconds, 0);
+  else if (service->backoff.policy == NSSM_BACKOFF_DECAYING) {
+    _sntprintf_s(threshold, _countof(threshold), _TRUNCATE, _T("%lu"), service->throttle - 1);
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_THROTTLED_DECAYING, service->name, threshold, milliseconds, 0);
+  }
   else {
     _sntprintf_s(threshold, _countof(threshold), _TRUNCATE, _T("%lu"), service->throttle_delay);
     log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_THROTTLED, service->name, threshold, milliseconds, 0);
@@ -2169,7 +2992,13 @@ void throttle_restart(nssm_service_t *service) {
   }
   else {
     if (service->throttle_timer) WaitForSingleObject(service->throttle_timer, INFINITE);
-    else Sleep(ms);
+    else platform_sleep(ms);
+  }
+
+  /* The next run is a trial unless CONTINUE closed the breaker. */
+  if (begin_trial(&service->breaker)) {
+    log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_BREAKER_HALF_OPEN, service->name, 0);
+    publish_stats(service, false);
   }
 }
 
@@ -2324,6 +3153,278 @@ int list_nssm_services(int argc, TCHAR **argv) {
   return 0;
 }
 
+/* Read the host group of a service.  Returns non-zero if it has none. */
+int get_host_group(const TCHAR *service_name, TCHAR *group, unsigned long grouplen) {
+  HKEY key = open_registry(service_name, 0, KEY_READ, false);
+  if (! key) return 1;
+
+  int ret = get_string(key, NSSM_REG_HOST, group, grouplen * sizeof(TCHAR), false, false, false);
+  RegCloseKey(key);
+  if (ret) return 2;
+
+  return group[0] ? 0 : 3;
+}
+
+/* Is the service configured to run in the given host group? */
+bool in_host_group(const TCHAR *service_name, const TCHAR *group) {
+  TCHAR host[SERVICE_NAME_LENGTH];
+  if (get_host_group(service_name, host, _countof(host))) return false;
+  return str_equiv(host, group) ? true : false;
+}
+
+/*
+  Call a function for every service configured to run in a host group,
+  stopping at the first which returns non-zero.  Returns that value, 0 if
+  there was none or -1 if the services couldn't be enumerated, with the
+  reason in GetLastError().
+*/
+typedef int (*host_member_function_t)(SC_HANDLE, const TCHAR *, void *);
+
+static int for_each_host_member(SC_HANDLE services, const TCHAR *group, host_member_function_t fn, void *arg) {
+  /* Hosted services are always of type SERVICE_WIN32_SHARE_PROCESS. */
+  unsigned long bufsize, required, count, i;
+  unsigned long resume = 0;
+  if (EnumServicesStatusEx(services, SC_ENUM_PROCESS_INFO, SERVICE_WIN32_SHARE_PROCESS, SERVICE_STATE_ALL, 0, 0, &required, &count, &resume, 0)) return 0;
+  if (GetLastError() != ERROR_MORE_DATA) return -1;
+
+  ENUM_SERVICE_STATUS_PROCESS *status = (ENUM_SERVICE_STATUS_PROCESS *) HeapAlloc(GetProcessHeap(), 0, required);
+  if (! status) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return -1;
+  }
+
+  bufsize = required;
+  while (true) {
+    int ret = EnumServicesStatusEx(services, SC_ENUM_PROCESS_INFO, SERVICE_WIN32_SHARE_PROCESS, SERVICE_STATE_ALL, (LPBYTE) status, bufsize, &required, &count, &resume, 0);
+    if (! ret) {
+      unsigned long error = GetLastError();
+      if (error != ERROR_MORE_DATA) {
+        HeapFree(GetProcessHeap(), 0, status);
+        SetLastError(error);
+        return -1;
+      }
+    }
+
+    for (i = 0; i < count; i++) {
+      if (! in_host_group(status[i].lpServiceName, group)) continue;
+      int stop = fn(services, status[i].lpServiceName, arg);
+      if (stop) {
+        HeapFree(GetProcessHeap(), 0, status);
+        return stop;
+      }
+    }
+
+    if (ret) break;
+  }
+
+  HeapFree(GetProcessHeap(), 0, status);
+  return 0;
+}
+
+/* Do two service accounts name the same user?  An empty name is LocalSystem. */
+static bool same_service_account(const TCHAR *a, const TCHAR *b) {
+  if (! a || ! a[0]) a = NSSM_LOCALSYSTEM_ACCOUNT;
+  if (! b || ! b[0]) b = NSSM_LOCALSYSTEM_ACCOUNT;
+  if (str_equiv(a, b)) return true;
+  if (is_localsystem(a)) return is_localsystem(b) ? true : false;
+  return username_equiv(a, b) ? true : false;
+}
+
+/* Configuration of another service in a host group.  Must be freed. */
+static QUERY_SERVICE_CONFIG *query_host_member(SC_HANDLE services, const TCHAR *service_name) {
+  SC_HANDLE service_handle = OpenService(services, service_name, SERVICE_QUERY_CONFIG);
+  if (! service_handle) return 0;
+
+  QUERY_SERVICE_CONFIG *qsc = query_service_config(service_name, service_handle);
+  CloseServiceHandle(service_handle);
+  return qsc;
+}
+
+typedef struct {
+  const TCHAR *service_name;
+  const TCHAR *group;
+  const TCHAR *username;
+} host_account_t;
+
+static int compare_host_account(SC_HANDLE services, const TCHAR *service_name, void *arg) {
+  host_account_t *account = (host_account_t *) arg;
+  if (str_equiv(service_name, account->service_name)) return 0;
+
+  SC_HANDLE service_handle = OpenService(services, service_name, SERVICE_QUERY_CONFIG);
+  if (! service_handle) {
+    print_message(stderr, NSSM_MESSAGE_OPENSERVICE_FAILED, error_string(GetLastError()));
+    return 2;
+  }
+
+  QUERY_SERVICE_CONFIG *qsc = query_service_config(service_name, service_handle);
+  CloseServiceHandle(service_handle);
+  if (! qsc) return 2;
+
+  int ret = 0;
+  if (! same_service_account(account->username, qsc->lpServiceStartName)) {
+    const TCHAR *username = account->username;
+    if (! username || ! username[0]) username = NSSM_LOCALSYSTEM_ACCOUNT;
+    print_message(stderr, NSSM_MESSAGE_HOST_ACCOUNT_MISMATCH, account->service_name, username, service_name, account->group, qsc->lpServiceStartName);
+    ret = 1;
+  }
+
+  HeapFree(GetProcessHeap(), 0, qsc);
+  return ret;
+}
+
+/*
+  The service manager won't run services with different accounts in one
+  process, so a service may only join a host group, or change its account
+  while in one, if every other member runs under the same account.
+*/
+int check_host_account(const TCHAR *service_name, const TCHAR *group, const TCHAR *username) {
+  if (! group || ! group[0]) return 0;
+
+  SC_HANDLE services = open_service_manager(SC_MANAGER_CONNECT | SC_MANAGER_ENUMERATE_SERVICE);
+  if (! services) {
+    print_message(stderr, NSSM_MESSAGE_OPEN_SERVICE_MANAGER_FAILED);
+    return 1;
+  }
+
+  host_account_t account;
+  account.service_name = service_name;
+  account.group = group;
+  account.username = username;
+  int ret = for_each_host_member(services, group, compare_host_account, &account);
+  if (ret < 0) print_message(stderr, NSSM_MESSAGE_ENUMSERVICESSTATUS_FAILED, error_string(GetLastError()));
+  CloseServiceHandle(services);
+
+  return ret ? 1 : 0;
+}
+
+typedef struct {
+  SERVICE_TABLE_ENTRY *table;
+  unsigned long count;
+  unsigned long size;
+} host_table_t;
+
+static void free_host_table(SERVICE_TABLE_ENTRY *table) {
+  if (! table) return;
+  for (SERVICE_TABLE_ENTRY *entry = table; entry->lpServiceName; entry++) HeapFree(GetProcessHeap(), 0, entry->lpServiceName);
+  HeapFree(GetProcessHeap(), 0, table);
+}
+
+static int add_host_entry(SC_HANDLE services, const TCHAR *service_name, void *arg) {
+  host_table_t *hosted = (host_table_t *) arg;
+
+  /* Leave room for the terminating entry. */
+  if (hosted->count + 1 >= hosted->size) {
+    unsigned long size = hosted->size ? hosted->size * 2 : 16;
+    SERVICE_TABLE_ENTRY *table = (SERVICE_TABLE_ENTRY *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size * sizeof(SERVICE_TABLE_ENTRY));
+    if (! table) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("SERVICE_TABLE_ENTRY"), _T("host_services()"), 0);
+      return 5;
+    }
+    if (hosted->table) {
+      memmove(table, hosted->table, hosted->count * sizeof(SERVICE_TABLE_ENTRY));
+      HeapFree(GetProcessHeap(), 0, hosted->table);
+    }
+    hosted->table = table;
+    hosted->size = size;
+  }
+
+  size_t len = _tcslen(service_name) + 1;
+  TCHAR *name = (TCHAR *) HeapAlloc(GetProcessHeap(), 0, len * sizeof(TCHAR));
+  if (! name) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("lpServiceName"), _T("host_services()"), 0);
+    return 5;
+  }
+  memmove(name, service_name, len * sizeof(TCHAR));
+  hosted->table[hosted->count].lpServiceName = name;
+  hosted->table[hosted->count++].lpServiceProc = service_main;
+  return 0;
+}
+
+/*
+  Check that every service in the table runs under the same account, in
+  case one was changed behind our back.  Returns non-zero if not.
+*/
+static int check_host_accounts(SC_HANDLE services, const TCHAR *group, host_table_t *hosted) {
+  QUERY_SERVICE_CONFIG *first = 0;
+  unsigned long i, f = 0;
+  int ret = 0;
+
+  for (i = 0; i < hosted->count; i++) {
+    const TCHAR *service_name = hosted->table[i].lpServiceName;
+    QUERY_SERVICE_CONFIG *qsc = query_host_member(services, service_name);
+    if (! qsc) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_HOST_MEMBER_UNKNOWN, service_name, group, error_string(GetLastError()), 0);
+      ret = 1;
+      break;
+    }
+
+    if (! first) {
+      first = qsc;
+      f = i;
+      continue;
+    }
+
+    bool same = same_service_account(first->lpServiceStartName, qsc->lpServiceStartName);
+    if (! same) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_HOST_ACCOUNT_MISMATCH, group, hosted->table[f].lpServiceName, first->lpServiceStartName, service_name, qsc->lpServiceStartName, 0);
+    HeapFree(GetProcessHeap(), 0, qsc);
+    if (! same) {
+      ret = 2;
+      break;
+    }
+  }
+
+  if (first) HeapFree(GetProcessHeap(), 0, first);
+  return ret;
+}
+
+/*
+  Run every service in a host group from this process.  The service manager
+  starts us with the command line "nssm host <group>" and calls service_main()
+  on a new thread for each service in the group which it wants to start.
+*/
+int host_services(const TCHAR *group) {
+  if (! valid_host_name(group)) return usage(1);
+
+  SC_HANDLE services = open_service_manager(SC_MANAGER_CONNECT | SC_MANAGER_ENUMERATE_SERVICE);
+  if (! services) return 1;
+
+  host_table_t hosted;
+  ZeroMemory(&hosted, sizeof(hosted));
+  int ret = for_each_host_member(services, group, add_host_entry, &hosted);
+  if (ret) {
+    if (ret < 0) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_ENUMSERVICESSTATUS_FAILED, error_string(GetLastError()), 0);
+    free_host_table(hosted.table);
+    CloseServiceHandle(services);
+    return ret < 0 ? 2 : ret;
+  }
+
+  if (! hosted.count) {
+    free_host_table(hosted.table);
+    CloseServiceHandle(services);
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_NO_HOSTED_SERVICES, group, 0);
+    return 6;
+  }
+
+  ret = check_host_accounts(services, group, &hosted);
+  CloseServiceHandle(services);
+  if (ret) {
+    free_host_table(hosted.table);
+    return 7;
+  }
+
+  hosting = true;
+  if (! StartServiceCtrlDispatcher(hosted.table)) {
+    unsigned long error = GetLastError();
+    free_host_table(hosted.table);
+    if (error == ERROR_FAILED_SERVICE_CONTROLLER_CONNECT) return usage(1);
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_DISPATCHER_FAILED, error_string(error), 0);
+    return 100;
+  }
+
+  free_host_table(hosted.table);
+  return 0;
+}
+
 int service_process_tree(int argc, TCHAR **argv) {
   int errors = 0;
   if (argc < 1) return usage(1);
@@ -29,35 +29,82 @@
 #define NSSM_ROTATE_ONLINE 1
 #define NSSM_ROTATE_ONLINE_ASAP 2
 
+/* An extra instance of the application when AppInstances is more than one. */
+typedef struct {
+  void *service;
+  unsigned long index;
+  HANDLE process_handle;
+  unsigned long pid;
+  FILETIME creation_time;
+  HANDLE wait_handle;
+  HANDLE stop_event;
+  HANDLE job;
+  bool stopping;
+  unsigned long throttle;
+  backoff_t backoff;
+  CRITICAL_SECTION section;
+} worker_t;
+
+/* What a logging thread was started with, to decide whether it can be reused. */
+typedef struct {
+  unsigned long sharing;
+  unsigned long disposition;
+  unsigned long flags;
+  unsigned long rotate_bytes_low;
+  unsigned long rotate_bytes_high;
+  unsigned long rotate_delay;
+  bool timestamp_log;
+  unsigned long group_bytes;
+  bool strip_ansi;
+  bool copy_and_truncate;
+  router_t *router;
+  ready_watch_t *ready_watch;
+} logger_settings_t;
+
 typedef struct {
   bool native;
   TCHAR name[SERVICE_NAME_LENGTH];
   TCHAR displayname[SERVICE_NAME_LENGTH];
-  TCHAR description[VALUE_LENGTH];
+  TCHAR *description;
   unsigned long startup;
   TCHAR *username;
   size_t usernamelen;
   TCHAR *password;
   size_t passwordlen;
   unsigned long type;
-  TCHAR image[PATH_LENGTH];
-  TCHAR exe[EXE_LENGTH];
-  TCHAR flags[VALUE_LENGTH];
-  TCHAR dir[DIR_LENGTH];
+  TCHAR *image;
+  TCHAR *host;
+  TCHAR *exe;
+  TCHAR *flags;
+  TCHAR *dir;
   TCHAR *env;
   __int64 affinity;
+  cpuset_t cpuset;
   TCHAR *dependencies;
   unsigned long dependencieslen;
   unsigned long envlen;
   TCHAR *env_extra;
   unsigned long env_extralen;
   unsigned long priority;
+  unsigned long memory_limit;
+  unsigned long cpu_rate_limit;
+  unsigned long process_limit;
+  unsigned long min_working_set;
+  unsigned long max_working_set;
+  HANDLE job;
+  unsigned long instances;
+  worker_t **workers;
+  unsigned long num_workers;
+  CRITICAL_SECTION worker_section;
+  bool worker_section_initialised;
+  long memory_limit_breached;
+  long process_limit_breached;
   unsigned long no_console;
-  TCHAR stdin_path[PATH_LENGTH];
+  TCHAR *stdin_path;
   unsigned long stdin_sharing;
   unsigned long stdin_disposition;
   unsigned long stdin_flags;
-  TCHAR stdout_path[PATH_LENGTH];
+  TCHAR *stdout_path;
   unsigned long stdout_sharing;
   unsigned long stdout_disposition;
   unsigned long stdout_flags;
@@ -66,7 +113,10 @@ typedef struct {
   HANDLE stdout_pipe;
   HANDLE stdout_thread;
   unsigned long stdout_tid;
-  TCHAR stderr_path[PATH_LENGTH];
+  TCHAR *stdout_logger_path;
+  logger_settings_t stdout_logger_settings;
+  volatile long stdout_new_run;
+  TCHAR *stderr_path;
   unsigned long stderr_sharing;
   unsigned long stderr_disposition;
   unsigned long stderr_flags;
@@ -75,9 +125,53 @@ typedef struct {
   HANDLE stderr_pipe;
   HANDLE stderr_thread;
   unsigned long stderr_tid;
+  TCHAR *stderr_logger_path;
+  logger_settings_t stderr_logger_settings;
+  volatile long stderr_new_run;
+  bool use_routes;
+  router_t *router;
+  HANDLE stats_mapping;
+  nssm_stats_t *stats;
+  CRITICAL_SECTION stats_section;
+  bool stats_section_initialised;
+  bool notify;
+  unsigned long ready_timeout;
+  notifier_t *notifier;
+  TCHAR *ready_pattern;
+  ready_watch_t *ready_watch;
+  TCHAR *probe;
+  unsigned long probe_interval;
+  unsigned long probe_timeout;
+  unsigned long probe_failures;
+  probe_t *prober;
+  unsigned long watchdog_timeout;
+  watchdog_t *watchdog;
+  unsigned long sample_interval;
+  sampler_t *sampler;
+  TCHAR *recycle_schedule;
+  unsigned long recycle_uptime;
+  unsigned long recycle_private_bytes;
+  unsigned long recycle_working_set;
+  unsigned long recycle_sustain;
+  unsigned long recycle_trend;
+  TCHAR *recycle_window;
+  recycler_t *recycler;
+  volatile long recycling;
+  const TCHAR *recycle_reason;
+  bool leak_predicted;
+  unsigned __int64 leak_rate;
+  unsigned __int64 leak_eta;
+  unsigned long metrics_port;
+  metrics_t *metrics;
+  TCHAR *listen;
+  listen_sockets_t *listeners;
+  long unhealthy;
   bool hook_share_output_handles;
   bool rotate_files;
   bool timestamp_log;
+  bool timestamp_group;
+  unsigned long timestamp_group_bytes;
+  bool strip_ansi;
   bool stdout_copy_and_truncate;
   bool stderr_copy_and_truncate;
   unsigned long rotate_stdout_online;
@@ -99,20 +193,34 @@ typedef struct {
   SERVICE_STATUS_HANDLE status_handle;
   HANDLE process_handle;
   unsigned long pid;
+  HANDLE old_process_handle;
+  unsigned long old_pid;
+  HANDLE old_job;
+  volatile long reloading;
   HANDLE wait_handle;
   unsigned long exitcode;
   bool stopping;
   bool allow_restart;
   unsigned long throttle;
+  backoff_t backoff;
+  breaker_t breaker;
   CRITICAL_SECTION throttle_section;
   bool throttle_section_initialised;
   CRITICAL_SECTION hook_section;
   bool hook_section_initialised;
+  /*
+    Guards the application's handle, pid, job, creation time and wait, the
+    instance a reload replaced, the monitors and stopping.  Never held while
+    closing a monitor, since their callbacks take it.
+  */
+  CRITICAL_SECTION instance_section;
+  bool instance_section_initialised;
   CONDITION_VARIABLE throttle_condition;
   HANDLE throttle_timer;
   LARGE_INTEGER throttle_duetime;
   FILETIME nssm_creation_time;
   FILETIME creation_time;
+  FILETIME old_creation_time;
   FILETIME exit_time;
   TCHAR *initial_env;
   unsigned long last_control;
@@ -133,6 +241,11 @@ unsigned long priority_mask();
 int priority_constant_to_index(unsigned long);
 unsigned long priority_index_to_constant(int);
 
+bool valid_host_name(const TCHAR *);
+int host_imagepath(const TCHAR *, TCHAR *, unsigned long);
+int set_service_host(const TCHAR *, SC_HANDLE, const TCHAR *);
+int set_service_string(TCHAR **, const TCHAR *);
+void free_service_string(TCHAR **);
 nssm_service_t *alloc_nssm_service();
 void set_nssm_service_defaults(nssm_service_t *);
 void cleanup_nssm_service(nssm_service_t *);
@@ -166,6 +279,10 @@ void CALLBACK end_service(void *, unsigned char);
 void throttle_restart(nssm_service_t *);
 int await_single_handle(SERVICE_STATUS_HANDLE, SERVICE_STATUS *, HANDLE, TCHAR *, TCHAR *, unsigned long);
 int list_nssm_services(int, TCHAR **);
+int get_host_group(const TCHAR *, TCHAR *, unsigned long);
+bool in_host_group(const TCHAR *, const TCHAR *);
+int check_host_account(const TCHAR *, const TCHAR *, const TCHAR *);
+int host_services(const TCHAR *);
 int service_process_tree(int, TCHAR **);
 
 #endif
@@ -9,6 +9,7 @@
 extern const TCHAR *exit_action_strings[];
 extern const TCHAR *startup_strings[];
 extern const TCHAR *priority_strings[];
+extern const TCHAR *throttle_policy_strings[];
 extern const TCHAR *hook_event_strings[];
 extern const TCHAR *hook_action_strings[];
 
@@ -340,6 +341,97 @@ static int setting_dump_hooks(const TCHAR *service_name, void *param, const TCHA
   return 0;
 }
 
+static int setting_set_route(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  if (! additional || ! additional[0]) return -1;
+
+  TCHAR *rule;
+  if (value && value->string) rule = value->string;
+  else rule = _T("");
+
+  if (set_route(service_name, additional, rule)) return -1;
+  if (! _tcslen(rule)) return 0;
+  return 1;
+}
+
+static int setting_get_route(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  if (! additional || ! additional[0]) return -1;
+
+  TCHAR rule[VALUE_LENGTH];
+  if (get_route(service_name, additional, rule, sizeof(rule))) return -1;
+
+  value_from_string(name, value, rule);
+
+  if (! _tcslen(rule)) return 0;
+  return 1;
+}
+
+static int setting_dump_routes(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  HKEY key = open_registry(service_name, NSSM_REG_ROUTES, KEY_READ, false);
+  if (! key) return 0;
+
+  TCHAR path[PATH_LENGTH];
+  unsigned long index = 0;
+  int errors = 0;
+  while (true) {
+    long error = enumerate_registry_values(key, &index, path, _countof(path));
+    if (error == ERROR_NO_MORE_ITEMS) break;
+    if (error != ERROR_SUCCESS) {
+      errors++;
+      break;
+    }
+
+    int ret = setting_get_route(service_name, param, name, default_value, value, path);
+    if (ret != 1) {
+      if (ret < 0) errors++;
+      continue;
+    }
+
+    if (setting_dump_string(service_name, (void *) REG_SZ, name, value, path)) errors++;
+  }
+  RegCloseKey(key);
+
+  if (errors) return -1;
+  return 0;
+}
+
+/* Changing the host group changes how the service manager starts us. */
+static int setting_set_host(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  HKEY key = (HKEY) param;
+  if (! key) return -1;
+
+  TCHAR *group = _T("");
+  if (value && value->string) group = value->string;
+  if (group[0] && ! valid_host_name(group)) {
+    print_message(stderr, NSSM_MESSAGE_INVALID_HOST, group);
+    return -1;
+  }
+
+  SC_HANDLE services = open_service_manager(SC_MANAGER_CONNECT);
+  if (! services) {
+    print_message(stderr, NSSM_MESSAGE_OPEN_SERVICE_MANAGER_FAILED);
+    return -1;
+  }
+
+  SC_HANDLE service_handle = open_service(services, (TCHAR *) service_name, SERVICE_QUERY_CONFIG | SERVICE_CHANGE_CONFIG, 0, 0);
+  CloseServiceHandle(services);
+  if (! service_handle) return -1;
+
+  int ret = set_service_host(service_name, service_handle, group);
+  CloseServiceHandle(service_handle);
+  if (ret) return -1;
+
+  if (! group[0]) {
+    long error = RegDeleteValue(key, name);
+    if (error == ERROR_SUCCESS || error == ERROR_FILE_NOT_FOUND) return 0;
+    print_message(stderr, NSSM_MESSAGE_REGDELETEVALUE_FAILED, name, service_name, error_string(error));
+    return -1;
+  }
+
+  if (set_string(key, (TCHAR *) name, group)) return -1;
+
+  return 1;
+}
+
 static int setting_set_affinity(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
   HKEY key = (HKEY) param;
   if (! key) return -1;
@@ -354,8 +446,20 @@ static int setting_set_affinity(const TCHAR *service_name, void *param, const TC
 
     if (is_default(value->string) || str_equiv(value->string, NSSM_AFFINITY_ALL)) mask = 0LL;
     else if (affinity_string_to_mask(value->string, &mask)) {
-      print_message(stderr, NSSM_MESSAGE_BOGUS_AFFINITY_MASK, value->string, num_cpus() - 1);
-      return -1;
+      /* Processor groups and NUMA nodes can't be checked against our mask. */
+      cpuset_t set;
+      TCHAR canon[512];
+      if (parse_cpuset(value->string, &set) || ! cpuset_is_extended(&set) || format_cpuset(&set, canon, _countof(canon))) {
+        print_message(stderr, NSSM_MESSAGE_BOGUS_AFFINITY_MASK, value->string, num_cpus() - 1);
+        return -1;
+      }
+
+      if (RegSetValueEx(key, name, 0, REG_SZ, (const unsigned char *) canon, (unsigned long) (_tcslen(canon) + 1) * sizeof(TCHAR)) != ERROR_SUCCESS) {
+        log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_SETVALUE_FAILED, name, error_string(GetLastError()), 0);
+        return -1;
+      }
+
+      return 1;
     }
   }
   else mask = 0LL;
@@ -427,9 +531,16 @@ static int setting_get_affinity(const TCHAR *service_name, void *param, const TC
 
   __int64 affinity;
   if (affinity_string_to_mask(buffer, &affinity)) {
-    print_message(stderr, NSSM_MESSAGE_BOGUS_AFFINITY_MASK, buffer, num_cpus() - 1);
+    cpuset_t set;
+    TCHAR canon[512];
+    if (parse_cpuset(buffer, &set) || ! cpuset_is_extended(&set) || format_cpuset(&set, canon, _countof(canon))) {
+      print_message(stderr, NSSM_MESSAGE_BOGUS_AFFINITY_MASK, buffer, num_cpus() - 1);
+      HeapFree(GetProcessHeap(), 0, buffer);
+      return -1;
+    }
+
     HeapFree(GetProcessHeap(), 0, buffer);
-    return -1;
+    return value_from_string(name, value, canon);
   }
 
   HeapFree(GetProcessHeap(), 0, buffer);
@@ -648,6 +759,82 @@ static int setting_dump_priority(const TCHAR *service_name, void *key_ptr, const
   return setting_dump_string(service_name, (void *) REG_SZ, name, value, 0);
 }
 
+static int setting_set_throttle_policy(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  HKEY key = (HKEY) param;
+  if (! param) return -1;
+
+  TCHAR *policy_string;
+  int i;
+  long error;
+
+  if (value && value->string && value->string[0]) policy_string = value->string;
+  else policy_string = (TCHAR *) default_value;
+
+  for (i = 0; throttle_policy_strings[i]; i++) {
+    if (! str_equiv(throttle_policy_strings[i], policy_string)) continue;
+
+    if (str_equiv(policy_string, (TCHAR *) default_value)) {
+      error = RegDeleteValue(key, name);
+      if (error == ERROR_SUCCESS || error == ERROR_FILE_NOT_FOUND) return 0;
+      print_message(stderr, NSSM_MESSAGE_REGDELETEVALUE_FAILED, name, service_name, error_string(error));
+      return -1;
+    }
+
+    if (set_string(key, (TCHAR *) name, (TCHAR *) throttle_policy_strings[i])) return -1;
+    return 1;
+  }
+
+  print_message(stderr, NSSM_MESSAGE_INVALID_THROTTLE_POLICY, policy_string);
+  for (i = 0; throttle_policy_strings[i]; i++) _ftprintf(stderr, _T("%s\n"), throttle_policy_strings[i]);
+
+  return -1;
+}
+
+static int setting_set_listen(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  if (value && value->string && value->string[0] && parse_listen(value->string, 0)) {
+    print_message(stderr, NSSM_MESSAGE_INVALID_LISTEN, value->string);
+    return -1;
+  }
+
+  return setting_set_string(service_name, param, name, default_value, value, additional);
+}
+
+static int setting_set_probe(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  if (value && value->string && value->string[0] && parse_probe(value->string, 0, 0, 0)) {
+    print_message(stderr, NSSM_MESSAGE_INVALID_PROBE, value->string);
+    return -1;
+  }
+
+  return setting_set_string(service_name, param, name, default_value, value, additional);
+}
+
+static int setting_set_ready_pattern(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  if (value && value->string && value->string[0] && check_ready_pattern(value->string)) {
+    print_message(stderr, NSSM_MESSAGE_INVALID_READY_PATTERN, value->string);
+    return -1;
+  }
+
+  return setting_set_string(service_name, param, name, default_value, value, additional);
+}
+
+static int setting_set_recycle_schedule(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  if (value && value->string && value->string[0] && parse_schedule(value->string, 0)) {
+    print_message(stderr, NSSM_MESSAGE_INVALID_RECYCLE_SCHEDULE, value->string);
+    return -1;
+  }
+
+  return setting_set_string(service_name, param, name, default_value, value, additional);
+}
+
+static int setting_set_recycle_window(const TCHAR *service_name, void *param, const TCHAR *name, void *default_value, value_t *value, const TCHAR *additional) {
+  if (value && value->string && value->string[0] && parse_window(value->string, 0, 0)) {
+    print_message(stderr, NSSM_MESSAGE_INVALID_RECYCLE_WINDOW, value->string);
+    return -1;
+  }
+
+  return setting_set_string(service_name, param, name, default_value, value, additional);
+}
+
 /* Functions to manage native service settings. */
 static int native_set_dependon(const TCHAR *service_name, SC_HANDLE service_handle, TCHAR **dependencies, unsigned long *dependencieslen, value_t *value, int type) {
   *dependencieslen = 0;
@@ -1114,6 +1301,13 @@ int native_set_objectname(const TCHAR *service_name, void *param, const TCHAR *n
     HeapFree(GetProcessHeap(), 0, qsc);
   }
 
+  /* Every service in a host group must run under the same account. */
+  TCHAR group[SERVICE_NAME_LENGTH];
+  if (! get_host_group(service_name, group, _countof(group)) && check_host_account(service_name, group, username)) {
+    if (passwordsize) SecureZeroMemory(password, passwordsize);
+    return -1;
+  }
+
   if (! well_known && ! virtual_account) {
     if (grant_logon_as_service(username)) {
       if (passwordsize) SecureZeroMemory(password, passwordsize);
@@ -1267,23 +1461,26 @@ int native_set_type(const TCHAR *service_name, void *param, const TCHAR *name, v
     return -1;
   }
 
+  QUERY_SERVICE_CONFIG *qsc = query_service_config(service_name, service_handle);
+  if (! qsc) return -1;
+
   /*
     ChangeServiceConfig() will fail if the service runs under an account
     other than LOCALSYSTEM and we try to make it interactive.
   */
   if (type & SERVICE_INTERACTIVE_PROCESS) {
-    QUERY_SERVICE_CONFIG *qsc = query_service_config(service_name, service_handle);
-    if (! qsc) return -1;
-
     if (! str_equiv(qsc->lpServiceStartName, NSSM_LOCALSYSTEM_ACCOUNT)) {
       HeapFree(GetProcessHeap(), 0, qsc);
       print_message(stderr, NSSM_MESSAGE_INTERACTIVE_NOT_LOCALSYSTEM, value->string, service_name, NSSM_LOCALSYSTEM_ACCOUNT);
       return -1;
     }
-
-    HeapFree(GetProcessHeap(), 0, qsc);
   }
 
+  /* Services in a host group must keep sharing its process. */
+  if (qsc->dwServiceType & SERVICE_WIN32_SHARE_PROCESS) type = (type & SERVICE_INTERACTIVE_PROCESS) | SERVICE_WIN32_SHARE_PROCESS;
+
+  HeapFree(GetProcessHeap(), 0, qsc);
+
   if (! ChangeServiceConfig(service_handle, type, SERVICE_NO_CHANGE, SERVICE_NO_CHANGE, 0, 0, 0, 0, 0, 0, 0)) {
     print_message(stderr, NSSM_MESSAGE_CHANGESERVICECONFIG_FAILED, error_string(GetLastError()));
     return -1;
@@ -1320,7 +1517,8 @@ int set_setting(const TCHAR *service_name, HKEY key, settings_t *setting, value_
   if (! key) return -1;
   int ret;
 
-  if (setting->set) ret = setting->set(service_name, (void *) key, setting->name, setting->default_value, value, additional);
+  if (check_instances_setting(service_name, key, setting->name, value ? value->string : 0)) ret = -1;
+  else if (setting->set) ret = setting->set(service_name, (void *) key, setting->name, setting->default_value, value, additional);
   else ret = -1;
 
   if (! ret) print_message(stdout, NSSM_MESSAGE_RESET_SETTING, setting->name, service_name);
@@ -1402,7 +1600,14 @@ settings_t settings[] = {
   { NSSM_REG_DIR, REG_EXPAND_SZ, (void *) _T(""), false, 0, setting_set_string, setting_get_string, 0 },
   { NSSM_REG_EXIT, REG_SZ, (void *) exit_action_strings[NSSM_EXIT_RESTART], false, ADDITIONAL_MANDATORY, setting_set_exit_action, setting_get_exit_action, setting_dump_exit_action },
   { NSSM_REG_HOOK, REG_SZ, (void *) _T(""), false, ADDITIONAL_MANDATORY, setting_set_hook, setting_get_hook, setting_dump_hooks },
+  { NSSM_REG_ROUTES, REG_SZ, (void *) _T(""), false, ADDITIONAL_MANDATORY, setting_set_route, setting_get_route, setting_dump_routes },
+  { NSSM_REG_HOST, REG_SZ, NULL, false, 0, setting_set_host, setting_get_string, 0 },
   { NSSM_REG_AFFINITY, REG_SZ, 0, false, 0, setting_set_affinity, setting_get_affinity, 0 },
+  { NSSM_REG_MEMORY_LIMIT, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_CPU_RATE_LIMIT, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_PROCESS_LIMIT, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_MIN_WORKING_SET, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_MAX_WORKING_SET, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_REG_ENV, REG_MULTI_SZ, NULL, false, ADDITIONAL_CRLF, setting_set_environment, setting_get_environment, setting_dump_environment },
   { NSSM_REG_ENV_EXTRA, REG_MULTI_SZ, NULL, false, ADDITIONAL_CRLF, setting_set_environment, setting_get_environment, setting_dump_environment },
   { NSSM_REG_NO_CONSOLE, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
@@ -1428,6 +1633,14 @@ settings_t settings[] = {
   { NSSM_REG_KILL_THREADS_GRACE_PERIOD, REG_DWORD, (void *) NSSM_KILL_THREADS_GRACE_PERIOD, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_REG_KILL_PROCESS_TREE, REG_DWORD, (void *) 1, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_REG_THROTTLE, REG_DWORD, (void *) NSSM_RESET_THROTTLE_RESTART, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_THROTTLE_POLICY, REG_SZ, (void *) throttle_policy_strings[NSSM_BACKOFF_EXPONENTIAL], false, 0, setting_set_throttle_policy, setting_get_string, 0 },
+  { NSSM_REG_THROTTLE_BASE, REG_DWORD, (void *) NSSM_THROTTLE_BASE, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_THROTTLE_CAP, REG_DWORD, (void *) NSSM_THROTTLE_CAP, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_THROTTLE_JITTER, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_THROTTLE_DECAY, REG_DWORD, (void *) NSSM_THROTTLE_DECAY, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_BREAKER_FAILURES, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_BREAKER_WINDOW, REG_DWORD, (void *) NSSM_BREAKER_WINDOW, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_BREAKER_RETRY, REG_DWORD, (void *) NSSM_BREAKER_RETRY, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_REG_HOOK_SHARE_OUTPUT_HANDLES, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_REG_ROTATE, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_REG_ROTATE_ONLINE, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
@@ -1436,6 +1649,28 @@ settings_t settings[] = {
   { NSSM_REG_ROTATE_BYTES_HIGH, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_REG_ROTATE_DELAY, REG_DWORD, (void *) NSSM_ROTATE_DELAY, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_REG_TIMESTAMP_LOG, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_TIMESTAMP_GROUP, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_TIMESTAMP_GROUP_BYTES, REG_DWORD, (void *) NSSM_TIMESTAMP_GROUP_BYTES, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_STRIP_ANSI, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_NOTIFY, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_READY_TIMEOUT, REG_DWORD, (void *) NSSM_READY_TIMEOUT, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_READY_PATTERN, REG_SZ, NULL, false, 0, setting_set_ready_pattern, setting_get_string, 0 },
+  { NSSM_REG_PROBE, REG_EXPAND_SZ, NULL, false, 0, setting_set_probe, setting_get_string, 0 },
+  { NSSM_REG_PROBE_INTERVAL, REG_DWORD, (void *) NSSM_PROBE_INTERVAL, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_PROBE_TIMEOUT, REG_DWORD, (void *) NSSM_PROBE_TIMEOUT, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_PROBE_FAILURES, REG_DWORD, (void *) NSSM_PROBE_FAILURES, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_WATCHDOG_TIMEOUT, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_SAMPLE_INTERVAL, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_RECYCLE_SCHEDULE, REG_SZ, NULL, false, 0, setting_set_recycle_schedule, setting_get_string, 0 },
+  { NSSM_REG_RECYCLE_UPTIME, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_RECYCLE_PRIVATE_BYTES, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_RECYCLE_WORKING_SET, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_RECYCLE_SUSTAIN, REG_DWORD, (void *) NSSM_RECYCLE_SUSTAIN, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_RECYCLE_TREND, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_RECYCLE_WINDOW, REG_SZ, NULL, false, 0, setting_set_recycle_window, setting_get_string, 0 },
+  { NSSM_REG_METRICS_PORT, REG_DWORD, 0, false, 0, setting_set_number, setting_get_number, 0 },
+  { NSSM_REG_LISTEN, REG_SZ, NULL, false, 0, setting_set_listen, setting_get_string, 0 },
+  { NSSM_REG_INSTANCES, REG_DWORD, (void *) 1, false, 0, setting_set_number, setting_get_number, 0 },
   { NSSM_NATIVE_DEPENDONGROUP, REG_MULTI_SZ, NULL, true, ADDITIONAL_CRLF, native_set_dependongroup, native_get_dependongroup, native_dump_dependongroup },
   { NSSM_NATIVE_DEPENDONSERVICE, REG_MULTI_SZ, NULL, true, ADDITIONAL_CRLF, native_set_dependonservice, native_get_dependonservice, native_dump_dependonservice },
   { NSSM_NATIVE_DESCRIPTION, REG_SZ, _T(""), true, 0, native_set_description, native_get_description, 0 },
@@ -0,0 +1,427 @@
+#include "nssm.h"
+#include <sddl.h>
+
+static const TCHAR *stream_names[] = { _T("stdout"), _T("stderr") };
+static const TCHAR *breaker_names[] = { _T("closed"), _T("tripped"), _T("half-open") };
+static const TCHAR *usage_names[] = { _T("cpu%"), _T("private bytes"), _T("working set"), _T("handles"), _T("io bytes/s") };
+static const TCHAR *phase_names[] = { _T("parameters"), _T("throttle"), _T("output"), _T("hook"), _T("environment"), _T("createprocess"), _T("affinity"), _T("wait") };
+
+static int stats_mapping_name(const TCHAR *service_name, TCHAR *buffer, unsigned long len) {
+  if (_sntprintf_s(buffer, len, _TRUNCATE, _T("%s%s"), NSSM_STATS_PREFIX, service_name) < 0) return 1;
+  return 0;
+}
+
+/*
+  Create the shared statistics block for a service.
+  Returns a pointer to the mapped view or NULL on failure.
+*/
+nssm_stats_t *open_stats(const TCHAR *service_name, HANDLE *mapping) {
+  *mapping = 0;
+
+  TCHAR name[SERVICE_NAME_LENGTH + 32];
+  if (stats_mapping_name(service_name, name, _countof(name))) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("stats mapping name"), _T("open_stats()"), 0);
+    return 0;
+  }
+
+  SECURITY_ATTRIBUTES attributes;
+  ZeroMemory(&attributes, sizeof(attributes));
+  attributes.nLength = sizeof(attributes);
+  if (! ConvertStringSecurityDescriptorToSecurityDescriptor(NSSM_STATS_SDDL, SDDL_REVISION_1, &attributes.lpSecurityDescriptor, 0)) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_CREATEFILEMAPPING_FAILED, service_name, name, _T("ConvertStringSecurityDescriptorToSecurityDescriptor()"), error_string(GetLastError()), 0);
+    return 0;
+  }
+
+  *mapping = CreateFileMapping(INVALID_HANDLE_VALUE, &attributes, PAGE_READWRITE, 0, sizeof(nssm_stats_t), name);
+  unsigned long error = GetLastError();
+  LocalFree(attributes.lpSecurityDescriptor);
+  if (! *mapping) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_CREATEFILEMAPPING_FAILED, service_name, name, _T("CreateFileMapping()"), error_string(error), 0);
+    return 0;
+  }
+
+  nssm_stats_t *stats = (nssm_stats_t *) MapViewOfFile(*mapping, FILE_MAP_WRITE, 0, 0, sizeof(nssm_stats_t));
+  if (! stats) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_CREATEFILEMAPPING_FAILED, service_name, name, _T("MapViewOfFile()"), error_string(GetLastError()), 0);
+    CloseHandle(*mapping);
+    *mapping = 0;
+    return 0;
+  }
+
+  /* Start from zero even if a reader kept an old mapping open. */
+  ZeroMemory(stats, sizeof(nssm_stats_t));
+  LARGE_INTEGER frequency;
+  if (QueryPerformanceFrequency(&frequency)) stats->frequency = (unsigned __int64) frequency.QuadPart;
+  stats->size = sizeof(nssm_stats_t);
+  stats->version = NSSM_STATS_VERSION;
+
+  return stats;
+}
+
+void close_stats(nssm_stats_t **stats, HANDLE *mapping) {
+  if (*stats) UnmapViewOfFile(*stats);
+  *stats = 0;
+  if (*mapping) CloseHandle(*mapping);
+  *mapping = 0;
+}
+
+unsigned __int64 filetime_value(FILETIME *ft) {
+  return ((unsigned __int64) ft->dwHighDateTime << 32) | ft->dwLowDateTime;
+}
+
+unsigned __int64 stats_ticks() {
+  LARGE_INTEGER now;
+  if (! QueryPerformanceCounter(&now)) return 0;
+  return (unsigned __int64) now.QuadPart;
+}
+
+/* Interlocked operations are full barriers so no fences are needed. */
+void begin_stats(stream_stats_t *stats) {
+  InterlockedIncrement(&stats->sequence);
+}
+
+void begin_stats(usage_stats_t *stats) {
+  InterlockedIncrement(&stats->sequence);
+}
+
+void begin_stats(supervisor_stats_t *stats) {
+  InterlockedIncrement(&stats->sequence);
+}
+
+void begin_stats(start_stats_t *stats) {
+  InterlockedIncrement(&stats->sequence);
+}
+
+void end_stats(stream_stats_t *stats) {
+  InterlockedIncrement(&stats->sequence);
+}
+
+void end_stats(usage_stats_t *stats) {
+  InterlockedIncrement(&stats->sequence);
+}
+
+void end_stats(supervisor_stats_t *stats) {
+  InterlockedIncrement(&stats->sequence);
+}
+
+void end_stats(start_stats_t *stats) {
+  InterlockedIncrement(&stats->sequence);
+}
+
+static void read_sequenced(volatile long *sequence, const void *stats, void *copy, size_t len) {
+  while (true) {
+    long before = InterlockedCompareExchange(sequence, 0, 0);
+    if (before & 1) {
+      Sleep(0);
+      continue;
+    }
+    memmove(copy, stats, len);
+    if (InterlockedCompareExchange(sequence, 0, 0) == before) return;
+  }
+}
+
+/* Take a consistent copy of a stream's counters. */
+void read_stream_stats(stream_stats_t *stats, stream_stats_t *copy) {
+  read_sequenced(&stats->sequence, (void *) stats, copy, sizeof(*copy));
+}
+
+/* Take a consistent copy of the usage histograms. */
+void read_usage_stats(usage_stats_t *stats, usage_stats_t *copy) {
+  read_sequenced(&stats->sequence, (void *) stats, copy, sizeof(*copy));
+}
+
+/* Take a consistent copy of the supervision counters. */
+void read_supervisor_stats(supervisor_stats_t *stats, supervisor_stats_t *copy) {
+  read_sequenced(&stats->sequence, (void *) stats, copy, sizeof(*copy));
+}
+
+/* Take a consistent copy of the start timings. */
+void read_start_stats(start_stats_t *stats, start_stats_t *copy) {
+  read_sequenced(&stats->sequence, (void *) stats, copy, sizeof(*copy));
+}
+
+static unsigned long histogram_bucket(unsigned __int64 value) {
+  if (value < (1 << NSSM_HISTOGRAM_SUB_BITS)) return (unsigned long) value;
+
+  unsigned long msb = 0;
+  for (unsigned __int64 v = value; v >>= 1; ) msb++;
+  unsigned long shift = msb - NSSM_HISTOGRAM_SUB_BITS;
+  return ((shift + 1) << NSSM_HISTOGRAM_SUB_BITS) + (unsigned long) ((value >> shift) & ((1 << NSSM_HISTOGRAM_SUB_BITS) - 1));
+}
+
+/* Largest value which would be counted in a bucket. */
+static unsigned __int64 histogram_bucket_limit(unsigned long bucket) {
+  if (bucket < (1 << NSSM_HISTOGRAM_SUB_BITS)) return bucket;
+
+  unsigned long shift = (bucket >> NSSM_HISTOGRAM_SUB_BITS) - 1;
+  unsigned __int64 mantissa = (1 << NSSM_HISTOGRAM_SUB_BITS) + (bucket & ((1 << NSSM_HISTOGRAM_SUB_BITS) - 1));
+  return (mantissa << shift) + (((unsigned __int64) 1 << shift) - 1);
+}
+
+/* Must be called between begin_stats() and end_stats(). */
+void record_histogram(histogram_t *histogram, unsigned __int64 value) {
+  if (! histogram->count || value < histogram->min) histogram->min = value;
+  if (value > histogram->max) histogram->max = value;
+  histogram->count++;
+  histogram->sum += value;
+  histogram->buckets[histogram_bucket(value)]++;
+}
+
+/* Estimate a percentile from a copy of a histogram. */
+unsigned __int64 histogram_percentile(histogram_t *histogram, unsigned long percent) {
+  if (! histogram->count) return 0;
+
+  unsigned __int64 rank = (histogram->count * percent + 99) / 100;
+  if (! rank) rank = 1;
+
+  unsigned __int64 seen = 0;
+  for (unsigned long i = 0; i < NSSM_HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen < rank) continue;
+    unsigned __int64 value = histogram_bucket_limit(i);
+    if (value < histogram->min) return histogram->min;
+    if (value > histogram->max) return histogram->max;
+    return value;
+  }
+
+  return histogram->max;
+}
+
+static unsigned __int64 ticks_to_us(unsigned __int64 ticks, unsigned __int64 frequency) {
+  if (! frequency) return 0;
+  return ticks * 1000000 / frequency;
+}
+
+void begin_phase(start_trace_t *trace, unsigned long phase) {
+  trace->phase_begin[phase] = stats_ticks();
+}
+
+void end_phase(start_trace_t *trace, unsigned long phase) {
+  trace->phase_end[phase] = stats_ticks();
+}
+
+/*
+  Finish timing a start and record it.  The trace goes into a ring of the
+  most recent starts and its phases into the per-phase histograms.
+*/
+void publish_start_trace(nssm_stats_t *stats, start_trace_t *trace) {
+  trace->end = stats_ticks();
+  if (! stats) return;
+
+  start_stats_t *start = &stats->start;
+  begin_stats(start);
+  memmove(&start->trace[start->traces % NSSM_START_TRACES], trace, sizeof(*trace));
+  start->traces++;
+  record_histogram(&start->total, ticks_to_us(trace->end - trace->begin, stats->frequency));
+  for (unsigned long i = 0; i < NSSM_START_PHASES; i++) {
+    if (! trace->phase_begin[i] || trace->phase_end[i] < trace->phase_begin[i]) continue;
+    record_histogram(&start->phases[i], ticks_to_us(trace->phase_end[i] - trace->phase_begin[i], stats->frequency));
+  }
+  end_stats(start);
+}
+
+/* Map a running service's statistics for reading. */
+static nssm_stats_t *map_stats(const TCHAR *service_name, HANDLE *mapping) {
+  TCHAR name[SERVICE_NAME_LENGTH + 32];
+  *mapping = 0;
+  if (stats_mapping_name(service_name, name, _countof(name))) {
+    SetLastError(ERROR_INVALID_NAME);
+    return 0;
+  }
+
+  *mapping = OpenFileMapping(FILE_MAP_READ, false, name);
+  if (! *mapping) return 0;
+
+  nssm_stats_t *stats = (nssm_stats_t *) MapViewOfFile(*mapping, FILE_MAP_READ, 0, 0, 0);
+  if (! stats) {
+    unsigned long error = GetLastError();
+    CloseHandle(*mapping);
+    *mapping = 0;
+    SetLastError(error);
+  }
+  return stats;
+}
+
+/*
+  Copy the supervision counters published by a running service.
+  Returns: 0 on success.
+           1 if the service isn't publishing them or we can't read them.
+*/
+int get_published_supervisor_stats(const TCHAR *service_name, supervisor_stats_t *copy) {
+  HANDLE mapping;
+  nssm_stats_t *stats = map_stats(service_name, &mapping);
+  if (! stats) return 1;
+
+  int ret = 1;
+  if (stats->version == NSSM_STATS_VERSION && stats->size >= sizeof(nssm_stats_t)) {
+    read_supervisor_stats(&stats->supervisor, copy);
+    ret = 0;
+  }
+
+  UnmapViewOfFile(stats);
+  CloseHandle(mapping);
+  return ret;
+}
+
+static double ticks_to_ms(unsigned __int64 ticks, unsigned __int64 frequency) {
+  if (! frequency) return 0.0;
+  return (double) ticks * 1000.0 / (double) frequency;
+}
+
+static void print_histogram(const TCHAR *service_name, unsigned long metric, histogram_t *h) {
+  unsigned __int64 values[6];
+  values[0] = h->min;
+  values[1] = h->count ? h->sum / h->count : 0;
+  values[2] = histogram_percentile(h, 50);
+  values[3] = histogram_percentile(h, 90);
+  values[4] = histogram_percentile(h, 99);
+  values[5] = h->max;
+
+  if (metric == NSSM_USAGE_CPU) _tprintf(_T("%s %s: min %.2f avg %.2f p50 %.2f p90 %.2f p99 %.2f max %.2f\n"), service_name, usage_names[metric], values[0] / 100.0, values[1] / 100.0, values[2] / 100.0, values[3] / 100.0, values[4] / 100.0, values[5] / 100.0);
+  else _tprintf(_T("%s %s: min %I64u avg %I64u p50 %I64u p90 %I64u p99 %I64u max %I64u\n"), service_name, usage_names[metric], values[0], values[1], values[2], values[3], values[4], values[5]);
+}
+
+/* Start timings are recorded in microseconds and printed in milliseconds. */
+static void print_phase(const TCHAR *service_name, const TCHAR *phase, histogram_t *h) {
+  if (! h->count) return;
+  _tprintf(_T("%s start %s: count %I64u min %.3fms avg %.3fms p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms\n"), service_name, phase, h->count, h->min / 1000.0, (double) h->sum / (double) h->count / 1000.0, histogram_percentile(h, 50) / 1000.0, histogram_percentile(h, 90) / 1000.0, histogram_percentile(h, 99) / 1000.0, h->max / 1000.0);
+}
+
+/* Print the logging and resource usage statistics of running services. */
+int print_stats(int argc, TCHAR **argv) {
+  if (argc < 1) return usage(1);
+
+  int errors = 0;
+  int i, j;
+  for (i = 0; i < argc; i++) {
+    TCHAR *service_name = argv[i];
+    HANDLE mapping;
+    nssm_stats_t *stats = map_stats(service_name, &mapping);
+    if (! stats) {
+      _ftprintf(stderr, _T("%s: %s\n"), service_name, error_string(GetLastError()));
+      errors++;
+      continue;
+    }
+
+    if (stats->version != NSSM_STATS_VERSION || stats->size < sizeof(nssm_stats_t)) {
+      _ftprintf(stderr, _T("%s: %s %lu\n"), service_name, _T("unsupported statistics version"), stats->version);
+      UnmapViewOfFile(stats);
+      CloseHandle(mapping);
+      errors++;
+      continue;
+    }
+
+    supervisor_stats_t supervisor;
+    read_supervisor_stats(&stats->supervisor, &supervisor);
+    _tprintf(_T("%s: start requests %lu starts %lu exits %lu throttle %lu exit code %lu breaker %s\n"), service_name, supervisor.start_requested_count, supervisor.start_count, supervisor.exit_count, supervisor.throttle, supervisor.exitcode, breaker_names[supervisor.breaker < _countof(breaker_names) ? supervisor.breaker : 0]);
+
+    start_stats_t *start = (start_stats_t *) HeapAlloc(GetProcessHeap(), 0, sizeof(start_stats_t));
+    if (start) {
+      read_start_stats(&stats->start, start);
+      print_phase(service_name, _T("total"), &start->total);
+      for (j = 0; j < NSSM_START_PHASES; j++) print_phase(service_name, phase_names[j], &start->phases[j]);
+      HeapFree(GetProcessHeap(), 0, start);
+    }
+
+    for (j = 0; j < NSSM_STATS_STREAMS; j++) {
+      stream_stats_t s;
+      read_stream_stats(&stats->streams[j], &s);
+      _tprintf(_T("%s %s: reads %I64u bytes %I64u lines %I64u\n"), service_name, stream_names[j], s.reads, s.bytes_read, s.lines_read);
+      _tprintf(_T("%s %s: writes %I64u bytes %I64u blocked %.3fms retries %I64u dropped %I64u\n"), service_name, stream_names[j], s.writes, s.bytes_written, ticks_to_ms(s.write_ticks, stats->frequency), s.retries, s.drops);
+      _tprintf(_T("%s %s: rotations %I64u rotating %.3fms\n"), service_name, stream_names[j], s.rotations, ticks_to_ms(s.rotate_ticks, stats->frequency));
+    }
+
+    usage_stats_t usage;
+    read_usage_stats(&stats->usage, &usage);
+    if (usage.samples) {
+      _tprintf(_T("%s usage: samples %I64u processes %lu cpu %.3fs io bytes %I64u\n"), service_name, usage.samples, usage.processes, (double) usage.cpu_time / 10000000.0, usage.io_bytes);
+      for (j = 0; j < NSSM_USAGE_METRICS; j++) print_histogram(service_name, j, &usage.metrics[j]);
+    }
+
+    UnmapViewOfFile(stats);
+    CloseHandle(mapping);
+  }
+
+  return errors;
+}
+
+static void print_json_string(const TCHAR *string) {
+  _puttchar(_T('"'));
+  for (const TCHAR *s = string; *s; s++) {
+    if (*s == _T('"') || *s == _T('\\')) _puttchar(_T('\\'));
+    _puttchar(*s);
+  }
+  _puttchar(_T('"'));
+}
+
+static void print_trace_event(bool *first, unsigned long pid, const TCHAR *name, unsigned __int64 begin, unsigned __int64 end, unsigned __int64 frequency, unsigned long start) {
+  if (! *first) _tprintf(_T(",\n"));
+  *first = false;
+  _tprintf(_T("{\"name\":\"%s\",\"cat\":\"start\",\"ph\":\"X\",\"pid\":%lu,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"start\":%lu}}"), name, pid, (double) begin * 1000000.0 / (double) frequency, (double) (end - begin) * 1000000.0 / (double) frequency, start);
+}
+
+/*
+  Print the most recent starts of running services in Chrome's trace event
+  format, for chrome://tracing or Perfetto.  Each service is a process and
+  each start a slice containing its phases.
+*/
+int print_trace(int argc, TCHAR **argv) {
+  if (argc < 1) return usage(1);
+
+  start_stats_t *start = (start_stats_t *) HeapAlloc(GetProcessHeap(), 0, sizeof(start_stats_t));
+  if (! start) {
+    print_message(stderr, NSSM_MESSAGE_OUT_OF_MEMORY, _T("start_stats_t"), _T("print_trace()"));
+    return 1;
+  }
+
+  int errors = 0;
+  bool first = true;
+  int i;
+  unsigned long j, k;
+  _tprintf(_T("{\"traceEvents\":[\n"));
+  for (i = 0; i < argc; i++) {
+    TCHAR *service_name = argv[i];
+    HANDLE mapping;
+    nssm_stats_t *stats = map_stats(service_name, &mapping);
+    if (! stats) {
+      _ftprintf(stderr, _T("%s: %s\n"), service_name, error_string(GetLastError()));
+      errors++;
+      continue;
+    }
+
+    if (stats->version != NSSM_STATS_VERSION || stats->size < sizeof(nssm_stats_t) || ! stats->frequency) {
+      _ftprintf(stderr, _T("%s: %s %lu\n"), service_name, _T("unsupported statistics version"), stats->version);
+      UnmapViewOfFile(stats);
+      CloseHandle(mapping);
+      errors++;
+      continue;
+    }
+
+    unsigned __int64 frequency = stats->frequency;
+    read_start_stats(&stats->start, start);
+    UnmapViewOfFile(stats);
+    CloseHandle(mapping);
+
+    unsigned long pid = (unsigned long) i + 1;
+    if (! first) _tprintf(_T(",\n"));
+    first = false;
+    _tprintf(_T("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"args\":{\"name\":"), pid);
+    print_json_string(service_name);
+    _tprintf(_T("}}"));
+
+    /* Oldest first. */
+    unsigned long count = start->traces < NSSM_START_TRACES ? start->traces : NSSM_START_TRACES;
+    for (j = 0; j < count; j++) {
+      start_trace_t *trace = &start->trace[(start->traces - count + j) % NSSM_START_TRACES];
+      print_trace_event(&first, pid, _T("start"), trace->begin, trace->end, frequency, trace->start_requested_count);
+      for (k = 0; k < NSSM_START_PHASES; k++) {
+        if (! trace->phase_begin[k] || trace->phase_end[k] < trace->phase_begin[k]) continue;
+        print_trace_event(&first, pid, phase_names[k], trace->phase_begin[k], trace->phase_end[k], frequency, trace->start_requested_count);
+      }
+    }
+  }
+  _tprintf(_T("\n],\"displayTimeUnit\":\"ms\"}\n"));
+
+  HeapFree(GetProcessHeap(), 0, start);
+  return errors;
+}
@@ -0,0 +1,158 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* Statistics are published in a named file mapping per service. */
+#define NSSM_STATS_PREFIX _T("Global\\nssm-stats-")
+#define NSSM_STATS_VERSION 5
+/* LocalSystem can write; administrators can read. */
+#define NSSM_STATS_SDDL _T("D:(A;;GA;;;SY)(A;;GR;;;BA)")
+
+#define NSSM_STATS_STDOUT 0
+#define NSSM_STATS_STDERR 1
+#define NSSM_STATS_STREAMS 2
+
+/*
+  Counters for one output stream.  Only the stream's logging thread writes
+  them, incrementing the sequence before and after each update.  Readers
+  retry if the sequence was odd or changed while they were reading.
+*/
+typedef struct {
+  volatile long sequence;
+  unsigned __int64 reads;
+  unsigned __int64 bytes_read;
+  unsigned __int64 lines_read;
+  unsigned __int64 writes;
+  unsigned __int64 bytes_written;
+  unsigned __int64 write_ticks;
+  unsigned __int64 retries;
+  unsigned __int64 drops;
+  unsigned __int64 rotations;
+  unsigned __int64 rotate_ticks;
+} stream_stats_t;
+
+/*
+  Resource usage histograms.  Values below 2^NSSM_HISTOGRAM_SUB_BITS have
+  their own bucket; larger values share a bucket with others having the same
+  leading NSSM_HISTOGRAM_SUB_BITS + 1 bits, so percentiles are accurate to
+  within 1/2^NSSM_HISTOGRAM_SUB_BITS of the value.
+*/
+#define NSSM_HISTOGRAM_SUB_BITS 3
+#define NSSM_HISTOGRAM_BUCKETS ((64 - NSSM_HISTOGRAM_SUB_BITS + 1) << NSSM_HISTOGRAM_SUB_BITS)
+
+/* CPU is in hundredths of a percent of one processor; I/O in bytes per second. */
+#define NSSM_USAGE_CPU 0
+#define NSSM_USAGE_PRIVATE_BYTES 1
+#define NSSM_USAGE_WORKING_SET 2
+#define NSSM_USAGE_HANDLES 3
+#define NSSM_USAGE_IO 4
+#define NSSM_USAGE_METRICS 5
+
+typedef struct {
+  unsigned __int64 count;
+  unsigned __int64 sum;
+  unsigned __int64 min;
+  unsigned __int64 max;
+  unsigned long buckets[NSSM_HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/* Written only by the service's sampler, using the same sequence protocol. */
+typedef struct {
+  volatile long sequence;
+  unsigned __int64 samples;
+  unsigned long processes;
+  unsigned __int64 cpu_time;
+  unsigned __int64 io_bytes;
+  histogram_t metrics[NSSM_USAGE_METRICS];
+} usage_stats_t;
+
+/*
+  Supervision counters, copied from the service when they change by whichever
+  thread changed them.  Writers hold the service's stats_section so there is
+  only ever one at a time.  Times are FILETIMEs; restart latency is in
+  milliseconds from an application's exit to the creation of its replacement.
+*/
+typedef struct {
+  volatile long sequence;
+  unsigned long start_requested_count;
+  unsigned long start_count;
+  unsigned long exit_count;
+  unsigned long throttle;
+  unsigned long exitcode;
+  unsigned long pid;
+  unsigned long breaker;
+  unsigned __int64 creation_time;
+  unsigned __int64 exit_time;
+  histogram_t restart_latency;
+} supervisor_stats_t;
+
+/* Phases of start_service(), in the order they run. */
+#define NSSM_PHASE_PARAMETERS 0
+#define NSSM_PHASE_THROTTLE 1
+#define NSSM_PHASE_OUTPUT 2
+#define NSSM_PHASE_HOOK 3
+#define NSSM_PHASE_ENVIRONMENT 4
+#define NSSM_PHASE_CREATE_PROCESS 5
+#define NSSM_PHASE_AFFINITY 6
+#define NSSM_PHASE_WAIT 7
+#define NSSM_START_PHASES 8
+
+/* The most recent starts are kept for "nssm trace". */
+#define NSSM_START_TRACES 16
+
+/*
+  Timings of one call to start_service(), in performance counter ticks.  A
+  phase which didn't run has zero begin and end.
+*/
+typedef struct {
+  unsigned long start_requested_count;
+  unsigned __int64 begin;
+  unsigned __int64 end;
+  unsigned __int64 phase_begin[NSSM_START_PHASES];
+  unsigned __int64 phase_end[NSSM_START_PHASES];
+} start_trace_t;
+
+/* Written by start_service(), holding the service's stats_section, using the same sequence protocol.  Histograms are in microseconds. */
+typedef struct {
+  volatile long sequence;
+  unsigned long traces;
+  start_trace_t trace[NSSM_START_TRACES];
+  histogram_t total;
+  histogram_t phases[NSSM_START_PHASES];
+} start_stats_t;
+
+typedef struct {
+  unsigned long version;
+  unsigned long size;
+  unsigned __int64 frequency;
+  stream_stats_t streams[NSSM_STATS_STREAMS];
+  usage_stats_t usage;
+  supervisor_stats_t supervisor;
+  start_stats_t start;
+} nssm_stats_t;
+
+nssm_stats_t *open_stats(const TCHAR *, HANDLE *);
+void close_stats(nssm_stats_t **, HANDLE *);
+unsigned __int64 filetime_value(FILETIME *);
+unsigned __int64 stats_ticks();
+void begin_stats(stream_stats_t *);
+void begin_stats(usage_stats_t *);
+void begin_stats(supervisor_stats_t *);
+void begin_stats(start_stats_t *);
+void end_stats(stream_stats_t *);
+void end_stats(usage_stats_t *);
+void end_stats(supervisor_stats_t *);
+void end_stats(start_stats_t *);
+void read_stream_stats(stream_stats_t *, stream_stats_t *);
+void read_usage_stats(usage_stats_t *, usage_stats_t *);
+void read_supervisor_stats(supervisor_stats_t *, supervisor_stats_t *);
+void read_start_stats(start_stats_t *, start_stats_t *);
+void record_histogram(histogram_t *, unsigned __int64);
+unsigned __int64 histogram_percentile(histogram_t *, unsigned long);
+int get_published_supervisor_stats(const TCHAR *, supervisor_stats_t *);
+void begin_phase(start_trace_t *, unsigned long);
+void end_phase(start_trace_t *, unsigned long);
+void publish_start_trace(nssm_stats_t *, start_trace_t *);
+int print_stats(int, TCHAR **);
+int print_trace(int, TCHAR **);
+
+#endif
@@ -0,0 +1,104 @@
+#include "nssm.h"
+
+/* Create the heartbeat slot for the service's next process. */
+watchdog_t *open_watchdog(const TCHAR *service_name, unsigned long count, unsigned long timeout) {
+  watchdog_t *watchdog = (watchdog_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(watchdog_t));
+  if (! watchdog) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("watchdog"), _T("open_watchdog()"), 0);
+    return 0;
+  }
+
+  watchdog->service_name = service_name;
+  watchdog->timeout = timeout;
+  if (_sntprintf_s(watchdog->name, _countof(watchdog->name), _TRUNCATE, NSSM_WATCHDOG_MAPPING, service_name, GetCurrentProcessId(), count) < 0) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("watchdog name"), _T("open_watchdog()"), 0);
+    close_watchdog(&watchdog);
+    return 0;
+  }
+
+  /* The application runs under the same account as us. */
+  watchdog->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, 0, sizeof(nssm_heartbeat_t), watchdog->name);
+  if (! watchdog->mapping) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATEFILEMAPPING_FAILED, service_name, watchdog->name, _T("CreateFileMapping()"), error_string(GetLastError()), 0);
+    close_watchdog(&watchdog);
+    return 0;
+  }
+
+  watchdog->heartbeat = (nssm_heartbeat_t *) MapViewOfFile(watchdog->mapping, FILE_MAP_WRITE, 0, 0, sizeof(nssm_heartbeat_t));
+  if (! watchdog->heartbeat) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATEFILEMAPPING_FAILED, service_name, watchdog->name, _T("MapViewOfFile()"), error_string(GetLastError()), 0);
+    close_watchdog(&watchdog);
+    return 0;
+  }
+
+  ZeroMemory(watchdog->heartbeat, sizeof(nssm_heartbeat_t));
+  watchdog->heartbeat->size = sizeof(nssm_heartbeat_t);
+  watchdog->heartbeat->version = NSSM_WATCHDOG_VERSION;
+
+  return watchdog;
+}
+
+/* Timer queue callback.  Checking is just a read of the shared counter. */
+static void CALLBACK check_watchdog(void *arg, BOOLEAN fired) {
+  watchdog_t *watchdog = (watchdog_t *) arg;
+  if (watchdog->tripped) return;
+
+  unsigned long now = GetTickCount();
+  long beats = watchdog->heartbeat->beats;
+  if (beats != watchdog->beats) {
+    watchdog->beats = beats;
+    watchdog->beat_time = now;
+    return;
+  }
+  if (now - watchdog->beat_time < watchdog->timeout) return;
+
+  /* Don't fire again while the callback is deciding what to do. */
+  if (InterlockedExchange(&watchdog->tripped, 1)) return;
+
+  TCHAR milliseconds[16];
+  _sntprintf_s(milliseconds, _countof(milliseconds), _TRUNCATE, _T("%lu"), now - watchdog->beat_time);
+  log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_WATCHDOG_EXPIRED, watchdog->service_name, milliseconds, 0);
+
+  if (watchdog->expired(watchdog->arg)) return;
+
+  /* Give the application another period. */
+  watchdog->beats = watchdog->heartbeat->beats;
+  watchdog->beat_time = GetTickCount();
+  InterlockedExchange(&watchdog->tripped, 0);
+}
+
+/*
+  Start checking the heartbeat once the application is running.  The
+  expired callback runs on a timer thread.
+*/
+int start_watchdog(watchdog_t *watchdog, watchdog_expired_t expired, void *arg) {
+  watchdog->expired = expired;
+  watchdog->arg = arg;
+  watchdog->beats = watchdog->heartbeat->beats;
+  watchdog->beat_time = GetTickCount();
+
+  unsigned long period = watchdog->timeout / NSSM_WATCHDOG_CHECKS;
+  if (! period) period = 1;
+  if (! CreateTimerQueueTimer(&watchdog->timer, 0, check_watchdog, (void *) watchdog, period, period, WT_EXECUTELONGFUNCTION)) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_CREATETIMERQUEUETIMER_FAILED, watchdog->service_name, error_string(GetLastError()), 0);
+    watchdog->timer = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+  Stop checking, waiting for a check in progress to finish.  Must not be
+  called from the expired callback.
+*/
+void close_watchdog(watchdog_t **watchdog_ptr) {
+  watchdog_t *watchdog = *watchdog_ptr;
+  if (! watchdog) return;
+
+  if (watchdog->timer) DeleteTimerQueueTimer(0, watchdog->timer, INVALID_HANDLE_VALUE);
+  if (watchdog->heartbeat) UnmapViewOfFile(watchdog->heartbeat);
+  if (watchdog->mapping) CloseHandle(watchdog->mapping);
+  HeapFree(GetProcessHeap(), 0, watchdog);
+  *watchdog_ptr = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+/*
+  In-band watchdog.  NSSM creates a small file mapping for each process and
+  passes its name to the application in the NSSM_WATCHDOG environment
+  variable.  The application opens the mapping and increments the beats
+  counter more often than AppWatchdogTimeout milliseconds.
+*/
+#define NSSM_WATCHDOG_MAPPING _T("Local\\nssm-watchdog-%s-%lu-%lu")
+#define NSSM_WATCHDOG_MAPPING_LENGTH 256
+#define NSSM_WATCHDOG_VARIABLE _T("NSSM_WATCHDOG")
+#define NSSM_WATCHDOG_VERSION 1
+
+/* How many times to check the heartbeat per timeout period. */
+#define NSSM_WATCHDOG_CHECKS 4
+
+typedef struct {
+  unsigned long version;
+  unsigned long size;
+  volatile long beats;
+} nssm_heartbeat_t;
+
+/* Return true to stop watching or false to allow another timeout period. */
+typedef bool (*watchdog_expired_t)(void *);
+
+typedef struct {
+  const TCHAR *service_name;
+  TCHAR name[NSSM_WATCHDOG_MAPPING_LENGTH];
+  HANDLE mapping;
+  nssm_heartbeat_t *heartbeat;
+  unsigned long timeout;
+  long beats;
+  unsigned long beat_time;
+  volatile long tripped;
+  HANDLE timer;
+  watchdog_expired_t expired;
+  void *arg;
+} watchdog_t;
+
+watchdog_t *open_watchdog(const TCHAR *, unsigned long, unsigned long);
+int start_watchdog(watchdog_t *, watchdog_expired_t, void *);
+void close_watchdog(watchdog_t **);
+
+#endif
@@ -0,0 +1,560 @@
+#include "nssm.h"
+
+extern CRITICAL_SECTION process_section;
+
+/*
+  Settings which need instance 0's logging threads or monitors.  Workers'
+  output goes straight to their files and nothing probes or samples them,
+  so none of these can be combined with AppInstances greater than 1.
+  AppRoutes is a subkey and is checked separately.
+*/
+static const TCHAR *single_instance_settings[] = {
+  NSSM_REG_ROTATE,
+  NSSM_REG_ROTATE_ONLINE,
+  NSSM_REG_TIMESTAMP_LOG,
+  NSSM_REG_STRIP_ANSI,
+  NSSM_REG_PROBE,
+  NSSM_REG_WATCHDOG_TIMEOUT,
+  NSSM_REG_SAMPLE_INTERVAL,
+  NSSM_REG_RECYCLE_SCHEDULE,
+  NSSM_REG_RECYCLE_UPTIME,
+  NSSM_REG_RECYCLE_PRIVATE_BYTES,
+  NSSM_REG_RECYCLE_WORKING_SET,
+  NSSM_REG_RECYCLE_TREND,
+  0
+};
+
+static bool is_single_instance_setting(const TCHAR *name) {
+  if (str_equiv(name, NSSM_REG_ROUTES)) return true;
+  for (int i = 0; single_instance_settings[i]; i++) {
+    if (str_equiv(name, single_instance_settings[i])) return true;
+  }
+  return false;
+}
+
+/* A value is in use if it's a non-zero number or a non-empty string. */
+static bool registry_setting_in_use(HKEY key, const TCHAR *name) {
+  unsigned long type;
+  unsigned long number = 0;
+  unsigned long len = sizeof(number);
+  long error = RegQueryValueEx(key, name, 0, &type, (unsigned char *) &number, &len);
+  if (error == ERROR_MORE_DATA) return true;
+  if (error != ERROR_SUCCESS) return false;
+  if (type == REG_DWORD) return number ? true : false;
+  return (len >= sizeof(TCHAR) && *(TCHAR *) &number);
+}
+
+/* The first setting in the registry which needs a single instance. */
+static const TCHAR *registry_single_instance_setting(const TCHAR *service_name, HKEY key) {
+  for (int i = 0; single_instance_settings[i]; i++) {
+    if (registry_setting_in_use(key, single_instance_settings[i])) return single_instance_settings[i];
+  }
+  if (has_routes(service_name)) return NSSM_REG_ROUTES;
+  return 0;
+}
+
+/* The first setting of a service's parameters which needs a single instance. */
+static const TCHAR *single_instance_setting(nssm_service_t *service) {
+  if (service->rotate_files) return NSSM_REG_ROTATE;
+  if (service->rotate_stdout_online || service->rotate_stderr_online) return NSSM_REG_ROTATE_ONLINE;
+  if (service->timestamp_log) return NSSM_REG_TIMESTAMP_LOG;
+  if (service->strip_ansi) return NSSM_REG_STRIP_ANSI;
+  if (service->probe && service->probe[0]) return NSSM_REG_PROBE;
+  if (service->watchdog_timeout) return NSSM_REG_WATCHDOG_TIMEOUT;
+  if (service->sample_interval) return NSSM_REG_SAMPLE_INTERVAL;
+  if (service->recycle_schedule && service->recycle_schedule[0]) return NSSM_REG_RECYCLE_SCHEDULE;
+  if (service->recycle_uptime) return NSSM_REG_RECYCLE_UPTIME;
+  if (service->recycle_private_bytes) return NSSM_REG_RECYCLE_PRIVATE_BYTES;
+  if (service->recycle_working_set) return NSSM_REG_RECYCLE_WORKING_SET;
+  if (service->recycle_trend) return NSSM_REG_RECYCLE_TREND;
+  if (has_routes(service->name)) return NSSM_REG_ROUTES;
+  return 0;
+}
+
+/*
+  Read AppInstances, which is clamped to a sane range.  The other settings
+  must already have been read.  If any of them needs a single instance only
+  instance 0 is started.
+*/
+void get_instances(nssm_service_t *service, HKEY key) {
+  if (get_number(key, NSSM_REG_INSTANCES, &service->instances, false) != 1 || ! service->instances) service->instances = 1;
+  if (service->instances > NSSM_MAX_INSTANCES) {
+    TCHAR maximum[16];
+    _sntprintf_s(maximum, _countof(maximum), _TRUNCATE, _T("%lu"), NSSM_MAX_INSTANCES);
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_BOGUS_INSTANCES, service->name, NSSM_REG_INSTANCES, maximum, 0);
+    service->instances = NSSM_MAX_INSTANCES;
+  }
+
+  if (service->instances > 1) {
+    const TCHAR *setting = single_instance_setting(service);
+    if (setting) {
+      log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_SINGLE_INSTANCE_SETTING, service->name, setting, NSSM_REG_INSTANCES, 0);
+      service->instances = 1;
+    }
+  }
+}
+
+/*
+  Check that a service being installed or edited doesn't combine
+  AppInstances with a setting which needs a single instance.  The GUI
+  doesn't show AppInstances so an edited service keeps its registry value.
+  Returns: 0 if the parameters can be saved.
+*/
+int check_instances(nssm_service_t *service, bool editing) {
+  unsigned long instances = service->instances;
+  if (editing && instances < 2) {
+    HKEY key = open_registry(service->name, 0, KEY_READ, false);
+    if (key) {
+      if (get_number(key, NSSM_REG_INSTANCES, &instances, false) != 1) instances = 1;
+      RegCloseKey(key);
+    }
+  }
+  if (instances < 2) return 0;
+
+  const TCHAR *setting = single_instance_setting(service);
+  if (! setting) return 0;
+
+  print_message(stderr, NSSM_MESSAGE_SINGLE_INSTANCE_SETTING, setting, NSSM_REG_INSTANCES, service->name, setting, NSSM_REG_INSTANCES);
+  return 1;
+}
+
+/*
+  Check that setting a value won't combine AppInstances with a setting
+  which needs a single instance.  Resetting is always allowed.
+  Returns: 0 if the value can be set.
+*/
+int check_instances_setting(const TCHAR *service_name, HKEY key, const TCHAR *name, const TCHAR *string) {
+  if (! string || ! string[0]) return 0;
+
+  unsigned long number;
+  const TCHAR *setting;
+  if (str_equiv(name, NSSM_REG_INSTANCES)) {
+    if (str_number(string, &number) || number < 2) return 0;
+    setting = registry_single_instance_setting(service_name, key);
+    if (! setting) return 0;
+  }
+  else {
+    if (! is_single_instance_setting(name)) return 0;
+    if (! str_number(string, &number) && ! number) return 0;
+    if (get_number(key, NSSM_REG_INSTANCES, &number, false) != 1 || number < 2) return 0;
+    setting = name;
+  }
+
+  print_message(stderr, NSSM_MESSAGE_SINGLE_INSTANCE_SETTING, setting, NSSM_REG_INSTANCES, service_name, setting, NSSM_REG_INSTANCES);
+  return 1;
+}
+
+/* Insert the instance number before the extension, eg app.log becomes app-1.log. */
+void instance_path(const TCHAR *path, unsigned long index, TCHAR *buffer, unsigned long len) {
+  TCHAR base[PATH_LENGTH];
+  _sntprintf_s(base, _countof(base), _TRUNCATE, _T("%s"), path);
+  TCHAR *ext = PathFindExtension(base);
+  TCHAR extension[PATH_LENGTH];
+  _sntprintf_s(extension, _countof(extension), _TRUNCATE, _T("-%lu%s"), index, ext);
+  *ext = _T('\0');
+  _sntprintf_s(buffer, len, _TRUNCATE, _T("%s%s"), base, extension);
+}
+
+/*
+  Processors for an instance of the application.  With more than one
+  instance the processors in AppAffinity, or all of them if it isn't set,
+  are shared out in contiguous slices.  If there are more instances than
+  processors they double up.
+*/
+__int64 instance_affinity(nssm_service_t *service, unsigned long index) {
+  DWORD_PTR affinity, system_affinity;
+  unsigned __int64 mask = (unsigned __int64) service->affinity;
+  if (GetProcessAffinityMask(GetCurrentProcess(), &affinity, &system_affinity)) {
+    if (mask) mask &= system_affinity;
+    else mask = system_affinity;
+  }
+  if (service->instances < 2) return (__int64) mask;
+
+  unsigned long count = 0;
+  unsigned long i;
+  for (i = 0; i < 64; i++) if (mask & (1ULL << i)) count++;
+  if (! count) return (__int64) mask;
+
+  unsigned long first, last;
+  if (count >= service->instances) {
+    first = index * count / service->instances;
+    last = (index + 1) * count / service->instances;
+  }
+  else {
+    first = index % count;
+    last = first + 1;
+  }
+
+  unsigned __int64 slice = 0;
+  unsigned long rank = 0;
+  for (i = 0; i < 64; i++) {
+    if (! (mask & (1ULL << i))) continue;
+    if (rank >= first && rank < last) slice |= 1ULL << i;
+    rank++;
+  }
+
+  return (__int64) slice;
+}
+
+/*
+  Processors for an instance when AppAffinity names groups or NUMA nodes.
+  Returns false if the classic mask from instance_affinity() applies, which
+  includes when none of the named processors exist.
+*/
+bool instance_cpuset(nssm_service_t *service, unsigned long index, cpuset_t *set) {
+  if (! cpuset_is_extended(&service->cpuset)) return false;
+
+  cpuset_t resolved;
+  resolve_cpuset(&service->cpuset, &resolved);
+  if (! cpuset_count(&resolved)) return false;
+  slice_cpuset(&resolved, index, service->instances, set);
+  return true;
+}
+
+static void log_cpuset_failure(nssm_service_t *service, const TCHAR *function, unsigned long error) {
+  TCHAR string[512];
+  if (format_cpuset(&service->cpuset, string, _countof(string))) string[0] = _T('\0');
+  log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_CPUSET_FAILED, service->name, string, function, error_string(error), 0);
+}
+
+/* Startup information which puts an instance in its group and NUMA node. */
+STARTUPINFO *instance_startupinfo(nssm_service_t *service, cpuset_t *set, cpuset_attributes_t *attributes, STARTUPINFO *si, unsigned long *flags) {
+  const TCHAR *function = 0;
+  if (open_cpuset_attributes(set, attributes, &function)) {
+    log_cpuset_failure(service, function, GetLastError());
+    return si;
+  }
+  return cpuset_startupinfo(attributes, si, flags);
+}
+
+/* The thread handle may be NULL when rebalancing a running instance. */
+void set_instance_affinity(nssm_service_t *service, HANDLE process_handle, HANDLE thread_handle, unsigned long index) {
+  cpuset_t set;
+  if (instance_cpuset(service, index, &set)) {
+    const TCHAR *function = 0;
+    if (apply_cpuset(process_handle, thread_handle, &set, &function)) log_cpuset_failure(service, function, GetLastError());
+    return;
+  }
+
+  if (! SetProcessAffinityMask(process_handle, (DWORD_PTR) instance_affinity(service, index))) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_SETPROCESSAFFINITYMASK_FAILED, service->name, error_string(GetLastError()), 0);
+  }
+}
+
+/* Each worker writes to its own copy of the output files. */
+static int open_worker_output(nssm_service_t *service, unsigned long index, STARTUPINFO *si) {
+  SECURITY_ATTRIBUTES attributes;
+  ZeroMemory(&attributes, sizeof(attributes));
+  attributes.nLength = sizeof(attributes);
+  attributes.bInheritHandle = true;
+
+  TCHAR path[PATH_LENGTH];
+  if (service->stdout_path[0]) {
+    instance_path(service->stdout_path, index, path, _countof(path));
+    si->hStdOutput = write_to_file(path, service->stdout_sharing, &attributes, service->stdout_disposition, service->stdout_flags);
+    if (si->hStdOutput == INVALID_HANDLE_VALUE) {
+      si->hStdOutput = 0;
+      return 1;
+    }
+    si->dwFlags |= STARTF_USESTDHANDLES;
+  }
+
+  if (service->stderr_path[0]) {
+    if (si->hStdOutput && str_equiv(service->stderr_path, service->stdout_path)) {
+      if (! DuplicateHandle(GetCurrentProcess(), si->hStdOutput, GetCurrentProcess(), &si->hStdError, 0, true, DUPLICATE_SAME_ACCESS)) {
+        log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_DUPLICATEHANDLE_FAILED, _T("stdout"), _T("stderr"), error_string(GetLastError()), 0);
+        si->hStdError = 0;
+        return 2;
+      }
+    }
+    else {
+      instance_path(service->stderr_path, index, path, _countof(path));
+      si->hStdError = write_to_file(path, service->stderr_sharing, &attributes, service->stderr_disposition, service->stderr_flags);
+      if (si->hStdError == INVALID_HANDLE_VALUE) {
+        si->hStdError = 0;
+        return 2;
+      }
+    }
+    si->dwFlags |= STARTF_USESTDHANDLES;
+  }
+
+  return 0;
+}
+
+static void CALLBACK worker_exited(void *, unsigned char);
+
+/*
+  Launch a worker.  The application's parameters are only stable while we
+  hold process_section, because restarting instance 0 rereads them.
+  Returns: 0 if the worker was started or is being stopped.
+*/
+static int launch_worker(worker_t *worker) {
+  nssm_service_t *service = (nssm_service_t *) worker->service;
+  int ret = 0;
+
+  EnterCriticalSection(&worker->section);
+  if (worker->stopping) {
+    LeaveCriticalSection(&worker->section);
+    return 0;
+  }
+
+  TCHAR index[16];
+  _sntprintf_s(index, _countof(index), _TRUNCATE, _T("%lu"), worker->index);
+
+  STARTUPINFO si;
+  ZeroMemory(&si, sizeof(si));
+  si.cb = sizeof(si);
+  PROCESS_INFORMATION pi;
+  ZeroMemory(&pi, sizeof(pi));
+
+  EnterCriticalSection(&process_section);
+  TCHAR cmd[CMD_LENGTH];
+  if (_sntprintf_s(cmd, _countof(cmd), _TRUNCATE, _T("\"%s\" %s"), service->exe, service->flags) < 0) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("command line"), _T("launch_worker"), 0);
+    ret = 1;
+  }
+  else if (open_worker_output(service, worker->index, &si)) ret = 2;
+  else {
+    set_service_environment(service);
+    SetEnvironmentVariable(NSSM_INSTANCE_VARIABLE, index);
+    if (service->listeners) SetEnvironmentVariable(NSSM_LISTEN_VARIABLE, service->listeners->variable);
+
+    bool inherit_handles = false;
+    if (si.dwFlags & STARTF_USESTDHANDLES) inherit_handles = true;
+    if (service->listeners) {
+      inherit_listen_sockets(service->listeners, true);
+      inherit_handles = true;
+    }
+    unsigned long flags = (service->priority & priority_mask()) | CREATE_SUSPENDED;
+    if (! service->no_console) flags |= CREATE_NEW_CONSOLE;
+    cpuset_t set;
+    cpuset_attributes_t attributes;
+    ZeroMemory(&attributes, sizeof(attributes));
+    STARTUPINFO *startup = &si;
+    if (instance_cpuset(service, worker->index, &set)) startup = instance_startupinfo(service, &set, &attributes, &si, &flags);
+    if (! CreateProcess(0, cmd, 0, 0, inherit_handles, flags, 0, service->dir, startup, &pi)) {
+      log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_WORKER_FAILED, service->name, index, _T("CreateProcess()"), error_string(GetLastError()), 0);
+      ret = 3;
+    }
+    close_cpuset_attributes(&attributes);
+
+    inherit_listen_sockets(service->listeners, false);
+    unset_service_environment(service);
+  }
+  LeaveCriticalSection(&process_section);
+  close_output_handles(&si);
+
+  if (ret) {
+    LeaveCriticalSection(&worker->section);
+    return ret;
+  }
+
+  worker->process_handle = pi.hProcess;
+  worker->pid = pi.dwProcessId;
+  if (get_process_creation_time(worker->process_handle, &worker->creation_time)) GetSystemTimeAsFileTime(&worker->creation_time);
+  set_instance_affinity(service, worker->process_handle, pi.hThread, worker->index);
+  /* Limits must be in place before the worker can start children. */
+  if (has_limits(service)) open_worker_job(service, worker->process_handle, &worker->job);
+  ResumeThread(pi.hThread);
+  CloseHandle(pi.hThread);
+
+  TCHAR pid[16];
+  _sntprintf_s(pid, _countof(pid), _TRUNCATE, _T("%lu"), worker->pid);
+  log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_WORKER_STARTED, service->name, index, pid, 0);
+
+  /* The previous wait already fired so this can't block. */
+  HANDLE wait_handle = worker->wait_handle;
+  if (! RegisterWaitForSingleObject(&worker->wait_handle, worker->process_handle, worker_exited, (void *) worker, INFINITE, WT_EXECUTEONLYONCE | WT_EXECUTELONGFUNCTION)) {
+    log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_REGISTERWAITFORSINGLEOBJECT_FAILED, service->name, service->exe, error_string(GetLastError()), 0);
+    worker->wait_handle = 0;
+  }
+  if (wait_handle) UnregisterWait(wait_handle);
+
+  LeaveCriticalSection(&worker->section);
+  return 0;
+}
+
+/* Kill a worker and its descendants. */
+static void kill_worker(worker_t *worker, FILETIME *exit_time) {
+  nssm_service_t *service = (nssm_service_t *) worker->service;
+  kill_t k;
+  service_kill_t(service, &k);
+  k.process_handle = worker->process_handle;
+  k.pid = worker->pid;
+  k.creation_time = worker->creation_time;
+  k.exitcode = 0;
+  if (! exit_time) {
+    kill_process(&k);
+    GetSystemTimeAsFileTime(&k.exit_time);
+  }
+  else k.exit_time = *exit_time;
+  if (service->kill_process_tree) kill_process_tree(&k, worker->pid);
+
+  CloseHandle(worker->process_handle);
+  worker->process_handle = 0;
+  worker->pid = 0;
+  platform_close_job(&worker->job);
+}
+
+/*
+  Callback function triggered when a worker exits.  It is restarted after
+  its own throttle delay, whatever its exit code was.
+*/
+static void CALLBACK worker_exited(void *arg, unsigned char why) {
+  worker_t *worker = (worker_t *) arg;
+  nssm_service_t *service = (nssm_service_t *) worker->service;
+
+  TCHAR index[16], code[16];
+  _sntprintf_s(index, _countof(index), _TRUNCATE, _T("%lu"), worker->index);
+
+  EnterCriticalSection(&worker->section);
+  if (worker->stopping || ! worker->process_handle) {
+    LeaveCriticalSection(&worker->section);
+    return;
+  }
+
+  unsigned long exitcode = 0;
+  GetExitCodeProcess(worker->process_handle, &exitcode);
+  FILETIME exit_time;
+  if (get_process_exit_time(worker->process_handle, &exit_time)) GetSystemTimeAsFileTime(&exit_time);
+  platform_u64_t uptime = (filetime_value(&exit_time) - filetime_value(&worker->creation_time)) / 10000;
+  kill_worker(worker, &exit_time);
+  LeaveCriticalSection(&worker->section);
+
+  _sntprintf_s(code, _countof(code), _TRUNCATE, _T("%lu"), exitcode);
+  log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_WORKER_EXITED, service->name, index, code, 0);
+
+  /* Healthy uptime resets or wears down the throttle. */
+  if (worker->backoff.policy == NSSM_BACKOFF_DECAYING) worker->throttle = decay_throttle(&worker->backoff, worker->throttle, uptime);
+  else if (uptime >= service->throttle_delay) worker->throttle = 0;
+
+  while (true) {
+    unsigned long ms = 0;
+    if (worker->throttle++) ms = backoff_delay(&worker->backoff, worker->throttle);
+    if (service->restart_delay > ms) ms = service->restart_delay;
+    if (ms) {
+      TCHAR milliseconds[16];
+      _sntprintf_s(milliseconds, _countof(milliseconds), _TRUNCATE, _T("%lu"), ms);
+      log_event(EVENTLOG_WARNING_TYPE, NSSM_EVENT_WORKER_THROTTLED, service->name, index, milliseconds, 0);
+    }
+
+    /* stop_worker() sets the event. */
+    if (WaitForSingleObject(worker->stop_event, ms) != WAIT_TIMEOUT) return;
+    if (! launch_worker(worker)) return;
+  }
+}
+
+static worker_t *alloc_worker(nssm_service_t *service, unsigned long index) {
+  worker_t *worker = (worker_t *) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(worker_t));
+  if (! worker) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("worker"), _T("alloc_worker()"), 0);
+    return 0;
+  }
+
+  worker->stop_event = CreateEvent(0, true, false, 0);
+  if (! worker->stop_event) {
+    log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("worker event"), _T("alloc_worker()"), 0);
+    HeapFree(GetProcessHeap(), 0, worker);
+    return 0;
+  }
+
+  InitializeCriticalSection(&worker->section);
+  worker->service = (void *) service;
+  worker->index = index;
+
+  /* Workers which fail together shouldn't restart together. */
+  worker->backoff = service->backoff;
+  seed_backoff(&worker->backoff, service->backoff.seed ^ (index * 0x9e3779b9UL));
+  return worker;
+}
+
+/* Stop a worker, waiting for a restart in progress, and free it. */
+static void free_worker(worker_t *worker) {
+  EnterCriticalSection(&worker->section);
+  worker->stopping = true;
+  SetEvent(worker->stop_event);
+  HANDLE wait_handle = worker->wait_handle;
+  worker->wait_handle = 0;
+  LeaveCriticalSection(&worker->section);
+
+  if (wait_handle) UnregisterWaitEx(wait_handle, INVALID_HANDLE_VALUE);
+  if (worker->process_handle) kill_worker(worker, 0);
+
+  DeleteCriticalSection(&worker->section);
+  CloseHandle(worker->stop_event);
+  HeapFree(GetProcessHeap(), 0, worker);
+}
+
+/*
+  Make sure instances 1 to AppInstances - 1 are running, starting workers
+  which are missing and stopping those which are surplus.  Called whenever
+  instance 0 starts and when the service is scaled.
+*/
+void start_workers(nssm_service_t *service) {
+  EnterCriticalSection(&service->worker_section);
+
+  unsigned long wanted = service->instances - 1;
+  if (! service->instances || ! service->allow_restart) wanted = 0;
+
+  /* Stop the highest numbered workers first. */
+  while (service->num_workers > wanted) free_worker(service->workers[--service->num_workers]);
+
+  if (wanted > service->num_workers) {
+    worker_t **workers = (worker_t **) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, wanted * sizeof(worker_t *));
+    if (! workers) log_event(EVENTLOG_ERROR_TYPE, NSSM_EVENT_OUT_OF_MEMORY, _T("workers"), _T("start_workers()"), 0);
+    else {
+      if (service->workers) {
+        memmove(workers, service->workers, service->num_workers * sizeof(worker_t *));
+        HeapFree(GetProcessHeap(), 0, service->workers);
+      }
+      service->workers = workers;
+      while (service->num_workers < wanted) {
+        worker_t *worker = alloc_worker(service, service->num_workers + 1);
+        if (! worker) break;
+        service->workers[service->num_workers++] = worker;
+      }
+    }
+  }
+
+  /* Start new workers, retry failed ones and rebalance the rest. */
+  for (unsigned long i = 0; i < service->num_workers; i++) {
+    worker_t *worker = service->workers[i];
+    EnterCriticalSection(&worker->section);
+    if (worker->process_handle) set_instance_affinity(service, worker->process_handle, 0, worker->index);
+    else if (! worker->wait_handle) launch_worker(worker);
+    LeaveCriticalSection(&worker->section);
+  }
+
+  LeaveCriticalSection(&service->worker_section);
+}
+
+void stop_workers(nssm_service_t *service) {
+  EnterCriticalSection(&service->worker_section);
+  while (service->num_workers) free_worker(service->workers[--service->num_workers]);
+  if (service->workers) {
+    HeapFree(GetProcessHeap(), 0, service->workers);
+    service->workers = 0;
+  }
+  LeaveCriticalSection(&service->worker_section);
+}
+
+/* Thread which rereads AppInstances in response to the SCALE control. */
+unsigned long WINAPI scale_workers(void *arg) {
+  nssm_service_t *service = (nssm_service_t *) arg;
+
+  HKEY key = open_registry(service->name, KEY_READ);
+  if (! key) return 1;
+  get_instances(service, key);
+  RegCloseKey(key);
+
+  TCHAR instances[16];
+  _sntprintf_s(instances, _countof(instances), _TRUNCATE, _T("%lu"), service->instances);
+  log_event(EVENTLOG_INFORMATION_TYPE, NSSM_EVENT_SCALED, service->name, instances, 0);
+
+  /* Workers start with instance 0, which gets a new slice straight away. */
+  if (! service->process_handle) return 0;
+  set_instance_affinity(service, service->process_handle, 0, 0);
+  start_workers(service);
+
+  return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+/*
+  With AppInstances greater than one the service runs that many copies of
+  the application.  Instance 0 is the application as usual.  The others are
+  workers which NSSM restarts on its own, each with its own throttle, its
+  own output files and its own slice of the processors.  Workers'
+  output bypasses the logging threads and they have no monitors, so
+  settings which need either are refused with more than one instance.
+*/
+#define NSSM_INSTANCE_VARIABLE _T("NSSM_INSTANCE")
+#define NSSM_MAX_INSTANCES 64
+
+void get_instances(nssm_service_t *, HKEY);
+int check_instances(nssm_service_t *, bool);
+int check_instances_setting(const TCHAR *, HKEY, const TCHAR *, const TCHAR *);
+void instance_path(const TCHAR *, unsigned long, TCHAR *, unsigned long);
+__int64 instance_affinity(nssm_service_t *, unsigned long);
+bool instance_cpuset(nssm_service_t *, unsigned long, cpuset_t *);
+STARTUPINFO *instance_startupinfo(nssm_service_t *, cpuset_t *, cpuset_attributes_t *, STARTUPINFO *, unsigned long *);
+void set_instance_affinity(nssm_service_t *, HANDLE, HANDLE, unsigned long);
+void start_workers(nssm_service_t *);
+void stop_workers(nssm_service_t *);
+unsigned long WINAPI scale_workers(void *);
+
+#endif